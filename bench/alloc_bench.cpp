@@ -0,0 +1,127 @@
+#include "DataManager.h"
+#include "IGPUExecutor.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Replays the device allocations of a LiDAR frame pipeline against GPUMemoryAllocator
+//  - Every frame uploads a scan, produces shrinking intermediates (crop -> voxel -> ground -> clusters) with a count
+//    buffer per stage, and frees each buffer once its consumer is done
+//  - Cluster results stay alive for a couple of frames (tracking), so frees interleave with the next frame's allocs
+
+const int NUM_FRAMES = 20000;
+const int FRAMES_KEPT = 2;
+const size_t POINT_BYTES = 16;
+const size_t COUNT_BYTES = 8;
+
+struct TraceOp {
+    bool allocate;
+    int slot;
+    size_t size;
+    MemoryHint mem_hint;
+};
+
+class FrameTrace {
+  public:
+    std::vector<TraceOp> ops;
+    int num_slots = 0;
+
+    int allocate(size_t size, MemoryHint mem_hint) {
+        ops.push_back({true, num_slots, size, mem_hint});
+        return num_slots++;
+    }
+
+    void free(int slot) { ops.push_back({false, slot, 0, MemoryHint::DeviceLocal}); }
+};
+
+FrameTrace build_trace(int num_frames) {
+    FrameTrace trace;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<size_t> points_dist(100000, 130000);
+    std::uniform_real_distribution<float> keep_dist(0.8f, 1.2f);
+
+    std::vector<std::vector<int>> kept_slots;
+    for (int frame = 0; frame < num_frames; ++frame) {
+        size_t num_points = points_dist(rng);
+
+        int scan = trace.allocate(num_points * POINT_BYTES, MemoryHint::DeviceLocal);
+
+        // Crop keeps roughly 60% of the scan
+        size_t cropped_points = num_points * 0.6f * keep_dist(rng);
+        int crop = trace.allocate(cropped_points * POINT_BYTES, MemoryHint::DeviceLocal);
+        int crop_count = trace.allocate(COUNT_BYTES, MemoryHint::Unified);
+        trace.free(scan);
+
+        // Voxel downsampling keeps roughly a third of that
+        size_t voxel_points = cropped_points * 0.35f * keep_dist(rng);
+        int voxel = trace.allocate(voxel_points * POINT_BYTES, MemoryHint::DeviceLocal);
+        int voxel_count = trace.allocate(COUNT_BYTES, MemoryHint::Unified);
+        trace.free(crop);
+        trace.free(crop_count);
+
+        // Ground removal writes a per point mask and the remaining points
+        int ground_mask = trace.allocate(voxel_points, MemoryHint::DeviceLocal);
+        size_t object_points = voxel_points * 0.5f * keep_dist(rng);
+        int objects = trace.allocate(object_points * POINT_BYTES, MemoryHint::DeviceLocal);
+        int objects_count = trace.allocate(COUNT_BYTES, MemoryHint::Unified);
+        trace.free(ground_mask);
+        trace.free(voxel);
+        trace.free(voxel_count);
+
+        // Clustering labels every remaining point and keeps a small cluster table around for tracking
+        int labels = trace.allocate(object_points * sizeof(int), MemoryHint::DeviceLocal);
+        int clusters = trace.allocate(512 * POINT_BYTES * keep_dist(rng), MemoryHint::DeviceLocal);
+        trace.free(objects);
+        trace.free(objects_count);
+        trace.free(labels);
+
+        kept_slots.push_back({clusters});
+        if (kept_slots.size() > FRAMES_KEPT) {
+            for (int slot : kept_slots.front()) {
+                trace.free(slot);
+            }
+            kept_slots.erase(kept_slots.begin());
+        }
+    }
+
+    for (const std::vector<int> &slots : kept_slots) {
+        for (int slot : slots) {
+            trace.free(slot);
+        }
+    }
+
+    return trace;
+}
+
+int main() {
+    FrameTrace trace = build_trace(NUM_FRAMES);
+    std::cout << "Frame churn trace: " << NUM_FRAMES << " frames, " << trace.ops.size() << " alloc/free ops\n";
+
+    // 256 byte to 256 MiB device local slab, small unified slab for the count buffers
+    IGPUExecutor::GPUMemoryAllocator mem_alloc(256, 1 << 28, COUNT_BYTES, 1 << 20, 0, 0);
+
+    std::vector<size_t> offsets(trace.num_slots);
+    std::vector<const TraceOp *> slot_allocs(trace.num_slots);
+
+    auto start = std::chrono::steady_clock::now();
+    for (const TraceOp &op : trace.ops) {
+        if (op.allocate) {
+            offsets[op.slot] = mem_alloc.allocate_memory(op.size, op.mem_hint);
+            slot_allocs[op.slot] = &op;
+        } else {
+            const TraceOp &alloc_op = *slot_allocs[op.slot];
+            mem_alloc.check_free_mem(alloc_op.size, offsets[op.slot], alloc_op.mem_hint);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+    double ns_per_op = static_cast<double>(duration.count()) / trace.ops.size();
+    std::cout << "Replay time: " << std::chrono::duration_cast<std::chrono::microseconds>(duration) << "\n";
+    std::cout << "Throughput: " << 1e3 / ns_per_op << " Mops/s (" << ns_per_op << " ns/op)\n";
+
+    return 0;
+}
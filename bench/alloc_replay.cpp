@@ -0,0 +1,189 @@
+#include "DataManager.h"
+#include "IGPUExecutor.h"
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Replays an allocation trace written by GPUMemoryAllocator::write_trace (e.g. Runtime::write_allocation_trace after
+// a frame) against other slab sizes and minimum orders
+//
+// Usage: alloc_replay <trace.csv> [--devloc MIN:MAX] [--unified MIN:MAX] [--hostvis MIN:MAX]
+//  - Classes without a range get the smallest power of two slab that replays the trace without failures
+//  - Recorded failures are skipped, the scheduler retried those requests and they show up later as allocations
+
+using GPUMemoryAllocator = IGPUExecutor::GPUMemoryAllocator;
+
+const size_t DEFAULT_MIN_SIZE = 64;
+const size_t MAX_SEARCH_ORDER = 40;
+
+struct SlabRange {
+    size_t min_size = 0;
+    size_t max_size = 0;
+};
+
+const std::vector<std::pair<MemoryHint, std::string>> MEMORY_CLASSES = {
+    {MemoryHint::DeviceLocal, "DeviceLocal"},
+    {MemoryHint::Unified, "Unified"},
+    {MemoryHint::HostVisible, "HostVisible"},
+};
+
+GPUMemoryAllocator make_allocator(const std::map<MemoryHint, SlabRange> &ranges) {
+    auto range = [&](MemoryHint mem_hint) {
+        auto range_iter = ranges.find(mem_hint);
+        return range_iter == ranges.end() ? SlabRange() : range_iter->second;
+    };
+
+    return GPUMemoryAllocator(range(MemoryHint::DeviceLocal).min_size, range(MemoryHint::DeviceLocal).max_size,
+                              range(MemoryHint::Unified).min_size, range(MemoryHint::Unified).max_size,
+                              range(MemoryHint::HostVisible).min_size, range(MemoryHint::HostVisible).max_size);
+}
+
+struct ReplayResult {
+    size_t failures = 0;
+    // Internal fragmentation when the live bytes peaked, the point that decides the slab size
+    double peak_fragmentation = 0.0;
+};
+
+// Replays the events of one memory class
+ReplayResult replay(const std::vector<GPUMemoryAllocator::TraceEvent> &trace, MemoryHint mem_hint,
+                    GPUMemoryAllocator &mem_alloc) {
+    std::unordered_map<size_t, std::pair<size_t, size_t>> live_blocks;
+    ReplayResult result;
+    size_t peak_bytes = 0;
+
+    for (const GPUMemoryAllocator::TraceEvent &event : trace) {
+        if (event.mem_hint != mem_hint) {
+            continue;
+        }
+
+        if (event.op == GPUMemoryAllocator::TraceOp::Alloc) {
+            std::optional<size_t> offset;
+            try {
+                offset = mem_alloc.try_allocate_memory(event.size, mem_hint);
+            } catch (const std::runtime_error &) {
+            }
+
+            if (!offset) {
+                result.failures++;
+                continue;
+            }
+
+            live_blocks[event.id] = {event.size, *offset};
+            GPUMemoryAllocator::AllocatorStats stats = mem_alloc.get_stats(mem_hint);
+            if (stats.live_bytes > peak_bytes) {
+                peak_bytes = stats.live_bytes;
+                result.peak_fragmentation = stats.internal_fragmentation;
+            }
+        } else if (event.op == GPUMemoryAllocator::TraceOp::Free) {
+            auto block_iter = live_blocks.find(event.id);
+            if (block_iter != live_blocks.end()) {
+                mem_alloc.check_free_mem(block_iter->second.first, block_iter->second.second, mem_hint);
+                live_blocks.erase(block_iter);
+            }
+        }
+    }
+
+    return result;
+}
+
+// Smallest power of two slab (for the given minimum block) that never fails on the trace
+std::optional<size_t> smallest_slab(const std::vector<GPUMemoryAllocator::TraceEvent> &trace, MemoryHint mem_hint,
+                                    size_t min_size) {
+    size_t max_request = 0;
+    for (const GPUMemoryAllocator::TraceEvent &event : trace) {
+        if (event.mem_hint == mem_hint && event.op != GPUMemoryAllocator::TraceOp::Free) {
+            max_request = std::max(max_request, event.size);
+        }
+    }
+
+    size_t first_order = __builtin_ctzll(GPUMemoryAllocator::next_pow2(std::max(max_request, min_size)));
+    for (size_t order = std::max<size_t>(first_order, 1); order <= MAX_SEARCH_ORDER; ++order) {
+        GPUMemoryAllocator mem_alloc = make_allocator({{mem_hint, {min_size, 1ULL << order}}});
+        if (replay(trace, mem_hint, mem_alloc).failures == 0) {
+            return 1ULL << order;
+        }
+    }
+
+    return std::nullopt;
+}
+
+void print_stats(const std::string &name, const GPUMemoryAllocator::AllocatorStats &stats,
+                 const ReplayResult &result) {
+    std::cout << name << ": slab " << stats.capacity_bytes << " B, peak " << stats.peak_bytes << " B ("
+              << 100.0 * stats.peak_bytes / stats.capacity_bytes << "%), internal fragmentation at peak "
+              << 100.0 * result.peak_fragmentation << "%, failed allocations " << result.failures
+              << ", still live at end " << stats.live_bytes << " B\n";
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <trace.csv> [--devloc MIN:MAX] [--unified MIN:MAX] [--hostvis MIN:MAX]\n";
+        return 1;
+    }
+
+    std::ifstream trace_file(argv[1]);
+    if (!trace_file) {
+        std::cerr << "Could not open trace " << argv[1] << "\n";
+        return 1;
+    }
+    std::vector<GPUMemoryAllocator::TraceEvent> trace = GPUMemoryAllocator::read_trace(trace_file);
+
+    std::map<MemoryHint, SlabRange> ranges;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string range = argv[i + 1];
+        size_t split = range.find(':');
+        if (split == std::string::npos) {
+            std::cerr << "Ranges are given as MIN:MAX, got " << range << "\n";
+            return 1;
+        }
+
+        SlabRange slab_range{std::stoull(range.substr(0, split)), std::stoull(range.substr(split + 1))};
+        if (flag == "--devloc") {
+            ranges[MemoryHint::DeviceLocal] = slab_range;
+        } else if (flag == "--unified") {
+            ranges[MemoryHint::Unified] = slab_range;
+        } else if (flag == "--hostvis") {
+            ranges[MemoryHint::HostVisible] = slab_range;
+        } else {
+            std::cerr << "Unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << "Replaying " << trace.size() << " events from " << argv[1] << "\n";
+    for (const auto &[mem_hint, name] : MEMORY_CLASSES) {
+        size_t num_events = std::count_if(trace.begin(), trace.end(), [mem_hint](const auto &event) {
+            return event.mem_hint == mem_hint && event.op == GPUMemoryAllocator::TraceOp::Alloc;
+        });
+        if (num_events == 0) {
+            continue;
+        }
+
+        if (ranges.find(mem_hint) == ranges.end()) {
+            std::optional<size_t> slab_size = smallest_slab(trace, mem_hint, DEFAULT_MIN_SIZE);
+            if (!slab_size) {
+                std::cout << name << ": no slab up to 2^" << MAX_SEARCH_ORDER << " B replays without failures\n";
+                continue;
+            }
+
+            std::cout << name << ": smallest slab without failures is " << *slab_size << " B (min block "
+                      << DEFAULT_MIN_SIZE << " B)\n";
+            ranges[mem_hint] = {DEFAULT_MIN_SIZE, *slab_size};
+        }
+
+        GPUMemoryAllocator mem_alloc = make_allocator({{mem_hint, ranges[mem_hint]}});
+        ReplayResult result = replay(trace, mem_hint, mem_alloc);
+        print_stats(name, mem_alloc.get_stats(mem_hint), result);
+    }
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+#include "AllocationTracker.h"
+#include "DataManager.h"
+#include "HostExecutor.h"
+#include "IGPUExecutor.h"
+#include "Scheduler.h"
+#include "Tasks.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Overhead of the graph runtime itself: every CPU task is empty, so the time per task is what the scheduler, thread
+// pool and completion queue cost
+//  - Graphs are prepared once and run repeatedly over a long lived pool (and host executor), the way a prepared graph
+//    runs frame after frame (see Runtime::run), so thread, executor and scheduler setup are not part of the numbers
+//  - Every edge is a small piece of data marked as a graph output, so nothing is released between repetitions
+//  - Reports the median run, per task and per edge (producer -> consumer dependency), and the heap allocations the
+//    scheduler thread made per run, which are 0 for CPU graphs (see AllocationTracker)
+//  - The tracing section runs graphs with the Tracer off and on, the difference is what recording every event costs
+
+const size_t GPU_VALUES = 256;
+
+// Task graph with one int of data per produced edge
+class BenchGraph {
+  public:
+    TaskGraph task_graph;
+    size_t num_tasks = 0;
+    size_t num_edges = 0;
+
+    explicit BenchGraph(DataManager &data_manager) : data_manager_(data_manager) {}
+
+    // Empty CPU task reading the outputs of the given tasks, returns the id of its own output
+    int add_cpu(const std::vector<int> &input_ids) {
+        int output_id = make_output();
+        auto task = std::make_shared<BaseCPUTask>("empty", input_ids, output_id);
+        task->task_lambda = [] {};
+        add(task, input_ids.empty(), input_ids.size());
+        return output_id;
+    }
+
+    // Copy kernel on the host executor reading a user input (see add_gpu_input), returns its device local output
+    int add_gpu(int input_id) {
+        gpu_values_.emplace_back(GPU_VALUES, 1.0f);
+        int output_id =
+            data_manager_.create_ref_handle(&gpu_values_.back(), DataUsage::ReadWrite, MemoryHint::DeviceLocal).id;
+        task_graph.mark_output(output_id);
+        add(std::make_shared<GPUTask>("bench_copy", std::vector<int>{input_id}, output_id, false, GPU_VALUES), true, 0);
+        return output_id;
+    }
+
+    int add_gpu_input() {
+        gpu_values_.emplace_back(GPU_VALUES, 1.0f);
+        return data_manager_.create_ref_handle(&gpu_values_.back(), DataUsage::ReadOnly, MemoryHint::DeviceLocal).id;
+    }
+
+  private:
+    DataManager &data_manager_;
+    // Deques keep the referenced data in place as the graph grows
+    std::deque<int> values_;
+    std::deque<std::vector<float>> gpu_values_;
+
+    int make_output() {
+        values_.push_back(0);
+        int output_id = data_manager_.create_ref_handle(&values_.back(), DataUsage::ReadWrite).id;
+        task_graph.mark_output(output_id);
+        return output_id;
+    }
+
+    void add(std::shared_ptr<ITask> task, bool root_task, size_t num_dependencies) {
+        task_graph.add_task(task, root_task);
+        num_tasks++;
+        num_edges += num_dependencies;
+    }
+};
+
+BenchGraph empty_tasks(DataManager &data_manager, size_t num_tasks) {
+    BenchGraph graph(data_manager);
+    for (size_t i = 0; i < num_tasks; ++i) {
+        graph.add_cpu({});
+    }
+
+    return graph;
+}
+
+// source -> width tasks -> sink
+BenchGraph fan_out_in(DataManager &data_manager, size_t width) {
+    BenchGraph graph(data_manager);
+    int source = graph.add_cpu({});
+
+    std::vector<int> middle;
+    for (size_t i = 0; i < width; ++i) {
+        middle.push_back(graph.add_cpu({source}));
+    }
+    graph.add_cpu(middle);
+
+    return graph;
+}
+
+BenchGraph chain(DataManager &data_manager, size_t length) {
+    BenchGraph graph(data_manager);
+    int previous = graph.add_cpu({});
+    for (size_t i = 1; i < length; ++i) {
+        previous = graph.add_cpu({previous});
+    }
+
+    return graph;
+}
+
+// Diamonds stacked on each other: top -> (left, right) -> bottom, where each bottom is the next top
+BenchGraph diamonds(DataManager &data_manager, size_t num_diamonds) {
+    BenchGraph graph(data_manager);
+    int top = graph.add_cpu({});
+    for (size_t i = 0; i < num_diamonds; ++i) {
+        int left = graph.add_cpu({top});
+        int right = graph.add_cpu({top});
+        top = graph.add_cpu({left, right});
+    }
+
+    return graph;
+}
+
+// Independent lanes of GPU copy -> CPU reader, so every CPU task waits on a download
+BenchGraph mixed(DataManager &data_manager, size_t num_lanes) {
+    BenchGraph graph(data_manager);
+    for (size_t i = 0; i < num_lanes; ++i) {
+        int gpu_output = graph.add_gpu(graph.add_gpu_input());
+        graph.add_cpu({gpu_output});
+    }
+
+    return graph;
+}
+
+struct BenchResult {
+    double run_ns;
+    double ns_per_task;
+    double ns_per_edge;
+    double allocations_per_run;
+};
+
+// Tracing is switched on before the warm-up, so every thread already has its trace buffer when the timing starts
+BenchResult run_graph(DataManager &data_manager, BenchGraph &graph, std::unique_ptr<ThreadPool> &thread_pool,
+                      std::unique_ptr<IGPUExecutor> &gpu_exec, int repetitions, bool tracing = false) {
+    graph.task_graph.validate_graph();
+
+    Scheduler scheduler(data_manager, thread_pool, gpu_exec);
+    scheduler.prepare_graph(graph.task_graph, true);
+    Tracer::set_enabled(tracing);
+
+    // Warm up the pool, the allocator and the executor's buffers
+    for (int i = 0; i < 3; ++i) {
+        scheduler.run_graph();
+    }
+
+    std::vector<double> run_times;
+    run_times.reserve(repetitions);
+    AllocationCounts allocations_before = AllocationTracker::thread_counts();
+    for (int i = 0; i < repetitions; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        scheduler.run_graph();
+        run_times.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+    double allocations_per_run =
+        static_cast<double>(AllocationTracker::thread_counts().allocations - allocations_before.allocations) /
+        repetitions;
+    Tracer::set_enabled(false);
+    Tracer::clear();
+
+    std::nth_element(run_times.begin(), run_times.begin() + run_times.size() / 2, run_times.end());
+    double run_ns = run_times[run_times.size() / 2];
+    return {run_ns, run_ns / graph.num_tasks, graph.num_edges > 0 ? run_ns / graph.num_edges : 0.0,
+            allocations_per_run};
+}
+
+void print_header() {
+    std::cout << std::left << std::setw(28) << "graph" << std::right << std::setw(8) << "threads" << std::setw(8)
+              << "tasks" << std::setw(8) << "edges" << std::setw(14) << "run (us)" << std::setw(12) << "ns/task"
+              << std::setw(12) << "ns/edge" << std::setw(12) << "allocs/run" << "\n";
+}
+
+void print_result(const std::string &name, size_t num_threads, const BenchGraph &graph, const BenchResult &result) {
+    std::cout << std::left << std::setw(28) << name << std::right << std::setw(8) << num_threads << std::setw(8)
+              << graph.num_tasks << std::setw(8) << graph.num_edges << std::fixed << std::setprecision(1)
+              << std::setw(14) << result.run_ns / 1e3 << std::setw(12) << result.ns_per_task;
+    if (graph.num_edges > 0) {
+        std::cout << std::setw(12) << result.ns_per_edge;
+    } else {
+        std::cout << std::setw(12) << "-";
+    }
+    std::cout << std::setw(12) << result.allocations_per_run << "\n";
+}
+
+// Median runs of the graph with tracing off and on, alternating so drift in the machine hits both alike
+void print_trace_overhead(const std::string &name, DataManager &data_manager, BenchGraph &graph,
+                          std::unique_ptr<ThreadPool> &thread_pool, std::unique_ptr<IGPUExecutor> &gpu_exec,
+                          int repetitions) {
+    const int rounds = 5;
+    std::vector<double> off_ns, on_ns;
+    for (int round = 0; round < rounds; ++round) {
+        off_ns.push_back(run_graph(data_manager, graph, thread_pool, gpu_exec, repetitions, false).run_ns);
+        on_ns.push_back(run_graph(data_manager, graph, thread_pool, gpu_exec, repetitions, true).run_ns);
+    }
+    std::nth_element(off_ns.begin(), off_ns.begin() + rounds / 2, off_ns.end());
+    std::nth_element(on_ns.begin(), on_ns.begin() + rounds / 2, on_ns.end());
+    double off = off_ns[rounds / 2], on = on_ns[rounds / 2];
+
+    std::cout << std::left << std::setw(28) << name << std::right << std::setw(8) << graph.num_tasks << std::fixed
+              << std::setprecision(1) << std::setw(14) << off / 1e3 << std::setw(14) << on / 1e3 << std::setw(12)
+              << (on - off) / graph.num_tasks << std::setprecision(2) << std::setw(12) << 100.0 * (on - off) / off
+              << "\n";
+}
+
+// Usage: scheduler_bench [repetitions]
+int main(int argc, char **argv) {
+    int repetitions = argc > 1 ? std::max(1, std::atoi(argv[1])) : 20;
+    size_t max_threads = std::max<unsigned int>(std::thread::hardware_concurrency(), 1);
+    size_t default_threads = std::min<size_t>(max_threads, 4);
+
+    HostExecutor::register_kernel("bench_copy", [](const HostKernelContext &context) {
+        auto in = context.buffer<const float>(0);
+        auto out = context.buffer<float>(1);
+
+        size_t i = context.linear_id();
+        if (i < out.size()) {
+            out[i] = in[i];
+        }
+    });
+
+    DataManager data_manager;
+    std::unique_ptr<IGPUExecutor> no_gpu;
+    std::unique_ptr<ThreadPool> thread_pool = std::make_unique<ThreadPool>(default_threads);
+
+    std::cout << "Scheduler overhead, median of " << repetitions << " runs\n\n";
+    print_header();
+
+    BenchGraph empty_graph = empty_tasks(data_manager, 10000);
+    print_result("empty tasks", default_threads, empty_graph,
+                 run_graph(data_manager, empty_graph, thread_pool, no_gpu, repetitions));
+
+    for (size_t width : {1, 4, 16, 64, 256, 1024}) {
+        BenchGraph fan_graph = fan_out_in(data_manager, width);
+        print_result("fan out/in width " + std::to_string(width), default_threads, fan_graph,
+                     run_graph(data_manager, fan_graph, thread_pool, no_gpu, repetitions));
+    }
+
+    // Every task waits for the previous one, so this is the dispatch -> completion -> dispatch latency
+    BenchGraph chain_graph = chain(data_manager, 1000);
+    print_result("chain 1000", default_threads, chain_graph,
+                 run_graph(data_manager, chain_graph, thread_pool, no_gpu, repetitions));
+
+    BenchGraph diamond_graph = diamonds(data_manager, 250);
+    print_result("diamonds 250", default_threads, diamond_graph,
+                 run_graph(data_manager, diamond_graph, thread_pool, no_gpu, repetitions));
+
+    {
+        std::unique_ptr<IGPUExecutor> host_exec = std::make_unique<HostExecutor>(
+            std::pair(256, 1 << 24), std::pair(256, 1 << 24), std::pair(8, 1 << 20), default_threads);
+        host_exec->prepare_kernels({"bench_copy"});
+
+        for (size_t num_lanes : {1, 16, 64}) {
+            BenchGraph mixed_graph = mixed(data_manager, num_lanes);
+            print_result("mixed cpu/gpu lanes " + std::to_string(num_lanes), default_threads, mixed_graph,
+                         run_graph(data_manager, mixed_graph, thread_pool, host_exec, repetitions));
+        }
+    }
+
+    std::cout << "\nTracing overhead\n\n";
+    std::cout << std::left << std::setw(28) << "graph" << std::right << std::setw(8) << "tasks" << std::setw(14)
+              << "off (us)" << std::setw(14) << "on (us)" << std::setw(12) << "ns/task" << std::setw(12) << "overhead %"
+              << "\n";
+    print_trace_overhead("empty tasks", data_manager, empty_graph, thread_pool, no_gpu, repetitions);
+    print_trace_overhead("chain 1000", data_manager, chain_graph, thread_pool, no_gpu, repetitions);
+    print_trace_overhead("diamonds 250", data_manager, diamond_graph, thread_pool, no_gpu, repetitions);
+
+    std::cout << "\nThread scaling\n\n";
+    print_header();
+    BenchGraph wide_graph = fan_out_in(data_manager, 1024);
+    for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        thread_pool = std::make_unique<ThreadPool>(num_threads);
+        print_result("empty tasks", num_threads, empty_graph,
+                     run_graph(data_manager, empty_graph, thread_pool, no_gpu, repetitions));
+        print_result("fan out/in width 1024", num_threads, wide_graph,
+                     run_graph(data_manager, wide_graph, thread_pool, no_gpu, repetitions));
+    }
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef ALLOCATION_TRACKER_H
+#define ALLOCATION_TRACKER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Code that allocations are charged to while checking is on, Untracked code is never flagged
+//  - Scheduler: the thread running the graph (dispatch, completions, releases)
+//  - Worker: thread pool workers around the jobs they run
+//  - Task: the user code of a CPU task, counted on its own as the runtime can't keep it from allocating
+enum class AllocationSite { Untracked, Scheduler, Worker, Task, NUM_SITES };
+
+struct AllocationCounts {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+/*
+ * AllocationTracker
+ * Counts global operator new calls per thread, and flags the ones made on a tracked site while checking is on (a
+ * committed graph's steady state, see Runtime::enable_allocation_check)
+ *  - Counting needs the replacement operators of the Helios_AllocationHooks library to be linked into the binary,
+ *    without them every count stays 0 and hooks_installed is false
+ *  - Counting is a thread local increment, a violation additionally an atomic add on its site's counter
+ *  - on_violation is a function of its own so a debugger breakpoint on it stops at the allocating call, with
+ *    set_abort_on_violation the process aborts there instead (e.g. for a core dump in CI)
+ */
+class AllocationTracker {
+  public:
+    static bool hooks_installed();
+
+    // Allocations made by the calling thread since it started
+    static AllocationCounts thread_counts();
+
+    // Process wide switch, allocations on a tracked site are violations while it is on
+    static void set_checking(bool enabled);
+    static bool checking();
+    static void set_abort_on_violation(bool enabled);
+
+    // Violations on the site since the last reset
+    static AllocationCounts violations(AllocationSite site);
+    static void reset_violations();
+
+    static AllocationSite current_site();
+    static const char *site_name(AllocationSite site);
+
+    // Only called by the replacement operators
+    static void record_allocation(size_t num_bytes);
+    static void mark_hooks_installed();
+
+  private:
+    friend class AllocationSiteScope;
+    static void set_site(AllocationSite site);
+};
+
+// Charges the calling thread's allocations to a site until the scope ends, scopes nest
+class AllocationSiteScope {
+  public:
+    explicit AllocationSiteScope(AllocationSite site) : previous_(AllocationTracker::current_site()) {
+        AllocationTracker::set_site(site);
+    }
+    ~AllocationSiteScope() { AllocationTracker::set_site(previous_); }
+
+    AllocationSiteScope(const AllocationSiteScope &) = delete;
+    AllocationSiteScope &operator=(const AllocationSiteScope &) = delete;
+
+  private:
+    AllocationSite previous_;
+};
+
+#endif
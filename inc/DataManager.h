@@ -1,15 +1,22 @@
 #ifndef DATA_HANDLE_H
 #define DATA_HANDLE_H
 
+#include "MappedFile.h"
 #include "TypeTraits.h"
 #include <any>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <span>
 #include <stdexcept>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 // MemoryHint - How the data stored in the buffer will be treated throughout the lifetime of a task on a CPU/GPU level
 //  - Enables optimizations with private memory on the GPU, guarantee that only it has access to it
@@ -30,7 +37,7 @@ class GPUBufferHandle {
 
 // GPUBufferHandle objects have effective hashes already since they store a unique ID
 namespace std {
-template <> struct std::hash<GPUBufferHandle> {
+template <> struct hash<GPUBufferHandle> {
     std::size_t operator()(const GPUBufferHandle &buffer_handle) const noexcept {
         return std::hash<int>{}(buffer_handle.id);
     }
@@ -63,14 +70,26 @@ struct DataEntry {
     // Generic getters for accessing data memory
     std::function<std::span<const std::byte>()> const_data_accessor;
     std::function<std::span<std::byte>()> raw_data_accessor;
+
+    // Columnar data (e.g. PointCloud) additionally exposes each column as its own byte range
+    size_t column_count = 0;
+    std::function<std::span<const std::byte>(size_t)> column_accessor;
+    std::function<std::span<std::byte>(size_t)> raw_column_accessor;
+
+    // Elements a counting kernel (see GPUTask::count_buffer_active) actually wrote, the storage may be larger
+    std::optional<size_t> counted_length;
 };
 
 // DataManager object allows for caching of DataHandles to their actual objects
 class DataManager {
   public:
-    size_t get_type_size(int data_id) { return data_map.at(data_id).type_size; }
+    size_t get_type_size(int data_id) const {
+        std::shared_lock<std::shared_mutex> lock(data_mut_);
+        return data_map.at(data_id).type_size;
+    }
 
     template <typename T> T &get_data(DataHandle<T> data_handle) {
+        std::shared_lock<std::shared_mutex> lock(data_mut_);
         auto &any_data = data_map.at(data_handle.id).data;
 
         if (any_data.type() == typeid(std::shared_ptr<T>)) {
@@ -98,44 +117,9 @@ class DataManager {
         entry.mem_hint = mem_hint;
         entry.data_usage = data_usage;
 
-        // If true then T is a container type, else its size can be found through sizeof() at compile time
-        if constexpr (ContiguousContainer<T>) {
-            size_t byte_size = raw_ptr->size() * sizeof(typename T::value_type);
-            entry.byte_size = byte_size;
-            entry.type_size = sizeof(typename T::value_type);
-
-            entry.const_data_accessor = [raw_ptr, byte_size]() {
-                return std::span<const std::byte>(reinterpret_cast<const std::byte *>(raw_ptr->data()), byte_size);
-            };
-
-            if (data_usage == DataUsage::ReadWrite) {
-                entry.raw_data_accessor = [raw_ptr, byte_size]() {
-                    return std::span<std::byte>(reinterpret_cast<std::byte *>(raw_ptr->data()), byte_size);
-                };
-            }
-        } else {
-            size_t byte_size = sizeof(T);
-            entry.byte_size = byte_size;
-            entry.type_size = sizeof(T);
-
-            entry.const_data_accessor = [raw_ptr, byte_size]() {
-                return std::span<const std::byte>(reinterpret_cast<const std::byte *>(raw_ptr), byte_size);
-            };
-
-            if (data_usage == DataUsage::ReadWrite) {
-                entry.raw_data_accessor = [raw_ptr, byte_size]() {
-                    return std::span<std::byte>(reinterpret_cast<std::byte *>(raw_ptr), byte_size);
-                };
-            }
-        }
-
-        data_handle.id = id_counter++;
-        data_map[data_handle.id] = entry;
-
-        if (mem_hint == MemoryHint::DeviceLocal) {
-            device_local_tasks_.push_back(entry);
-        }
+        assign_accessors(entry, raw_ptr, data_usage);
 
+        data_handle.id = insert_entry(entry);
         return data_handle;
     }
 
@@ -151,45 +135,23 @@ class DataManager {
         entry.mem_hint = mem_hint;
         entry.data_usage = data_usage;
 
-        // If true then T is a container type, else it's size can be found through sizeof() at compile time
-        if constexpr (ContiguousContainer<T>) {
-            size_t byte_size = data->size() * sizeof(typename T::value_type);
-            entry.byte_size = byte_size;
-            entry.type_size = sizeof(typename T::value_type);
-
-            entry.const_data_accessor = [data, byte_size]() {
-                return std::span<const std::byte>(reinterpret_cast<const std::byte *>(data->data()), byte_size);
-            };
-
-            if (data_usage == DataUsage::ReadWrite) {
-                entry.raw_data_accessor = [data, byte_size]() {
-                    return std::span<std::byte>(reinterpret_cast<std::byte *>(data->data()), byte_size);
-                };
-            }
-        } else {
-            size_t byte_size = sizeof(T);
-            entry.byte_size = byte_size;
-            entry.type_size = sizeof(T);
-
-            entry.const_data_accessor = [data, byte_size]() {
-                return std::span<const std::byte>(reinterpret_cast<const std::byte *>(data), byte_size);
-            };
-
-            if (data_usage == DataUsage::ReadWrite) {
-                entry.raw_data_accessor = [data, byte_size]() {
-                    return std::span<std::byte>(reinterpret_cast<std::byte *>(data), byte_size);
-                };
-            }
-        }
+        assign_accessors(entry, data, data_usage);
 
-        data_handle.id = id_counter++;
-        data_map[data_handle.id] = entry;
+        data_handle.id = insert_entry(entry);
+        return data_handle;
+    }
 
-        if (mem_hint == MemoryHint::DeviceLocal) {
-            device_local_tasks_.push_back(entry);
-        }
+    // Registers a file-backed handle - the file is mmap'd rather than read so tasks and copy_to_device consume the
+    // sensor log directly from the page cache without any intermediate copies
+    //  - ReadWrite usage creates a private copy-on-write mapping, the file on disk is never modified
+    template <typename T>
+    DataHandle<MappedBuffer<T>> create_mapped_handle(const std::string &path, MappedFileOptions options = {},
+                                                     const DataUsage &data_usage = DataUsage::ReadOnly,
+                                                     const MemoryHint &mem_hint = MemoryHint::HostVisible) {
+        options.writable = data_usage == DataUsage::ReadWrite;
 
-        return data_handle;
+        // MappedBuffer is move-only and satisfies ContiguousContainer, so the generic path can take ownership of it
+        return create_data_handle(MappedBuffer<T>(path, options), data_usage, mem_hint);
     }
 
     // NOTE: Effectively acts as a "placeholder" handle. When the data is passed back from the GPU, create a new "real"
@@ -205,14 +167,7 @@ class DataManager {
         entry.data_usage = buffer_usage;
         entry.byte_size = byte_size;
 
-        data_handle.id = id_counter++;
-
-        if (mem_hint == MemoryHint::DeviceLocal) {
-            device_local_tasks_.push_back(entry);
-        }
-
-        data_map[data_handle.id] = entry;
-
+        data_handle.id = insert_entry(entry);
         return data_handle;
     }
 
@@ -221,30 +176,92 @@ class DataManager {
         std::copy(new_bytes.begin(), new_bytes.end(), dest_span.begin());
     };
 
-    template <typename T> void store_data(int data_id, const T &new_data) {
-        auto raw_data = get_span_mut(data_id);
-        T *dest_object = reinterpret_cast<T *>(raw_data.data());
-        *dest_object = new_data;
-    }
-
+    // Assigns through the typed object (rather than its bytes) so containers are resized instead of overrun
     template <typename T> void store_data(int data_id, T &&new_data) {
         using U = std::decay_t<T>;
-        auto raw_data = get_span_mut(data_id);
-        U *dest_object = reinterpret_cast<U *>(raw_data.data());
-        *dest_object = std::forward<T>(new_data);
+        if (get_data_usage(data_id) != DataUsage::ReadWrite) {
+            throw std::runtime_error("Attempted to store data into read-only data");
+        }
+
+        get_data(DataHandle<U>{data_id}) = std::forward<T>(new_data);
     };
 
-    std::span<const std::byte> get_span(int data_id) const { return data_map.at(data_id).const_data_accessor(); };
+    std::span<const std::byte> get_span(int data_id) const;
+    std::span<const std::byte> get_column_span(int data_id, size_t column) const;
+    std::span<std::byte> get_column_span_mut(int data_id, size_t column);
+    size_t get_column_count(int data_id) const;
     std::span<std::byte> get_span_mut(int data_id);
-    int get_data_length(int data_id) const { return data_map.at(data_id).byte_size; };
-    const MemoryHint &get_mem_hint(int data_id) const { return data_map.at(data_id).mem_hint; };
-    const DataUsage &get_data_usage(int data_id) const { return data_map.at(data_id).data_usage; };
+    int get_data_length(int data_id) const;
+    void set_counted_length(int data_id, size_t counted_length);
+    std::optional<size_t> get_counted_length(int data_id) const;
+    MemoryHint get_mem_hint(int data_id) const;
+    DataUsage get_data_usage(int data_id) const;
+    bool contains(int data_id) const;
     const std::vector<DataEntry> &get_device_local_tasks() const { return device_local_tasks_; };
 
+    // Drops the entry (and the data if it is owned by the DataManager) once no task will access it again
+    //  - Aliased data is only unregistered, the referenced object belongs to the user
+    void release_data(int data_id);
+
   private:
+    // Builds the byte accessors for an object at a stable address
+    // Sizes are evaluated on every call so containers resized by a task are still described correctly
+    template <typename T> static void assign_accessors(DataEntry &entry, T *data_ptr, const DataUsage &data_usage) {
+        if constexpr (ColumnarContainer<T>) {
+            entry.byte_size = data_ptr->bytes().size();
+            // Columns have different element sizes, so there is no single type size for the entry
+            entry.type_size = 0;
+            entry.column_count = data_ptr->column_count();
+
+            entry.const_data_accessor = [data_ptr]() { return std::span<const std::byte>(data_ptr->bytes()); };
+            entry.column_accessor = [data_ptr](size_t column) {
+                return std::span<const std::byte>(data_ptr->column_bytes(column));
+            };
+
+            if (data_usage == DataUsage::ReadWrite) {
+                entry.raw_data_accessor = [data_ptr]() { return data_ptr->bytes(); };
+                entry.raw_column_accessor = [data_ptr](size_t column) { return data_ptr->column_bytes(column); };
+            }
+        } else if constexpr (ContiguousContainer<T>) {
+            // If true then T is a container type, else its size can be found through sizeof() at compile time
+            using ValueType = typename T::value_type;
+            entry.byte_size = data_ptr->size() * sizeof(ValueType);
+            entry.type_size = sizeof(ValueType);
+
+            entry.const_data_accessor = [data_ptr]() {
+                return std::span<const std::byte>(reinterpret_cast<const std::byte *>(data_ptr->data()),
+                                                  data_ptr->size() * sizeof(ValueType));
+            };
+
+            if (data_usage == DataUsage::ReadWrite) {
+                entry.raw_data_accessor = [data_ptr]() {
+                    return std::span<std::byte>(reinterpret_cast<std::byte *>(data_ptr->data()),
+                                                data_ptr->size() * sizeof(ValueType));
+                };
+            }
+        } else {
+            entry.byte_size = sizeof(T);
+            entry.type_size = sizeof(T);
+
+            entry.const_data_accessor = [data_ptr]() {
+                return std::span<const std::byte>(reinterpret_cast<const std::byte *>(data_ptr), sizeof(T));
+            };
+
+            if (data_usage == DataUsage::ReadWrite) {
+                entry.raw_data_accessor = [data_ptr]() {
+                    return std::span<std::byte>(reinterpret_cast<std::byte *>(data_ptr), sizeof(T));
+                };
+            }
+        }
+    }
+
+    // Guards data_map so entries can be released by the scheduler while workers are still looking up others
+    mutable std::shared_mutex data_mut_;
     std::unordered_map<int, DataEntry> data_map;
     std::vector<DataEntry> device_local_tasks_;
     size_t id_counter = 0;
+
+    int insert_entry(const DataEntry &entry);
 };
 
 #endif
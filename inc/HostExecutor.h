@@ -0,0 +1,141 @@
+#ifndef HOST_EXECUTOR_H
+#define HOST_EXECUTOR_H
+
+#include "DataManager.h"
+#include "IGPUExecutor.h"
+#include "ThreadPool.h"
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Everything a host kernel invocation can see, mirroring what a GPU thread gets from its launch
+//  - buffers are bound in the same order as KernelDispatch::buffer_handles
+//  - thread_position is the global thread index (thread_position_in_grid), grid_size the total threads per dimension
+struct HostKernelContext {
+    std::span<const std::span<std::byte>> buffers;
+    std::array<int, 3> thread_position;
+    std::array<int, 3> grid_size;
+
+    template <typename T> std::span<T> buffer(size_t index) const {
+        std::span<std::byte> bytes = buffers[index];
+        return {reinterpret_cast<T *>(bytes.data()), bytes.size() / sizeof(T)};
+    }
+
+    // Flattened global thread index, kernels still have to bounds check like on a GPU
+    size_t linear_id() const {
+        return thread_position[0] + static_cast<size_t>(grid_size[0]) *
+                                        (thread_position[1] + static_cast<size_t>(grid_size[1]) * thread_position[2]);
+    }
+};
+
+using HostKernel = std::function<void(const HostKernelContext &)>;
+
+/*
+ * HostExecutor
+ * IGPUExecutor backend that emulates a GPU on the host so the GPU scheduling path runs (and can be benchmarked) on
+ * machines without a supported device, or acts as a CPU fallback device
+ *  - Memory classes are backed by host slabs managed by the same buddy allocator as real devices
+ *  - Kernels are C++ functions registered by name (the host equivalent of the default Metal library) and are run
+ *    once per grid thread, with blocks spread over the executor's own worker threads
+ *  - Each queue processes its submissions in order on its own command thread, completion callbacks fire from that
+ *    thread, kernels of different queues share the worker threads
+ *  - Asynchronous copies are queued on the first queue, and event waits of a kernel stall its queue's thread the way
+ *    they would stall a device queue
+ */
+class HostExecutor : public IGPUExecutor {
+  public:
+    HostExecutor(std::pair<int, int> devloc_bounds, std::pair<int, int> hostvis_bounds,
+                 std::pair<int, int> unified_bounds, size_t num_threads = std::thread::hardware_concurrency(),
+                 size_t num_queues = 1);
+    ~HostExecutor();
+
+    static void register_kernel(const std::string &kernel_name, HostKernel kernel);
+
+    std::optional<GPUBufferHandle> try_allocate_buffer(std::size_t buffer_size, const MemoryHint mem_hint) override;
+    GPUState deallocate_buffer(const GPUBufferHandle &buffer_handle) override;
+
+    GPUState copy_to_device(std::span<const std::byte> data_mem, const GPUBufferHandle &buffer_handle) override;
+    GPUState copy_from_device(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle) override;
+    GPUState copy_to_device_batch(const std::vector<BufferCopy> &copies) override;
+    std::shared_ptr<GPUEvent> copy_to_device_async(const std::vector<BufferCopy> &copies) override;
+    std::shared_ptr<GPUEvent> copy_from_device_async(std::span<std::byte> data_mem,
+                                                     const GPUBufferHandle &buffer_handle) override;
+
+    using IGPUExecutor::execute_batch;
+    GPUState execute_batch(const std::vector<KernelDispatch> &kernels, const DispatchType &dispatch_type,
+                           std::vector<std::function<void()>> &cpu_callbacks, size_t queue = 0) override;
+    GPUState execute_kernel(const KernelDispatch &kernel, std::function<void()> &cpu_callback) override;
+
+    GPUState synchronize() override;
+
+    size_t num_queues() const override { return queues_.size(); }
+
+  protected:
+    bool prepare_kernel(const std::string &kernel_name) override;
+
+    // Queues a command behind everything submitted so far to the queue, it runs on the queue's command thread
+    void submit(std::function<void()> command, size_t queue = 0);
+    // Queues a command on the first queue that also waits for everything submitted so far to the other queues
+    //  - at_queue runs on each queue's thread once that queue has reached the command (e.g. to read its state)
+    void submit_after_all(std::function<void()> command, std::function<void(size_t queue)> at_queue = nullptr);
+    std::span<std::byte> buffer_span(const GPUBufferHandle &buffer_handle);
+
+  private:
+    int buffer_counter = 0;
+
+    // Kernels this executor has already resolved, so dispatches skip the shared library lookup
+    std::unordered_map<std::string, HostKernel> prepared_kernels_;
+    std::mutex prepared_mut_;
+
+    // Host memory standing in for each device memory class
+    std::unique_ptr<std::byte[]> devloc_slab_;
+    std::unique_ptr<std::byte[]> hostvis_slab_;
+    std::unique_ptr<std::byte[]> unified_slab_;
+
+    // Workers that execute the blocks of a grid
+    ThreadPool grid_pool_;
+    size_t num_threads_;
+
+    // In-order command queue, equivalent to one device queue
+    struct CommandQueue {
+        std::thread command_thread;
+        std::deque<std::function<void()>> commands;
+        std::mutex command_mut;
+        std::condition_variable command_cv;
+        std::condition_variable idle_cv;
+        bool command_running = false;
+        bool stop = false;
+    };
+    std::vector<std::unique_ptr<CommandQueue>> queues_;
+
+    static std::unordered_map<std::string, HostKernel> &kernel_library();
+    static std::mutex &kernel_library_mut();
+
+    HostKernel resolve_kernel(const std::string &kernel_name);
+    std::byte *select_slab(MemoryHint mem_hint);
+    // Throws unless the buffer lies within its memory class's slab
+    void check_buffer(const GPUBufferHandle &buffer_handle);
+
+    // Bound buffers and outstanding block work of one kernel launch
+    struct GridLaunch {
+        std::vector<std::span<std::byte>> buffers;
+        std::vector<std::future<void>> block_futures;
+    };
+
+    void launch_grid(const KernelDispatch &kernel, const HostKernel &host_kernel, GridLaunch &launch);
+    void wait_grid(GridLaunch &launch);
+    void command_loop(CommandQueue &command_queue);
+};
+
+#endif
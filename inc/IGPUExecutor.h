@@ -2,15 +2,57 @@
 #define IGPU_H
 
 #include "DataManager.h"
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <optional>
 #include <span>
 #include <unordered_map>
+#include <vector>
 
 // TODO: Add more options as interface is built out
 enum class GPUState { GPUSuccess, GPUFailure, GhostBuffer, InvalidDispatchType };
 
+/*
+ * GPUEvent
+ * Fence returned by the asynchronous executor commands, signalled once the command has completed on the device
+ *  - Kernels list the events they depend on in KernelDispatch::wait_events, the executor holds them back on its own
+ *    queue so the submitting thread never blocks
+ *  - Backends with native fences record their timeline and value, so waits on their own events are encoded on the
+ *    device rather than resolved by the host
+ */
+class GPUEvent {
+  public:
+    // Already complete, for commands that finished synchronously
+    static std::shared_ptr<GPUEvent> signalled();
+
+    bool is_signalled() const;
+    void wait() const;
+    void signal();
+
+    // Runs on the signalling thread, or straight away if the event has already been signalled
+    void on_signal(std::function<void()> callback);
+
+    const void *device_timeline = nullptr;
+    uint64_t device_value = 0;
+
+  private:
+    mutable std::mutex event_mut_;
+    mutable std::condition_variable event_cv_;
+    bool signalled_ = false;
+    std::vector<std::function<void()>> signal_callbacks_;
+};
+
+// Counter written by a counting kernel (64 bit element count), followed by room for the indirect dispatch arguments
+// (3 x 32 bit threadgroup counts) that backends build from it on the device
+constexpr size_t COUNT_BUFFER_SIZE = 32;
+constexpr size_t INDIRECT_ARGS_OFFSET = 8;
+
 // Encapsulate information about kernels
 class KernelDispatch {
   public:
@@ -19,11 +61,22 @@ class KernelDispatch {
     std::vector<int> grid_dim;
     std::vector<int> block_dim;
 
+    // The kernel does not start before every one of these has been signalled
+    std::vector<std::shared_ptr<GPUEvent>> wait_events = {};
+
+    // Indirect dispatch, the grid is sized to one thread per element counted in this buffer (see COUNT_BUFFER_SIZE)
+    // when the kernel starts, so a count produced on the device never visits the host
+    //  - grid_dim is ignored, the grid still rounds up to whole blocks so kernels bounds check against the count
+    std::optional<GPUBufferHandle> indirect_count = std::nullopt;
+
+    // Signalled once this kernel has completed, so kernels on other queues can wait for it (see make_queue_event)
+    std::shared_ptr<GPUEvent> signal_event = nullptr;
+
     bool operator==(const KernelDispatch &other) const { return this->kernel_name == other.kernel_name; };
 };
 
 namespace std {
-template <> struct std::hash<KernelDispatch> {
+template <> struct hash<KernelDispatch> {
     std::size_t operator()(const KernelDispatch &kernel_dispatch) const noexcept {
         return std::hash<std::string>{}(kernel_dispatch.kernel_name);
     }
@@ -32,78 +85,259 @@ template <> struct std::hash<KernelDispatch> {
 
 enum class DispatchType { Serial, Concurrent };
 
+// One host to device upload of a batch
+struct BufferCopy {
+    std::span<const std::byte> data_mem;
+    GPUBufferHandle buffer_handle;
+};
+
 class IGPUExecutor {
   public:
     // Allocating/freeing buffer memory on the GPU for kernel tasks
-    GPUBufferHandle virtual allocate_buffer(std::size_t buffer_size, const MemoryHint mem_hint) = 0;
+    //  - try_allocate_buffer returns nothing while the slab is full, so callers can wait for in-flight work to free it
+    //  - allocate_buffer throws in that case instead
+    std::optional<GPUBufferHandle> virtual try_allocate_buffer(std::size_t buffer_size, const MemoryHint mem_hint) = 0;
+    GPUBufferHandle virtual allocate_buffer(std::size_t buffer_size, const MemoryHint mem_hint);
     GPUState virtual deallocate_buffer(const GPUBufferHandle &buffer_handle) = 0;
 
     // Sending memory between devices for task completion/after task completion
     GPUState virtual copy_to_device(std::span<const std::byte> data_mem, const GPUBufferHandle &buffer_handle) = 0;
     GPUState virtual copy_from_device(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle) = 0;
 
+    // Uploads every copy before returning, backends with a staging path pack them into a single staging copy and
+    // submission rather than one per buffer (default is one copy_to_device per entry)
+    GPUState virtual copy_to_device_batch(const std::vector<BufferCopy> &copies);
+
+    // Asynchronous transfers return as soon as the copy is queued, the returned event signals its completion
+    //  - Host memory must stay valid (and for downloads, unread) until the event is signalled
+    //  - Downloads are ordered after the kernels already submitted to the executor
+    //  - Defaults run the synchronous copy and return a signalled event
+    std::shared_ptr<GPUEvent> virtual copy_to_device_async(const std::vector<BufferCopy> &copies);
+    std::shared_ptr<GPUEvent> virtual copy_from_device_async(std::span<std::byte> data_mem,
+                                                             const GPUBufferHandle &buffer_handle);
+
+    // One submission for every kernel of the batch, cpu_callbacks[i] fires once kernels[i] has completed
+    //  - Serial batches run in order and each kernel sees the writes of the previous ones, so dependent chains fit in
+    //    one batch, Concurrent kernels must be independent
+    //  - The batch goes to one of the executor's queues (see num_queues), a serial batch only holds a kernel back on
+    //    its wait_events right before that kernel, so batches on different queues can wait on each other's kernels
     GPUState virtual execute_batch(const std::vector<KernelDispatch> &kernels, const DispatchType &dispatch_type,
-                                   std::function<void()> &cpu_callback) = 0;
+                                   std::vector<std::function<void()>> &cpu_callbacks, size_t queue = 0) = 0;
+    // Same callback for every kernel of the batch
+    GPUState execute_batch(const std::vector<KernelDispatch> &kernels, const DispatchType &dispatch_type,
+                           std::function<void()> &cpu_callback, size_t queue = 0) {
+        std::vector<std::function<void()>> cpu_callbacks(kernels.size(), cpu_callback);
+        return execute_batch(kernels, dispatch_type, cpu_callbacks, queue);
+    }
     GPUState virtual execute_kernel(const KernelDispatch &kernel, std::function<void()> &cpu_callback) = 0;
 
     // Prevents more GPU tasks from being added until all current ones are complete
     GPUState virtual synchronize() = 0;
 
+    // In-order execution queues of the device, batches on different queues may run at the same time
+    //  - Transfers are ordered as if there was a single queue, downloads wait for the kernels of every queue
+    size_t virtual num_queues() const { return 1; }
+
+    // Event for the signal_event of a kernel about to be submitted to queue, which kernels on other queues list in
+    // their wait_events
+    //  - Has to be made in the order the kernels are submitted to the queue, backends with native fences reserve the
+    //    next value of the queue's timeline so the wait is encoded on the device even when the waiting batch is
+    //    submitted first
+    std::shared_ptr<GPUEvent> virtual make_queue_event([[maybe_unused]] size_t queue) {
+        return std::make_shared<GPUEvent>();
+    }
+
     // Note this will default construct to false if value is not present - intended behavior here
     bool get_kernel_status(const std::string &kernel_name) { return kernel_status_[kernel_name]; }
 
+    // Resolves (and on compiled backends builds) kernels ahead of their first dispatch, so the first frame does not
+    // pay for pipeline creation
+    //  - Returns the names the backend has no kernel for, prepared kernels are remembered in the kernel status
+    std::vector<std::string> prepare_kernels(const std::vector<std::string> &kernel_names);
+
+    // Most threads one block of the kernel can launch with, bounds the block sizes tried when autotuning
+    size_t virtual max_block_threads([[maybe_unused]] const std::string &kernel_name) { return 1024; }
+
     void map_data_to_buffer(int data_id, GPUBufferHandle &buffer_handle) { data_buffer_map_[data_id] = buffer_handle; }
     GPUBufferHandle buffer_from_data(int data_id) { return data_buffer_map_[data_id]; };
     bool data_buffer_exists(int data_id) { return data_buffer_map_.find(data_id) != data_buffer_map_.end(); }
 
+    // Columns of columnar data are uploaded individually, so each (data, column) pair gets its own buffer
+    void map_column_to_buffer(int data_id, int column, GPUBufferHandle &buffer_handle) {
+        column_buffer_map_[data_id][column] = buffer_handle;
+    }
+    GPUBufferHandle buffer_from_column(int data_id, int column) { return column_buffer_map_[data_id][column]; };
+    bool column_buffer_exists(int data_id, int column) {
+        auto column_iter = column_buffer_map_.find(data_id);
+        return column_iter != column_buffer_map_.end() && column_iter->second.find(column) != column_iter->second.end();
+    }
+
+    // Frees the buffers mapped to a data id once the scheduler knows no remaining task will read it
+    //  - Returns whether any device memory was given back
+    bool release_data_buffer(int data_id) {
+        bool released = false;
+
+        auto buffer_iter = data_buffer_map_.find(data_id);
+        if (buffer_iter != data_buffer_map_.end()) {
+            deallocate_buffer(buffer_iter->second);
+            data_buffer_map_.erase(buffer_iter);
+            released = true;
+        }
+
+        auto column_iter = column_buffer_map_.find(data_id);
+        if (column_iter != column_buffer_map_.end()) {
+            for (auto &[column, column_buffer] : column_iter->second) {
+                deallocate_buffer(column_buffer);
+            }
+            column_buffer_map_.erase(column_iter);
+            released = true;
+        }
+
+        return released;
+    }
+
     virtual ~IGPUExecutor() = default;
 
-    // Class to handle memory allocation efficiently through the buddy system
+    /*
+     * GPUMemoryAllocator
+     * Buddy allocator over one slab per memory class, free blocks are tracked in flat bitmaps (no hashing)
+     *  - Each order owns a bitmap with one bit per block of that size, block index = offset >> order
+     *  - free_mask has bit `order` set while that order has any free block, so the smallest fitting order is a ctz
+     *  - Allocation takes the lowest free address of that order and splits it down, freeing merges with free buddies
+     *  - A second bitmap per order marks the blocks handed out at that order, so a free must name a live block at the
+     *    size it was allocated with (no sub-block or wrong size frees)
+     *  - Both paths are O(orders) bit operations, bitmap memory is ~2^(max_order - min_order + 2) bits per class
+     */
     class GPUMemoryAllocator {
       public:
+        // Occupancy and fragmentation of one memory class
+        struct AllocatorStats {
+            size_t capacity_bytes = 0;
+            // Bytes of the blocks handed out (rounded to powers of two) and the bytes actually requested for them
+            size_t live_bytes = 0;
+            size_t requested_bytes = 0;
+            size_t peak_bytes = 0;
+            size_t live_allocations = 0;
+            size_t failed_allocations = 0;
+            size_t largest_free_block = 0;
+            // Indexed by order, bytes held by free blocks of that order
+            std::vector<size_t> free_bytes_per_order;
+            // Share of the live bytes lost to power of two rounding, 1 - requested / live
+            double internal_fragmentation = 0.0;
+        };
+
+        // One allocator operation, ids pair every free (and failure) with the allocation it belongs to
+        enum class TraceOp { Alloc, Free, Failed };
+        struct TraceEvent {
+            TraceOp op;
+            MemoryHint mem_hint;
+            size_t id;
+            size_t size;
+            size_t offset;
+        };
+
         GPUMemoryAllocator(size_t devloc_min_size, size_t devloc_max_size, size_t unified_min_size,
                            size_t unified_max_size, size_t hostvis_min_size, size_t hostvis_max_size);
         GPUMemoryAllocator();
 
-        uint64_t next_pow2(uint64_t x) { return x <= 1 ? 1 : 1 << (64 - __builtin_clz(x - 1)); }
+        static uint64_t next_pow2(uint64_t x) { return x <= 1 ? 1 : 1ULL << (64 - __builtin_clzll(x - 1)); }
         size_t allocate_memory(size_t mem_size, MemoryHint mem_hint);
+        // Returns nothing when no free block currently fits, requests larger than the whole slab still throw
+        std::optional<size_t> try_allocate_memory(size_t mem_size, MemoryHint mem_hint);
         void check_free_mem(size_t mem_size, size_t mem_offset, MemoryHint mem_hint);
 
-        size_t devloc_min_order;
-        size_t devloc_max_order;
-        size_t hostvis_min_order;
-        size_t hostvis_max_order;
-        size_t unified_min_order;
-        size_t unified_max_order;
+        // Allocator state per memory class, orders are 0 for classes that were disabled (zero sized)
+        size_t min_order(MemoryHint mem_hint) const { return region(mem_hint).min_order; };
+        size_t max_order(MemoryHint mem_hint) const { return region(mem_hint).max_order; };
+        uint64_t free_mask(MemoryHint mem_hint) const { return region(mem_hint).free_mask; };
+        size_t free_block_count(MemoryHint mem_hint, size_t order) const;
 
-        uint64_t devloc_free_mask = 0;
-        uint64_t hostvis_free_mask = 0;
-        uint64_t unified_free_mask = 0;
+        AllocatorStats get_stats(MemoryHint mem_hint) const;
+        void reset_peak(MemoryHint mem_hint);
 
-        std::unordered_map<uint8_t, std::vector<size_t>> devloc_size_address;
-        std::unordered_map<uint8_t, std::vector<size_t>> unified_size_address;
-        std::unordered_map<uint8_t, std::vector<size_t>> hostvis_size_address;
-
-        std::unordered_map<size_t, std::unordered_map<size_t, size_t>> devloc_free_map;
-        std::unordered_map<size_t, std::unordered_map<size_t, size_t>> unified_free_map;
-        std::unordered_map<size_t, std::unordered_map<size_t, size_t>> hostvis_free_map;
+        // Records every alloc/free (e.g. for one frame) so the sequence can be replayed offline against other slab
+        // sizes and minimum orders, see bench/alloc_replay.cpp
+        void set_tracing(bool tracing);
+        const std::vector<TraceEvent> &get_trace() const { return trace_; };
+        void clear_trace() { trace_.clear(); };
+        void write_trace(std::ostream &out) const;
+        static std::vector<TraceEvent> read_trace(std::istream &in);
 
       private:
-        std::unordered_map<MemoryHint, GPUBufferHandle> slab_map;
+        // Bitmap with a summary level per 64 words, so the lowest set bit is found in O(log64 n)
+        class BlockBitmap {
+          public:
+            explicit BlockBitmap(size_t num_bits = 0);
+
+            bool test(size_t index) const { return (levels_[0][index / 64] >> (index % 64)) & 1ULL; };
+            void set(size_t index);
+            void reset(size_t index);
+            size_t find_first() const;
+            size_t count() const { return count_; };
 
-        // helper function for selecting the current state variables based on memory type
-        void init_mem_types(uint64_t *&free_mask, std::unordered_map<uint8_t, std::vector<size_t>> *&size_address,
-                            std::unordered_map<size_t, std::unordered_map<size_t, size_t>> *&free_map,
-                            MemoryHint mem_hint);
+          private:
+            // levels_[0] holds the bits themselves, each level above marks the non-empty words of the one below
+            std::vector<std::vector<uint64_t>> levels_;
+            size_t count_ = 0;
+        };
+
+        struct BuddyRegion {
+            size_t min_order = 0;
+            size_t max_order = 0;
+            uint64_t free_mask = 0;
+            // Indexed by order - min_order
+            std::vector<BlockBitmap> free_blocks;
+            std::vector<BlockBitmap> live_blocks;
+
+            size_t live_bytes = 0;
+            size_t requested_bytes = 0;
+            size_t peak_bytes = 0;
+            size_t live_allocations = 0;
+            size_t failed_allocations = 0;
+        };
+
+        BuddyRegion devloc_region_;
+        BuddyRegion unified_region_;
+        BuddyRegion hostvis_region_;
+
+        static BuddyRegion make_region(size_t min_size, size_t max_size);
+        static size_t size_order(size_t mem_size) { return __builtin_ctzll(next_pow2(mem_size)); }
+
+        // Selects the region for a memory hint, throwing if that memory class was disabled
+        BuddyRegion &region(MemoryHint mem_hint);
+        const BuddyRegion &region(MemoryHint mem_hint) const;
+        BuddyRegion &valid_region(MemoryHint mem_hint);
+
+        static void take_block(BuddyRegion &region, size_t order, size_t block);
+        static void give_block(BuddyRegion &region, size_t order, size_t block);
+
+        // Trace ids of the live allocations per (memory class, offset), only kept while tracing
+        bool tracing_ = false;
+        size_t next_trace_id_ = 0;
+        std::vector<TraceEvent> trace_;
+        std::unordered_map<MemoryHint, std::unordered_map<size_t, size_t>> trace_ids_;
+
+        void record(TraceOp op, MemoryHint mem_hint, size_t size, size_t offset);
     };
 
+    // Allocator of the backend, e.g. for telemetry after a frame
+    GPUMemoryAllocator &get_allocator() { return mem_allocator; }
+    const GPUMemoryAllocator &get_allocator() const { return mem_allocator; }
+
   protected:
+    // Builds and caches one kernel, false if the backend has no kernel of that name
+    bool virtual prepare_kernel(const std::string &kernel_name) = 0;
+
+    // Every backend hands out buffers from its slabs through the same buddy allocator
+    GPUMemoryAllocator mem_allocator;
+
     // Allows for the scheduler to check the status of kernels it has dispatched (kernel name -> future promise)
     // Is this needed still?
     std::unordered_map<std::string, bool> kernel_status_;
 
     // This mapping allows for checking which data has already been allocated to a buffer
     std::unordered_map<int, GPUBufferHandle> data_buffer_map_;
+    std::unordered_map<int, std::unordered_map<int, GPUBufferHandle>> column_buffer_map_;
 };
 
 #endif
@@ -0,0 +1,10 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <ostream>
+#include <string_view>
+
+// Writes text as a quoted JSON string, escaping quotes, backslashes and control characters
+void write_json_string(std::ostream &out, std::string_view text);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef LAUNCH_CONFIG_H
+#define LAUNCH_CONFIG_H
+
+#include "IGPUExecutor.h"
+#include <cstddef>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Grid and block of one kernel launch, always 3 dimensions
+struct LaunchConfig {
+    std::vector<int> grid_dim;
+    std::vector<int> block_dim;
+};
+
+// Smallest grid of whole blocks covering the problem shape (1 to 3 dimensions)
+//  - Block dimensions beyond the shape's are folded into its last dimension, so a {8, 8, 8} block still launches 512
+//    threads per block for a 1-D problem instead of 8
+LaunchConfig make_launch(const std::vector<int> &shape, const std::vector<int> &block_dim);
+
+/*
+ * LaunchTuner
+ * Picks the block dimensions of each kernel by timing a set of candidates on the device, once per kernel, problem
+ * dimensionality and size bucket (power of two of the thread count)
+ *  - Candidates run back to back on scratch buffers shaped like the real ones (zero filled), so the graph's data is
+ *    never touched by a tuning launch
+ *  - Winners can be written to and read from a cache file, so later runs launch the tuned configuration straight away
+ *  - Tuning stalls the scheduler thread while it runs, it only happens the first time a bucket is seen
+ */
+class LaunchTuner {
+  public:
+    // Timed launches per candidate, the fastest one counts
+    static constexpr int TUNING_REPEATS = 3;
+
+    // Block dimensions for this launch, tuned on first use of the bucket
+    //  - Falls back to the default block when the scratch buffers don't fit in device memory right now
+    std::vector<int> select_block(IGPUExecutor &gpu_executor, const KernelDispatch &kernel,
+                                  const std::vector<int> &shape, const std::vector<int> &default_block);
+
+    static std::vector<std::vector<int>> candidate_blocks(size_t num_dims);
+    static size_t size_bucket(const std::vector<int> &shape);
+
+    bool contains(const std::string &kernel_name, const std::vector<int> &shape) const;
+    size_t size() const;
+
+    void write_cache(std::ostream &out) const;
+    void read_cache(std::istream &in);
+    // A missing file is an empty cache
+    void load(const std::string &path);
+    void save(const std::string &path) const;
+
+  private:
+    // (kernel name, dimensions, size bucket) -> winning block
+    using TuningKey = std::tuple<std::string, size_t, size_t>;
+    std::map<TuningKey, std::vector<int>> tuned_blocks_;
+    mutable std::mutex tuner_mut_;
+
+    static TuningKey make_key(const std::string &kernel_name, const std::vector<int> &shape);
+    // Nothing when the scratch buffers don't fit
+    std::optional<std::vector<int>> tune(IGPUExecutor &gpu_executor, const KernelDispatch &kernel,
+                                         const std::vector<int> &shape, const std::vector<int> &default_block);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Hints applied to a file mapping once it has been created
+//  - sequential/will_need are forwarded to madvise, and are purely advisory
+//  - huge_pages aligns the mapping to a huge page boundary and requests transparent huge pages where supported
+//  - writable creates a private copy-on-write mapping, writes are never flushed back to the file
+struct MappedFileOptions {
+    bool sequential = false;
+    bool will_need = false;
+    bool huge_pages = false;
+    bool writable = false;
+};
+
+/*
+ * MappedFile
+ * Owns a read-only (or private copy-on-write) mmap of an entire file
+ * Move-only, the mapping is released when the owning object is destroyed
+ */
+class MappedFile {
+  public:
+    MappedFile(const std::string &path, const MappedFileOptions &options = {});
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    std::byte *data() { return data_; }
+    const std::byte *data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    std::byte *data_ = nullptr;
+    size_t size_ = 0;
+
+    void unmap();
+};
+
+// Typed view over a mapped file, satisfies ContiguousContainer so it can be registered with the DataManager like any
+// other container without copying the file contents
+template <typename T> class MappedBuffer {
+  public:
+    using value_type = T;
+
+    MappedBuffer(const std::string &path, const MappedFileOptions &options = {}) : file_(path, options) {};
+
+    T *data() { return reinterpret_cast<T *>(file_.data()); }
+    const T *data() const { return reinterpret_cast<const T *>(file_.data()); }
+    size_t size() const { return file_.size() / sizeof(T); }
+
+    T *begin() { return data(); }
+    T *end() { return data() + size(); }
+    const T *begin() const { return data(); }
+    const T *end() const { return data() + size(); }
+
+    T &operator[](size_t idx) { return data()[idx]; }
+    const T &operator[](size_t idx) const { return data()[idx]; }
+
+  private:
+    MappedFile file_;
+};
+
+#endif
@@ -3,39 +3,58 @@
 
 #include "DataManager.h"
 #include "IGPUExecutor.h"
+#include "StagingRing.h"
 #include <cstddef>
 #include <memory>
+#include <optional>
 #include <unordered_map>
 
 class MetalExecutor : public IGPUExecutor {
   public:
-    // If no device local (private) buffers will be used, no proxy buffer is needed
+    // Private (device local) transfers are staged through staging_slots slots of staging_slot_size bytes each
+    //  - If no device local buffers will be used no slots are needed, a single slot is made on first use otherwise
+    //  - Kernels are spread over num_queues command queues, transfers go through the first one
     MetalExecutor(std::pair<int, int> devloc_bounds, std::pair<int, int> hostvis_bounds,
-                  std::pair<int, int> unified_bounds, size_t proxy_size = 0);
+                  std::pair<int, int> unified_bounds, size_t staging_slot_size = 0, size_t staging_slots = 0,
+                  size_t num_queues = 1);
     ~MetalExecutor();
 
-    GPUBufferHandle allocate_buffer(std::size_t buffer_size, const MemoryHint mem_hint) override;
+    std::optional<GPUBufferHandle> try_allocate_buffer(std::size_t buffer_size, const MemoryHint mem_hint) override;
     GPUState deallocate_buffer(const GPUBufferHandle &buffer_handle) override;
 
     GPUState copy_to_device(std::span<const std::byte> data_mem, const GPUBufferHandle &buffer_handle) override;
     GPUState copy_from_device(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle) override;
+    GPUState copy_to_device_batch(const std::vector<BufferCopy> &copies) override;
+    std::shared_ptr<GPUEvent> copy_to_device_async(const std::vector<BufferCopy> &copies) override;
+    std::shared_ptr<GPUEvent> copy_from_device_async(std::span<std::byte> data_mem,
+                                                     const GPUBufferHandle &buffer_handle) override;
 
+    using IGPUExecutor::execute_batch;
     GPUState execute_batch(const std::vector<KernelDispatch> &kernels, const DispatchType &dispatch_type,
-                           std::function<void()> &cpu_callback) override;
+                           std::vector<std::function<void()>> &cpu_callbacks, size_t queue = 0) override;
     GPUState execute_kernel(const KernelDispatch &kernel, std::function<void()> &cpu_callback) override;
 
     GPUState synchronize() override;
 
+    size_t num_queues() const override;
+    std::shared_ptr<GPUEvent> make_queue_event(size_t queue) override;
+
+    size_t max_block_threads(const std::string &kernel_name) override;
+
+  protected:
+    bool prepare_kernel(const std::string &kernel_name) override;
+
   private:
     int buffer_counter = 0;
 
     struct MetalExecutorImpl;
     std::unique_ptr<MetalExecutorImpl> p_metal_impl;
 
-    // Reusable proxy buffer private resources
-    GPUBufferHandle proxy_handle_;
+    // Staging slots in shared memory for private transfers, recycled once their transfer's fence is signalled
+    std::unique_ptr<StagingRing> staging_ring_;
 
     void load_default_library();
+    void load_indirect_args_pipeline();
 
     // Helper functions for managing memory transfers
     GPUState blit_to_private(std::span<const std::byte> data_mem, const GPUBufferHandle &buffer_handle);
@@ -44,11 +63,6 @@ class MetalExecutor : public IGPUExecutor {
     GPUState private_to_cpu(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle);
     GPUState managed_to_cpu(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle);
     GPUState shared_to_cpu(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle);
-
-    GPUMemoryAllocator mem_allocator;
-
-    // Provides access to proxy buffer and extends size if needed
-    void access_proxy(size_t data_size);
 };
 
 #endif
@@ -0,0 +1,188 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Raises the atomic to value if it is larger, safe with any number of writers
+template <typename T> void update_max(std::atomic<T> &maximum, T value) {
+    T current = maximum.load(std::memory_order_relaxed);
+    while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+// Percentiles of a latency histogram, all in ns
+struct LatencySummary {
+    uint64_t count = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+    double mean = 0.0;
+};
+
+/*
+ * LatencyHistogram
+ * Log-linear histogram of durations in ns, in the style of HdrHistogram: every power of two is split into SUB_BUCKETS
+ * equal buckets, so any value is reported within 1 / SUB_BUCKETS (6.25%) of what was recorded, over the full 64 bit
+ * range
+ *  - Recording is a handful of relaxed atomic adds, any number of threads may record and read at once
+ *  - A percentile is the highest value of its bucket, capped at the largest value recorded
+ */
+class LatencyHistogram {
+  public:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr size_t NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t value_ns);
+    void record(std::chrono::nanoseconds duration) {
+        record(static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0)));
+    }
+
+    // Quantile in [0, 1]
+    uint64_t percentile(double quantile) const;
+    LatencySummary summary() const;
+    void reset();
+
+    static size_t bucket_index(uint64_t value_ns);
+    // Highest value that falls into the bucket
+    static uint64_t bucket_upper(size_t bucket);
+
+  private:
+    std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets_{};
+    std::atomic<uint64_t> sum_ = 0;
+    std::atomic<uint64_t> max_ = 0;
+
+    static uint64_t percentile_of(const std::array<uint64_t, NUM_BUCKETS> &buckets, uint64_t count, uint64_t max,
+                                  double quantile);
+};
+
+// Totals of the thread pools of a runtime, their workers add to them as they run tasks
+struct ThreadPoolCounters {
+    std::atomic<uint64_t> tasks = 0;
+    std::atomic<uint64_t> busy_ns = 0;
+    // Tasks waiting for a worker
+    std::atomic<size_t> queue_depth = 0;
+    std::atomic<size_t> max_queue_depth = 0;
+};
+
+struct TaskLatency {
+    std::string task_name;
+    LatencySummary latency;
+};
+
+// Everything RuntimeMetrics collected since it was created
+struct MetricsSnapshot {
+    std::chrono::nanoseconds uptime{0};
+
+    uint64_t graphs_run = 0;
+    LatencySummary graph_latency;
+    // Dispatch to completion as seen by the scheduler, per task name in order of first completion
+    std::vector<TaskLatency> task_latencies;
+    // A task finishing to the scheduler picking its completion up
+    LatencySummary completion_latency;
+
+    size_t pool_threads = 0;
+    uint64_t pool_tasks = 0;
+    std::chrono::nanoseconds pool_busy{0};
+    // Busy time over uptime times the number of workers
+    double pool_utilization = 0.0;
+    size_t pool_queue_depth = 0;
+    size_t max_pool_queue_depth = 0;
+    size_t max_ready_queue_depth = 0;
+    // Most completions the scheduler picked up at once
+    size_t max_completion_batch = 0;
+
+    uint64_t bytes_to_device = 0;
+    uint64_t bytes_to_host = 0;
+    uint64_t gpu_batches = 0;
+    uint64_t gpu_kernels = 0;
+};
+
+void write_metrics_json(std::ostream &out, const MetricsSnapshot &snapshot);
+
+/*
+ * RuntimeMetrics
+ * Always-on production counters of a runtime, meant for spotting regressions per stage without a profiler
+ *  - Writers only touch atomics (task names are registered once under a lock that readers never take), so snapshot
+ *    is lock free and can be called from any thread while graphs run
+ *  - Up to MAX_TASK_NAMES - 1 task names get their own histogram, any further names share the last one ("other tasks")
+ *  - The optional file writer replaces the file with a fresh JSON snapshot every interval (written next to it and
+ *    renamed, so readers never see a partial file)
+ */
+class RuntimeMetrics {
+  public:
+    static constexpr size_t MAX_TASK_NAMES = 256;
+
+    RuntimeMetrics() : start_(std::chrono::steady_clock::now()) {};
+    ~RuntimeMetrics() { stop_file_writer(); }
+
+    RuntimeMetrics(const RuntimeMetrics &) = delete;
+    RuntimeMetrics &operator=(const RuntimeMetrics &) = delete;
+
+    // Takes the registration lock, the returned histogram stays valid for the lifetime of the metrics
+    LatencyHistogram &task_histogram(const std::string &task_name);
+    LatencyHistogram &graph_histogram() { return graph_latency_; }
+    LatencyHistogram &completion_histogram() { return completion_latency_; }
+    ThreadPoolCounters &pool_counters() { return pool_counters_; }
+
+    void set_pool_threads(size_t num_threads) { pool_threads_.store(num_threads, std::memory_order_relaxed); }
+    void record_ready_depth(size_t depth) { update_max(max_ready_depth_, depth); }
+    void record_completion_batch(size_t num_completions) { update_max(max_completion_batch_, num_completions); }
+    void record_graph(std::chrono::nanoseconds duration, uint64_t bytes_to_device, uint64_t bytes_to_host,
+                      uint64_t gpu_batches, uint64_t gpu_kernels);
+
+    MetricsSnapshot snapshot() const;
+
+    void start_file_writer(const std::string &path, std::chrono::milliseconds interval);
+    // Writes one last snapshot before returning
+    void stop_file_writer();
+
+  private:
+    struct TaskSlot {
+        std::string task_name;
+        LatencyHistogram histogram;
+    };
+
+    std::chrono::steady_clock::time_point start_;
+
+    // Slots below num_slots_ are complete and never change owner
+    std::array<std::unique_ptr<TaskSlot>, MAX_TASK_NAMES> task_slots_;
+    std::atomic<size_t> num_slots_ = 0;
+    std::mutex slot_mut_;
+    std::unordered_map<std::string, size_t> slot_ids_;
+
+    LatencyHistogram graph_latency_;
+    LatencyHistogram completion_latency_;
+    ThreadPoolCounters pool_counters_;
+    std::atomic<size_t> pool_threads_ = 0;
+    std::atomic<size_t> max_ready_depth_ = 0;
+    std::atomic<size_t> max_completion_batch_ = 0;
+
+    std::atomic<uint64_t> bytes_to_device_ = 0;
+    std::atomic<uint64_t> bytes_to_host_ = 0;
+    std::atomic<uint64_t> gpu_batches_ = 0;
+    std::atomic<uint64_t> gpu_kernels_ = 0;
+
+    std::thread writer_thread_;
+    std::mutex writer_mut_;
+    std::condition_variable writer_cv_;
+    bool writer_stop_ = false;
+
+    void write_file(const std::string &path) const;
+};
+
+#endif
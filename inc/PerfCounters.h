@@ -0,0 +1,87 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum PerfCounter { Cycles, Instructions, LLCMisses, BranchMisses, NUM_PERF_COUNTERS };
+
+using PerfSample = std::array<uint64_t, NUM_PERF_COUNTERS>;
+
+/*
+ * ThreadPerfCounters
+ * Hardware counters of the calling thread (user space only) through perf_event_open, opened as one group the first
+ * time a thread samples them and closed when the thread exits
+ *  - Counters the CPU or kernel can't provide (e.g. no LLC event in a VM) are left out, the others still count
+ *  - Without any counter (perf_event_paranoid, seccomp, not Linux) sampling returns nothing and costs a branch
+ *  - Values are scaled by enabled over running time, so multiplexed counters are estimates
+ */
+class ThreadPerfCounters {
+  public:
+    // Nothing when the thread has no counters
+    static std::optional<PerfSample> sample();
+    // Counters opened on the calling thread, all false when perf events are unavailable
+    static std::array<bool, NUM_PERF_COUNTERS> available();
+    // Why the counters of the calling thread could not be opened, empty when they were
+    static std::string unavailable_reason();
+
+    static const char *counter_name(PerfCounter counter);
+};
+
+// Counter totals of every run of one task name
+struct TaskPerfStats {
+    std::string task_name;
+    uint64_t runs = 0;
+    // Elements of the largest input of each run, summed over the runs
+    uint64_t points = 0;
+    PerfSample totals{};
+
+    double ipc() const;
+    // Per point of input, 0 without points
+    double per_point(PerfCounter counter) const;
+};
+
+struct PerfReport {
+    // Counters that were open on every thread that sampled, all false when none could be opened
+    std::array<bool, NUM_PERF_COUNTERS> available{};
+    std::string unavailable_reason;
+    // In order of first run
+    std::vector<TaskPerfStats> tasks;
+};
+
+// Table of the report, counters that were not available print as "n/a"
+void write_perf_report(std::ostream &out, const PerfReport &report);
+
+/*
+ * TaskPerfCounters
+ * Aggregates the counter deltas of task runs per task name, filled by the scheduler around every CPU task when
+ * enabled on the runtime
+ *  - Runs of threads without counters are still counted (runs and points), so the report shows what ran either way
+ */
+class TaskPerfCounters {
+  public:
+    // Deltas of one run, before and after are the thread's samples around it
+    void record(const std::string &task_name, const std::optional<PerfSample> &before,
+                const std::optional<PerfSample> &after, size_t points);
+
+    PerfReport report() const;
+    void reset();
+
+  private:
+    mutable std::mutex stats_mut_;
+    std::unordered_map<std::string, size_t> task_ids_;
+    std::vector<TaskPerfStats> tasks_;
+
+    bool sampled_ = false;
+    std::array<bool, NUM_PERF_COUNTERS> available_{};
+    std::string unavailable_reason_;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef POINT_CLOUD_H
+#define POINT_CLOUD_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+// Columns stored by the point cloud, in storage order
+enum class PointField : uint8_t { X, Y, Z, Intensity, Ring };
+
+const size_t POINT_FIELD_COUNT = 5;
+const size_t POINT_CLOUD_ALIGNMENT = 64;
+
+/*
+ * PointCloud
+ * Structure-of-arrays point cloud where every column starts on a 64-byte boundary
+ *  - All columns live in one allocation so the cloud is registered with the DataManager as a single handle
+ *  - Stages (and GPU kernels) can read just the columns they need through column spans/ranges
+ *  - Capacity is rounded so every column length is a multiple of the alignment, keeping the next column aligned
+ */
+class PointCloud {
+  public:
+    PointCloud() = default;
+    explicit PointCloud(size_t num_points);
+
+    PointCloud(const PointCloud &other);
+    PointCloud &operator=(const PointCloud &other);
+    // A moved-from cloud is empty with no capacity, so resizing it allocates again
+    PointCloud(PointCloud &&other) noexcept;
+    PointCloud &operator=(PointCloud &&other) noexcept;
+
+    // Builds a cloud from interleaved (x, y, z, intensity) tuples, e.g. a KITTI velodyne scan
+    static PointCloud from_xyzi(std::span<const float> interleaved);
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    void resize(size_t num_points);
+
+    std::span<float> x() { return column<float>(PointField::X); }
+    std::span<float> y() { return column<float>(PointField::Y); }
+    std::span<float> z() { return column<float>(PointField::Z); }
+    std::span<float> intensity() { return column<float>(PointField::Intensity); }
+    std::span<uint16_t> ring() { return column<uint16_t>(PointField::Ring); }
+
+    std::span<const float> x() const { return column<float>(PointField::X); }
+    std::span<const float> y() const { return column<float>(PointField::Y); }
+    std::span<const float> z() const { return column<float>(PointField::Z); }
+    std::span<const float> intensity() const { return column<float>(PointField::Intensity); }
+    std::span<const uint16_t> ring() const { return column<uint16_t>(PointField::Ring); }
+
+    // Columnar interface used by the DataManager (see ColumnarContainer)
+    size_t column_count() const { return POINT_FIELD_COUNT; }
+    std::span<std::byte> column_bytes(size_t column);
+    std::span<const std::byte> column_bytes(size_t column) const;
+    std::span<std::byte> bytes() { return {storage_.get(), storage_bytes()}; }
+    std::span<const std::byte> bytes() const { return {storage_.get(), storage_bytes()}; }
+
+    static size_t field_size(PointField field) { return field == PointField::Ring ? sizeof(uint16_t) : sizeof(float); }
+
+  private:
+    struct AlignedDelete {
+        void operator()(std::byte *ptr) const;
+    };
+
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    std::unique_ptr<std::byte[], AlignedDelete> storage_;
+
+    size_t column_offset(PointField field) const;
+    size_t storage_bytes() const;
+
+    template <typename T> std::span<T> column(PointField field) {
+        T *column_ptr = reinterpret_cast<T *>(storage_.get() + column_offset(field));
+        return {std::assume_aligned<POINT_CLOUD_ALIGNMENT>(column_ptr), size_};
+    }
+
+    template <typename T> std::span<const T> column(PointField field) const {
+        const T *column_ptr = reinterpret_cast<const T *>(storage_.get() + column_offset(field));
+        return {std::assume_aligned<POINT_CLOUD_ALIGNMENT>(column_ptr), size_};
+    }
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef RESIDENCY_MANAGER_H
+#define RESIDENCY_MANAGER_H
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Where the valid copy of a piece of data currently lives
+enum class Residency { Host, Device, Both };
+
+// Bytes moved between host and device, reported per executed graph (i.e. per frame)
+struct TransferStats {
+    size_t bytes_to_device = 0;
+    size_t bytes_to_host = 0;
+    size_t uploads = 0;
+    size_t downloads = 0;
+};
+
+/*
+ * ResidencyManager
+ * Tracks which side holds the valid copy of each data id (and of each uploaded column), so transfers are only issued
+ * when the other side actually needs the data
+ *  - GPU results stay Device until a CPU task reads them or their device buffer is about to be dropped
+ *  - CPU writes make any device copy stale, the next GPU reader uploads again into the existing buffer
+ *  - Unknown data is Host, nothing has been uploaded for it
+ *  - Column -1 refers to the whole data, other columns are tracked separately like their buffers
+ *  - Dropped and reset entries stay in the maps as Host (same as unknown), so repeated runs don't reallocate them
+ *
+ * Updates come from the scheduler thread and executor completion callbacks, so every access is locked
+ */
+class ResidencyManager {
+  public:
+    Residency get_residency(int data_id, int column = -1) const;
+
+    // The data (all of its columns) was modified on the host
+    void mark_host_written(int data_id);
+    // A kernel wrote the device copy, the host copy is stale
+    void mark_device_written(int data_id, int column = -1);
+
+    // Both copies are valid after a transfer, which is counted towards the stats
+    void mark_uploaded(int data_id, int column, size_t num_bytes);
+    void mark_downloaded(int data_id, int column, size_t num_bytes);
+
+    // The device copy is gone, only the host copy is left
+    void drop_device(int data_id);
+
+    // Columns (-1 for the whole data) whose only valid copy is on the device
+    std::vector<int> device_only_columns(int data_id) const;
+
+    TransferStats get_stats() const;
+    void reset();
+
+  private:
+    mutable std::mutex residency_mut_;
+    std::unordered_map<int, std::unordered_map<int, Residency>> residency_map_;
+    TransferStats stats_;
+};
+
+#endif
@@ -1,21 +1,27 @@
 #ifndef RUNTIME_H
 #define RUNTIME_H
 
+#include "AllocationTracker.h"
 #include "DataManager.h"
 #include "IGPUExecutor.h"
+#include "LaunchConfig.h"
+#include "Metrics.h"
+#include "PerfCounters.h"
+#include "Scheduler.h"
+#include "SimulatedExecutor.h"
 #include "Tasks.h"
 #include "ThreadPool.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <ostream>
+#include <string>
 #include <variant>
 
-enum class TaskState { Pending, Ready, Running, Complete };
-
-struct TaskRuntimeState {
-    TaskState state;
-    int num_dependencies;
-};
-
-enum class GPUBackend { Metal, Cuda };
+// Host runs "GPU" tasks on an emulated device (see HostExecutor), available on every platform
+// Simulated additionally models the timing of a target device (see SimulatedExecutor)
+enum class GPUBackend { Metal, Cuda, Host, Simulated };
 
 struct GPUDevice {
     GPUBackend backend;
@@ -27,12 +33,42 @@ struct GPUDevice {
     std::pair<int, int> unified_range;
     std::pair<int, int> hostvis_range;
 
+    // Record every device allocation of the committed graph so it can be replayed offline (see write_allocation_trace)
+    bool trace_allocations = false;
+
+    // Transfers to/from device local memory that can be in flight at once on backends that stage them
+    size_t staging_slots = 4;
+
+    // Execution queues of the device, independent GPU tasks are spread over them so small kernels can overlap
+    size_t num_queues = 1;
+
+    // Bandwidth, latency and throughput of the device the Simulated backend stands in for
+    SimulatedDeviceModel simulated_model;
+
+    // Time candidate block sizes per kernel and problem size the first time they are dispatched (see LaunchTuner)
+    //  - With a cache path the winners are loaded from and saved to that file, so later runs skip the tuning
+    bool autotune_launches = false;
+    std::string launch_cache_path;
+
     GPUDevice(GPUBackend backend, std::pair<int, int> devloc_range, std::pair<int, int> unified_range,
               std::pair<int, int> hostvis_range, int device_id = -1)
         : backend(backend), device_id(device_id), devloc_range(devloc_range), unified_range(unified_range),
           hostvis_range(hostvis_range) {};
 };
 
+// Heap allocations flagged during the checked runs of a prepared graph (see Runtime::enable_allocation_check)
+struct AllocationReport {
+    // False when the binary was built without Helios_AllocationHooks, nothing is counted then
+    bool available = false;
+    size_t checked_runs = 0;
+    // Runtime paths, zero in the steady state only for graphs without GPU work (CPU tasks and split tasks whose whole
+    // range runs on the CPU), every GPU dispatch still allocates on the scheduler thread and inside the executor
+    AllocationCounts scheduler;
+    AllocationCounts worker;
+    // Allocations made by the tasks' own code, reported but outside the runtime's control
+    AllocationCounts task;
+};
+
 /*
  * The Runtime is the owner of all the system resources
  * It coordinates data handling and creating schedulers
@@ -40,19 +76,92 @@ struct GPUDevice {
 class Runtime {
   public:
     // The GPU executor and Thread Pool are created at initialization to accurately reflect system state
-    Runtime(DataManager &data_manager, size_t num_threads) : data_manager_(data_manager), num_threads(num_threads) {};
+    Runtime(DataManager &data_manager, size_t num_threads) : data_manager_(data_manager), num_threads(num_threads) {
+        metrics_.set_pool_threads(num_threads);
+    };
 
     // Immediately communicates with the scheduler to begin executing tasks
     void commit_graph(TaskGraph &task_graph, GPUDevice &device_info);
 
+    // Sets the graph up once (executor, kernels, thread pool and the scheduler's per-task state) so run() can execute
+    // it every frame, which is what a real-time pipeline should do instead of committing the graph again
+    //  - Intermediates stay registered between runs instead of being released, the graph must outlive the runtime's
+    //    use of it and must not change until another graph is prepared or committed
+    void prepare_graph(TaskGraph &task_graph, GPUDevice &device_info);
+    // Executes the prepared graph once, a graph of CPU tasks allocates nothing on the scheduler and worker paths once
+    // its first run has sized the queues
+    //  - The guarantee is CPU only, a GPU dispatch still allocates its kernel dispatch, completion callback and events
+    void run();
+
+    // Flags heap allocations during every run() after the first warmup_runs ones, charged to the scheduler thread, the
+    // workers or the tasks' own code (see AllocationTracker)
+    //  - Counting needs Helios_AllocationHooks linked into the binary, the report says whether it was
+    //  - With abort_on_allocation the first flagged allocation aborts the process, on the allocating call's stack
+    void enable_allocation_check(size_t warmup_runs, bool abort_on_allocation = false);
+    void disable_allocation_check();
+    AllocationReport get_allocation_report() const { return allocation_report_; }
+
+    // Scheduler counters (e.g. time GPU tasks spent waiting on device memory) of the last committed graph
+    const SchedulerStats &get_scheduler_stats() const { return scheduler_stats_; }
+
+    // Device memory telemetry of the last committed graph (e.g. one frame), used to size the GPUDevice ranges
+    IGPUExecutor::GPUMemoryAllocator::AllocatorStats get_allocator_stats(MemoryHint mem_hint) const;
+    void write_allocation_trace(std::ostream &out) const;
+
+    // Modelled device timeline of the last committed graph, only available on the Simulated backend
+    SimulatedDeviceStats get_simulated_stats() const;
+
+    // Tuned launch configurations, kept across committed graphs
+    const LaunchTuner &get_launch_tuner() const { return launch_tuner_; }
+
+    // Latency histograms and counters of every graph committed so far, lock free so any thread may poll it while a
+    // graph runs (see RuntimeMetrics)
+    MetricsSnapshot get_metrics() const { return metrics_.snapshot(); }
+    // Keeps the file replaced with a JSON snapshot every interval until stopped or the runtime is destroyed
+    void start_metrics_file(const std::string &path, std::chrono::milliseconds interval) {
+        metrics_.start_file_writer(path, interval);
+    }
+    void stop_metrics_file() { metrics_.stop_file_writer(); }
+
+    // Cycles, instructions, LLC and branch misses of every CPU task run while enabled, per task name (see
+    // TaskPerfCounters), the report says which counters the workers could not open
+    void enable_perf_counters(bool enabled) { perf_counters_enabled_ = enabled; }
+    PerfReport get_perf_report() const { return perf_counters_.report(); }
+    void reset_perf_counters() { perf_counters_.reset(); }
+
   private:
     DataManager &data_manager_;
+    // Outlives the thread pool, whose workers add to its counters until they are joined
+    RuntimeMetrics metrics_;
+    TaskPerfCounters perf_counters_;
+    bool perf_counters_enabled_ = false;
     std::unique_ptr<ThreadPool> thread_pool_;
     std::unique_ptr<IGPUExecutor> gpu_exec_;
     size_t num_threads;
+    SchedulerStats scheduler_stats_;
+    LaunchTuner launch_tuner_;
+    std::string loaded_launch_cache_;
+
+    // Scheduler of the prepared graph, kept so run() reuses its state
+    std::unique_ptr<Scheduler> prepared_scheduler_;
+    std::string prepared_launch_cache_;
+
+    bool allocation_check_ = false;
+    size_t allocation_warmup_runs_ = 0;
+    size_t runs_since_check_ = 0;
+    AllocationReport allocation_report_;
 
-    void create_thread_pool_() { thread_pool_ = std::make_unique<ThreadPool>(num_threads); };
+    void create_thread_pool_() {
+        thread_pool_ = std::make_unique<ThreadPool>(num_threads, "worker", &metrics_.pool_counters());
+    };
     void create_executor_(GPUDevice &device_info, const TaskGraph &task_graph);
+    void validate_access_(const TaskGraph &task_graph) const;
+    void prepare_kernels_(const TaskGraph &task_graph);
+    // Everything a graph needs before its first run, shared by commit_graph and prepare_graph
+    void set_up_graph_(TaskGraph &task_graph, GPUDevice &device_info);
+    std::unique_ptr<Scheduler> make_scheduler_(bool autotune_launches);
+    // Runs the scheduler's prepared graph once, new launch tunings are saved to the cache path unless it is empty
+    void run_scheduler_(Scheduler &scheduler, const std::string &launch_cache_path);
 };
 
 #endif
@@ -3,11 +3,51 @@
 
 #include "DataManager.h"
 #include "IGPUExecutor.h"
+#include "LaunchConfig.h"
+#include "Metrics.h"
+#include "PerfCounters.h"
+#include "ResidencyManager.h"
 #include "Tasks.h"
 #include "ThreadPool.h"
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
+
+enum class TaskState { Pending, Ready, Running, Complete };
+
+struct TaskRuntimeState {
+    TaskState state;
+    int num_dependencies;
+    // When the task became ready, only set while tracing
+    uint64_t ready_ns = 0;
+    // Only set when the scheduler records metrics
+    std::chrono::steady_clock::time_point dispatched_at{};
+};
+
+// Counters collected over one execute_graph call
+struct SchedulerStats {
+    // GPU tasks whose buffers did not fit when they became ready, and the total time they waited for device memory
+    size_t deferred_gpu_tasks = 0;
+    std::chrono::nanoseconds alloc_stall_time{0};
+
+    // Host/device traffic of the graph, GPU to GPU chains contribute nothing
+    TransferStats transfers;
+
+    // Submissions to the GPU executor and the kernels they carried
+    size_t gpu_batches = 0;
+    size_t gpu_kernels = 0;
+    // Kernels ordered after a kernel of another GPU queue through an event
+    size_t cross_queue_waits = 0;
+};
 
 class Scheduler {
   public:
@@ -18,11 +58,35 @@ class Scheduler {
     // TODO: For both visit methods, implement event polling -> wrap in a lambda that pushes to thread safe queue
     void visit(const BaseCPUTask &cpu_task);
     void visit(const GPUTask &gpu_task);
+    void visit(const SplitTask &split_task);
 
     bool check_kernel_status(const std::string &kernel_name) { return gpu_executor->get_kernel_status(kernel_name); }
 
+    // Prepares and runs the graph once, intermediates are released as soon as they are consumed
     void execute_graph(const TaskGraph &task_graph);
 
+    // Builds the dense per-task state of the graph, which run_graph then reuses on every run
+    //  - With retain_intermediates, intermediates stay registered after they are consumed (only their device buffers
+    //    are given back), so the graph can run again
+    //  - The graph must not change until another graph is prepared
+    void prepare_graph(const TaskGraph &task_graph, bool retain_intermediates);
+    // Runs the prepared graph, a graph of CPU tasks does not allocate on the scheduler and worker paths once the first
+    // run has sized the queues (see AllocationTracker)
+    //  - GPU tasks still allocate on every dispatch (the KernelDispatch, its completion callback and the executor's
+    //    events), only their per-task bookkeeping is dense
+    //  - When a CPU task (or the CPU part of a split task) throws, no further task is dispatched, the tasks in flight
+    //    are waited for and the first error is rethrown
+    void run_graph();
+
+    const SchedulerStats &get_stats() const { return stats_; }
+
+    // Block dimensions of directly dispatched kernels are picked by the tuner when set, the task's otherwise
+    void set_launch_tuner(LaunchTuner *launch_tuner) { launch_tuner_ = launch_tuner; }
+    // Task latencies, queue depths and completion latency are recorded into the metrics when set
+    void set_metrics(RuntimeMetrics *metrics) { metrics_ = metrics; }
+    // Hardware counters are sampled around every CPU task lambda when set
+    void set_perf_counters(TaskPerfCounters *perf_counters) { perf_counters_ = perf_counters; }
+
   private:
     class CompletionQueue {
       private:
@@ -30,26 +94,170 @@ class Scheduler {
         std::condition_variable cond_var;
 
       public:
-        // Public so the scheduler can drain the queue
-        std::queue<int> data_queue;
+        struct Completion {
+            int task_id;
+            std::chrono::steady_clock::time_point completed_at;
+        };
+
+        // Each task completes once per run, so with both vectors reserved for every task of the graph neither ever
+        // grows while it runs
+        std::vector<Completion> data_queue;
+
+        void reserve(size_t num_tasks) {
+            std::lock_guard<std::mutex> lock(queue_mut);
+            data_queue.reserve(num_tasks);
+        }
 
         // Locks the mutex -> pushes and notifies scheduler of completion
         void push_task(int task_id) {
+            auto completed_at = std::chrono::steady_clock::now();
             std::lock_guard<std::mutex> lock(queue_mut);
-            data_queue.push(task_id);
+            data_queue.push_back({task_id, completed_at});
             cond_var.notify_one();
         }
 
-        // Waits for a task to notify the scheduler thread of it's completion
-        std::unique_lock<std::mutex> wait() {
+        // Waits for a task to notify the scheduler thread of it's completion, then swaps the completions into the
+        // (empty) drained vector, which hands its capacity to the queue
+        void wait_and_drain(std::vector<Completion> &drained) {
             std::unique_lock<std::mutex> lock(queue_mut);
             cond_var.wait(lock, [this] { return !data_queue.empty(); });
-
-            return lock;
+            data_queue.swap(drained);
         }
     };
 
     CompletionQueue completed_queue;
+    std::vector<CompletionQueue::Completion> drained_completions_;
+
+    // Dense state of the prepared graph, indexed by task id (ids are handed out from 0 by the TaskGraph)
+    //  - Dependents and dependencies are copied out of the graph, whose accessors return them by value
+    //  - The ready queue holds every task at most once per run, so it is a reserved vector read from ready_head_
+    const TaskGraph *task_graph_ = nullptr;
+    bool retain_intermediates_ = false;
+    std::vector<ITask *> tasks_;
+    std::vector<bool> is_gpu_task_;
+    // Latency histogram of each task's name, looked up once so completions only touch its atomics
+    std::vector<LatencyHistogram *> task_histograms_;
+    std::vector<std::vector<int>> dependents_;
+    std::vector<std::vector<int>> dependencies_;
+    std::vector<TaskRuntimeState> graph_tasks_;
+    std::vector<int> ready_queue_;
+    size_t ready_head_ = 0;
+    size_t num_running_ = 0;
+
+    // Every data id the graph reads or writes maps to a slot of the per-data counters
+    //  - Consumers left before an intermediate is released, -1 for data that is never released (root inputs, graph
+    //    outputs)
+    //  - Pending device reads, the device buffer is dropped when they reach zero
+    std::unordered_map<int, size_t> data_slots_;
+    std::vector<int> release_counts_;
+    std::vector<int> remaining_consumers_;
+    std::vector<int> total_readers_;
+    std::vector<int> device_readers_;
+
+    // GPU tasks dispatched in the current pass, GPU tasks depending only on them can join their batch
+    std::vector<int> pass_gpu_tasks_;
+    std::vector<bool> in_pass_;
+
+    // What a queued CPU task needs on the worker, one per task so queueing it passes a pointer instead of a closure
+    //  - error holds what the task threw, the worker still reports the task so the scheduler can rethrow it
+    struct CPURun {
+        Scheduler *scheduler;
+        const BaseCPUTask *task;
+        uint64_t dispatch_ns;
+        size_t points;
+        std::exception_ptr error = nullptr;
+    };
+    std::vector<CPURun> cpu_runs_;
+    static void run_cpu_task(void *context);
+
+    void dispatch(int task_id);
+    bool chainable(int task_id) const;
+    void chain_dependents();
+    void release_consumed_data(const ITask &task);
+    // Data registered with separately sized columns (e.g. PointCloud), it has no per-element byte size
+    bool is_columnar(int data_id) const;
+
+    // Valid copy of each data id, downloads are only issued when the host side actually needs the data
+    ResidencyManager residency_;
+
+    std::shared_ptr<GPUEvent> download_async(int data_id, int column);
+    void download_device_only(int data_id);
+
+    // GPU work of the current ready set, uploaded in one batch and then submitted by flush_gpu_dispatches
+    //  - pass_dependencies are the GPU tasks of the same pass the kernel has to run after (chained tasks)
+    struct PendingDispatch {
+        KernelDispatch kernel;
+        std::function<void()> cpu_callback;
+        int task_id;
+        size_t queue;
+        std::vector<int> pass_dependencies;
+    };
+    std::vector<BufferCopy> pending_uploads_;
+    std::vector<PendingDispatch> pending_dispatches_;
+
+    void flush_gpu_dispatches();
+
+    // GPU queue of each task dispatched in the current pass
+    //  - Independent tasks are spread over the queues in turn, chained tasks follow their first dependency so a plain
+    //    chain stays in order on one queue, dependencies on other queues are waited on through events
+    //  - Indexed by task id, only the entries of the current pass are meaningful
+    std::vector<size_t> pass_queues_;
+    size_t next_queue_ = 0;
+    size_t assign_queue(int task_id);
+
+    // Set while a dependent GPU task is offered a place in the current batch, it is never deferred
+    bool chaining_ = false;
+    bool chain_rejected_ = false;
+    std::vector<int> chain_dependencies_;
+
+    // GPU tasks waiting for device memory, retried whenever a completion gives buffers back
+    std::deque<int> deferred_gpu_tasks_;
+    // When each deferred task was first deferred, indexed by task id
+    static constexpr std::chrono::steady_clock::time_point NOT_DEFERRED{};
+    std::vector<std::chrono::steady_clock::time_point> deferred_since_;
+    bool gpu_memory_freed_ = false;
+
+    // Counter of each counted data id, it lives as long as the data's device buffer so downstream kernels can size
+    // their dispatch from it
+    //  - Counters are all the same tiny Unified buffer, so they are pooled for the graph instead of freed
+    std::unordered_map<int, GPUBufferHandle> data_counts_;
+    std::vector<GPUBufferHandle> count_buffer_pool_;
+
+    // Both halves of a running split task, the task completes once remaining reaches zero
+    //  - One per split task, made when the graph is prepared and reused by every run, so the CPU half is queued with a
+    //    pointer to it like a CPU task
+    struct SplitRun {
+        Scheduler *scheduler = nullptr;
+        const SplitTask *task = nullptr;
+        bool active = false;
+        size_t gpu_count = 0;
+        // Device buffers only this run uses (uploaded inputs and the GPU part of the output)
+        std::vector<GPUBufferHandle> owned_buffers;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::nanoseconds gpu_time{0};
+        std::chrono::nanoseconds cpu_time{0};
+        std::atomic<int> remaining = 0;
+        std::exception_ptr error = nullptr;
+    };
+    std::vector<std::unique_ptr<SplitRun>> split_runs_;
+    static void run_split_cpu_part(void *context);
+
+    bool dispatch_split_gpu(const SplitTask &split_task, SplitRun &split_run);
+    void finish_split(const SplitTask &split_task);
+
+    // First error a task threw in the current run
+    std::exception_ptr task_error_ = nullptr;
+    std::exception_ptr take_task_error(int task_id);
+
+    SchedulerStats stats_;
+    LaunchTuner *launch_tuner_ = nullptr;
+    RuntimeMetrics *metrics_ = nullptr;
+    TaskPerfCounters *perf_counters_ = nullptr;
+
+    // Grid covering the shape with the task's block, or the tuned block for this kernel and size
+    LaunchConfig plan_launch(const KernelDispatch &kernel, const std::vector<int> &shape,
+                             const std::vector<int> &default_block);
+
     DataManager &data_manager;
     std::unique_ptr<ThreadPool> &thread_pool;
     std::unique_ptr<IGPUExecutor> &gpu_executor;
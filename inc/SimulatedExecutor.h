@@ -0,0 +1,119 @@
+#ifndef SIMULATED_EXECUTOR_H
+#define SIMULATED_EXECUTOR_H
+
+#include "DataManager.h"
+#include "HostExecutor.h"
+#include "IGPUExecutor.h"
+#include "Trace.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Performance model of the simulated device, the memory classes come from the executor bounds like any other backend
+struct SimulatedDeviceModel {
+    // Bytes per second in each direction, every transfer also pays the fixed latency
+    double host_to_device_bandwidth = 16e9;
+    double device_to_host_bandwidth = 16e9;
+    std::chrono::nanoseconds transfer_latency{10'000};
+
+    // Fixed cost of a launch, concurrent batches pay it once and serial batches once per kernel
+    std::chrono::nanoseconds launch_latency{5'000};
+
+    // Grid threads per second, per kernel name with a fallback for kernels without their own entry
+    double default_throughput = 1e9;
+    std::unordered_map<std::string, double> kernel_throughput;
+
+    // 0 only advances the virtual clock, callbacks fire as soon as the host has done the work
+    // Otherwise every command completes no earlier than its modelled time multiplied by this factor in real time
+    double real_time_scale = 0.0;
+};
+
+// Modelled device timeline, time zero is the creation (or last reset) of the executor
+struct SimulatedDeviceStats {
+    // Completion of the last command on either engine
+    std::chrono::nanoseconds device_time{0};
+    std::chrono::nanoseconds compute_busy{0};
+    std::chrono::nanoseconds copy_busy{0};
+
+    size_t kernels = 0;
+    size_t transfers = 0;
+    size_t bytes_to_device = 0;
+    size_t bytes_to_host = 0;
+};
+
+/*
+ * SimulatedExecutor
+ * Host emulated device that additionally models how long every command would take on a target GPU, so scheduling
+ * policies (placement, batching, transfer overlap) can be measured deterministically on machines without that GPU
+ *  - Kernels and copies still run on the host (see HostExecutor), so graphs produce their real results
+ *  - The device has a copy engine and a compute engine per queue with their own clocks, so transfers overlap kernels
+ *    unless a kernel waits on them, downloads are ordered after the kernels already submitted to every queue
+ *  - Kernels of different queues overlap fully, as kernels too small to fill the device would, a kernel waiting on
+ *    another queue's kernel starts once that one has completed
+ *  - Events of this executor carry their modelled completion time (ns) as their device value
+ *  - Command timing is computed on the command thread in submission order, so the virtual clock only depends on the
+ *    submitted work and never on host timing
+ *  - With tracing on, every modelled command is also a span on its engine's track, placed at the executor's epoch plus
+ *    its modelled start
+ */
+class SimulatedExecutor : public HostExecutor {
+  public:
+    SimulatedExecutor(const SimulatedDeviceModel &model, std::pair<int, int> devloc_bounds,
+                      std::pair<int, int> hostvis_bounds, std::pair<int, int> unified_bounds,
+                      size_t num_threads = std::thread::hardware_concurrency(), size_t num_queues = 1);
+
+    GPUState copy_to_device(std::span<const std::byte> data_mem, const GPUBufferHandle &buffer_handle) override;
+    GPUState copy_from_device(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle) override;
+    GPUState copy_to_device_batch(const std::vector<BufferCopy> &copies) override;
+    std::shared_ptr<GPUEvent> copy_to_device_async(const std::vector<BufferCopy> &copies) override;
+    std::shared_ptr<GPUEvent> copy_from_device_async(std::span<std::byte> data_mem,
+                                                     const GPUBufferHandle &buffer_handle) override;
+
+    using HostExecutor::execute_batch;
+    GPUState execute_batch(const std::vector<KernelDispatch> &kernels, const DispatchType &dispatch_type,
+                           std::vector<std::function<void()>> &cpu_callbacks, size_t queue = 0) override;
+
+    SimulatedDeviceStats get_simulated_stats() const;
+    // Restarts the clocks and stats at time zero (e.g. per frame), the executor should be idle
+    void reset_clock();
+
+  private:
+    SimulatedDeviceModel model_;
+
+    mutable std::mutex clock_mut_;
+    std::chrono::nanoseconds copy_clock_{0};
+    // One compute engine per queue
+    std::vector<std::chrono::nanoseconds> compute_clocks_;
+    SimulatedDeviceStats stats_;
+    std::chrono::steady_clock::time_point epoch_;
+
+    uint32_t copy_track_;
+    std::vector<uint32_t> compute_tracks_;
+
+    // Places a command on its engine once it may start, returning its modelled completion time
+    //  - Downloads start after kernels_done, the completion of every kernel they are ordered after (all submitted so
+    //    far when not given)
+    std::chrono::nanoseconds schedule_copy(size_t num_bytes, bool to_device,
+                                           std::optional<std::chrono::nanoseconds> kernels_done = std::nullopt);
+    std::chrono::nanoseconds schedule_kernel(const KernelDispatch &kernel, bool launch, size_t queue);
+
+    void trace_command(std::string_view name, const char *category, uint32_t track, std::chrono::nanoseconds start,
+                       std::chrono::nanoseconds end, const TraceArgs &args) const;
+
+    // Earliest start of a new command, the current real time is part of it once the clock is scaled
+    std::chrono::nanoseconds ready_time() const;
+    // Holds the calling thread until the modelled time has passed in scaled real time
+    void pace(std::chrono::nanoseconds completion) const;
+};
+
+#endif
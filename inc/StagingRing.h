@@ -0,0 +1,55 @@
+#ifndef STAGING_RING_H
+#define STAGING_RING_H
+
+#include "DataManager.h"
+#include "IGPUExecutor.h"
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * StagingRing
+ * Fixed set of host visible (Unified) staging slots for transfers to and from device local memory
+ *  - Slots are allocated once up front and handed out round robin, a slot is reused as soon as the fence of the
+ *    transfer that last used it has been signalled, so several transfers can be in flight at once
+ *  - Only when every slot is still in flight does acquire block, on the oldest one
+ *  - A transfer larger than its slot grows that slot, sizing the slots from the device local profile avoids this
+ */
+class StagingRing {
+  public:
+    struct Slot {
+        size_t mem_offset;
+        size_t size;
+        // Signalled once the transfer currently using the slot no longer touches it
+        std::shared_ptr<GPUEvent> fence;
+    };
+
+    StagingRing() = default;
+    StagingRing(IGPUExecutor::GPUMemoryAllocator &mem_allocator, size_t num_slots, size_t slot_size);
+
+    // Claims a slot of at least num_bytes, returning its index, the slot must be handed back through release
+    size_t acquire(size_t num_bytes);
+    // The slot stays busy until the fence of the transfer using it is signalled
+    void release(size_t slot_index, std::shared_ptr<GPUEvent> fence);
+
+    const Slot &get_slot(size_t slot_index) const { return slots_[slot_index]; }
+    size_t slot_count() const { return slots_.size(); }
+
+    // Number of times a slot had to be grown, stays at 0 when the ring was sized correctly
+    size_t get_grow_count() const { return grow_count_; }
+
+  private:
+    IGPUExecutor::GPUMemoryAllocator *mem_allocator_ = nullptr;
+    std::vector<Slot> slots_;
+    std::vector<bool> claimed_;
+    size_t next_slot_ = 0;
+    size_t grow_count_ = 0;
+    std::mutex ring_mut_;
+    std::condition_variable release_cv_;
+
+    bool slot_free(size_t slot_index) const;
+};
+
+#endif
@@ -2,13 +2,18 @@
 #define TASK_H
 
 #include "DataManager.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <numeric>
 #include <string>
 #include <tuple>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -29,6 +34,15 @@ class ITask {
         : task_name(task_name), input_ids(input_ids), output_id(output_id) {};
     ITask() = default;
 
+    // How the task accesses each input - inputs are only read unless the task declares it modifies them in place
+    //  - Readers of the same data may run concurrently, in-place writers are ordered against them by the TaskGraph
+    std::unordered_map<int, DataUsage> input_usages;
+    void set_input_usage(int data_id, DataUsage usage) { input_usages[data_id] = usage; };
+    DataUsage get_input_usage(int data_id) const {
+        auto usage_iter = input_usages.find(data_id);
+        return usage_iter == input_usages.end() ? DataUsage::ReadOnly : usage_iter->second;
+    };
+
     virtual void accept(Scheduler &scheduler) = 0;
 };
 
@@ -85,10 +99,72 @@ class GPUTask : public ITask {
     std::vector<int> block_dim;
     bool count_buffer_active;
 
+    // Extent of the problem in up to 3 dimensions (e.g. {width, height} of an image), the grid covers it with whole
+    // blocks (see make_launch), a 1-D problem of threads when not set
+    std::vector<int> shape;
+    void set_shape(const std::vector<int> &problem_shape) {
+        shape = problem_shape;
+        threads = std::accumulate(shape.begin(), shape.end(), 1, std::multiplies<int>());
+    };
+    std::vector<int> problem_shape() const { return shape.empty() ? std::vector<int>{threads} : shape; };
+
+    // Columnar inputs (e.g. PointCloud) can be restricted to the columns a kernel reads
+    //  - Each selected column is uploaded and bound as its own buffer, in the order given
+    std::unordered_map<int, std::vector<int>> input_columns;
+    void select_columns(int data_id, const std::vector<int> &columns) { input_columns[data_id] = columns; };
+
+    // Sizes the grid from the device counter of an input produced by a counting task (indirect dispatch), so a
+    // compaction feeding this kernel needs no host sync
+    //  - The counter is bound after every other buffer of the kernel, which should bounds check against it
+    int count_input = VOID_RETURN;
+    void dispatch_from_count(int data_id) { count_input = data_id; };
+
   private:
     void accept(Scheduler &scheduler) override;
 };
 
+/*
+ * SplitTask
+ * Data parallel task whose element range is shared between the GPU executor and the CPU thread pool, so neither side
+ * idles while the other works through a large stage (e.g. per-point range filtering)
+ *  - Elements [0, gpu_count) run as the kernel task_name with one grid thread per element, the kernel bounds checks
+ *    against its output buffer, which holds exactly those elements
+ *  - Elements [gpu_count, num_elements) run through cpu_range on the thread pool and write the host output directly
+ *  - The GPU part is downloaded into the front of the output, so the output holds every element once both sides
+ *    have completed
+ *  - The GPU share is retuned after every run towards the split at which both sides would have finished together,
+ *    it never leaves [MIN_SHARE, 1 - MIN_SHARE] so both throughputs keep being observed
+ */
+class SplitTask : public ITask {
+  public:
+    static constexpr double MIN_SHARE = 0.05;
+    // Weight of the latest run when moving the share, smooths out noisy frames
+    static constexpr double TUNING_RATE = 0.5;
+
+    SplitTask(const std::string &task_name, const std::vector<int> &input_ids, int output_id, size_t num_elements,
+              std::function<void(size_t begin, size_t end)> cpu_range, const std::vector<int> &block_dim = {64, 1, 1})
+        : ITask(task_name, input_ids, output_id), num_elements(num_elements), block_dim(block_dim),
+          cpu_range(std::move(cpu_range)) {};
+
+    size_t num_elements;
+    std::vector<int> block_dim;
+    std::function<void(size_t begin, size_t end)> cpu_range;
+
+    double get_gpu_share() const { return gpu_share_; };
+    void set_gpu_share(double gpu_share) const { gpu_share_ = gpu_share; };
+
+    // Elements the GPU gets in the next run
+    size_t gpu_count() const;
+    // Feeds back how long each side took for its part of a run
+    void record_split(size_t gpu_count, std::chrono::nanoseconds gpu_time, std::chrono::nanoseconds cpu_time) const;
+
+  private:
+    // Tuned while the graph runs, which only holds const tasks
+    mutable std::atomic<double> gpu_share_ = 0.5;
+
+    void accept(Scheduler &scheduler) override;
+};
+
 /*
  * TaskGraph
  * Represent tasks (nodes) and their dependencies (edges)
@@ -102,6 +178,10 @@ class GPUTask : public ITask {
  *      - data_producer_map_: map<int (dataID), int (taskID)> - maps a data handle to the task that produces it
  *      - unfulfilled_data_: map<int (dataID), vector<int> (taskIDs)> - maps a data handle with no producer to a vector
  * tasks that require it
+ *      - graph_outputs_: set<int (dataID)> - data the user reads after execution, never released by the scheduler
+ *      - last_writer_/readers_since_write_: per data handle, the latest in-place writer and the readers added after it
+ *          - A reader depends on the last writer (RAW), a writer depends on every reader since the last write (WAR)
+ *          - Readers never depend on each other, so any number of them run concurrently on the same data
  * Methods:
  *      - add_task(std::shared_ptr<ITask> task): adds a task to the graph following this algorithm
  *          1. Add a shared pointer to the task to the all_tasks_ map
@@ -124,6 +204,13 @@ class TaskGraph {
     std::vector<int> find_ready() const;
     void validate_graph();
 
+    // Graph outputs are kept alive after execution, all other task produced data is released once fully consumed
+    void mark_output(int data_id) { graph_outputs_.insert(data_id); };
+    bool is_output(int data_id) const { return graph_outputs_.find(data_id) != graph_outputs_.end(); };
+
+    // Maps every releasable (task produced, non-output) data id to the number of task inputs that read it
+    std::unordered_map<int, int> get_release_counts() const;
+
     std::vector<int> get_task_ids() const;
     std::shared_ptr<ITask> get_task(int task_id) const { return all_tasks_.at(task_id); };
     std::vector<int> get_dependents(int task_id) const {
@@ -149,6 +236,12 @@ class TaskGraph {
     std::unordered_map<int, std::vector<int>> dependents_;
     std::unordered_map<int, int> data_producer_map_;
     std::unordered_map<int, std::vector<int>> unfulfilled_data_;
+    std::unordered_set<int> graph_outputs_;
+    std::unordered_map<int, int> last_writer_;
+    std::unordered_map<int, std::vector<int>> readers_since_write_;
+
+    void add_edge(int producer_id, int consumer_id);
+    void add_access_hazards(const ITask &task);
 };
 
 #endif
@@ -1,21 +1,35 @@
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
+#include "Metrics.h"
+#include "Trace.h"
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <future>
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <string>
 #include <thread>
+#include <vector>
 
 class ThreadPool {
   public:
-    ThreadPool(size_t num_threads);
+    // Workers are named "<thread_name> <index>" in traces
+    //  - With counters, the pool adds its queue depth, task count and busy time to them (see RuntimeMetrics)
+    ThreadPool(size_t num_threads, const std::string &thread_name = "worker", ThreadPoolCounters *counters = nullptr);
     ThreadPool() {};
     ~ThreadPool();
 
+    // Runs job(context) on a worker, the caller keeps the context alive until then
+    //  - Queues without allocating once the ring has grown to the deepest queue seen, so a graph's steady state can
+    //    dispatch its CPU tasks through it (see Scheduler::run_graph)
+    void add_job(void (*job)(void *), void *context);
+    // Grows the ring to hold at least num_jobs queued jobs, so queueing that many never allocates
+    void reserve_jobs(size_t num_jobs);
+
     template <typename Callable> std::future<void> add_task(Callable &task /*, Types &&...task_args */) {
         // Wrap the task call with its arguments inside a lambda such that the queue
         // can always store consistent type of std::function<void()>
@@ -34,33 +48,44 @@ class ThreadPool {
         // TODO: Refactor this for event driven tasks
         // Do we still need this packaged task? Currently just directly passing task
         //  - Really is a question of if the future is useful to us
-        std::shared_ptr<std::packaged_task<void()>> task_package = std::make_shared<std::packaged_task<void()>>(task);
+        auto task_package = std::make_unique<std::packaged_task<void()>>(task);
         std::future<void> task_future = task_package->get_future();
 
-        auto wrapper = [task_package]() { (*task_package)(); };
-
-        {
-            // Lock the mutex, emplace the task into the queue, then unlock the mutex
-            // This prevents threads from accessing the queue as tasks are being added
-            std::unique_lock<std::mutex> lock(queue_mtx_);
-            task_queue_.emplace(task);
-        }
-
-        // Notify just one thread (undeterministic) that the task queue is ready to
-        // be read from
-        cv_.notify_one();
+        // The job owns the packaged task and deletes it once it has run, until it is queued it is freed here if
+        // queueing throws
+        add_job(
+            [](void *context) {
+                std::unique_ptr<std::packaged_task<void()>> package(
+                    static_cast<std::packaged_task<void()> *>(context));
+                (*package)();
+            },
+            task_package.get());
+        task_package.release();
 
         return task_future;
     }
 
   private:
+    struct PoolJob {
+        void (*job)(void *);
+        void *context;
+        // With tracing on, the job's span carries how long it sat in the queue before a worker picked it up
+        uint64_t enqueue_ns;
+    };
+
     std::vector<std::thread> workers_;
-    std::queue<std::function<void()>> task_queue_;
+    // Ring of queued jobs, num_queued_ of them starting at queue_head_, doubled when full
+    std::vector<PoolJob> job_ring_;
+    size_t queue_head_ = 0;
+    size_t num_queued_ = 0;
     std::mutex queue_mtx_;
     std::condition_variable cv_;
     bool stop_ = false;
+    ThreadPoolCounters *counters_ = nullptr;
 
     void worker_loop();
+    // Called with the queue locked
+    void grow_ring(size_t capacity);
 };
 
 #endif
@@ -0,0 +1,123 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// One timeline entry, fixed size so recording never allocates
+//  - Category and argument names must be string literals, the name is copied (and cut to MAX_NAME characters)
+struct TraceEvent {
+    static constexpr size_t MAX_NAME = 47;
+    static constexpr size_t MAX_ARGS = 2;
+
+    std::array<char, MAX_NAME + 1> name;
+    const char *category;
+    // 'X' span, 'i' instant
+    char phase;
+    // 0 is the recording thread, anything else a track from Tracer::register_track
+    uint32_t track;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+
+    std::array<const char *, MAX_ARGS> arg_names;
+    std::array<int64_t, MAX_ARGS> arg_values;
+};
+
+// Optional arguments of an event, shown in the trace viewer when the event is selected
+struct TraceArgs {
+    std::array<const char *, TraceEvent::MAX_ARGS> names{};
+    std::array<int64_t, TraceEvent::MAX_ARGS> values{};
+
+    TraceArgs() = default;
+    TraceArgs(const char *name, int64_t value) : names{name, nullptr}, values{value, 0} {};
+    TraceArgs(const char *first_name, int64_t first_value, const char *second_name, int64_t second_value)
+        : names{first_name, second_name}, values{first_value, second_value} {};
+};
+
+/*
+ * Tracer
+ * Process wide timeline of graph execution (tasks, pool queue waits, GPU transfers and kernels), exported in the
+ * Chrome trace event format (chrome://tracing, ui.perfetto.dev)
+ *  - Off by default, set_enabled switches it at any time, a disabled record is a single relaxed atomic load
+ *  - Every thread records into its own ring buffer (created on its first event), so recording takes no lock and
+ *    never allocates after that, a full ring overwrites its oldest events
+ *  - Timestamps are steady clock nanoseconds, so spans recorded on different threads (or tracks) line up
+ *  - When on, a CPU task costs about 4 events and 8 clock reads, so the overhead is bound by the clock and only small
+ *    next to tasks of tens of microseconds or more (see the tracing section of bench/scheduler_bench.cpp)
+ *  - Export and clear are meant for an idle process (e.g. between frames), events recorded while exporting may be
+ *    torn
+ */
+class Tracer {
+  public:
+    static constexpr size_t DEFAULT_BUFFER_EVENTS = 1 << 14;
+
+    static void set_enabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    // Applies to threads that have not recorded yet
+    static void set_buffer_events(size_t num_events);
+
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // Name shown for the calling thread
+    static void set_thread_name(const std::string &thread_name);
+    // Named timeline not tied to a thread (e.g. a device queue), events pass its id as their track
+    //  - The same name always gives back the same track
+    static uint32_t register_track(const std::string &track_name);
+
+    static void record_span(std::string_view name, const char *category, uint64_t start_ns, uint64_t end_ns,
+                            const TraceArgs &args = {}, uint32_t track = 0);
+    static void record_instant(std::string_view name, const char *category, const TraceArgs &args = {},
+                               uint32_t track = 0);
+
+    // Events currently held by every buffer
+    static size_t event_count();
+    static void clear();
+
+    static void write_chrome_trace(std::ostream &out);
+    static void save_chrome_trace(const std::string &path);
+
+  private:
+    struct ThreadBuffer;
+
+    static inline std::atomic<bool> enabled_ = false;
+
+    static ThreadBuffer &thread_buffer();
+    static void record(const TraceEvent &event);
+};
+
+// Span from construction to destruction, when tracing was enabled at construction
+class TraceScope {
+  public:
+    TraceScope(std::string_view name, const char *category, const TraceArgs &args = {})
+        : active_(Tracer::enabled()), name_(name), category_(category), args_(args),
+          start_ns_(active_ ? Tracer::now_ns() : 0) {};
+    ~TraceScope() {
+        if (active_) {
+            Tracer::record_span(name_, category_, start_ns_, Tracer::now_ns(), args_);
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+  private:
+    bool active_;
+    std::string_view name_;
+    const char *category_;
+    TraceArgs args_;
+    uint64_t start_ns_;
+};
+
+#endif
@@ -2,13 +2,23 @@
 #define TYPE_TRAITS_H
 
 #include <concepts>
+#include <cstddef>
+#include <span>
 
 template <typename T>
 concept ContiguousContainer = requires(T t) {
     { t.data() } -> std::convertible_to<const void *>;
     { t.size() } -> std::convertible_to<size_t>;
 
-    T::value_type;
+    typename T::value_type;
+};
+
+// Columnar containers (e.g. PointCloud) own one block of memory but expose it as independent columns
+template <typename T>
+concept ColumnarContainer = requires(T t, size_t column) {
+    { t.bytes() } -> std::convertible_to<std::span<std::byte>>;
+    { t.column_count() } -> std::convertible_to<size_t>;
+    { t.column_bytes(column) } -> std::convertible_to<std::span<std::byte>>;
 };
 
 #endif
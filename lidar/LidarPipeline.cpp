@@ -0,0 +1,254 @@
+#include "LidarPipeline.h"
+#include "PointCloud.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+// Cell coordinates are offset so they stay positive, 21 bits each covers +-200 km at 0.2 m cells
+const int64_t CELL_OFFSET = 1 << 20;
+const uint64_t CELL_MASK = (1 << 21) - 1;
+
+int64_t cell_coord(float value, float cell_size) { return static_cast<int64_t>(std::floor(value / cell_size)); }
+
+uint64_t cell_key(int64_t x, int64_t y, int64_t z) {
+    return (static_cast<uint64_t>(x + CELL_OFFSET) & CELL_MASK) << 42 |
+           (static_cast<uint64_t>(y + CELL_OFFSET) & CELL_MASK) << 21 |
+           (static_cast<uint64_t>(z + CELL_OFFSET) & CELL_MASK);
+}
+
+// Copies the points at the given indices, in that order
+PointCloud gather(const PointCloud &cloud, const std::vector<uint32_t> &indices) {
+    PointCloud result(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        result.x()[i] = cloud.x()[indices[i]];
+        result.y()[i] = cloud.y()[indices[i]];
+        result.z()[i] = cloud.z()[indices[i]];
+        result.intensity()[i] = cloud.intensity()[indices[i]];
+        result.ring()[i] = cloud.ring()[indices[i]];
+    }
+
+    return result;
+}
+
+uint32_t find_root(std::vector<uint32_t> &parents, uint32_t point) {
+    while (parents[point] != point) {
+        parents[point] = parents[parents[point]];
+        point = parents[point];
+    }
+
+    return point;
+}
+} // namespace
+
+PointCloud crop_cloud(const PointCloud &cloud, const PipelineParams &params) {
+    std::span<const float> x = cloud.x(), y = cloud.y(), z = cloud.z();
+    float min_range_sq = params.min_range * params.min_range;
+
+    std::vector<uint32_t> kept;
+    kept.reserve(cloud.size());
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        bool in_box = std::abs(x[i]) <= params.max_x && std::abs(y[i]) <= params.max_y && z[i] >= params.min_z &&
+                      z[i] <= params.max_z;
+        if (in_box && x[i] * x[i] + y[i] * y[i] >= min_range_sq) {
+            kept.push_back(i);
+        }
+    }
+
+    return gather(cloud, kept);
+}
+
+// Points are sorted by voxel, every run of equal keys becomes its centroid
+PointCloud voxel_downsample(const PointCloud &cloud, const PipelineParams &params) {
+    std::span<const float> x = cloud.x(), y = cloud.y(), z = cloud.z(), intensity = cloud.intensity();
+
+    std::vector<std::pair<uint64_t, uint32_t>> keyed_points(cloud.size());
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        keyed_points[i] = {cell_key(cell_coord(x[i], params.voxel_size), cell_coord(y[i], params.voxel_size),
+                                    cell_coord(z[i], params.voxel_size)),
+                           i};
+    }
+    std::sort(keyed_points.begin(), keyed_points.end());
+
+    PointCloud result(cloud.size());
+    size_t num_voxels = 0;
+    for (size_t begin = 0; begin < keyed_points.size();) {
+        size_t end = begin;
+        float sum_x = 0.0f, sum_y = 0.0f, sum_z = 0.0f, sum_intensity = 0.0f;
+        while (end < keyed_points.size() && keyed_points[end].first == keyed_points[begin].first) {
+            uint32_t point = keyed_points[end].second;
+            sum_x += x[point];
+            sum_y += y[point];
+            sum_z += z[point];
+            sum_intensity += intensity[point];
+            end++;
+        }
+
+        float count = static_cast<float>(end - begin);
+        result.x()[num_voxels] = sum_x / count;
+        result.y()[num_voxels] = sum_y / count;
+        result.z()[num_voxels] = sum_z / count;
+        result.intensity()[num_voxels] = sum_intensity / count;
+        result.ring()[num_voxels] = cloud.ring()[keyed_points[begin].second];
+        num_voxels++;
+        begin = end;
+    }
+    result.resize(num_voxels);
+
+    return result;
+}
+
+// Lowest point per ground column, then everything close above it is dropped
+PointCloud remove_ground(const PointCloud &cloud, const PipelineParams &params) {
+    std::span<const float> x = cloud.x(), y = cloud.y(), z = cloud.z();
+
+    std::vector<uint64_t> columns(cloud.size());
+    std::unordered_map<uint64_t, float> column_min_z;
+    column_min_z.reserve(cloud.size() / 4);
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        columns[i] = cell_key(cell_coord(x[i], params.ground_cell), cell_coord(y[i], params.ground_cell), 0);
+        auto [min_iter, inserted] = column_min_z.try_emplace(columns[i], z[i]);
+        if (!inserted) {
+            min_iter->second = std::min(min_iter->second, z[i]);
+        }
+    }
+
+    std::vector<uint32_t> kept;
+    kept.reserve(cloud.size());
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        if (z[i] > column_min_z[columns[i]] + params.ground_height) {
+            kept.push_back(i);
+        }
+    }
+
+    return gather(cloud, kept);
+}
+
+// Euclidean clustering on a grid of cells whose diagonal is the tolerance, so every cell is connected on its own and
+// only cells (not points) are merged with union-find
+//  - Cells up to two steps apart can hold points within the tolerance, a pair of them merges at the first such pair of
+//    points
+//  - Cells are sorted by key, so the cells of one (x, y) column are adjacent and a neighbouring column is one lookup
+std::vector<int> cluster_cloud(const PointCloud &cloud, const PipelineParams &params) {
+    std::span<const float> x = cloud.x(), y = cloud.y(), z = cloud.z();
+    float tolerance_sq = params.cluster_tolerance * params.cluster_tolerance;
+    float cell_size = params.cluster_tolerance / std::sqrt(3.0f);
+
+    std::vector<std::pair<uint64_t, uint32_t>> keyed_points(cloud.size());
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        keyed_points[i] = {cell_key(cell_coord(x[i], cell_size), cell_coord(y[i], cell_size),
+                                    cell_coord(z[i], cell_size)),
+                           i};
+    }
+    std::sort(keyed_points.begin(), keyed_points.end());
+
+    // Occupied cells in key order with their range of keyed_points, and the range of cells of every column
+    struct Cell {
+        uint64_t key;
+        uint32_t begin;
+        uint32_t end;
+    };
+    std::vector<Cell> cells;
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> columns;
+    for (uint32_t begin = 0; begin < keyed_points.size();) {
+        uint32_t end = begin;
+        while (end < keyed_points.size() && keyed_points[end].first == keyed_points[begin].first) {
+            end++;
+        }
+
+        uint64_t column = keyed_points[begin].first >> 21;
+        auto [column_iter, inserted] = columns.try_emplace(column, cells.size(), cells.size());
+        column_iter->second.second++;
+        cells.push_back({keyed_points[begin].first, begin, end});
+        begin = end;
+    }
+
+    auto cells_touch = [&](const Cell &cell, const Cell &other_cell) {
+        for (uint32_t k = cell.begin; k < cell.end; ++k) {
+            uint32_t point = keyed_points[k].second;
+            for (uint32_t j = other_cell.begin; j < other_cell.end; ++j) {
+                uint32_t other = keyed_points[j].second;
+                float diff_x = x[point] - x[other], diff_y = y[point] - y[other], diff_z = z[point] - z[other];
+                if (diff_x * diff_x + diff_y * diff_y + diff_z * diff_z <= tolerance_sq) {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    };
+
+    std::vector<uint32_t> parents(cells.size());
+    std::iota(parents.begin(), parents.end(), 0);
+    auto merge = [&](uint32_t cell, uint32_t other_cell) {
+        uint32_t root = find_root(parents, cell), other_root = find_root(parents, other_cell);
+        if (root != other_root && cells_touch(cells[cell], cells[other_cell])) {
+            parents[std::max(root, other_root)] = std::min(root, other_root);
+        }
+    };
+
+    // Every pair of cells is merged from its later cell, which looks at the neighbours before it in key order: lower
+    // columns and the cells just below it in its own column
+    for (uint32_t cell = 0; cell < cells.size(); ++cell) {
+        uint32_t point = keyed_points[cells[cell].begin].second;
+        int64_t cell_x = cell_coord(x[point], cell_size);
+        int64_t cell_y = cell_coord(y[point], cell_size);
+        uint64_t cell_z = cells[cell].key & CELL_MASK;
+
+        for (int64_t dx = -2; dx <= 0; ++dx) {
+            for (int64_t dy = -2; dy <= (dx < 0 ? 2 : -1); ++dy) {
+                auto column_iter = columns.find(cell_key(cell_x + dx, cell_y + dy, 0) >> 21);
+                if (column_iter == columns.end()) {
+                    continue;
+                }
+
+                for (uint32_t other = column_iter->second.first; other < column_iter->second.second; ++other) {
+                    uint64_t other_z = cells[other].key & CELL_MASK;
+                    if (other_z + 2 >= cell_z && other_z <= cell_z + 2) {
+                        merge(cell, other);
+                    }
+                }
+            }
+        }
+
+        for (uint32_t other = cell; other > 0 && cells[other - 1].key >> 21 == cells[cell].key >> 21 &&
+                                    (cells[other - 1].key & CELL_MASK) + 2 >= cell_z;
+             --other) {
+            merge(cell, other - 1);
+        }
+    }
+
+    std::vector<uint32_t> cluster_sizes(cells.size(), 0);
+    std::vector<uint32_t> point_roots(cloud.size());
+    for (uint32_t cell = 0; cell < cells.size(); ++cell) {
+        uint32_t root = find_root(parents, cell);
+        cluster_sizes[root] += cells[cell].end - cells[cell].begin;
+        for (uint32_t k = cells[cell].begin; k < cells[cell].end; ++k) {
+            point_roots[keyed_points[k].second] = root;
+        }
+    }
+
+    // Clusters are numbered in the order of their first point
+    std::vector<int> labels(cloud.size(), NOISE_LABEL);
+    std::vector<int> root_labels(cells.size(), NOISE_LABEL);
+    int num_clusters = 0;
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        uint32_t root = point_roots[i];
+        if (cluster_sizes[root] < params.min_cluster_points) {
+            continue;
+        }
+
+        if (root_labels[root] == NOISE_LABEL) {
+            root_labels[root] = num_clusters++;
+        }
+        labels[i] = root_labels[root];
+    }
+
+    return labels;
+}
@@ -0,0 +1,43 @@
+#ifndef LIDAR_PIPELINE_H
+#define LIDAR_PIPELINE_H
+
+#include "PointCloud.h"
+#include <cstddef>
+#include <vector>
+
+// Tunables of the frame pipeline, defaults fit a KITTI HDL-64E scan (sensor ~1.73 m above the road)
+struct PipelineParams {
+    // Region of interest around the sensor, points inside min_range (the vehicle itself) are dropped too
+    float max_x = 40.0f;
+    float max_y = 20.0f;
+    float min_z = -3.0f;
+    float max_z = 1.0f;
+    float min_range = 2.5f;
+
+    // Edge of the cubes every point of which is merged into their centroid
+    float voxel_size = 0.2f;
+
+    // Points within ground_height of the lowest point of their ground_cell x ground_cell column are ground
+    float ground_cell = 1.0f;
+    float ground_height = 0.25f;
+
+    // Points closer than cluster_tolerance share a cluster, clusters below min_cluster_points are noise
+    float cluster_tolerance = 0.5f;
+    size_t min_cluster_points = 5;
+};
+
+// Label of points that belong to no cluster
+const int NOISE_LABEL = -1;
+
+/*
+ * Stages of the LiDAR frame pipeline: crop -> voxel downsample -> ground removal -> clustering
+ *  - Each stage reads the cloud of the previous one and returns a new one, so they run as TypedCPUTasks
+ *  - Voxel and cluster results are ordered by voxel key / first point, so a frame always gives the same output
+ */
+PointCloud crop_cloud(const PointCloud &cloud, const PipelineParams &params);
+PointCloud voxel_downsample(const PointCloud &cloud, const PipelineParams &params);
+PointCloud remove_ground(const PointCloud &cloud, const PipelineParams &params);
+// Cluster id per point (0 .. clusters - 1), NOISE_LABEL for points of clusters that are too small
+std::vector<int> cluster_cloud(const PointCloud &cloud, const PipelineParams &params);
+
+#endif
@@ -1,145 +1,369 @@
 #include "DataManager.h"
+#include "LidarPipeline.h"
+#include "MappedFile.h"
+#include "PointCloud.h"
 #include "Runtime.h"
 #include "Tasks.h"
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <numbers>
+#include <numeric>
+#include <random>
+#include <span>
 #include <stdexcept>
-#include <tuple>
+#include <string>
+#include <thread>
 #include <vector>
 
-const size_t MACBOOK_PROCESS_THREADS = 10;
+// Replays LiDAR frames at the sensor rate through crop -> voxel downsample -> ground removal -> clustering and reports
+// the tail of the per frame latency
+//  - Frames are KITTI velodyne .bin scans (x, y, z, reflectance floats) from a directory, or generated scans when no
+//    directory is given, all loaded up front so disk reads don't land in the measurements
+//  - Frame i is released at start + i / rate, its latency runs from that release to its graph completing, so a frame
+//    held up by a late predecessor counts the wait as well (rate 0 runs the frames back to back)
+//  - A frame misses its deadline (the frame period unless given) when its latency exceeds it
+//  - The pipeline graph is prepared once and run per frame (see Runtime::run), each frame is swapped into its input
+//    cloud, so a frame costs no graph setup and no copy of its points
+//  - --check-allocations reports the heap allocations of the measured frames, the runtime's own should be 0
+
+#ifdef __APPLE__
+const GPUBackend DEFAULT_BACKEND = GPUBackend::Metal;
+#else
+const GPUBackend DEFAULT_BACKEND = GPUBackend::Host;
+#endif
+
+const size_t SYNTHETIC_FRAMES = 100;
+
+struct BenchOptions {
+    std::string frames_dir;
+    double rate_hz = 10.0;
+    // 0 takes the frame period
+    double deadline_ms = 0.0;
+    size_t num_threads = std::max<unsigned int>(std::thread::hardware_concurrency(), 1);
+    // Frames measured, the loaded frames are replayed in a loop until there are this many (0: each frame once)
+    size_t num_frames = 0;
+    // Leading frames run at the sensor rate but left out of the statistics (page faults, first allocations)
+    size_t warmup_frames = 3;
+    std::string csv_path;
+    std::string summary_path;
+    bool check_allocations = false;
+};
+
+struct Frame {
+    std::string name;
+    PointCloud cloud;
+};
+
+struct FrameResult {
+    std::string name;
+    size_t input_points;
+    size_t cropped_points;
+    size_t voxel_points;
+    size_t object_points;
+    int clusters;
+    double latency_ms;
+    bool missed;
+};
+
+// Intermediates of one frame, kept across frames so their storage is reused
+struct FrameOutputs {
+    PointCloud cropped;
+    PointCloud voxels;
+    PointCloud objects;
+    std::vector<int> labels;
+};
+
+std::vector<Frame> load_kitti_frames(const std::string &frames_dir) {
+    std::vector<std::filesystem::path> paths;
+    for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(frames_dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".bin") {
+            paths.push_back(entry.path());
+        }
+    }
+    if (paths.empty()) {
+        throw std::runtime_error("No KITTI .bin frames were found in " + frames_dir);
+    }
+    std::sort(paths.begin(), paths.end());
 
-float dot_product(const std::vector<float> &vec1, const std::vector<float> &vec2) {
-    float result = 0;
-    for (int i = 0; i < vec1.size(); ++i) {
-        result += vec1[i] * vec2[i];
+    std::vector<Frame> frames;
+    for (const std::filesystem::path &path : paths) {
+        MappedBuffer<float> scan(path.string(), {.sequential = true});
+        frames.push_back({path.filename().string(), PointCloud::from_xyzi({scan.data(), scan.size()})});
     }
 
-    return result;
+    return frames;
 }
 
-std::vector<float> vec_sum(const std::vector<float> vec1, const std::vector<float> vec2) {
-    std::vector<float> result(vec1.size());
-    for (int i = 0; i < vec1.size(); ++i) {
-        result[i] = vec1[i] + vec2[i];
+// Road plane with a few box shaped objects and walls, roughly the density of a 64 beam scan
+Frame generate_frame(size_t index, std::mt19937 &rng) {
+    const float sensor_height = 1.73f;
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+
+    std::vector<float> interleaved;
+    auto add_point = [&](float x, float y, float z) {
+        interleaved.insert(interleaved.end(), {x + noise(rng), y + noise(rng), z + noise(rng), unit(rng)});
+    };
+
+    // Ground returns get sparser with range
+    for (int i = 0; i < 90000; ++i) {
+        float range = 3.0f + 77.0f * unit(rng) * unit(rng);
+        float azimuth = 2.0f * std::numbers::pi_v<float> * unit(rng);
+        add_point(range * std::cos(azimuth), range * std::sin(azimuth), -sensor_height);
     }
 
-    return result;
-}
+    // Cars and pedestrians, sampled on their surfaces
+    for (int object = 0; object < 25; ++object) {
+        float center_x = -35.0f + 70.0f * unit(rng), center_y = -18.0f + 36.0f * unit(rng);
+        float length = 0.5f + 4.0f * unit(rng), width = 0.5f + 1.5f * unit(rng), height = 1.0f + 1.0f * unit(rng);
+        for (int i = 0; i < 800; ++i) {
+            add_point(center_x + length * (unit(rng) - 0.5f), center_y + width * (unit(rng) - 0.5f),
+                      -sensor_height + height * unit(rng));
+        }
+    }
 
-// Functions for benchmarking
-std::vector<float> generate_random_vec(size_t size) {
-    std::vector<float> v(size);
+    // Building walls on both sides of the road
+    for (int i = 0; i < 10000; ++i) {
+        float side = unit(rng) < 0.5f ? -15.0f : 15.0f;
+        add_point(-60.0f + 120.0f * unit(rng), side, -sensor_height + 6.0f * unit(rng));
+    }
 
-    for (int i = 0; i < size; ++i) {
-        v[i] = (i * 0.1);
+    PointCloud cloud = PointCloud::from_xyzi(interleaved);
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        cloud.ring()[i] = i % 64;
     }
 
-    return v;
+    return {"synthetic_" + std::to_string(index), std::move(cloud)};
 }
 
-template <typename F, class... Types>
-void benchmark(DataManager &data_manager, int num_tasks, auto hash_lambda, F &&task, Types &&...args) {
-    std::vector<int> input_ids(sizeof...(args));
-    (input_ids.push_back(args.id), ...);
-
-    auto benchmarked_func = std::decay_t<F>(task);
-    auto args_tuple = std::make_tuple(std::forward<Types>(args)...);
-    auto inputs = std::apply(
-        [&](auto &&...handles) { return std::forward_as_tuple(data_manager.get_data(handles)...); }, args_tuple);
+// Pipeline over the input cloud, built and prepared once then run for every frame, the labels are the graph output
+TaskGraph build_pipeline(DataManager &data_manager, const PipelineParams &params, PointCloud &input_cloud,
+                         FrameOutputs &outputs) {
+    auto input_handle = data_manager.create_ref_handle(&input_cloud, DataUsage::ReadOnly);
+    auto cropped_handle = data_manager.create_ref_handle(&outputs.cropped);
+    auto voxels_handle = data_manager.create_ref_handle(&outputs.voxels);
+    auto objects_handle = data_manager.create_ref_handle(&outputs.objects);
+    auto labels_handle = data_manager.create_ref_handle(&outputs.labels);
+
+    TaskGraph task_graph;
+    auto crop_task = TypedCPUTask(
+        "crop", {input_handle.id}, cropped_handle.id, data_manager,
+        [&params](const PointCloud &cloud) { return crop_cloud(cloud, params); }, input_handle);
+    auto voxel_task = TypedCPUTask(
+        "voxel_downsample", {cropped_handle.id}, voxels_handle.id, data_manager,
+        [&params](const PointCloud &cloud) { return voxel_downsample(cloud, params); }, cropped_handle);
+    auto ground_task = TypedCPUTask(
+        "remove_ground", {voxels_handle.id}, objects_handle.id, data_manager,
+        [&params](const PointCloud &cloud) { return remove_ground(cloud, params); }, voxels_handle);
+    auto cluster_task = TypedCPUTask(
+        "cluster", {objects_handle.id}, labels_handle.id, data_manager,
+        [&params](const PointCloud &cloud) { return cluster_cloud(cloud, params); }, objects_handle);
+
+    task_graph.add_task(std::make_shared<decltype(crop_task)>(crop_task), true);
+    task_graph.add_task(std::make_shared<decltype(voxel_task)>(voxel_task), false);
+    task_graph.add_task(std::make_shared<decltype(ground_task)>(ground_task), false);
+    task_graph.add_task(std::make_shared<decltype(cluster_task)>(cluster_task), false);
+    task_graph.mark_output(labels_handle.id);
+
+    return task_graph;
+}
 
-    std::cout << "Benchmarking without Helios" << std::endl;
-    auto start = std::chrono::steady_clock::now();
+// Nearest rank percentile of sorted values
+double percentile(const std::vector<double> &sorted_values, double fraction) {
+    size_t rank = static_cast<size_t>(std::ceil(fraction * sorted_values.size()));
+    return sorted_values[std::clamp<size_t>(rank, 1, sorted_values.size()) - 1];
+}
 
-    using ResultType = decltype(std::apply(benchmarked_func, inputs));
-    ResultType result;
-    for (int i = 0; i < num_tasks; ++i) {
-        result = hash_lambda(std::apply(benchmarked_func, inputs));
+void write_frame_csv(const std::string &path, const std::vector<FrameResult> &results) {
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Failed to open " + path + " for writing");
     }
 
-    auto end = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    std::cout << "Execution time: " << duration << "\n\n";
-
-    for (int num_threads = 2; num_threads <= MACBOOK_PROCESS_THREADS; ++num_threads) {
-        Runtime helios_runtime(data_manager, num_threads);
-        GPUDevice device(GPUBackend::Metal, std::pair(2, 256), std::pair(2, 256), std::pair(2, 256));
-
-        TaskGraph task_graph;
-
-        std::vector<ResultType> results(num_tasks);
-        // auto gpu_test_task = GPUTask();
+    out << "frame,name,input_points,cropped_points,voxel_points,object_points,clusters,latency_ms,deadline_missed\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const FrameResult &result = results[i];
+        out << i << "," << result.name << "," << result.input_points << "," << result.cropped_points << ","
+            << result.voxel_points << "," << result.object_points << "," << result.clusters << "," << std::fixed
+            << std::setprecision(4) << result.latency_ms << "," << result.missed << "\n";
+    }
+}
 
-        std::cout << "(Helios) Benchmarking with " << num_threads << " threads" << std::endl;
-        for (int n_task = 0; n_task < num_tasks; ++n_task) {
-            auto result_handle =
-                data_manager.create_ref_handle(&(results[n_task]), DataUsage::ReadWrite, MemoryHint::Unified);
-            std::string name = "benchmark" + std::to_string(n_task);
-            auto benchmark_task = TypedCPUTask(name, input_ids, result_handle.id, data_manager, task, args...);
+void print_usage() {
+    std::cout << "Usage: user_test [kitti_velodyne_dir] [--rate HZ] [--deadline-ms MS] [--threads N] [--frames N]\n"
+                 "                 [--warmup N] [--csv PATH] [--summary-csv PATH] [--check-allocations]\n"
+                 "  Without a directory, generated frames are replayed\n"
+                 "  --csv writes one row per measured frame, --summary-csv appends one row per run\n";
+}
 
-            task_graph.add_task(std::make_shared<decltype(benchmark_task)>(benchmark_task), true);
+int main(int argc, char **argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--help" || arg == "-h") {
+            print_usage();
+            return 0;
+        } else if (arg == "--rate" && has_value) {
+            options.rate_hz = std::stod(argv[++i]);
+        } else if (arg == "--deadline-ms" && has_value) {
+            options.deadline_ms = std::stod(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            options.num_threads = std::stoul(argv[++i]);
+        } else if (arg == "--frames" && has_value) {
+            options.num_frames = std::stoul(argv[++i]);
+        } else if (arg == "--warmup" && has_value) {
+            options.warmup_frames = std::stoul(argv[++i]);
+        } else if (arg == "--csv" && has_value) {
+            options.csv_path = argv[++i];
+        } else if (arg == "--summary-csv" && has_value) {
+            options.summary_path = argv[++i];
+        } else if (arg == "--check-allocations") {
+            options.check_allocations = true;
+        } else if (!arg.starts_with("--") && options.frames_dir.empty()) {
+            options.frames_dir = arg;
+        } else {
+            print_usage();
+            return 1;
         }
+    }
 
-        auto start = std::chrono::steady_clock::now();
-
-        helios_runtime.commit_graph(task_graph, device);
-
-        auto end = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-
-        std::cout << "Execution time: " << duration << "\n\n";
-
-        for (ResultType helios_result : results) {
-            if (result != helios_result) {
-                throw std::runtime_error("Helios result differed from expected!");
-            }
+    std::vector<Frame> frames;
+    if (options.frames_dir.empty()) {
+        std::mt19937 rng(42);
+        for (size_t i = 0; i < SYNTHETIC_FRAMES; ++i) {
+            frames.push_back(generate_frame(i, rng));
         }
+    } else {
+        frames = load_kitti_frames(options.frames_dir);
     }
-}
-
-void dp_benchmark() {
-    int num_tasks = 1000;
-    size_t vector_size = 1000000;
 
-    std::cout << "\n\nBENCHMARK: Dot Product\n\n";
+    size_t num_frames = options.num_frames > 0 ? options.num_frames : frames.size();
+    std::chrono::duration<double> period(options.rate_hz > 0.0 ? 1.0 / options.rate_hz : 0.0);
+    double deadline_ms = options.deadline_ms > 0.0 ? options.deadline_ms : period.count() * 1e3;
 
-    std::cout << "Generating data...";
-    std::vector<float> vec1 = generate_random_vec(vector_size);
-    std::vector<float> vec2 = generate_random_vec(vector_size);
-    std::cout << "Data generated!\n\n";
+    std::cout << "Replaying " << num_frames << " frames (" << frames.size() << " loaded"
+              << (options.frames_dir.empty() ? ", generated" : " from " + options.frames_dir) << ") at "
+              << options.rate_hz << " Hz on " << options.num_threads << " threads, deadline " << deadline_ms
+              << " ms\n";
 
     DataManager data_manager;
-    auto vec1_handle = data_manager.create_data_handle(vec1, DataUsage::ReadOnly);
-    auto vec2_handle = data_manager.create_data_handle(vec2, DataUsage::ReadOnly);
-
-    auto hash_lambda = [](float result) { return result; };
-
-    benchmark(data_manager, num_tasks, hash_lambda, dot_product, vec1_handle, vec2_handle);
-}
+    Runtime runtime(data_manager, options.num_threads);
+    GPUDevice device(DEFAULT_BACKEND, std::pair(256, 1 << 24), std::pair(256, 1 << 24), std::pair(256, 1 << 24));
+    PipelineParams params;
+    PointCloud input_cloud;
+    FrameOutputs outputs;
+
+    TaskGraph pipeline = build_pipeline(data_manager, params, input_cloud, outputs);
+    runtime.prepare_graph(pipeline, device);
+    if (options.check_allocations) {
+        runtime.enable_allocation_check(options.warmup_frames);
+    }
 
-void vec_sum_benchmark() {
-    int num_tasks = 1000;
-    size_t vector_size = 1000000;
+    std::vector<FrameResult> results;
+    size_t total_frames = options.warmup_frames + num_frames;
+    auto start = std::chrono::steady_clock::now();
+    auto measure_start = start;
+    for (size_t i = 0; i < total_frames; ++i) {
+        Frame &frame = frames[i % frames.size()];
+
+        auto release = std::chrono::steady_clock::now();
+        if (period.count() > 0.0) {
+            release = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(period * i);
+            std::this_thread::sleep_until(release);
+        }
+        if (i == options.warmup_frames) {
+            measure_start = release;
+        }
 
-    std::cout << "\n\nBENCHMARK: Vector Sum\n\n";
+        std::swap(input_cloud, frame.cloud);
+        runtime.run();
+        std::swap(input_cloud, frame.cloud);
+        double latency_ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - release).count();
 
-    std::cout << "Generating data...";
-    std::vector<float> vec1 = generate_random_vec(vector_size);
-    std::vector<float> vec2 = generate_random_vec(vector_size);
-    std::cout << "Data generated!\n\n";
+        if (i < options.warmup_frames) {
+            continue;
+        }
+        int clusters = outputs.labels.empty() ? 0 : *std::max_element(outputs.labels.begin(), outputs.labels.end()) + 1;
+        bool missed = deadline_ms > 0.0 && latency_ms > deadline_ms;
+        results.push_back({frame.name, frame.cloud.size(), outputs.cropped.size(), outputs.voxels.size(),
+                           outputs.objects.size(), clusters, latency_ms, missed});
+    }
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - measure_start).count();
 
-    DataManager data_manager;
-    auto vec1_handle = data_manager.create_data_handle(vec1, DataUsage::ReadOnly);
-    auto vec2_handle = data_manager.create_data_handle(vec2, DataUsage::ReadOnly);
+    if (results.empty()) {
+        std::cout << "No frames were measured\n";
+        return 0;
+    }
 
-    auto hash_lambda = [](std::vector<float> vec_sum) { return vec_sum; };
+    std::vector<double> latencies;
+    size_t deadline_misses = 0;
+    size_t total_points = 0;
+    for (const FrameResult &result : results) {
+        latencies.push_back(result.latency_ms);
+        deadline_misses += result.missed;
+        total_points += result.input_points;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double mean_ms = std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size();
+    double throughput_fps = results.size() / elapsed_s;
+
+    std::cout << std::fixed << std::setprecision(3) << "\nFrame latency (ms)\n"
+              << "  p50  " << percentile(latencies, 0.50) << "\n"
+              << "  p95  " << percentile(latencies, 0.95) << "\n"
+              << "  p99  " << percentile(latencies, 0.99) << "\n"
+              << "  max  " << latencies.back() << "\n"
+              << "  mean " << mean_ms << "\n"
+              << "Deadline misses: " << deadline_misses << " / " << results.size() << "\n"
+              << "Throughput: " << std::setprecision(2) << throughput_fps << " frames/s, "
+              << total_points / elapsed_s / 1e6 << " Mpoints/s\n";
+
+    const FrameResult &last = results.back();
+    std::cout << "Last frame: " << last.input_points << " points -> " << last.cropped_points << " cropped -> "
+              << last.voxel_points << " voxels -> " << last.object_points << " above ground -> " << last.clusters
+              << " clusters\n";
+
+    if (options.check_allocations) {
+        AllocationReport report = runtime.get_allocation_report();
+        if (!report.available) {
+            std::cout << "Allocation check unavailable: built without Helios_AllocationHooks\n";
+        } else {
+            std::cout << "Heap allocations over " << report.checked_runs << " frames: scheduler "
+                      << report.scheduler.allocations << ", workers " << report.worker.allocations << ", stages "
+                      << report.task.allocations << " (" << std::setprecision(1)
+                      << report.task.bytes / 1024.0 / std::max<size_t>(report.checked_runs, 1) << " KiB/frame)\n";
+        }
+    }
 
-    benchmark(data_manager, num_tasks, hash_lambda, vec_sum, vec1_handle, vec2_handle);
-}
+    if (!options.csv_path.empty()) {
+        write_frame_csv(options.csv_path, results);
+    }
 
-int main() {
-    dp_benchmark();
-    vec_sum_benchmark();
+    // One row per run, so runs on different builds or machines can be compared over time
+    if (!options.summary_path.empty()) {
+        bool write_header = !std::filesystem::exists(options.summary_path);
+        std::ofstream summary(options.summary_path, std::ios::app);
+        if (!summary) {
+            throw std::runtime_error("Failed to open " + options.summary_path + " for writing");
+        }
+        if (write_header) {
+            summary << "timestamp,frames_dir,frames,rate_hz,deadline_ms,threads,p50_ms,p95_ms,p99_ms,max_ms,mean_ms,"
+                       "deadline_misses,throughput_fps\n";
+        }
+        summary << std::time(nullptr) << "," << (options.frames_dir.empty() ? "synthetic" : options.frames_dir)
+                << "," << results.size() << "," << options.rate_hz << "," << deadline_ms << "," << options.num_threads
+                << "," << std::setprecision(4) << percentile(latencies, 0.50) << "," << percentile(latencies, 0.95)
+                << "," << percentile(latencies, 0.99) << "," << latencies.back() << "," << mean_ms << ","
+                << deadline_misses << "," << throughput_fps << "\n";
+    }
 
     return 0;
 }
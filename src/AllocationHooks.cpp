@@ -0,0 +1,74 @@
+#include "AllocationTracker.h"
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Replacement global operators that report every allocation to the AllocationTracker
+//  - Linked in on purpose (Helios_AllocationHooks) by the binaries that verify allocations, everything else keeps the
+//    standard library's operators
+//  - Memory comes from malloc/aligned_alloc, so every delete (sized or not) is a free
+
+namespace {
+void *allocate(size_t num_bytes) {
+    AllocationTracker::record_allocation(num_bytes);
+    return std::malloc(num_bytes == 0 ? 1 : num_bytes);
+}
+
+void *allocate_aligned(size_t num_bytes, std::align_val_t alignment) {
+    AllocationTracker::record_allocation(num_bytes);
+    size_t align = static_cast<size_t>(alignment);
+    // aligned_alloc wants a multiple of the alignment
+    size_t padded = (num_bytes + align - 1) / align * align;
+    return std::aligned_alloc(align, padded == 0 ? align : padded);
+}
+
+struct HookRegistration {
+    HookRegistration() { AllocationTracker::mark_hooks_installed(); }
+};
+HookRegistration hook_registration;
+} // namespace
+
+void *operator new(size_t num_bytes) {
+    void *ptr = allocate(num_bytes);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t num_bytes) { return operator new(num_bytes); }
+
+void *operator new(size_t num_bytes, const std::nothrow_t &) noexcept { return allocate(num_bytes); }
+
+void *operator new[](size_t num_bytes, const std::nothrow_t &) noexcept { return allocate(num_bytes); }
+
+void *operator new(size_t num_bytes, std::align_val_t alignment) {
+    void *ptr = allocate_aligned(num_bytes, alignment);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t num_bytes, std::align_val_t alignment) { return operator new(num_bytes, alignment); }
+
+void *operator new(size_t num_bytes, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return allocate_aligned(num_bytes, alignment);
+}
+
+void *operator new[](size_t num_bytes, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return allocate_aligned(num_bytes, alignment);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { std::free(ptr); }
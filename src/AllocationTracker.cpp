@@ -0,0 +1,89 @@
+#include "AllocationTracker.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+// Plain thread locals (no constructors), so the hooks can touch them before anything else ran on the thread
+thread_local uint64_t thread_allocations = 0;
+thread_local uint64_t thread_bytes = 0;
+thread_local AllocationSite thread_site = AllocationSite::Untracked;
+
+std::atomic<bool> hooks_linked = false;
+std::atomic<bool> checking_enabled = false;
+std::atomic<bool> abort_on_violation = false;
+
+struct SiteViolations {
+    std::atomic<uint64_t> allocations = 0;
+    std::atomic<uint64_t> bytes = 0;
+};
+std::array<SiteViolations, static_cast<size_t>(AllocationSite::NUM_SITES)> site_violations;
+
+// Must not allocate, it runs inside operator new
+[[gnu::noinline]] void on_violation(AllocationSite site, size_t num_bytes) {
+    SiteViolations &violations = site_violations[static_cast<size_t>(site)];
+    violations.allocations.fetch_add(1, std::memory_order_relaxed);
+    violations.bytes.fetch_add(num_bytes, std::memory_order_relaxed);
+
+    if (abort_on_violation.load(std::memory_order_relaxed)) {
+        std::fprintf(stderr, "Heap allocation of %zu bytes on the %s path during a checked graph run\n", num_bytes,
+                     AllocationTracker::site_name(site));
+        std::abort();
+    }
+}
+} // namespace
+
+bool AllocationTracker::hooks_installed() { return hooks_linked.load(std::memory_order_relaxed); }
+
+AllocationCounts AllocationTracker::thread_counts() { return {thread_allocations, thread_bytes}; }
+
+void AllocationTracker::set_checking(bool enabled) { checking_enabled.store(enabled, std::memory_order_release); }
+
+bool AllocationTracker::checking() { return checking_enabled.load(std::memory_order_acquire); }
+
+void AllocationTracker::set_abort_on_violation(bool enabled) {
+    abort_on_violation.store(enabled, std::memory_order_relaxed);
+}
+
+AllocationCounts AllocationTracker::violations(AllocationSite site) {
+    const SiteViolations &violations = site_violations[static_cast<size_t>(site)];
+    return {violations.allocations.load(std::memory_order_relaxed), violations.bytes.load(std::memory_order_relaxed)};
+}
+
+void AllocationTracker::reset_violations() {
+    for (SiteViolations &violations : site_violations) {
+        violations.allocations.store(0, std::memory_order_relaxed);
+        violations.bytes.store(0, std::memory_order_relaxed);
+    }
+}
+
+AllocationSite AllocationTracker::current_site() { return thread_site; }
+
+const char *AllocationTracker::site_name(AllocationSite site) {
+    switch (site) {
+    case AllocationSite::Scheduler:
+        return "scheduler";
+    case AllocationSite::Worker:
+        return "worker";
+    case AllocationSite::Task:
+        return "task";
+    default:
+        return "untracked";
+    }
+}
+
+void AllocationTracker::record_allocation(size_t num_bytes) {
+    thread_allocations++;
+    thread_bytes += num_bytes;
+
+    if (thread_site != AllocationSite::Untracked && checking_enabled.load(std::memory_order_relaxed)) {
+        on_violation(thread_site, num_bytes);
+    }
+}
+
+void AllocationTracker::mark_hooks_installed() { hooks_linked.store(true, std::memory_order_relaxed); }
+
+void AllocationTracker::set_site(AllocationSite site) { thread_site = site; }
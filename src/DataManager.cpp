@@ -5,14 +5,106 @@
 #include <cstdint>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <span>
 #include <stdexcept>
 #include <unordered_map>
 
+std::span<const std::byte> DataManager::get_span(int data_id) const {
+    std::shared_lock<std::shared_mutex> lock(data_mut_);
+    return data_map.at(data_id).const_data_accessor();
+};
+
 std::span<std::byte> DataManager::get_span_mut(int data_id) {
+    std::shared_lock<std::shared_mutex> lock(data_mut_);
     if (data_map.at(data_id).data_usage != DataUsage::ReadWrite) {
         throw std::runtime_error("Attempted to fetch mutable span into read-only data");
     }
 
     return data_map.at(data_id).raw_data_accessor();
 };
+
+std::span<const std::byte> DataManager::get_column_span(int data_id, size_t column) const {
+    std::shared_lock<std::shared_mutex> lock(data_mut_);
+    const DataEntry &entry = data_map.at(data_id);
+    if (column >= entry.column_count) {
+        throw std::runtime_error("Attempted to fetch a column that the data does not have");
+    }
+
+    return entry.column_accessor(column);
+}
+
+std::span<std::byte> DataManager::get_column_span_mut(int data_id, size_t column) {
+    std::shared_lock<std::shared_mutex> lock(data_mut_);
+    const DataEntry &entry = data_map.at(data_id);
+    if (entry.data_usage != DataUsage::ReadWrite) {
+        throw std::runtime_error("Attempted to fetch mutable span into read-only data");
+    }
+    if (column >= entry.column_count) {
+        throw std::runtime_error("Attempted to fetch a column that the data does not have");
+    }
+
+    return entry.raw_column_accessor(column);
+}
+
+size_t DataManager::get_column_count(int data_id) const {
+    std::shared_lock<std::shared_mutex> lock(data_mut_);
+    return data_map.at(data_id).column_count;
+}
+
+int DataManager::get_data_length(int data_id) const {
+    std::shared_lock<std::shared_mutex> lock(data_mut_);
+    const DataEntry &entry = data_map.at(data_id);
+
+    // Placeholder (kernel output) entries only know the size they were created with
+    return entry.const_data_accessor ? entry.const_data_accessor().size() : entry.byte_size;
+};
+
+void DataManager::set_counted_length(int data_id, size_t counted_length) {
+    std::unique_lock<std::shared_mutex> lock(data_mut_);
+    data_map.at(data_id).counted_length = counted_length;
+}
+
+std::optional<size_t> DataManager::get_counted_length(int data_id) const {
+    std::shared_lock<std::shared_mutex> lock(data_mut_);
+    return data_map.at(data_id).counted_length;
+}
+
+MemoryHint DataManager::get_mem_hint(int data_id) const {
+    std::shared_lock<std::shared_mutex> lock(data_mut_);
+    return data_map.at(data_id).mem_hint;
+};
+
+DataUsage DataManager::get_data_usage(int data_id) const {
+    std::shared_lock<std::shared_mutex> lock(data_mut_);
+    return data_map.at(data_id).data_usage;
+};
+
+bool DataManager::contains(int data_id) const {
+    std::shared_lock<std::shared_mutex> lock(data_mut_);
+    return data_map.find(data_id) != data_map.end();
+}
+
+void DataManager::release_data(int data_id) {
+    std::unique_lock<std::shared_mutex> lock(data_mut_);
+    data_map.erase(data_id);
+}
+
+int DataManager::insert_entry(const DataEntry &entry) {
+    std::unique_lock<std::shared_mutex> lock(data_mut_);
+    int data_id = id_counter++;
+    data_map[data_id] = entry;
+
+    // Only the sizing profile is needed for device local data, don't keep the data itself alive through the copy
+    if (entry.mem_hint == MemoryHint::DeviceLocal) {
+        DataEntry profile_entry = entry;
+        profile_entry.data.reset();
+        profile_entry.const_data_accessor = nullptr;
+        profile_entry.raw_data_accessor = nullptr;
+        device_local_tasks_.push_back(profile_entry);
+    }
+
+    return data_id;
+}
@@ -0,0 +1,456 @@
+#include "HostExecutor.h"
+#include "DataManager.h"
+#include "IGPUExecutor.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+// Slabs are sized to the full buddy range so every offset the allocator hands out is addressable
+static std::unique_ptr<std::byte[]> make_slab(size_t max_order) {
+    if (max_order == 0) {
+        return nullptr;
+    }
+
+    return std::make_unique<std::byte[]>(1ULL << max_order);
+}
+
+HostExecutor::HostExecutor(std::pair<int, int> devloc_bounds, std::pair<int, int> hostvis_bounds,
+                           std::pair<int, int> unified_bounds, size_t num_threads, size_t num_queues)
+    : grid_pool_(std::max<size_t>(num_threads, 1), "gpu grid"), num_threads_(std::max<size_t>(num_threads, 1)) {
+    mem_allocator = GPUMemoryAllocator(devloc_bounds.first, devloc_bounds.second, unified_bounds.first,
+                                       unified_bounds.second, hostvis_bounds.first, hostvis_bounds.second);
+
+    devloc_slab_ = make_slab(mem_allocator.max_order(MemoryHint::DeviceLocal));
+    hostvis_slab_ = make_slab(mem_allocator.max_order(MemoryHint::HostVisible));
+    unified_slab_ = make_slab(mem_allocator.max_order(MemoryHint::Unified));
+
+    for (size_t queue = 0; queue < std::max<size_t>(num_queues, 1); ++queue) {
+        queues_.push_back(std::make_unique<CommandQueue>());
+        CommandQueue &command_queue = *queues_.back();
+        command_queue.command_thread = std::thread([this, &command_queue, queue] {
+            Tracer::set_thread_name("gpu queue " + std::to_string(queue));
+            command_loop(command_queue);
+        });
+    }
+}
+
+HostExecutor::~HostExecutor() {
+    for (std::unique_ptr<CommandQueue> &command_queue : queues_) {
+        {
+            std::unique_lock<std::mutex> lock(command_queue->command_mut);
+            command_queue->stop = true;
+        }
+
+        command_queue->command_cv.notify_all();
+    }
+
+    for (std::unique_ptr<CommandQueue> &command_queue : queues_) {
+        command_queue->command_thread.join();
+    }
+}
+
+std::unordered_map<std::string, HostKernel> &HostExecutor::kernel_library() {
+    static std::unordered_map<std::string, HostKernel> library;
+    return library;
+}
+
+std::mutex &HostExecutor::kernel_library_mut() {
+    static std::mutex library_mut;
+    return library_mut;
+}
+
+void HostExecutor::register_kernel(const std::string &kernel_name, HostKernel kernel) {
+    std::lock_guard<std::mutex> lock(kernel_library_mut());
+    kernel_library()[kernel_name] = std::move(kernel);
+}
+
+bool HostExecutor::prepare_kernel(const std::string &kernel_name) {
+    std::lock_guard<std::mutex> library_lock(kernel_library_mut());
+    auto kernel_iter = kernel_library().find(kernel_name);
+    if (kernel_iter == kernel_library().end()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> prepared_lock(prepared_mut_);
+    prepared_kernels_[kernel_name] = kernel_iter->second;
+    return true;
+}
+
+// Kernels that were not prepared ahead of time are looked up (and cached) on their first dispatch
+HostKernel HostExecutor::resolve_kernel(const std::string &kernel_name) {
+    {
+        std::lock_guard<std::mutex> prepared_lock(prepared_mut_);
+        auto prepared_iter = prepared_kernels_.find(kernel_name);
+        if (prepared_iter != prepared_kernels_.end()) {
+            return prepared_iter->second;
+        }
+    }
+
+    if (!prepare_kernel(kernel_name)) {
+        throw std::runtime_error("No kernel function with name: " + kernel_name + " was found");
+    }
+
+    std::lock_guard<std::mutex> prepared_lock(prepared_mut_);
+    return prepared_kernels_[kernel_name];
+}
+
+std::optional<GPUBufferHandle> HostExecutor::try_allocate_buffer(std::size_t buffer_size, const MemoryHint mem_hint) {
+    std::optional<size_t> free_offset = mem_allocator.try_allocate_memory(buffer_size, mem_hint);
+    if (!free_offset) {
+        return std::nullopt;
+    }
+
+    GPUBufferHandle buffer_handle(buffer_counter, mem_hint, *free_offset, buffer_size);
+    buffer_counter++;
+
+    return buffer_handle;
+}
+
+GPUState HostExecutor::deallocate_buffer(const GPUBufferHandle &buffer_handle) {
+    mem_allocator.check_free_mem(buffer_handle.size, buffer_handle.mem_offset, buffer_handle.mem_hint);
+
+    return GPUState::GPUSuccess;
+}
+
+std::byte *HostExecutor::select_slab(MemoryHint mem_hint) {
+    switch (mem_hint) {
+    case MemoryHint::DeviceLocal:
+        return devloc_slab_.get();
+    case MemoryHint::Unified:
+        return unified_slab_.get();
+    case MemoryHint::HostVisible:
+        return hostvis_slab_.get();
+    default:
+        throw std::runtime_error("Tried to fetch an invalid buffer!");
+    }
+}
+
+// Commands on the command threads can't report argument errors, so asynchronous transfers check their buffers up front
+void HostExecutor::check_buffer(const GPUBufferHandle &buffer_handle) {
+    if (select_slab(buffer_handle.mem_hint) == nullptr) {
+        throw std::runtime_error("Tried to copy with a buffer of a memory class the device does not have");
+    }
+
+    size_t slab_size = 1ULL << mem_allocator.max_order(buffer_handle.mem_hint);
+    if (buffer_handle.mem_offset > slab_size || buffer_handle.size > slab_size - buffer_handle.mem_offset) {
+        throw std::runtime_error("Tried to copy with a buffer outside of device memory");
+    }
+}
+
+std::span<std::byte> HostExecutor::buffer_span(const GPUBufferHandle &buffer_handle) {
+    return {select_slab(buffer_handle.mem_hint) + buffer_handle.mem_offset, buffer_handle.size};
+}
+
+// Every memory class is plain host memory, so transfers are direct copies regardless of the hint
+GPUState HostExecutor::copy_to_device(std::span<const std::byte> data_mem, const GPUBufferHandle &buffer_handle) {
+    std::span<std::byte> device_mem = buffer_span(buffer_handle);
+    if (device_mem.data() == nullptr) {
+        return GPUState::GhostBuffer;
+    }
+
+    std::memcpy(device_mem.data(), data_mem.data(), std::min(data_mem.size(), device_mem.size()));
+
+    return GPUState::GPUSuccess;
+}
+
+// Host memory has no staging step, so a batch is just the copies back to back
+GPUState HostExecutor::copy_to_device_batch(const std::vector<BufferCopy> &copies) {
+    for (const BufferCopy &copy : copies) {
+        std::span<std::byte> device_mem = buffer_span(copy.buffer_handle);
+        if (device_mem.data() == nullptr) {
+            return GPUState::GhostBuffer;
+        }
+
+        std::memcpy(device_mem.data(), copy.data_mem.data(), std::min(copy.data_mem.size(), device_mem.size()));
+    }
+
+    return GPUState::GPUSuccess;
+}
+
+GPUState HostExecutor::copy_from_device(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle) {
+    std::span<std::byte> device_mem = buffer_span(buffer_handle);
+    if (device_mem.data() == nullptr) {
+        return GPUState::GhostBuffer;
+    }
+
+    std::memcpy(data_mem.data(), device_mem.data(), std::min(data_mem.size(), device_mem.size()));
+
+    return GPUState::GPUSuccess;
+}
+
+std::shared_ptr<GPUEvent> HostExecutor::copy_to_device_async(const std::vector<BufferCopy> &copies) {
+    for (const BufferCopy &copy : copies) {
+        check_buffer(copy.buffer_handle);
+    }
+    std::shared_ptr<GPUEvent> copy_event = std::make_shared<GPUEvent>();
+
+    // The buffers were checked, so the copies can't fail
+    submit([this, copies, copy_event] {
+        uint64_t start_ns = Tracer::enabled() ? Tracer::now_ns() : 0;
+        copy_to_device_batch(copies);
+        if (start_ns != 0) {
+            size_t num_bytes = 0;
+            for (const BufferCopy &copy : copies) {
+                num_bytes += copy.data_mem.size();
+            }
+            Tracer::record_span("upload", "gpu transfer", start_ns, Tracer::now_ns(),
+                                {"bytes", static_cast<int64_t>(num_bytes)});
+        }
+        copy_event->signal();
+    });
+
+    return copy_event;
+}
+
+std::shared_ptr<GPUEvent> HostExecutor::copy_from_device_async(std::span<std::byte> data_mem,
+                                                               const GPUBufferHandle &buffer_handle) {
+    check_buffer(buffer_handle);
+    std::shared_ptr<GPUEvent> copy_event = std::make_shared<GPUEvent>();
+
+    submit_after_all([this, data_mem, buffer_handle, copy_event] {
+        uint64_t start_ns = Tracer::enabled() ? Tracer::now_ns() : 0;
+        copy_from_device(data_mem, buffer_handle);
+        if (start_ns != 0) {
+            Tracer::record_span("download", "gpu transfer", start_ns, Tracer::now_ns(),
+                                {"bytes", static_cast<int64_t>(data_mem.size())});
+        }
+        copy_event->signal();
+    });
+
+    return copy_event;
+}
+
+// Splits the blocks of the grid across the worker threads, the launch must outlive the returned work
+void HostExecutor::launch_grid(const KernelDispatch &kernel, const HostKernel &host_kernel, GridLaunch &launch) {
+    for (const GPUBufferHandle &buffer_handle : kernel.buffer_handles) {
+        launch.buffers.push_back(buffer_span(buffer_handle));
+    }
+
+    std::array<int, 3> grid_dim = {1, 1, 1};
+    std::array<int, 3> block_dim = {1, 1, 1};
+    for (size_t dim = 0; dim < 3; ++dim) {
+        grid_dim[dim] = dim < kernel.grid_dim.size() ? std::max(kernel.grid_dim[dim], 1) : 1;
+        block_dim[dim] = dim < kernel.block_dim.size() ? std::max(kernel.block_dim[dim], 1) : 1;
+    }
+
+    // The counter was written by an earlier kernel of the queue, so it is final by the time this kernel starts
+    if (kernel.indirect_count) {
+        uint64_t count = 0;
+        std::memcpy(&count, buffer_span(*kernel.indirect_count).data(), sizeof(count));
+
+        size_t num_block_threads = static_cast<size_t>(block_dim[0]) * block_dim[1] * block_dim[2];
+        grid_dim = {static_cast<int>((count + num_block_threads - 1) / num_block_threads), 1, 1};
+    }
+
+    std::array<int, 3> grid_size = {grid_dim[0] * block_dim[0], grid_dim[1] * block_dim[1],
+                                    grid_dim[2] * block_dim[2]};
+    size_t num_blocks = static_cast<size_t>(grid_dim[0]) * grid_dim[1] * grid_dim[2];
+    size_t blocks_per_worker = (num_blocks + num_threads_ - 1) / num_threads_;
+
+    for (size_t first_block = 0; first_block < num_blocks; first_block += blocks_per_worker) {
+        size_t last_block = std::min(num_blocks, first_block + blocks_per_worker);
+
+        auto run_blocks = [&launch, &host_kernel, grid_dim, block_dim, grid_size, first_block, last_block] {
+            HostKernelContext context{launch.buffers, {0, 0, 0}, grid_size};
+
+            for (size_t block = first_block; block < last_block; ++block) {
+                int block_x = block % grid_dim[0];
+                int block_y = (block / grid_dim[0]) % grid_dim[1];
+                int block_z = block / (static_cast<size_t>(grid_dim[0]) * grid_dim[1]);
+
+                for (int z = 0; z < block_dim[2]; ++z) {
+                    for (int y = 0; y < block_dim[1]; ++y) {
+                        for (int x = 0; x < block_dim[0]; ++x) {
+                            context.thread_position = {block_x * block_dim[0] + x, block_y * block_dim[1] + y,
+                                                       block_z * block_dim[2] + z};
+                            host_kernel(context);
+                        }
+                    }
+                }
+            }
+        };
+
+        launch.block_futures.push_back(grid_pool_.add_task(run_blocks));
+    }
+}
+
+void HostExecutor::wait_grid(GridLaunch &launch) {
+    for (std::future<void> &block_future : launch.block_futures) {
+        block_future.get();
+    }
+}
+
+GPUState HostExecutor::execute_batch(const std::vector<KernelDispatch> &kernels, const DispatchType &dispatch_type,
+                                     std::vector<std::function<void()>> &cpu_callbacks, size_t queue) {
+    if (dispatch_type != DispatchType::Serial && dispatch_type != DispatchType::Concurrent) {
+        return GPUState::InvalidDispatchType;
+    }
+    if (queue >= queues_.size()) {
+        throw std::runtime_error("Tried to submit to queue " + std::to_string(queue) + " of a " +
+                                 std::to_string(queues_.size()) + " queue executor");
+    }
+
+    // Resolve kernels at submission so a missing kernel is reported to the caller rather than the command thread
+    std::vector<HostKernel> host_kernels;
+    for (const KernelDispatch &kernel : kernels) {
+        host_kernels.push_back(resolve_kernel(kernel.kernel_name));
+    }
+
+    if (cpu_callbacks.size() != kernels.size()) {
+        throw std::runtime_error("A batch needs exactly one completion callback per kernel");
+    }
+
+    submit(
+        [this, kernels, host_kernels, dispatch_type, cpu_callbacks] {
+            std::vector<GridLaunch> launches(kernels.size());
+
+            // The queue stalls on unsignalled events like a device would, which orders kernels after their transfers
+            // and after the kernels of other queues they depend on
+            auto wait_kernel = [](const KernelDispatch &kernel) {
+                uint64_t start_ns = Tracer::enabled() && !kernel.wait_events.empty() ? Tracer::now_ns() : 0;
+                for (const std::shared_ptr<GPUEvent> &wait_event : kernel.wait_events) {
+                    wait_event->wait();
+                }
+                if (start_ns != 0) {
+                    Tracer::record_span("event wait", "gpu wait", start_ns, Tracer::now_ns(),
+                                        {"events", static_cast<int64_t>(kernel.wait_events.size())});
+                }
+            };
+            // Spans run from launch to grid completion, concurrent kernels overlap on the queue's timeline
+            std::vector<uint64_t> launch_ns(kernels.size(), 0);
+            auto start_kernel = [&](size_t i) {
+                launch_ns[i] = Tracer::enabled() ? Tracer::now_ns() : 0;
+                launch_grid(kernels[i], host_kernels[i], launches[i]);
+            };
+            // The callback runs first, so anything it records about the kernel is visible to the kernels waiting
+            auto complete_kernel = [&](size_t i) {
+                if (launch_ns[i] != 0) {
+                    Tracer::record_span(kernels[i].kernel_name, "gpu kernel", launch_ns[i], Tracer::now_ns(),
+                                        {"blocks", static_cast<int64_t>(launches[i].block_futures.size())});
+                }
+                cpu_callbacks[i]();
+                if (kernels[i].signal_event) {
+                    kernels[i].signal_event->signal();
+                }
+            };
+
+            if (dispatch_type == DispatchType::Serial) {
+                // Like a serial encoder, each kernel sees the results of the previous one
+                for (size_t i = 0; i < kernels.size(); ++i) {
+                    wait_kernel(kernels[i]);
+                    start_kernel(i);
+                    wait_grid(launches[i]);
+                    complete_kernel(i);
+                }
+
+                return;
+            }
+
+            // Concurrent kernels share the worker threads, so their blocks are all queued before waiting on any of them
+            for (const KernelDispatch &kernel : kernels) {
+                wait_kernel(kernel);
+            }
+            for (size_t i = 0; i < kernels.size(); ++i) {
+                start_kernel(i);
+            }
+            for (size_t i = 0; i < kernels.size(); ++i) {
+                wait_grid(launches[i]);
+                complete_kernel(i);
+            }
+        },
+        queue);
+
+    return GPUState::GPUSuccess;
+}
+
+GPUState HostExecutor::execute_kernel(const KernelDispatch &kernel, std::function<void()> &cpu_callback) {
+    std::vector<std::function<void()>> cpu_callbacks = {cpu_callback};
+    return execute_batch({kernel}, DispatchType::Serial, cpu_callbacks);
+}
+
+// Blocks until every command submitted so far has completed, on every queue
+GPUState HostExecutor::synchronize() {
+    for (std::unique_ptr<CommandQueue> &command_queue : queues_) {
+        std::unique_lock<std::mutex> lock(command_queue->command_mut);
+        command_queue->idle_cv.wait(
+            lock, [&command_queue] { return command_queue->commands.empty() && !command_queue->command_running; });
+    }
+
+    return GPUState::GPUSuccess;
+}
+
+void HostExecutor::submit(std::function<void()> command, size_t queue) {
+    CommandQueue &command_queue = *queues_[queue];
+    {
+        std::lock_guard<std::mutex> lock(command_queue.command_mut);
+        command_queue.commands.push_back(std::move(command));
+    }
+
+    command_queue.command_cv.notify_one();
+}
+
+// Every other queue signals a marker once it reaches the point of submission, the command waits for all of them
+//  - Commands only wait on work submitted before them, so queues waiting on each other never wait in a cycle
+void HostExecutor::submit_after_all(std::function<void()> command, std::function<void(size_t queue)> at_queue) {
+    std::vector<std::shared_ptr<GPUEvent>> queue_markers;
+    for (size_t queue = 1; queue < queues_.size(); ++queue) {
+        std::shared_ptr<GPUEvent> queue_marker = std::make_shared<GPUEvent>();
+        submit(
+            [queue_marker, at_queue, queue] {
+                if (at_queue) {
+                    at_queue(queue);
+                }
+                queue_marker->signal();
+            },
+            queue);
+        queue_markers.push_back(queue_marker);
+    }
+
+    submit([queue_markers, at_queue, command = std::move(command)] {
+        for (const std::shared_ptr<GPUEvent> &queue_marker : queue_markers) {
+            queue_marker->wait();
+        }
+        if (at_queue) {
+            at_queue(0);
+        }
+        command();
+    });
+}
+
+void HostExecutor::command_loop(CommandQueue &command_queue) {
+    while (true) {
+        std::function<void()> command;
+
+        {
+            std::unique_lock<std::mutex> lock(command_queue.command_mut);
+            command_queue.command_cv.wait(
+                lock, [&command_queue] { return command_queue.stop || !command_queue.commands.empty(); });
+
+            if (command_queue.stop && command_queue.commands.empty()) {
+                return;
+            }
+
+            command = std::move(command_queue.commands.front());
+            command_queue.commands.pop_front();
+            command_queue.command_running = true;
+        }
+
+        command();
+
+        {
+            std::lock_guard<std::mutex> lock(command_queue.command_mut);
+            command_queue.command_running = false;
+        }
+        command_queue.idle_cv.notify_all();
+    }
+}
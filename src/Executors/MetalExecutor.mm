@@ -1,6 +1,7 @@
 #include "MetalExecutor.h"
 #include "DataManager.h"
 #include "IGPUExecutor.h"
+#include "Trace.h"
 #include "Metal/Metal.h"
 #include <Foundation/Foundation.h>
 #include <Foundation/NSObjCRuntime.h>
@@ -18,14 +19,51 @@
 #include <memory>
 #include <objc/NSObjCRuntime.h>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 static constexpr NSString *const LIBRARY_NAME = @"kernels";
 
+// Turns the element count of a counter into the threadgroup counts of an indirect dispatch, written right after the
+// count (see COUNT_BUFFER_SIZE) so the counter is all the indirect dispatch needs
+static NSString *const INDIRECT_ARGS_SOURCE = @R"(
+#include <metal_stdlib>
+using namespace metal;
+
+kernel void helios_indirect_args(device const ulong *count [[buffer(0)]], device uint *threadgroups [[buffer(1)]],
+                                 constant uint &block_threads [[buffer(2)]]) {
+    threadgroups[0] = uint((count[0] + block_threads - 1) / block_threads);
+    threadgroups[1] = 1;
+    threadgroups[2] = 1;
+}
+)";
+
+// Blit offsets have to be 4 byte aligned, staging regions are kept 16 byte aligned
+static constexpr size_t STAGING_ALIGNMENT = 16;
+static size_t align_staging(size_t offset) {
+    return (offset + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+}
+
+// Called from a completion handler, the GPU times are seconds of system uptime so they are moved onto the steady clock
+// through the current offset between the two
+static void trace_command_buffer(id<MTLCommandBuffer> command_buffer, std::string_view name, const char *category,
+                                 uint32_t track, const TraceArgs &args) {
+    if (!Tracer::enabled()) {
+        return;
+    }
+
+    double offset_ns = Tracer::now_ns() - [[NSProcessInfo processInfo] systemUptime] * 1e9;
+    Tracer::record_span(name, category, static_cast<uint64_t>(command_buffer.GPUStartTime * 1e9 + offset_ns),
+                        static_cast<uint64_t>(command_buffer.GPUEndTime * 1e9 + offset_ns), args, track);
+}
+
 struct MetalExecutor::MetalExecutorImpl {
     // Metal specific variables
     id<MTLDevice> mtl_device_;
-    id<MTLCommandQueue> command_queue_;
+    // Transfers use the first queue, kernels any of them
+    std::vector<id<MTLCommandQueue>> command_queues_;
     id<MTLLibrary> mtl_library_;
 
     // Slab buffers for buddy memory allocation
@@ -36,12 +74,27 @@ struct MetalExecutor::MetalExecutorImpl {
     // map for storing already prepared compute pipelines
     std::unordered_map<std::string, id<MTLComputePipelineState>> pipeline_map_;
 
+    // Builds the arguments of indirect dispatches from device counters
+    id<MTLComputePipelineState> indirect_args_pipeline_;
+
     // map for storing relating synchronization events to their (shared memory) buffers
     std::unordered_map<GPUBufferHandle, id<MTLSharedEvent>> shared_event_map_;
 
     // map for storing GPU buffer handles
     std::unordered_map<GPUBufferHandle, id<MTLBuffer>> buffer_map_;
 
+    // Timeline signalled by asynchronous uploads, kernels waiting on them encode a wait on this event
+    id<MTLSharedEvent> transfer_event_;
+    uint64_t transfer_value_ = 0;
+
+    // Timeline of each queue, signalled after every batch and after kernels other queues wait on (see make_queue_event)
+    std::vector<id<MTLSharedEvent>> kernel_events_;
+    std::vector<uint64_t> kernel_values_;
+
+    // Trace tracks of the queues and of the transfers (which run on the first queue)
+    std::vector<uint32_t> queue_tracks_;
+    uint32_t transfer_track_ = 0;
+
     id<MTLBuffer> select_buffer(MemoryHint mem_hint) {
         switch (mem_hint) {
         case MemoryHint::DeviceLocal:
@@ -104,13 +157,42 @@ void MetalExecutor::load_default_library() {
     p_metal_impl->mtl_library_ = library;
 }
 
+void MetalExecutor::load_indirect_args_pipeline() {
+    NSError *library_error = nil;
+    id<MTLLibrary> library = [p_metal_impl->mtl_device_ newLibraryWithSource:INDIRECT_ARGS_SOURCE
+                                                                     options:nil
+                                                                       error:&library_error];
+    if (library == nil) {
+        std::string error_message = "Failed to build the indirect dispatch library. Description: ";
+        error_message += [[library_error localizedDescription] UTF8String];
+        throw std::runtime_error(error_message);
+    }
+
+    NSError *pipeline_error = nil;
+    id<MTLFunction> args_func = [library newFunctionWithName:@"helios_indirect_args"];
+    p_metal_impl->indirect_args_pipeline_ =
+        [p_metal_impl->mtl_device_ newComputePipelineStateWithFunction:args_func error:&pipeline_error];
+    if (p_metal_impl->indirect_args_pipeline_ == nil) {
+        std::string error_message = "Failed to create the indirect dispatch pipeline. Description: ";
+        error_message += [[pipeline_error localizedDescription] UTF8String];
+        throw std::runtime_error(error_message);
+    }
+}
+
 MetalExecutor::MetalExecutor(std::pair<int, int> devloc_bounds, std::pair<int, int> hostvis_bounds,
-                             std::pair<int, int> unified_bounds, size_t proxy_size)
+                             std::pair<int, int> unified_bounds, size_t staging_slot_size, size_t staging_slots,
+                             size_t num_queues)
     : p_metal_impl(std::make_unique<MetalExecutorImpl>()) {
     // Construct the GPUMemoryAllocator
     mem_allocator = GPUMemoryAllocator(devloc_bounds.first, devloc_bounds.second, unified_bounds.first,
                                        unified_bounds.second, hostvis_bounds.first, hostvis_bounds.second);
 
+    // The device has to exist before any slab can be created on it
+    p_metal_impl->mtl_device_ = MTLCreateSystemDefaultDevice();
+    if (!p_metal_impl->mtl_device_) {
+        throw std::runtime_error("Failed to get Metal device.");
+    }
+
     if (devloc_bounds != std::pair(0, 0)) {
         size_t devloc_size = devloc_bounds.second - devloc_bounds.first;
         p_metal_impl->devloc_slab_buffer_ =
@@ -129,48 +211,58 @@ MetalExecutor::MetalExecutor(std::pair<int, int> devloc_bounds, std::pair<int, i
             [p_metal_impl->mtl_device_ newBufferWithLength:unified_size options:MTLResourceStorageModeShared];
     }
 
-    p_metal_impl->mtl_device_ = MTLCreateSystemDefaultDevice();
-    if (!p_metal_impl->mtl_device_) {
-        throw std::runtime_error("Failed to get Metal device.");
+    for (size_t queue = 0; queue < std::max<size_t>(num_queues, 1); ++queue) {
+        p_metal_impl->command_queues_.push_back([p_metal_impl->mtl_device_ newCommandQueue]);
+        p_metal_impl->kernel_events_.push_back([p_metal_impl->mtl_device_ newSharedEvent]);
+        p_metal_impl->kernel_values_.push_back(0);
+        p_metal_impl->queue_tracks_.push_back(Tracer::register_track("metal queue " + std::to_string(queue)));
     }
-    p_metal_impl->command_queue_ = [p_metal_impl->mtl_device_ newCommandQueue];
+    p_metal_impl->transfer_track_ = Tracer::register_track("metal transfers");
+    p_metal_impl->transfer_event_ = [p_metal_impl->mtl_device_ newSharedEvent];
     load_default_library();
 
     p_metal_impl->pipeline_map_ = std::unordered_map<std::string, id<MTLComputePipelineState>>();
+    load_indirect_args_pipeline();
 
-    if (proxy_size > 0) {
-        // TODO: Make the free map hierarchical
-        // Currently the free map will find addresses outside of the order that was expected
-        proxy_handle_ = allocate_buffer(proxy_size, MemoryHint::Unified);
-        GPUBufferHandle buffer_test = allocate_buffer(32, MemoryHint::Unified);
-        GPUBufferHandle buffer_test2 = allocate_buffer(32, MemoryHint::Unified);
-        GPUBufferHandle buffer_test3 = allocate_buffer(32, MemoryHint::Unified);
-        GPUBufferHandle buffer_test4 = allocate_buffer(64, MemoryHint::Unified);
-        mem_allocator.check_free_mem(proxy_handle_.size, proxy_handle_.mem_offset, proxy_handle_.mem_hint);
-        mem_allocator.check_free_mem(buffer_test2.size, buffer_test2.mem_offset, buffer_test2.mem_hint);
-        mem_allocator.check_free_mem(buffer_test.size, buffer_test.mem_offset, buffer_test.mem_hint);
-        mem_allocator.check_free_mem(buffer_test3.size, buffer_test3.mem_offset, buffer_test3.mem_hint);
-        mem_allocator.check_free_mem(buffer_test4.size, buffer_test4.mem_offset, buffer_test4.mem_hint);
-        proxy_handle_ = allocate_buffer(proxy_size, MemoryHint::Unified);
+    staging_ring_ = std::make_unique<StagingRing>(mem_allocator, staging_slot_size > 0 ? staging_slots : 0,
+                                                  staging_slot_size);
+}
+
+// Compiles the compute pipeline now rather than inside the first dispatch of the kernel
+//  - Only a missing function is reported as false, a function whose pipeline fails to build still throws
+bool MetalExecutor::prepare_kernel(const std::string &kernel_name) {
+    NSString *ns_name = [NSString stringWithUTF8String:kernel_name.c_str()];
+    if ([p_metal_impl->mtl_library_ newFunctionWithName:ns_name] == nil) {
+        return false;
     }
+
+    p_metal_impl->find_cache_pipeline(kernel_name);
+    return true;
+}
+
+// Depends on the registers and threadgroup memory the pipeline uses, so it can be below the device limit
+size_t MetalExecutor::max_block_threads(const std::string &kernel_name) {
+    return p_metal_impl->find_cache_pipeline(kernel_name).maxTotalThreadsPerThreadgroup;
 }
 
 // NOTE: This destructor may need to be filled in (e.g. deallocating slab buffers)
 MetalExecutor::~MetalExecutor() = default;
 
-GPUBufferHandle MetalExecutor::allocate_buffer(std::size_t buffer_size, const MemoryHint mem_hint) {
-    // Create the buffer handle object
-    std::cout << "Allocating memory..." << std::endl;
-    size_t free_offset = mem_allocator.allocate_memory(buffer_size, mem_hint);
-    std::cout << "Allocated memory!" << " buffer offset: " << free_offset << std::endl;
-    GPUBufferHandle buffer_handle(buffer_counter, mem_hint, free_offset, buffer_size);
+std::optional<GPUBufferHandle> MetalExecutor::try_allocate_buffer(std::size_t buffer_size, const MemoryHint mem_hint) {
+    // Create the buffer handle object, or report the slab as full so the scheduler can wait for frees
+    std::optional<size_t> free_offset = mem_allocator.try_allocate_memory(buffer_size, mem_hint);
+    if (!free_offset) {
+        return std::nullopt;
+    }
+
+    GPUBufferHandle buffer_handle(buffer_counter, mem_hint, *free_offset, buffer_size);
     buffer_counter++;
 
     return buffer_handle;
 }
 
 GPUState MetalExecutor::deallocate_buffer(const GPUBufferHandle &buffer_handle) {
-    mem_allocator.check_free_mem(buffer_handle.mem_offset, buffer_handle.size, buffer_handle.mem_hint);
+    mem_allocator.check_free_mem(buffer_handle.size, buffer_handle.mem_offset, buffer_handle.mem_hint);
 
     // Remove the reference to the command buffer - Metal will automatically deallocate resources
     //    if (p_metal_impl->buffer_map_.contains(buffer_handle)) {
@@ -182,34 +274,12 @@ GPUState MetalExecutor::deallocate_buffer(const GPUBufferHandle &buffer_handle)
     return GPUState::GPUSuccess;
 }
 
-void MetalExecutor::access_proxy(size_t data_size) {
-    if (data_size > proxy_handle_.size) {
-        mem_allocator.check_free_mem(proxy_handle_.size, 0, MemoryHint::Unified);
-        proxy_handle_.size *= 2;
-        mem_allocator.allocate_memory(proxy_handle_.size, MemoryHint::Unified);
-    }
-}
-
 // TODO: How can we make command buffers more optimized for batch usages? Creating + committing each time -> perf
 // overhead
 
-// For private resources: Create a proxy buffer that can transfer to private
+// For private resources: Staged through a shared memory slot and blitted across
 GPUState MetalExecutor::blit_to_private(std::span<const std::byte> data_mem, const GPUBufferHandle &buffer_handle) {
-    access_proxy(buffer_handle.size);
-    copy_to_device(data_mem, proxy_handle_); // Should be safe since proxy will *never* be in private memory
-
-    id<MTLCommandBuffer> transfer_cmd_buffer = [p_metal_impl->command_queue_ commandBuffer];
-    id<MTLBlitCommandEncoder> blit_encoder = [transfer_cmd_buffer blitCommandEncoder];
-
-    [blit_encoder copyFromBuffer:p_metal_impl->unified_slab_buffer_
-                    sourceOffset:proxy_handle_.mem_offset
-                        toBuffer:p_metal_impl->devloc_slab_buffer_
-               destinationOffset:buffer_handle.mem_offset
-                            size:buffer_handle.size];
-    [blit_encoder endEncoding];
-
-    [transfer_cmd_buffer waitUntilCompleted];
-    [transfer_cmd_buffer commit];
+    copy_to_device_async({{data_mem, buffer_handle}})->wait();
 
     return GPUState::GPUSuccess;
 }
@@ -241,28 +311,9 @@ GPUState MetalExecutor::copy_to_shared(std::span<const std::byte> data_mem, cons
     return GPUState::GPUSuccess;
 }
 
-// For private resources: Create a proxy buffer that can contain private data and transfer to CPU
+// For private resources: Blitted into a shared memory slot and read back from there
 GPUState MetalExecutor::private_to_cpu(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle) {
-    access_proxy(buffer_handle.size);
-
-    id<MTLCommandBuffer> transfer_cmd_buffer = [p_metal_impl->command_queue_ commandBuffer];
-    id<MTLBlitCommandEncoder> blit_encoder = [transfer_cmd_buffer blitCommandEncoder];
-
-    [blit_encoder copyFromBuffer:p_metal_impl->devloc_slab_buffer_
-                    sourceOffset:buffer_handle.mem_offset
-                        toBuffer:p_metal_impl->unified_slab_buffer_
-               destinationOffset:proxy_handle_.mem_offset
-                            size:buffer_handle.size];
-    [blit_encoder endEncoding];
-
-    [transfer_cmd_buffer addCompletedHandler:^(id<MTLCommandBuffer> _Nonnull) {
-      void *slab_mem = [p_metal_impl->devloc_slab_buffer_ contents];
-      void *proxy_mem = (char *)slab_mem + proxy_handle_.mem_offset;
-
-      memcpy(data_mem.data(), proxy_mem, buffer_handle.size);
-    }];
-    [transfer_cmd_buffer waitUntilCompleted];
-    [transfer_cmd_buffer commit];
+    copy_from_device_async(data_mem, buffer_handle)->wait();
 
     return GPUState::GPUSuccess;
 }
@@ -271,7 +322,7 @@ GPUState MetalExecutor::private_to_cpu(std::span<std::byte> data_mem, const GPUB
 GPUState MetalExecutor::managed_to_cpu(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle) {
     id<MTLBuffer> buffer = p_metal_impl->hostvis_slab_buffer_;
 
-    id<MTLCommandBuffer> synchronize_cmd_buffer = [p_metal_impl->command_queue_ commandBuffer];
+    id<MTLCommandBuffer> synchronize_cmd_buffer = [p_metal_impl->command_queues_[0] commandBuffer];
     id<MTLBlitCommandEncoder> blit_encoder = [synchronize_cmd_buffer blitCommandEncoder];
 
     [blit_encoder synchronizeResource:buffer];
@@ -326,6 +377,118 @@ GPUState MetalExecutor::copy_to_device(std::span<const std::byte> data_mem, cons
     return GPUState::GPUFailure;
 }
 
+GPUState MetalExecutor::copy_to_device_batch(const std::vector<BufferCopy> &copies) {
+    copy_to_device_async(copies)->wait();
+
+    return GPUState::GPUSuccess;
+}
+
+// Private destinations are packed into one staging slot and blitted with one command buffer, so a batch costs a single
+// submission instead of one per upload, shared/managed destinations are written directly
+//  - The upload signals the transfer timeline, so kernels waiting on the returned event wait on the device
+std::shared_ptr<GPUEvent> MetalExecutor::copy_to_device_async(const std::vector<BufferCopy> &copies) {
+    size_t staging_size = 0;
+    for (const BufferCopy &copy : copies) {
+        if (copy.buffer_handle.mem_hint == MemoryHint::DeviceLocal) {
+            staging_size = align_staging(staging_size) + copy.data_mem.size();
+            continue;
+        }
+
+        if (copy_to_device(copy.data_mem, copy.buffer_handle) != GPUState::GPUSuccess) {
+            throw std::runtime_error("Failed to copy data to the device");
+        }
+    }
+
+    if (staging_size == 0) {
+        return GPUEvent::signalled();
+    }
+
+    // Only blocks when every slot is still being read by an earlier transfer
+    size_t slot_index = staging_ring_->acquire(staging_size);
+    size_t slot_offset = staging_ring_->get_slot(slot_index).mem_offset;
+    char *staging_mem = (char *)[p_metal_impl->unified_slab_buffer_ contents] + slot_offset;
+
+    id<MTLCommandBuffer> transfer_cmd_buffer = [p_metal_impl->command_queues_[0] commandBuffer];
+    id<MTLBlitCommandEncoder> blit_encoder = [transfer_cmd_buffer blitCommandEncoder];
+
+    size_t staging_offset = 0;
+    for (const BufferCopy &copy : copies) {
+        if (copy.buffer_handle.mem_hint != MemoryHint::DeviceLocal) {
+            continue;
+        }
+
+        staging_offset = align_staging(staging_offset);
+        memcpy(staging_mem + staging_offset, copy.data_mem.data(), copy.data_mem.size());
+
+        [blit_encoder copyFromBuffer:p_metal_impl->unified_slab_buffer_
+                        sourceOffset:slot_offset + staging_offset
+                            toBuffer:p_metal_impl->devloc_slab_buffer_
+                   destinationOffset:copy.buffer_handle.mem_offset
+                                size:copy.data_mem.size()];
+        staging_offset += copy.data_mem.size();
+    }
+    [blit_encoder endEncoding];
+
+    std::shared_ptr<GPUEvent> copy_event = std::make_shared<GPUEvent>();
+    copy_event->device_timeline = this;
+    copy_event->device_value = ++p_metal_impl->transfer_value_;
+    [transfer_cmd_buffer encodeSignalEvent:p_metal_impl->transfer_event_ value:copy_event->device_value];
+    uint32_t transfer_track = p_metal_impl->transfer_track_;
+    [transfer_cmd_buffer addCompletedHandler:^(id<MTLCommandBuffer> transfer_cmd_buffer) {
+      trace_command_buffer(transfer_cmd_buffer, "upload", "gpu transfer", transfer_track,
+                           {"bytes", static_cast<int64_t>(staging_size)});
+      copy_event->signal();
+    }];
+    [transfer_cmd_buffer commit];
+
+    staging_ring_->release(slot_index, copy_event);
+    return copy_event;
+}
+
+// Private sources are blitted into a staging slot, the host copy happens in the completion handler so the caller only
+// waits if it needs the data straight away
+std::shared_ptr<GPUEvent> MetalExecutor::copy_from_device_async(std::span<std::byte> data_mem,
+                                                                const GPUBufferHandle &buffer_handle) {
+    if (buffer_handle.mem_hint != MemoryHint::DeviceLocal) {
+        return IGPUExecutor::copy_from_device_async(data_mem, buffer_handle);
+    }
+
+    size_t copy_size = std::min(data_mem.size(), buffer_handle.size);
+    size_t slot_index = staging_ring_->acquire(copy_size);
+    size_t slot_offset = staging_ring_->get_slot(slot_index).mem_offset;
+
+    id<MTLCommandBuffer> transfer_cmd_buffer = [p_metal_impl->command_queues_[0] commandBuffer];
+
+    // The first queue orders the blit after its own kernels, the other queues are waited on up to their last batch
+    for (size_t queue = 1; queue < p_metal_impl->command_queues_.size(); ++queue) {
+        [transfer_cmd_buffer encodeWaitForEvent:p_metal_impl->kernel_events_[queue]
+                                          value:p_metal_impl->kernel_values_[queue]];
+    }
+
+    id<MTLBlitCommandEncoder> blit_encoder = [transfer_cmd_buffer blitCommandEncoder];
+
+    [blit_encoder copyFromBuffer:p_metal_impl->devloc_slab_buffer_
+                    sourceOffset:buffer_handle.mem_offset
+                        toBuffer:p_metal_impl->unified_slab_buffer_
+               destinationOffset:slot_offset
+                            size:copy_size];
+    [blit_encoder endEncoding];
+
+    std::shared_ptr<GPUEvent> copy_event = std::make_shared<GPUEvent>();
+    id<MTLBuffer> staging_buffer = p_metal_impl->unified_slab_buffer_;
+    uint32_t transfer_track = p_metal_impl->transfer_track_;
+    [transfer_cmd_buffer addCompletedHandler:^(id<MTLCommandBuffer> transfer_cmd_buffer) {
+      trace_command_buffer(transfer_cmd_buffer, "download", "gpu transfer", transfer_track,
+                           {"bytes", static_cast<int64_t>(copy_size)});
+      memcpy(data_mem.data(), (char *)[staging_buffer contents] + slot_offset, copy_size);
+      copy_event->signal();
+    }];
+    [transfer_cmd_buffer commit];
+
+    staging_ring_->release(slot_index, copy_event);
+    return copy_event;
+}
+
 GPUState MetalExecutor::copy_from_device(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle) {
     //    auto buffer_it = p_metal_impl->buffer_map_.find(buffer_handle);
     //    if (buffer_it == p_metal_impl->buffer_map_.end()) {
@@ -349,24 +512,106 @@ GPUState MetalExecutor::copy_from_device(std::span<std::byte> data_mem, const GP
 
 // See if we can optimize this further -> creating a new compute buffer each time is bad perf but also need cpu
 // callbacks
+// The whole batch is one command buffer on the chosen queue, so it costs one submission and one completion round trip
+// however many kernels it holds, the per-kernel callbacks all fire from that completion in batch order
+//  - A serial batch ends its encoder around waits on and signals of other queues, so each kernel only holds back the
+//    kernels behind it, a concurrent batch keeps one encoder and waits/signals around the whole batch
 GPUState MetalExecutor::execute_batch(const std::vector<KernelDispatch> &kernels, const DispatchType &dispatch_type,
-                                      std::function<void()> &cpu_callback) {
+                                      std::vector<std::function<void()>> &cpu_callbacks, size_t queue) {
+    if (cpu_callbacks.size() != kernels.size()) {
+        throw std::runtime_error("A batch needs exactly one completion callback per kernel");
+    }
+    if (queue >= p_metal_impl->command_queues_.size()) {
+        throw std::runtime_error("Tried to submit to queue " + std::to_string(queue) + " of a " +
+                                 std::to_string(p_metal_impl->command_queues_.size()) + " queue executor");
+    }
+
+    MTLDispatchType mtl_dispatch_type;
+    switch (dispatch_type) {
+    case DispatchType::Serial:
+        mtl_dispatch_type = MTLDispatchTypeSerial;
+        break;
+    case DispatchType::Concurrent:
+        mtl_dispatch_type = MTLDispatchTypeConcurrent;
+        break;
+    default:
+        return GPUState::InvalidDispatchType;
+    }
+    bool serial = dispatch_type == DispatchType::Serial;
+
+    id<MTLCommandBuffer> compute_buffer = [p_metal_impl->command_queues_[queue] commandBuffer];
+
+    // Kernel events of this executor live on the timeline of the queue that signals them
+    auto kernel_timeline = [this](const GPUEvent &wait_event) -> id<MTLSharedEvent> {
+        for (id<MTLSharedEvent> kernel_event : p_metal_impl->kernel_events_) {
+            if (wait_event.device_timeline == (__bridge const void *)kernel_event) {
+                return kernel_event;
+            }
+        }
+        return nil;
+    };
+
+    // Uploads from this executor are waited on by the GPU, anything else is resolved before encoding
     for (const KernelDispatch &kernel : kernels) {
-        // Construct a buffer for each kernel, needed to allow for end commands for individual kernel completion
-        id<MTLCommandBuffer> compute_buffer = [p_metal_impl->command_queue_ commandBuffer];
+        for (const std::shared_ptr<GPUEvent> &wait_event : kernel.wait_events) {
+            id<MTLSharedEvent> kernel_event = kernel_timeline(*wait_event);
+            if (wait_event->device_timeline == this) {
+                [compute_buffer encodeWaitForEvent:p_metal_impl->transfer_event_ value:wait_event->device_value];
+            } else if (kernel_event != nil) {
+                if (!serial) {
+                    [compute_buffer encodeWaitForEvent:kernel_event value:wait_event->device_value];
+                }
+            } else {
+                wait_event->wait();
+            }
+        }
+    }
 
-        // Prepare the compute encoder (binding GPU resources, providing compute pipeline, etc.)
-        id<MTLComputeCommandEncoder> compute_encoder;
+    // Prepare the compute encoder (binding GPU resources, providing compute pipeline, etc.)
+    // A serial encoder orders every dispatch after the previous one, which is what chains of dependent kernels need
+    id<MTLComputeCommandEncoder> compute_encoder = nil;
+    auto open_encoder = [&] {
+        if (compute_encoder == nil) {
+            compute_encoder = [compute_buffer computeCommandEncoderWithDispatchType:mtl_dispatch_type];
+        }
+    };
+    auto close_encoder = [&] {
+        if (compute_encoder != nil) {
+            [compute_encoder endEncoding];
+            compute_encoder = nil;
+        }
+    };
 
-        switch (dispatch_type) {
-        case DispatchType::Serial:
-            compute_encoder = [compute_buffer computeCommandEncoderWithDispatchType:MTLDispatchTypeSerial];
-            break;
-        case DispatchType::Concurrent:
-            compute_encoder = [compute_buffer computeCommandEncoderWithDispatchType:MTLDispatchTypeConcurrent];
-            break;
-        default:
-            return GPUState::InvalidDispatchType;
+    for (const KernelDispatch &kernel : kernels) {
+        // Waits can only be encoded between encoders
+        if (serial) {
+            for (const std::shared_ptr<GPUEvent> &wait_event : kernel.wait_events) {
+                id<MTLSharedEvent> kernel_event = kernel_timeline(*wait_event);
+                if (kernel_event != nil) {
+                    close_encoder();
+                    [compute_buffer encodeWaitForEvent:kernel_event value:wait_event->device_value];
+                }
+            }
+        }
+        open_encoder();
+
+        MTLSize threads_per_group = MTLSizeMake(kernel.block_dim[0], kernel.block_dim[1], kernel.block_dim[2]);
+
+        // The threadgroup counts are built from the counter right before the kernel, the barrier orders the two even
+        // in a concurrent encoder
+        id<MTLBuffer> count_slab_buffer;
+        if (kernel.indirect_count) {
+            count_slab_buffer = p_metal_impl->select_buffer(kernel.indirect_count->mem_hint);
+            uint32_t block_threads = kernel.block_dim[0] * kernel.block_dim[1] * kernel.block_dim[2];
+
+            [compute_encoder setComputePipelineState:p_metal_impl->indirect_args_pipeline_];
+            [compute_encoder setBuffer:count_slab_buffer offset:kernel.indirect_count->mem_offset atIndex:0];
+            [compute_encoder setBuffer:count_slab_buffer
+                                offset:kernel.indirect_count->mem_offset + INDIRECT_ARGS_OFFSET
+                               atIndex:1];
+            [compute_encoder setBytes:&block_threads length:sizeof(block_threads) atIndex:2];
+            [compute_encoder dispatchThreadgroups:MTLSizeMake(1, 1, 1) threadsPerThreadgroup:MTLSizeMake(1, 1, 1)];
+            [compute_encoder memoryBarrierWithScope:MTLBarrierScopeBuffers];
         }
 
         // Fetch the compute pipeline or create it if needed
@@ -381,33 +626,87 @@ GPUState MetalExecutor::execute_batch(const std::vector<KernelDispatch> &kernels
             [compute_encoder setBuffer:slab_bind_buffer offset:kernel.buffer_handles[j].mem_offset atIndex:j];
         }
 
-        MTLSize groups_per_grid = MTLSizeMake(kernel.grid_dim[0], kernel.grid_dim[1], kernel.grid_dim[2]);
-        MTLSize threads_per_group = MTLSizeMake(kernel.block_dim[0], kernel.block_dim[1], kernel.block_dim[2]);
-        [compute_encoder dispatchThreadgroups:groups_per_grid threadsPerThreadgroup:threads_per_group];
+        if (kernel.indirect_count) {
+            [compute_encoder dispatchThreadgroupsWithIndirectBuffer:count_slab_buffer
+                                               indirectBufferOffset:kernel.indirect_count->mem_offset +
+                                                                    INDIRECT_ARGS_OFFSET
+                                              threadsPerThreadgroup:threads_per_group];
+        } else {
+            MTLSize groups_per_grid = MTLSizeMake(kernel.grid_dim[0], kernel.grid_dim[1], kernel.grid_dim[2]);
+            [compute_encoder dispatchThreadgroups:groups_per_grid threadsPerThreadgroup:threads_per_group];
+        }
 
-        // Update when each kernel ends individually, rather than when the entire batch ends
-        // Might cause perf issues - how could we improve this?
-        [compute_buffer addCompletedHandler:^(id<MTLCommandBuffer> compute_buffer) {
-          cpu_callback();
-        }];
+        if (serial && kernel.signal_event) {
+            close_encoder();
+            [compute_buffer encodeSignalEvent:p_metal_impl->kernel_events_[queue]
+                                        value:kernel.signal_event->device_value];
+        }
+    }
+    close_encoder();
+
+    if (!serial) {
+        for (const KernelDispatch &kernel : kernels) {
+            if (kernel.signal_event) {
+                [compute_buffer encodeSignalEvent:p_metal_impl->kernel_events_[queue]
+                                            value:kernel.signal_event->device_value];
+            }
+        }
+    }
 
-        [compute_encoder endEncoding];
-        [compute_buffer commit];
+    // Downloads wait for this value, so they are ordered after the batch
+    [compute_buffer encodeSignalEvent:p_metal_impl->kernel_events_[queue] value:++p_metal_impl->kernel_values_[queue]];
+
+    // The block holds its own copies, the caller's callbacks may be gone by the time the batch completes
+    std::vector<std::function<void()>> completion_callbacks = cpu_callbacks;
+    std::vector<std::shared_ptr<GPUEvent>> signal_events;
+    for (const KernelDispatch &kernel : kernels) {
+        if (kernel.signal_event) {
+            signal_events.push_back(kernel.signal_event);
+        }
     }
+    // One span per command buffer, Metal only times whole command buffers
+    std::string batch_name = kernels.size() == 1 ? kernels[0].kernel_name : "kernel batch";
+    uint32_t queue_track = p_metal_impl->queue_tracks_[queue];
+    [compute_buffer addCompletedHandler:^(id<MTLCommandBuffer> compute_buffer) {
+      trace_command_buffer(compute_buffer, batch_name, "gpu kernel", queue_track,
+                           {"kernels", static_cast<int64_t>(completion_callbacks.size())});
+      for (const std::function<void()> &completion_callback : completion_callbacks) {
+          completion_callback();
+      }
+      for (const std::shared_ptr<GPUEvent> &signal_event : signal_events) {
+          signal_event->signal();
+      }
+    }];
+
+    [compute_buffer commit];
 
     return GPUState::GPUSuccess;
 }
 
 GPUState MetalExecutor::execute_kernel(const KernelDispatch &kernel, std::function<void()> &cpu_callback) {
-    return execute_batch({kernel}, DispatchType::Serial, cpu_callback);
+    std::vector<std::function<void()>> cpu_callbacks = {cpu_callback};
+    return execute_batch({kernel}, DispatchType::Serial, cpu_callbacks);
 }
 
-// Add a final empty command buffer and block until it finishes
+// Add a final empty command buffer to every queue and block until they finish
 GPUState MetalExecutor::synchronize() {
-    id<MTLCommandBuffer> synchronize_buffer = [p_metal_impl->command_queue_ commandBuffer];
+    for (id<MTLCommandQueue> command_queue : p_metal_impl->command_queues_) {
+        id<MTLCommandBuffer> synchronize_buffer = [command_queue commandBuffer];
 
-    [synchronize_buffer commit];
-    [synchronize_buffer waitUntilCompleted];
+        [synchronize_buffer commit];
+        [synchronize_buffer waitUntilCompleted];
+    }
 
     return GPUState::GPUSuccess;
 }
+
+size_t MetalExecutor::num_queues() const { return p_metal_impl->command_queues_.size(); }
+
+// Reserves the next value of the queue's timeline, execute_batch signals it right after the kernel
+std::shared_ptr<GPUEvent> MetalExecutor::make_queue_event(size_t queue) {
+    std::shared_ptr<GPUEvent> queue_event = std::make_shared<GPUEvent>();
+    queue_event->device_timeline = (__bridge const void *)p_metal_impl->kernel_events_[queue];
+    queue_event->device_value = ++p_metal_impl->kernel_values_[queue];
+
+    return queue_event;
+}
@@ -0,0 +1,253 @@
+#include "SimulatedExecutor.h"
+#include "DataManager.h"
+#include "HostExecutor.h"
+#include "IGPUExecutor.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+static std::chrono::nanoseconds model_seconds(double seconds) {
+    return std::chrono::nanoseconds(std::llround(seconds * 1e9));
+}
+
+SimulatedExecutor::SimulatedExecutor(const SimulatedDeviceModel &model, std::pair<int, int> devloc_bounds,
+                                     std::pair<int, int> hostvis_bounds, std::pair<int, int> unified_bounds,
+                                     size_t num_threads, size_t num_queues)
+    : HostExecutor(devloc_bounds, hostvis_bounds, unified_bounds, num_threads, num_queues), model_(model),
+      compute_clocks_(HostExecutor::num_queues()), epoch_(std::chrono::steady_clock::now()),
+      copy_track_(Tracer::register_track("simulated copy engine")) {
+    for (size_t queue = 0; queue < compute_clocks_.size(); ++queue) {
+        compute_tracks_.push_back(Tracer::register_track("simulated compute " + std::to_string(queue)));
+    }
+
+    if (model.host_to_device_bandwidth <= 0.0 || model.device_to_host_bandwidth <= 0.0 ||
+        model.default_throughput <= 0.0) {
+        throw std::runtime_error("Simulated device bandwidths and throughput have to be positive");
+    }
+}
+
+std::chrono::nanoseconds SimulatedExecutor::ready_time() const {
+    if (model_.real_time_scale <= 0.0) {
+        return std::chrono::nanoseconds(0);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - epoch_;
+    return model_seconds(elapsed.count() / model_.real_time_scale);
+}
+
+void SimulatedExecutor::pace(std::chrono::nanoseconds completion) const {
+    if (model_.real_time_scale <= 0.0) {
+        return;
+    }
+
+    auto scaled_completion = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double, std::nano>(completion.count() * model_.real_time_scale));
+    std::this_thread::sleep_until(epoch_ + scaled_completion);
+}
+
+void SimulatedExecutor::trace_command(std::string_view name, const char *category, uint32_t track,
+                                      std::chrono::nanoseconds start, std::chrono::nanoseconds end,
+                                      const TraceArgs &args) const {
+    uint64_t epoch_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(epoch_.time_since_epoch()).count();
+    Tracer::record_span(name, category, epoch_ns + start.count(), epoch_ns + end.count(), args, track);
+}
+
+// Transfers share the copy engine, downloads also wait for the kernels submitted before them
+std::chrono::nanoseconds SimulatedExecutor::schedule_copy(size_t num_bytes, bool to_device,
+                                                          std::optional<std::chrono::nanoseconds> kernels_done) {
+    double bandwidth = to_device ? model_.host_to_device_bandwidth : model_.device_to_host_bandwidth;
+    std::chrono::nanoseconds duration = model_.transfer_latency + model_seconds(num_bytes / bandwidth);
+
+    std::lock_guard<std::mutex> lock(clock_mut_);
+    std::chrono::nanoseconds start = std::max(copy_clock_, ready_time());
+    if (!to_device) {
+        start = std::max(start, kernels_done ? *kernels_done
+                                             : *std::max_element(compute_clocks_.begin(), compute_clocks_.end()));
+    }
+
+    copy_clock_ = start + duration;
+    stats_.device_time = std::max(stats_.device_time, copy_clock_);
+    stats_.copy_busy += duration;
+    stats_.transfers++;
+    (to_device ? stats_.bytes_to_device : stats_.bytes_to_host) += num_bytes;
+
+    if (Tracer::enabled()) {
+        trace_command(to_device ? "upload" : "download", "gpu transfer", copy_track_, start, copy_clock_,
+                      {"bytes", static_cast<int64_t>(num_bytes)});
+    }
+
+    return copy_clock_;
+}
+
+// Runs on the command thread once the kernel has completed on the host, so indirect counts are final
+std::chrono::nanoseconds SimulatedExecutor::schedule_kernel(const KernelDispatch &kernel, bool launch, size_t queue) {
+    size_t num_threads = 1;
+    if (kernel.indirect_count) {
+        uint64_t count = 0;
+        std::memcpy(&count, buffer_span(*kernel.indirect_count).data(), sizeof(count));
+        num_threads = count;
+    } else {
+        for (size_t dim = 0; dim < 3; ++dim) {
+            num_threads *= dim < kernel.grid_dim.size() ? std::max(kernel.grid_dim[dim], 1) : 1;
+            num_threads *= dim < kernel.block_dim.size() ? std::max(kernel.block_dim[dim], 1) : 1;
+        }
+    }
+
+    auto throughput_iter = model_.kernel_throughput.find(kernel.kernel_name);
+    double throughput =
+        throughput_iter != model_.kernel_throughput.end() ? throughput_iter->second : model_.default_throughput;
+    std::chrono::nanoseconds duration =
+        (launch ? model_.launch_latency : std::chrono::nanoseconds(0)) + model_seconds(num_threads / throughput);
+
+    std::lock_guard<std::mutex> lock(clock_mut_);
+    std::chrono::nanoseconds start = std::max(compute_clocks_[queue], ready_time());
+    for (const std::shared_ptr<GPUEvent> &wait_event : kernel.wait_events) {
+        if (wait_event->device_timeline == this) {
+            start = std::max(start, std::chrono::nanoseconds(wait_event->device_value));
+        }
+    }
+
+    compute_clocks_[queue] = start + duration;
+    stats_.device_time = std::max(stats_.device_time, compute_clocks_[queue]);
+    stats_.compute_busy += duration;
+    stats_.kernels++;
+
+    if (Tracer::enabled()) {
+        trace_command(kernel.kernel_name, "gpu kernel", compute_tracks_[queue], start, compute_clocks_[queue],
+                      {"threads", static_cast<int64_t>(num_threads)});
+    }
+
+    return compute_clocks_[queue];
+}
+
+GPUState SimulatedExecutor::copy_to_device(std::span<const std::byte> data_mem, const GPUBufferHandle &buffer_handle) {
+    GPUState copy_state = HostExecutor::copy_to_device(data_mem, buffer_handle);
+    pace(schedule_copy(data_mem.size(), true));
+    return copy_state;
+}
+
+GPUState SimulatedExecutor::copy_from_device(std::span<std::byte> data_mem, const GPUBufferHandle &buffer_handle) {
+    GPUState copy_state = HostExecutor::copy_from_device(data_mem, buffer_handle);
+    pace(schedule_copy(data_mem.size(), false));
+    return copy_state;
+}
+
+// A batch is one transfer on the device, so it pays the latency once
+GPUState SimulatedExecutor::copy_to_device_batch(const std::vector<BufferCopy> &copies) {
+    size_t num_bytes = 0;
+    for (const BufferCopy &copy : copies) {
+        num_bytes += copy.data_mem.size();
+    }
+
+    GPUState copy_state = HostExecutor::copy_to_device_batch(copies);
+    pace(schedule_copy(num_bytes, true));
+    return copy_state;
+}
+
+std::shared_ptr<GPUEvent> SimulatedExecutor::copy_to_device_async(const std::vector<BufferCopy> &copies) {
+    std::shared_ptr<GPUEvent> copy_event = std::make_shared<GPUEvent>();
+    copy_event->device_timeline = this;
+
+    submit([this, copies, copy_event] {
+        size_t num_bytes = 0;
+        for (const BufferCopy &copy : copies) {
+            num_bytes += copy.data_mem.size();
+        }
+
+        if (HostExecutor::copy_to_device_batch(copies) != GPUState::GPUSuccess) {
+            throw std::runtime_error("Failed to copy data to the device");
+        }
+
+        std::chrono::nanoseconds completion = schedule_copy(num_bytes, true);
+        copy_event->device_value = completion.count();
+        pace(completion);
+        copy_event->signal();
+    });
+
+    return copy_event;
+}
+
+std::shared_ptr<GPUEvent> SimulatedExecutor::copy_from_device_async(std::span<std::byte> data_mem,
+                                                                    const GPUBufferHandle &buffer_handle) {
+    std::shared_ptr<GPUEvent> copy_event = std::make_shared<GPUEvent>();
+    copy_event->device_timeline = this;
+
+    // Each queue's clock is read when the queue reaches the download, so later kernels of a queue that ran ahead are
+    // not waited for
+    auto queue_clocks = std::make_shared<std::vector<std::chrono::nanoseconds>>(num_queues());
+    auto read_clock = [this, queue_clocks](size_t queue) {
+        std::lock_guard<std::mutex> lock(clock_mut_);
+        (*queue_clocks)[queue] = compute_clocks_[queue];
+    };
+
+    submit_after_all(
+        [this, data_mem, buffer_handle, copy_event, queue_clocks] {
+            if (HostExecutor::copy_from_device(data_mem, buffer_handle) != GPUState::GPUSuccess) {
+                throw std::runtime_error("Failed to copy data from the device");
+            }
+
+            std::chrono::nanoseconds kernels_done = *std::max_element(queue_clocks->begin(), queue_clocks->end());
+            std::chrono::nanoseconds completion = schedule_copy(data_mem.size(), false, kernels_done);
+            copy_event->device_value = completion.count();
+            pace(completion);
+            copy_event->signal();
+        },
+        read_clock);
+
+    return copy_event;
+}
+
+// Each kernel is timed right before its callback fires, in the order the host executor completes them
+//  - Its signal event carries the modelled completion, so kernels of other queues waiting on it start after it
+GPUState SimulatedExecutor::execute_batch(const std::vector<KernelDispatch> &kernels,
+                                          const DispatchType &dispatch_type,
+                                          std::vector<std::function<void()>> &cpu_callbacks, size_t queue) {
+    if (cpu_callbacks.size() != kernels.size()) {
+        throw std::runtime_error("A batch needs exactly one completion callback per kernel");
+    }
+
+    std::vector<std::function<void()>> timed_callbacks;
+    for (size_t i = 0; i < kernels.size(); ++i) {
+        bool launch = dispatch_type == DispatchType::Serial || i == 0;
+
+        timed_callbacks.push_back([this, kernel = kernels[i], launch, queue, cpu_callback = cpu_callbacks[i]] {
+            std::chrono::nanoseconds completion = schedule_kernel(kernel, launch, queue);
+            if (kernel.signal_event) {
+                kernel.signal_event->device_timeline = this;
+                kernel.signal_event->device_value = completion.count();
+            }
+
+            pace(completion);
+            cpu_callback();
+        });
+    }
+
+    return HostExecutor::execute_batch(kernels, dispatch_type, timed_callbacks, queue);
+}
+
+SimulatedDeviceStats SimulatedExecutor::get_simulated_stats() const {
+    std::lock_guard<std::mutex> lock(clock_mut_);
+    return stats_;
+}
+
+void SimulatedExecutor::reset_clock() {
+    std::lock_guard<std::mutex> lock(clock_mut_);
+    copy_clock_ = std::chrono::nanoseconds(0);
+    std::fill(compute_clocks_.begin(), compute_clocks_.end(), std::chrono::nanoseconds(0));
+    stats_ = SimulatedDeviceStats();
+    epoch_ = std::chrono::steady_clock::now();
+}
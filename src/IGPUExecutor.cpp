@@ -2,209 +2,509 @@
 #include "DataManager.h"
 #include <algorithm>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <stdexcept>
+#include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
-IGPUExecutor::GPUMemoryAllocator::GPUMemoryAllocator(size_t devloc_min_size, size_t devloc_max_size,
-                                                     size_t unified_min_size, size_t unified_max_size,
-                                                     size_t hostvis_min_size, size_t hostvis_max_size) {
-    devloc_min_order = (int)log2(next_pow2(devloc_min_size));
-    devloc_max_order = (int)log2(next_pow2(devloc_max_size));
-    unified_min_order = (int)log2(next_pow2(unified_min_size));
-    unified_max_order = (int)log2(next_pow2(unified_max_size));
-    hostvis_min_order = (int)log2(next_pow2(hostvis_min_size));
-    hostvis_max_order = (int)log2(next_pow2(hostvis_max_size));
+IGPUExecutor::GPUMemoryAllocator::BlockBitmap::BlockBitmap(size_t num_bits) {
+    // Always keep at least one level so test() and find_first() never index an empty vector
+    size_t num_words = std::max<size_t>((num_bits + 63) / 64, 1);
+    levels_.emplace_back(num_words, 0);
 
-    devloc_free_mask = (1ULL << devloc_max_order);
-    unified_free_mask = (1ULL << unified_max_order);
-    hostvis_free_mask = (1ULL << hostvis_max_order);
+    while (num_words > 1) {
+        num_words = (num_words + 63) / 64;
+        levels_.emplace_back(num_words, 0);
+    }
+}
 
-    devloc_size_address[devloc_max_order].push_back(0);
-    devloc_free_map[devloc_max_order][0] = 0;
+void IGPUExecutor::GPUMemoryAllocator::BlockBitmap::set(size_t index) {
+    if (test(index)) {
+        return;
+    }
+    count_++;
 
-    unified_size_address[unified_max_order].push_back(0);
-    unified_free_map[unified_max_order][0] = 0;
+    // Only the first bit set in a word has to be propagated to the summary levels
+    for (std::vector<uint64_t> &level : levels_) {
+        uint64_t &word = level[index / 64];
+        bool was_empty = word == 0;
+        word |= 1ULL << (index % 64);
 
-    hostvis_size_address[hostvis_max_order].push_back(0);
-    hostvis_free_map[hostvis_max_order][0] = 0;
-};
+        if (!was_empty) {
+            break;
+        }
+        index /= 64;
+    }
+}
 
-IGPUExecutor::GPUMemoryAllocator::GPUMemoryAllocator() : GPUMemoryAllocator(0, 0, 0, 0, 0, 0) {};
+void IGPUExecutor::GPUMemoryAllocator::BlockBitmap::reset(size_t index) {
+    if (!test(index)) {
+        return;
+    }
+    count_--;
 
-void IGPUExecutor::GPUMemoryAllocator::init_mem_types(
-    uint64_t *&free_mask, std::unordered_map<uint8_t, std::vector<size_t>> *&size_address,
-    std::unordered_map<size_t, std::unordered_map<size_t, size_t>> *&free_map, MemoryHint mem_hint) {
-    // Fetch the relevant instance variables based on memory hint
-    switch (mem_hint) {
-    case MemoryHint::Unified:
-        if (unified_max_order == 0) {
-            throw std::runtime_error("Tried to allocate memory of invalid type: Unified");
-        }
+    // Likewise only a word becoming empty clears its summary bit
+    for (std::vector<uint64_t> &level : levels_) {
+        uint64_t &word = level[index / 64];
+        word &= ~(1ULL << (index % 64));
 
-        free_mask = &unified_free_mask;
-        size_address = &unified_size_address;
-        free_map = &unified_free_map;
-        break;
-    case MemoryHint::HostVisible:
-        if (hostvis_max_order == 0) {
-            throw std::runtime_error("Tried to allocate memory of invalid type: HostVisible");
+        if (word != 0) {
+            break;
         }
+        index /= 64;
+    }
+}
 
-        free_mask = &hostvis_free_mask;
-        size_address = &hostvis_size_address;
-        free_map = &hostvis_free_map;
-        break;
-    case MemoryHint::DeviceLocal:
-        if (devloc_max_order == 0) {
-            throw std::runtime_error("Tried to allocate memory of invalid type: DeviceLocal");
+// Descends from the single top word, each level narrows the search to one word of the level below
+size_t IGPUExecutor::GPUMemoryAllocator::BlockBitmap::find_first() const {
+    size_t index = 0;
+    for (auto level = levels_.rbegin(); level != levels_.rend(); ++level) {
+        uint64_t word = (*level)[index];
+        if (word == 0) {
+            throw std::runtime_error("Searched an empty block bitmap");
         }
 
-        free_mask = &devloc_free_mask;
-        size_address = &devloc_size_address;
-        free_map = &devloc_free_map;
-        break;
+        index = index * 64 + __builtin_ctzll(word);
     }
+
+    return index;
 }
 
-size_t IGPUExecutor::GPUMemoryAllocator::allocate_memory(size_t mem_size, MemoryHint mem_hint) {
-    // Find the minimum order (power of 2 memory size block) where this can be stored
-    size_t order = (int)log2(next_pow2(mem_size));
+IGPUExecutor::GPUMemoryAllocator::BuddyRegion IGPUExecutor::GPUMemoryAllocator::make_region(size_t min_size,
+                                                                                             size_t max_size) {
+    BuddyRegion region;
+    region.max_order = size_order(max_size);
+    region.min_order = std::min(size_order(min_size), region.max_order);
+
+    // A zero order region marks the memory class as unavailable
+    if (region.max_order == 0) {
+        return region;
+    }
+
+    for (size_t order = region.min_order; order <= region.max_order; ++order) {
+        region.free_blocks.emplace_back(1ULL << (region.max_order - order));
+        region.live_blocks.emplace_back(1ULL << (region.max_order - order));
+    }
+
+    // The whole slab starts as one free block
+    give_block(region, region.max_order, 0);
 
-    // Fetch the relevant instance variables based on memory hint
-    uint64_t *free_mask = nullptr;
-    std::unordered_map<uint8_t, std::vector<size_t>> *size_address = nullptr;
-    std::unordered_map<size_t, std::unordered_map<size_t, size_t>> *free_map = nullptr;
-    init_mem_types(free_mask, size_address, free_map, mem_hint);
+    return region;
+}
 
-    size_t min_order = 0;
+IGPUExecutor::GPUMemoryAllocator::GPUMemoryAllocator(size_t devloc_min_size, size_t devloc_max_size,
+                                                     size_t unified_min_size, size_t unified_max_size,
+                                                     size_t hostvis_min_size, size_t hostvis_max_size)
+    : devloc_region_(make_region(devloc_min_size, devloc_max_size)),
+      unified_region_(make_region(unified_min_size, unified_max_size)),
+      hostvis_region_(make_region(hostvis_min_size, hostvis_max_size)) {};
+
+IGPUExecutor::GPUMemoryAllocator::GPUMemoryAllocator() : GPUMemoryAllocator(0, 0, 0, 0, 0, 0) {};
+
+const IGPUExecutor::GPUMemoryAllocator::BuddyRegion &
+IGPUExecutor::GPUMemoryAllocator::region(MemoryHint mem_hint) const {
     switch (mem_hint) {
     case MemoryHint::DeviceLocal:
-        min_order = devloc_min_order;
-        break;
+        return devloc_region_;
     case MemoryHint::Unified:
-        min_order = unified_min_order;
-        break;
+        return unified_region_;
     case MemoryHint::HostVisible:
-        min_order = hostvis_min_order;
-        break;
+        return hostvis_region_;
     default:
         throw std::runtime_error("Tried to work with memory of invalid type");
     }
-    min_order = std::max(min_order, order);
+}
 
-    uint64_t search_mask = (*free_mask) & ~((1ULL << order) - 1);
-    // std::cout << "Free mask before alloc: " << std::bitset<64>(*free_mask) << std::endl;
-    //    std::cout << "Search mask: " << std::bitset<64>(search_mask) << std::endl;
-    if (search_mask == 0) {
-        // Find some way to more effectively handle being out of memory
-        // Some sort of futures system or multithreading?
+IGPUExecutor::GPUMemoryAllocator::BuddyRegion &IGPUExecutor::GPUMemoryAllocator::region(MemoryHint mem_hint) {
+    return const_cast<BuddyRegion &>(std::as_const(*this).region(mem_hint));
+}
+
+IGPUExecutor::GPUMemoryAllocator::BuddyRegion &IGPUExecutor::GPUMemoryAllocator::valid_region(MemoryHint mem_hint) {
+    BuddyRegion &mem_region = region(mem_hint);
+    if (mem_region.max_order != 0) {
+        return mem_region;
+    }
+
+    switch (mem_hint) {
+    case MemoryHint::Unified:
+        throw std::runtime_error("Tried to allocate memory of invalid type: Unified");
+    case MemoryHint::HostVisible:
+        throw std::runtime_error("Tried to allocate memory of invalid type: HostVisible");
+    default:
+        throw std::runtime_error("Tried to allocate memory of invalid type: DeviceLocal");
+    }
+}
+
+size_t IGPUExecutor::GPUMemoryAllocator::free_block_count(MemoryHint mem_hint, size_t order) const {
+    const BuddyRegion &mem_region = region(mem_hint);
+    if (mem_region.max_order == 0 || order < mem_region.min_order || order > mem_region.max_order) {
+        return 0;
+    }
+
+    return mem_region.free_blocks[order - mem_region.min_order].count();
+}
+
+void IGPUExecutor::GPUMemoryAllocator::take_block(BuddyRegion &region, size_t order, size_t block) {
+    BlockBitmap &free_blocks = region.free_blocks[order - region.min_order];
+    free_blocks.reset(block);
+
+    // Unmark the order as free once its last block is gone
+    if (free_blocks.count() == 0) {
+        region.free_mask &= ~(1ULL << order);
+    }
+}
+
+void IGPUExecutor::GPUMemoryAllocator::give_block(BuddyRegion &region, size_t order, size_t block) {
+    region.free_blocks[order - region.min_order].set(block);
+    region.free_mask |= 1ULL << order;
+}
+
+GPUBufferHandle IGPUExecutor::allocate_buffer(std::size_t buffer_size, const MemoryHint mem_hint) {
+    std::optional<GPUBufferHandle> buffer_handle = try_allocate_buffer(buffer_size, mem_hint);
+    if (!buffer_handle) {
         throw std::runtime_error("No space available on GPU for block size!");
     }
 
-    int next_free_order = __builtin_ctzll(search_mask);
-    size_t next_free_addr = (*size_address)[next_free_order].back();
+    return *buffer_handle;
+}
+
+std::shared_ptr<GPUEvent> GPUEvent::signalled() {
+    std::shared_ptr<GPUEvent> event = std::make_shared<GPUEvent>();
+    event->signal();
+    return event;
+}
+
+bool GPUEvent::is_signalled() const {
+    std::lock_guard<std::mutex> lock(event_mut_);
+    return signalled_;
+}
+
+void GPUEvent::wait() const {
+    std::unique_lock<std::mutex> lock(event_mut_);
+    event_cv_.wait(lock, [this] { return signalled_; });
+}
+
+// Waiters are only released once every callback has run, so a wait also covers the work chained on the event
+void GPUEvent::signal() {
+    while (true) {
+        std::vector<std::function<void()>> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(event_mut_);
+            if (signal_callbacks_.empty()) {
+                signalled_ = true;
+                break;
+            }
+            callbacks.swap(signal_callbacks_);
+        }
+
+        // Callbacks run outside the lock, they may well wait on or chain further events
+        for (std::function<void()> &callback : callbacks) {
+            callback();
+        }
+    }
+
+    event_cv_.notify_all();
+}
+
+void GPUEvent::on_signal(std::function<void()> callback) {
+    {
+        std::lock_guard<std::mutex> lock(event_mut_);
+        if (!signalled_) {
+            signal_callbacks_.push_back(std::move(callback));
+            return;
+        }
+    }
+
+    callback();
+}
+
+std::shared_ptr<GPUEvent> IGPUExecutor::copy_to_device_async(const std::vector<BufferCopy> &copies) {
+    if (copy_to_device_batch(copies) != GPUState::GPUSuccess) {
+        throw std::runtime_error("Failed to copy data to the device");
+    }
+
+    return GPUEvent::signalled();
+}
+
+std::shared_ptr<GPUEvent> IGPUExecutor::copy_from_device_async(std::span<std::byte> data_mem,
+                                                               const GPUBufferHandle &buffer_handle) {
+    if (copy_from_device(data_mem, buffer_handle) != GPUState::GPUSuccess) {
+        throw std::runtime_error("Failed to copy data from the device");
+    }
+
+    return GPUEvent::signalled();
+}
 
-    // Free the newly created split at next_free_addr
-    //    std::cout << "size addr size before: " << (*size_address)[next_free_order].size() << std::endl;
-    //    std::cout << "free map size before: " << (*free_map)[next_free_order].size() << std::endl;
-    (*size_address)[next_free_order].pop_back();
-    (*free_map)[next_free_order].erase(next_free_addr);
+std::vector<std::string> IGPUExecutor::prepare_kernels(const std::vector<std::string> &kernel_names) {
+    std::vector<std::string> missing_kernels;
 
-    // Unmark the previous order as free if necessary
-    if ((*size_address)[next_free_order].empty()) {
-        (*free_mask) &= (~(1ULL << next_free_order));
+    for (const std::string &kernel_name : kernel_names) {
+        if (kernel_status_[kernel_name]) {
+            continue;
+        }
+
+        kernel_status_[kernel_name] = prepare_kernel(kernel_name);
+        if (!kernel_status_[kernel_name] &&
+            std::find(missing_kernels.begin(), missing_kernels.end(), kernel_name) == missing_kernels.end()) {
+            missing_kernels.push_back(kernel_name);
+        }
     }
 
-    // Break down the buddy addresses to provide space
-    //   std::cout << "next free order: " << next_free_order << std::endl;
-    //    std::cout << "end order: " << order << std::endl;
-    for (int cur_order = next_free_order; min_order < cur_order; cur_order--) {
-        int split_order = cur_order - 1;
+    return missing_kernels;
+}
 
-        // Add both blocks to their respective free lists
-        size_t right_addr = next_free_addr + (1ULL << (split_order));
-        (*size_address)[split_order].push_back(right_addr);
+GPUState IGPUExecutor::copy_to_device_batch(const std::vector<BufferCopy> &copies) {
+    for (const BufferCopy &copy : copies) {
+        GPUState copy_state = copy_to_device(copy.data_mem, copy.buffer_handle);
+        if (copy_state != GPUState::GPUSuccess) {
+            return copy_state;
+        }
+    }
 
-        // Assign the right address be free in the free map
-        (*free_map)[split_order][right_addr] = (*size_address)[split_order].size() - 1;
+    return GPUState::GPUSuccess;
+}
 
-        // Mark the current order as containing a free block
-        (*free_mask) |= (1ULL << (split_order));
+size_t IGPUExecutor::GPUMemoryAllocator::allocate_memory(size_t mem_size, MemoryHint mem_hint) {
+    std::optional<size_t> offset = try_allocate_memory(mem_size, mem_hint);
+    if (!offset) {
+        throw std::runtime_error("No space available on GPU for block size!");
     }
 
-    //  std::cout << "Free mask after alloc: " << std::bitset<64>(*free_mask) << std::endl;
-    //    std::cout << "size addr size after: " << (*size_address)[next_free_order].size() << std::endl;
-    //    std::cout << "free map size after: " << (*free_map)[next_free_order].size() << std::endl;
-    return next_free_addr;
+    return *offset;
+}
+
+std::optional<size_t> IGPUExecutor::GPUMemoryAllocator::try_allocate_memory(size_t mem_size, MemoryHint mem_hint) {
+    BuddyRegion &mem_region = valid_region(mem_hint);
+
+    // Find the minimum order (power of 2 memory size block) where this can be stored
+    // Blocks larger than the slab can never be satisfied, so waiting on frees would never end
+    size_t order = std::max(mem_region.min_order, size_order(mem_size));
+    if (order > mem_region.max_order) {
+        mem_region.failed_allocations++;
+        record(TraceOp::Failed, mem_hint, mem_size, 0);
+        throw std::runtime_error("No space available on GPU for block size!");
+    }
+
+    uint64_t search_mask = mem_region.free_mask & ~((1ULL << order) - 1);
+    if (search_mask == 0) {
+        mem_region.failed_allocations++;
+        record(TraceOp::Failed, mem_hint, mem_size, 0);
+        return std::nullopt;
+    }
+
+    // Lowest address of the smallest order that fits, keeping allocations packed towards the start of the slab
+    size_t free_order = __builtin_ctzll(search_mask);
+    size_t block = mem_region.free_blocks[free_order - mem_region.min_order].find_first();
+    take_block(mem_region, free_order, block);
+
+    // Split down to the requested order, keeping the left half and freeing each right buddy
+    for (size_t cur_order = free_order; cur_order > order; --cur_order) {
+        block <<= 1;
+        give_block(mem_region, cur_order - 1, block | 1);
+    }
+    mem_region.live_blocks[order - mem_region.min_order].set(block);
+
+    mem_region.live_bytes += 1ULL << order;
+    mem_region.requested_bytes += mem_size;
+    mem_region.live_allocations++;
+    mem_region.peak_bytes = std::max(mem_region.peak_bytes, mem_region.live_bytes);
+
+    size_t offset = block << order;
+    record(TraceOp::Alloc, mem_hint, mem_size, offset);
+
+    return offset;
 }
 
 void IGPUExecutor::GPUMemoryAllocator::check_free_mem(size_t mem_size, size_t offset, MemoryHint mem_hint) {
-    // Fetch the relevant instance variables based on memory hint
-    uint64_t *free_mask = nullptr;
-    std::unordered_map<uint8_t, std::vector<size_t>> *size_address = nullptr;
-    std::unordered_map<size_t, std::unordered_map<size_t, size_t>> *free_map = nullptr;
-    init_mem_types(free_mask, size_address, free_map, mem_hint);
+    BuddyRegion &mem_region = valid_region(mem_hint);
 
-    size_t max_order = 0;
-    switch (mem_hint) {
-    case MemoryHint::DeviceLocal:
-        max_order = devloc_max_order;
-        break;
-    case MemoryHint::Unified:
-        max_order = unified_max_order;
-        break;
-    case MemoryHint::HostVisible:
-        max_order = hostvis_max_order;
-        break;
-    default:
-        throw std::runtime_error("Tried to work with memory of invalid type");
+    // Allocations below the minimum were rounded up, so they are freed at the same order
+    size_t order = std::max(mem_region.min_order, size_order(mem_size));
+    if (order > mem_region.max_order || offset % (1ULL << order) != 0 || offset >= (1ULL << mem_region.max_order)) {
+        throw std::runtime_error("Attempted to free memory that was never allocated");
+    }
+
+    // Catch if a double free occurs, either the block itself or a block it was merged into is already free
+    for (size_t cur_order = order; cur_order <= mem_region.max_order; ++cur_order) {
+        if (mem_region.free_blocks[cur_order - mem_region.min_order].test(offset >> cur_order)) {
+            throw std::runtime_error("CRITICAL: Attempted to free memory twice");
+        }
+    }
+
+    // The block must have been handed out at exactly this order, not be part of or contain a larger/smaller one
+    size_t block = offset >> order;
+    BlockBitmap &live_blocks = mem_region.live_blocks[order - mem_region.min_order];
+    if (!live_blocks.test(block)) {
+        throw std::runtime_error("Attempted to free memory that was never allocated at that size");
+    }
+    live_blocks.reset(block);
+
+    mem_region.live_bytes -= 1ULL << order;
+    mem_region.requested_bytes -= mem_size;
+    mem_region.live_allocations--;
+    record(TraceOp::Free, mem_hint, mem_size, offset);
+
+    // Merge upwards while the buddy is free
+    while (order < mem_region.max_order && mem_region.free_blocks[order - mem_region.min_order].test(block ^ 1)) {
+        take_block(mem_region, order, block ^ 1);
+        block >>= 1;
+        order++;
     }
 
-    // std::cout << "free mask before free: " << std::bitset<64>(*free_mask) << std::endl;
+    give_block(mem_region, order, block);
+}
 
-    size_t new_free_addr = offset;
-    size_t cur_order = (int)log2(next_pow2(mem_size));
+IGPUExecutor::GPUMemoryAllocator::AllocatorStats
+IGPUExecutor::GPUMemoryAllocator::get_stats(MemoryHint mem_hint) const {
+    const BuddyRegion &mem_region = region(mem_hint);
 
-    // Catch if a double free occurs
-    if ((*free_map)[cur_order].find(new_free_addr) != (*free_map)[cur_order].end()) {
-        throw std::runtime_error("CRITICAL: Attempted to free memory twice");
+    AllocatorStats stats;
+    stats.failed_allocations = mem_region.failed_allocations;
+    if (mem_region.max_order == 0) {
+        return stats;
     }
 
-    while (cur_order < max_order) {
-        size_t buddy_address = new_free_addr ^ (1ULL << (cur_order));
-        //   std::cout << "buddy address: " << buddy_address << std::endl;
+    stats.capacity_bytes = 1ULL << mem_region.max_order;
+    stats.live_bytes = mem_region.live_bytes;
+    stats.requested_bytes = mem_region.requested_bytes;
+    stats.peak_bytes = mem_region.peak_bytes;
+    stats.live_allocations = mem_region.live_allocations;
 
-        // Check if merging can begin
-        if ((*free_map)[cur_order].find(buddy_address) == (*free_map)[cur_order].end()) {
-            //     std::cout << "did not find buddy" << std::endl;
-            break;
+    // free_mask has the bit of every order holding a free block, so its highest bit is the largest free block
+    if (mem_region.free_mask != 0) {
+        stats.largest_free_block = 1ULL << (63 - __builtin_clzll(mem_region.free_mask));
+    }
+
+    stats.free_bytes_per_order.resize(mem_region.max_order + 1, 0);
+    for (size_t order = mem_region.min_order; order <= mem_region.max_order; ++order) {
+        stats.free_bytes_per_order[order] = mem_region.free_blocks[order - mem_region.min_order].count() << order;
+    }
+
+    if (stats.live_bytes > 0) {
+        stats.internal_fragmentation = 1.0 - static_cast<double>(stats.requested_bytes) / stats.live_bytes;
+    }
+
+    return stats;
+}
+
+void IGPUExecutor::GPUMemoryAllocator::reset_peak(MemoryHint mem_hint) {
+    BuddyRegion &mem_region = region(mem_hint);
+    mem_region.peak_bytes = mem_region.live_bytes;
+}
+
+void IGPUExecutor::GPUMemoryAllocator::set_tracing(bool tracing) {
+    tracing_ = tracing;
+    if (!tracing_) {
+        trace_ids_.clear();
+    }
+}
+
+void IGPUExecutor::GPUMemoryAllocator::record(TraceOp op, MemoryHint mem_hint, size_t size, size_t offset) {
+    if (!tracing_) {
+        return;
+    }
+
+    // Frees of blocks allocated before tracing started have no id to pair with, so the replay skips them
+    size_t id = next_trace_id_;
+    if (op == TraceOp::Alloc) {
+        trace_ids_[mem_hint][offset] = next_trace_id_++;
+    } else if (op == TraceOp::Free) {
+        auto id_iter = trace_ids_[mem_hint].find(offset);
+        if (id_iter == trace_ids_[mem_hint].end()) {
+            return;
         }
-        //  std::cout << "found buddy" << std::endl;
 
-        // Remove buddy from list and map
-        int buddy_order_idx = (*free_map)[cur_order][buddy_address];
-        size_t last_elem = (*size_address)[cur_order].back();
+        id = id_iter->second;
+        trace_ids_[mem_hint].erase(id_iter);
+    } else {
+        next_trace_id_++;
+    }
 
-        // Swap and pop buddy with back element
-        (*size_address)[cur_order][buddy_order_idx] = last_elem;
-        (*free_map)[cur_order][last_elem] = buddy_order_idx;
-        (*size_address)[cur_order].pop_back();
-        (*free_map)[cur_order].erase(buddy_address);
+    trace_.push_back({op, mem_hint, id, size, offset});
+}
+
+static const char *trace_op_name(IGPUExecutor::GPUMemoryAllocator::TraceOp op) {
+    switch (op) {
+    case IGPUExecutor::GPUMemoryAllocator::TraceOp::Alloc:
+        return "alloc";
+    case IGPUExecutor::GPUMemoryAllocator::TraceOp::Free:
+        return "free";
+    default:
+        return "failed";
+    }
+}
 
-        // Prepare for next iteration
-        if ((*size_address)[cur_order].empty()) {
-            (*free_mask) &= (~(1ULL << cur_order));
+static const char *mem_hint_name(MemoryHint mem_hint) {
+    switch (mem_hint) {
+    case MemoryHint::DeviceLocal:
+        return "DeviceLocal";
+    case MemoryHint::Unified:
+        return "Unified";
+    default:
+        return "HostVisible";
+    }
+}
+
+// CSV with one event per line: op,memory,id,size,offset
+void IGPUExecutor::GPUMemoryAllocator::write_trace(std::ostream &out) const {
+    out << "op,memory,id,size,offset\n";
+    for (const TraceEvent &event : trace_) {
+        out << trace_op_name(event.op) << ',' << mem_hint_name(event.mem_hint) << ',' << event.id << ','
+            << event.size << ',' << event.offset << '\n';
+    }
+}
+
+std::vector<IGPUExecutor::GPUMemoryAllocator::TraceEvent> IGPUExecutor::GPUMemoryAllocator::read_trace(
+    std::istream &in) {
+    std::vector<TraceEvent> trace;
+    std::string line;
+    std::getline(in, line);
+
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+
+        std::stringstream line_stream(line);
+        std::string op_name, hint_name, id, size, offset;
+        std::getline(line_stream, op_name, ',');
+        std::getline(line_stream, hint_name, ',');
+        std::getline(line_stream, id, ',');
+        std::getline(line_stream, size, ',');
+        std::getline(line_stream, offset, ',');
+
+        TraceEvent event;
+        if (op_name == "alloc") {
+            event.op = TraceOp::Alloc;
+        } else if (op_name == "free") {
+            event.op = TraceOp::Free;
+        } else if (op_name == "failed") {
+            event.op = TraceOp::Failed;
+        } else {
+            throw std::runtime_error("Unknown allocation trace op: " + op_name);
         }
-        if (buddy_address < new_free_addr) {
-            new_free_addr = buddy_address;
+
+        if (hint_name == "DeviceLocal") {
+            event.mem_hint = MemoryHint::DeviceLocal;
+        } else if (hint_name == "Unified") {
+            event.mem_hint = MemoryHint::Unified;
+        } else if (hint_name == "HostVisible") {
+            event.mem_hint = MemoryHint::HostVisible;
+        } else {
+            throw std::runtime_error("Unknown allocation trace memory type: " + hint_name);
         }
 
-        cur_order++;
+        event.id = std::stoull(id);
+        event.size = std::stoull(size);
+        event.offset = std::stoull(offset);
+        trace.push_back(event);
     }
 
-    // Mark as free memory after merging complete
-    (*size_address)[cur_order].push_back(new_free_addr);
-    (*free_map)[cur_order][new_free_addr] = (*size_address)[cur_order].size() - 1;
-    (*free_mask) |= (1ULL << cur_order);
-    // std::cout << "free mask after free: " << std::bitset<64>(*free_mask) << std::endl;
+    return trace;
 }
@@ -0,0 +1,30 @@
+#include "Json.h"
+#include <cstdio>
+#include <ostream>
+#include <string_view>
+
+void write_json_string(std::ostream &out, std::string_view text) {
+    out << '"';
+    for (char character : text) {
+        switch (character) {
+        case '"':
+            out << "\\\"";
+            break;
+        case '\\':
+            out << "\\\\";
+            break;
+        case '\n':
+            out << "\\n";
+            break;
+        default:
+            if (static_cast<unsigned char>(character) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+                out << escaped;
+            } else {
+                out << character;
+            }
+        }
+    }
+    out << '"';
+}
@@ -0,0 +1,220 @@
+#include "LaunchConfig.h"
+#include "DataManager.h"
+#include "IGPUExecutor.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+LaunchConfig make_launch(const std::vector<int> &shape, const std::vector<int> &block_dim) {
+    size_t num_dims = std::clamp<size_t>(shape.size(), 1, 3);
+    LaunchConfig launch{{1, 1, 1}, {1, 1, 1}};
+
+    for (size_t dim = 0; dim < 3; ++dim) {
+        int block = dim < block_dim.size() ? std::max(block_dim[dim], 1) : 1;
+        if (dim < num_dims) {
+            launch.block_dim[dim] = block;
+        } else {
+            launch.block_dim[num_dims - 1] *= block;
+        }
+    }
+
+    for (size_t dim = 0; dim < num_dims; ++dim) {
+        int extent = dim < shape.size() ? std::max(shape[dim], 0) : 1;
+        launch.grid_dim[dim] = (extent + launch.block_dim[dim] - 1) / launch.block_dim[dim];
+    }
+
+    return launch;
+}
+
+// Warp/SIMD-group multiples up to 1024 threads, the usual per-block limit
+std::vector<std::vector<int>> LaunchTuner::candidate_blocks(size_t num_dims) {
+    switch (num_dims) {
+    case 0:
+    case 1:
+        return {{32}, {64}, {128}, {256}, {512}, {1024}};
+    case 2:
+        return {{8, 8}, {16, 8}, {32, 4}, {16, 16}, {32, 8}, {32, 16}, {32, 32}};
+    default:
+        return {{4, 4, 4}, {8, 4, 4}, {8, 8, 4}, {8, 8, 8}, {16, 8, 4}, {16, 8, 8}};
+    }
+}
+
+size_t LaunchTuner::size_bucket(const std::vector<int> &shape) {
+    uint64_t num_threads = 1;
+    for (int extent : shape) {
+        num_threads *= std::max(extent, 1);
+    }
+
+    return std::bit_width(num_threads);
+}
+
+LaunchTuner::TuningKey LaunchTuner::make_key(const std::string &kernel_name, const std::vector<int> &shape) {
+    return {kernel_name, std::clamp<size_t>(shape.size(), 1, 3), size_bucket(shape)};
+}
+
+std::vector<int> LaunchTuner::select_block(IGPUExecutor &gpu_executor, const KernelDispatch &kernel,
+                                           const std::vector<int> &shape, const std::vector<int> &default_block) {
+    TuningKey key = make_key(kernel.kernel_name, shape);
+    {
+        std::lock_guard<std::mutex> lock(tuner_mut_);
+        auto tuned_iter = tuned_blocks_.find(key);
+        if (tuned_iter != tuned_blocks_.end()) {
+            return tuned_iter->second;
+        }
+    }
+
+    std::optional<std::vector<int>> tuned_block = tune(gpu_executor, kernel, shape, default_block);
+    if (!tuned_block) {
+        return default_block;
+    }
+
+    std::lock_guard<std::mutex> lock(tuner_mut_);
+    tuned_blocks_[key] = *tuned_block;
+    return *tuned_block;
+}
+
+std::optional<std::vector<int>> LaunchTuner::tune(IGPUExecutor &gpu_executor, const KernelDispatch &kernel,
+                                                  const std::vector<int> &shape,
+                                                  const std::vector<int> &default_block) {
+    // Zero filled scratch copies of every bound buffer, counters and indices read by the kernel stay in bounds
+    std::vector<GPUBufferHandle> scratch_buffers;
+    auto release_scratch = [&] {
+        for (auto buffer_iter = scratch_buffers.rbegin(); buffer_iter != scratch_buffers.rend(); ++buffer_iter) {
+            gpu_executor.deallocate_buffer(*buffer_iter);
+        }
+    };
+
+    size_t max_buffer_size = 0;
+    for (const GPUBufferHandle &buffer_handle : kernel.buffer_handles) {
+        std::optional<GPUBufferHandle> scratch_buffer =
+            gpu_executor.try_allocate_buffer(buffer_handle.size, buffer_handle.mem_hint);
+        if (!scratch_buffer) {
+            release_scratch();
+            return std::nullopt;
+        }
+
+        scratch_buffers.push_back(*scratch_buffer);
+        max_buffer_size = std::max(max_buffer_size, buffer_handle.size);
+    }
+
+    std::vector<std::byte> zeros(max_buffer_size);
+    std::vector<BufferCopy> zero_copies;
+    for (const GPUBufferHandle &scratch_buffer : scratch_buffers) {
+        zero_copies.push_back({std::span<const std::byte>(zeros).first(scratch_buffer.size), scratch_buffer});
+    }
+    gpu_executor.copy_to_device_batch(zero_copies);
+
+    // Work already queued on the device would otherwise be timed along with the first candidate
+    gpu_executor.synchronize();
+
+    std::vector<std::vector<int>> candidates = {default_block};
+    size_t max_threads = gpu_executor.max_block_threads(kernel.kernel_name);
+    for (const std::vector<int> &candidate : candidate_blocks(shape.size())) {
+        if (std::accumulate(candidate.begin(), candidate.end(), size_t(1), std::multiplies<size_t>()) <= max_threads) {
+            candidates.push_back(candidate);
+        }
+    }
+
+    std::vector<int> best_block = default_block;
+    std::chrono::nanoseconds best_time = std::chrono::nanoseconds::max();
+    std::function<void()> callback = [] {};
+    for (const std::vector<int> &candidate : candidates) {
+        LaunchConfig launch = make_launch(shape, candidate);
+        KernelDispatch trial(kernel.kernel_name, scratch_buffers, launch.grid_dim, launch.block_dim);
+
+        for (int repeat = 0; repeat < TUNING_REPEATS; ++repeat) {
+            auto start = std::chrono::steady_clock::now();
+            gpu_executor.execute_kernel(trial, callback);
+            gpu_executor.synchronize();
+            std::chrono::nanoseconds trial_time = std::chrono::steady_clock::now() - start;
+
+            if (trial_time < best_time) {
+                best_time = trial_time;
+                best_block = candidate;
+            }
+        }
+    }
+
+    release_scratch();
+    return best_block;
+}
+
+bool LaunchTuner::contains(const std::string &kernel_name, const std::vector<int> &shape) const {
+    std::lock_guard<std::mutex> lock(tuner_mut_);
+    return tuned_blocks_.find(make_key(kernel_name, shape)) != tuned_blocks_.end();
+}
+
+size_t LaunchTuner::size() const {
+    std::lock_guard<std::mutex> lock(tuner_mut_);
+    return tuned_blocks_.size();
+}
+
+void LaunchTuner::write_cache(std::ostream &out) const {
+    std::lock_guard<std::mutex> lock(tuner_mut_);
+
+    out << "kernel,dims,bucket,block_x,block_y,block_z\n";
+    for (const auto &[key, block] : tuned_blocks_) {
+        const auto &[kernel_name, num_dims, bucket] = key;
+        out << kernel_name << ',' << num_dims << ',' << bucket;
+        for (size_t dim = 0; dim < 3; ++dim) {
+            out << ',' << (dim < block.size() ? block[dim] : 1);
+        }
+        out << '\n';
+    }
+}
+
+void LaunchTuner::read_cache(std::istream &in) {
+    std::lock_guard<std::mutex> lock(tuner_mut_);
+    std::string line;
+    std::getline(in, line);
+
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+
+        std::stringstream line_stream(line);
+        std::vector<std::string> fields;
+        std::string field;
+        while (std::getline(line_stream, field, ',')) {
+            fields.push_back(field);
+        }
+        if (fields.size() != 6) {
+            throw std::runtime_error("Malformed launch cache line: " + line);
+        }
+
+        size_t num_dims = std::stoul(fields[1]);
+        std::vector<int> block = {std::stoi(fields[3]), std::stoi(fields[4]), std::stoi(fields[5])};
+        block.resize(std::clamp<size_t>(num_dims, 1, 3));
+        tuned_blocks_[{fields[0], num_dims, std::stoul(fields[2])}] = block;
+    }
+}
+
+void LaunchTuner::load(const std::string &path) {
+    std::ifstream in(path);
+    if (in) {
+        read_cache(in);
+    }
+}
+
+void LaunchTuner::save(const std::string &path) const {
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Failed to open the launch cache file: " + path);
+    }
+
+    write_cache(out);
+}
@@ -0,0 +1,120 @@
+#include "MappedFile.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+// 2MB is the common huge page size on both x86_64 and arm64 Linux
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Reserves an address range large enough to carve out a huge page aligned window, then maps the file over it
+static void *map_huge_aligned(int fd, size_t length, int prot, int flags) {
+    size_t reserve_length = length + HUGE_PAGE_SIZE;
+    void *reserved = mmap(nullptr, reserve_length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+
+    uintptr_t reserved_addr = reinterpret_cast<uintptr_t>(reserved);
+    uintptr_t aligned_addr = (reserved_addr + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+    void *mapped = mmap(reinterpret_cast<void *>(aligned_addr), length, prot, flags | MAP_FIXED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        // Reported by the caller, so keep it past the cleanup
+        int map_errno = errno;
+        munmap(reserved, reserve_length);
+        errno = map_errno;
+        return MAP_FAILED;
+    }
+
+    // Give back the unused slack on either side of the aligned window
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t mapped_end = aligned_addr + ((length + page_size - 1) & ~(page_size - 1));
+    if (aligned_addr > reserved_addr) {
+        munmap(reserved, aligned_addr - reserved_addr);
+    }
+    if (reserved_addr + reserve_length > mapped_end) {
+        munmap(reinterpret_cast<void *>(mapped_end), reserved_addr + reserve_length - mapped_end);
+    }
+
+#ifdef MADV_HUGEPAGE
+    madvise(mapped, length, MADV_HUGEPAGE);
+#endif
+
+    return mapped;
+}
+
+MappedFile::MappedFile(const std::string &path, const MappedFileOptions &options) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file for mapping: " + path + " (" + std::strerror(errno) + ")");
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        int stat_errno = errno;
+        close(fd);
+        throw std::runtime_error("Failed to stat file for mapping: " + path + " (" + std::strerror(stat_errno) + ")");
+    }
+
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ == 0) {
+        // Nothing to map, an empty file is represented as an empty span
+        close(fd);
+        return;
+    }
+
+    // Writable mappings are private so the source log is never modified
+    int prot = options.writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    int flags = MAP_PRIVATE;
+
+    void *mapped = options.huge_pages ? map_huge_aligned(fd, size_, prot, flags)
+                                      : mmap(nullptr, size_, prot, flags, fd, 0);
+    // Taken before close, which may overwrite errno
+    int map_errno = mapped == MAP_FAILED ? errno : 0;
+
+    // The mapping holds its own reference to the file
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Failed to map file: " + path + " (" + std::strerror(map_errno) + ")");
+    }
+
+    if (options.sequential) {
+        madvise(mapped, size_, MADV_SEQUENTIAL);
+    }
+    if (options.will_need) {
+        madvise(mapped, size_, MADV_WILLNEED);
+    }
+
+    data_ = static_cast<std::byte *>(mapped);
+}
+
+MappedFile::~MappedFile() { unmap(); }
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+        unmap();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+
+    return *this;
+}
+
+void MappedFile::unmap() {
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
@@ -0,0 +1,240 @@
+#include "Metrics.h"
+#include "Json.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+// Values below SUB_BUCKETS get a bucket each, above that the top SUB_BUCKET_BITS + 1 bits pick the bucket
+size_t LatencyHistogram::bucket_index(uint64_t value_ns) {
+    if (value_ns < SUB_BUCKETS) {
+        return value_ns;
+    }
+
+    int shift = std::bit_width(value_ns) - 1 - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((value_ns >> shift) - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::bucket_upper(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t mantissa = bucket % SUB_BUCKETS + SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value_ns) {
+    buckets_[bucket_index(value_ns)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value_ns, std::memory_order_relaxed);
+    update_max(max_, value_ns);
+}
+
+uint64_t LatencyHistogram::percentile_of(const std::array<uint64_t, NUM_BUCKETS> &buckets, uint64_t count,
+                                         uint64_t max, double quantile) {
+    if (count == 0) {
+        return 0;
+    }
+
+    // Rank of the value in 1..count, the bucket holding it bounds the percentile
+    uint64_t rank = std::max<uint64_t>(1, std::ceil(std::clamp(quantile, 0.0, 1.0) * count));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            return std::min(bucket_upper(bucket), max);
+        }
+    }
+
+    return max;
+}
+
+// The count comes from the copied buckets, so percentiles agree with them while other threads keep recording
+static uint64_t copy_buckets(const std::array<std::atomic<uint64_t>, LatencyHistogram::NUM_BUCKETS> &buckets,
+                             std::array<uint64_t, LatencyHistogram::NUM_BUCKETS> &copy) {
+    uint64_t count = 0;
+    for (size_t bucket = 0; bucket < LatencyHistogram::NUM_BUCKETS; ++bucket) {
+        copy[bucket] = buckets[bucket].load(std::memory_order_relaxed);
+        count += copy[bucket];
+    }
+
+    return count;
+}
+
+uint64_t LatencyHistogram::percentile(double quantile) const {
+    std::array<uint64_t, NUM_BUCKETS> buckets;
+    uint64_t count = copy_buckets(buckets_, buckets);
+    return percentile_of(buckets, count, max_.load(std::memory_order_relaxed), quantile);
+}
+
+LatencySummary LatencyHistogram::summary() const {
+    std::array<uint64_t, NUM_BUCKETS> buckets;
+    uint64_t count = copy_buckets(buckets_, buckets);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+
+    LatencySummary summary;
+    summary.count = count;
+    summary.p50 = percentile_of(buckets, count, max, 0.50);
+    summary.p90 = percentile_of(buckets, count, max, 0.90);
+    summary.p99 = percentile_of(buckets, count, max, 0.99);
+    summary.max = max;
+    summary.mean = count > 0 ? static_cast<double>(sum_.load(std::memory_order_relaxed)) / count : 0.0;
+    return summary;
+}
+
+void LatencyHistogram::reset() {
+    for (std::atomic<uint64_t> &bucket : buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+// The lock only guards the name map, snapshot never takes it
+LatencyHistogram &RuntimeMetrics::task_histogram(const std::string &task_name) {
+    std::lock_guard<std::mutex> lock(slot_mut_);
+    auto slot_iter = slot_ids_.find(task_name);
+    if (slot_iter != slot_ids_.end()) {
+        return task_slots_[slot_iter->second]->histogram;
+    }
+
+    size_t slot = num_slots_.load(std::memory_order_relaxed);
+    if (slot == MAX_TASK_NAMES) {
+        return task_slots_[MAX_TASK_NAMES - 1]->histogram;
+    }
+
+    bool overflow = slot == MAX_TASK_NAMES - 1;
+    task_slots_[slot] = std::make_unique<TaskSlot>();
+    task_slots_[slot]->task_name = overflow ? "other tasks" : task_name;
+    if (!overflow) {
+        slot_ids_[task_name] = slot;
+    }
+    num_slots_.store(slot + 1, std::memory_order_release);
+
+    return task_slots_[slot]->histogram;
+}
+
+void RuntimeMetrics::record_graph(std::chrono::nanoseconds duration, uint64_t bytes_to_device,
+                                  uint64_t bytes_to_host, uint64_t gpu_batches, uint64_t gpu_kernels) {
+    graph_latency_.record(duration);
+    bytes_to_device_.fetch_add(bytes_to_device, std::memory_order_relaxed);
+    bytes_to_host_.fetch_add(bytes_to_host, std::memory_order_relaxed);
+    gpu_batches_.fetch_add(gpu_batches, std::memory_order_relaxed);
+    gpu_kernels_.fetch_add(gpu_kernels, std::memory_order_relaxed);
+}
+
+MetricsSnapshot RuntimeMetrics::snapshot() const {
+    MetricsSnapshot snapshot;
+    snapshot.uptime = std::chrono::steady_clock::now() - start_;
+
+    snapshot.graph_latency = graph_latency_.summary();
+    snapshot.graphs_run = snapshot.graph_latency.count;
+    size_t num_slots = num_slots_.load(std::memory_order_acquire);
+    for (size_t slot = 0; slot < num_slots; ++slot) {
+        snapshot.task_latencies.push_back({task_slots_[slot]->task_name, task_slots_[slot]->histogram.summary()});
+    }
+    snapshot.completion_latency = completion_latency_.summary();
+
+    snapshot.pool_threads = pool_threads_.load(std::memory_order_relaxed);
+    snapshot.pool_tasks = pool_counters_.tasks.load(std::memory_order_relaxed);
+    snapshot.pool_busy = std::chrono::nanoseconds(pool_counters_.busy_ns.load(std::memory_order_relaxed));
+    if (snapshot.pool_threads > 0 && snapshot.uptime.count() > 0) {
+        snapshot.pool_utilization = static_cast<double>(snapshot.pool_busy.count()) /
+                                    (static_cast<double>(snapshot.uptime.count()) * snapshot.pool_threads);
+    }
+    snapshot.pool_queue_depth = pool_counters_.queue_depth.load(std::memory_order_relaxed);
+    snapshot.max_pool_queue_depth = pool_counters_.max_queue_depth.load(std::memory_order_relaxed);
+    snapshot.max_ready_queue_depth = max_ready_depth_.load(std::memory_order_relaxed);
+    snapshot.max_completion_batch = max_completion_batch_.load(std::memory_order_relaxed);
+
+    snapshot.bytes_to_device = bytes_to_device_.load(std::memory_order_relaxed);
+    snapshot.bytes_to_host = bytes_to_host_.load(std::memory_order_relaxed);
+    snapshot.gpu_batches = gpu_batches_.load(std::memory_order_relaxed);
+    snapshot.gpu_kernels = gpu_kernels_.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+static void write_latency_json(std::ostream &out, const LatencySummary &latency) {
+    out << "{\"count\":" << latency.count << ",\"p50_ns\":" << latency.p50 << ",\"p90_ns\":" << latency.p90
+        << ",\"p99_ns\":" << latency.p99 << ",\"max_ns\":" << latency.max << ",\"mean_ns\":" << latency.mean << "}";
+}
+
+// Only task names are user strings that need escaping, everything else is numeric
+void write_metrics_json(std::ostream &out, const MetricsSnapshot &snapshot) {
+    out << "{\n  \"uptime_ns\": " << snapshot.uptime.count() << ",\n  \"graphs_run\": " << snapshot.graphs_run
+        << ",\n  \"graph_latency\": ";
+    write_latency_json(out, snapshot.graph_latency);
+
+    out << ",\n  \"task_latency\": {";
+    for (size_t i = 0; i < snapshot.task_latencies.size(); ++i) {
+        out << (i == 0 ? "\n    " : ",\n    ");
+        write_json_string(out, snapshot.task_latencies[i].task_name);
+        out << ": ";
+        write_latency_json(out, snapshot.task_latencies[i].latency);
+    }
+    out << (snapshot.task_latencies.empty() ? "}" : "\n  }") << ",\n  \"completion_latency\": ";
+    write_latency_json(out, snapshot.completion_latency);
+
+    out << ",\n  \"pool\": {\"threads\":" << snapshot.pool_threads << ",\"tasks\":" << snapshot.pool_tasks
+        << ",\"busy_ns\":" << snapshot.pool_busy.count() << ",\"utilization\":" << snapshot.pool_utilization
+        << ",\"queue_depth\":" << snapshot.pool_queue_depth << ",\"max_queue_depth\":" << snapshot.max_pool_queue_depth
+        << "},\n  \"max_ready_queue_depth\": " << snapshot.max_ready_queue_depth
+        << ",\n  \"max_completion_batch\": " << snapshot.max_completion_batch << ",\n  \"gpu\": {\"bytes_to_device\":"
+        << snapshot.bytes_to_device << ",\"bytes_to_host\":" << snapshot.bytes_to_host
+        << ",\"batches\":" << snapshot.gpu_batches << ",\"kernels\":" << snapshot.gpu_kernels << "}\n}\n";
+}
+
+void RuntimeMetrics::write_file(const std::string &path) const {
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path);
+        if (!out) {
+            return;
+        }
+        write_metrics_json(out, snapshot());
+    }
+
+    std::rename(temp_path.c_str(), path.c_str());
+}
+
+// Failing writes are skipped rather than thrown, the writer must never take the runtime down
+void RuntimeMetrics::start_file_writer(const std::string &path, std::chrono::milliseconds interval) {
+    if (interval.count() <= 0) {
+        throw std::runtime_error("The metrics file interval has to be positive");
+    }
+
+    stop_file_writer();
+    writer_stop_ = false;
+    writer_thread_ = std::thread([this, path, interval] {
+        std::unique_lock<std::mutex> lock(writer_mut_);
+        while (!writer_cv_.wait_for(lock, interval, [this] { return writer_stop_; })) {
+            write_file(path);
+        }
+        write_file(path);
+    });
+}
+
+void RuntimeMetrics::stop_file_writer() {
+    if (!writer_thread_.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(writer_mut_);
+        writer_stop_ = true;
+    }
+    writer_cv_.notify_all();
+    writer_thread_.join();
+}
@@ -0,0 +1,236 @@
+#include "PerfCounters.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// One perf group per thread, read with a single syscall
+struct CounterGroup {
+    std::vector<int> fds;
+    // Position of each counter in the group's read values, -1 when it could not be opened
+    std::array<int, NUM_PERF_COUNTERS> slots;
+    std::string reason;
+
+    CounterGroup();
+    ~CounterGroup();
+};
+
+#ifdef __linux__
+perf_event_attr counter_attr(PerfCounter counter) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch (counter) {
+    case Cycles:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case Instructions:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case LLCMisses:
+        // The generic cache miss event is the last level cache on the common PMUs
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    default:
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    }
+
+    return attr;
+}
+
+// The first counter that opens leads the group, the others join it
+CounterGroup::CounterGroup() {
+    slots.fill(-1);
+    int open_errno = 0;
+    for (int counter = 0; counter < NUM_PERF_COUNTERS; ++counter) {
+        perf_event_attr attr = counter_attr(static_cast<PerfCounter>(counter));
+        int group_fd = fds.empty() ? -1 : fds.front();
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+        if (fd < 0) {
+            open_errno = open_errno != 0 ? open_errno : errno;
+            continue;
+        }
+
+        slots[counter] = static_cast<int>(fds.size());
+        fds.push_back(fd);
+    }
+
+    if (fds.empty()) {
+        reason = std::string("perf_event_open failed: ") + std::strerror(open_errno) +
+                 " (see /proc/sys/kernel/perf_event_paranoid)";
+    }
+}
+
+CounterGroup::~CounterGroup() {
+    for (int fd : fds) {
+        close(fd);
+    }
+}
+#else
+CounterGroup::CounterGroup() {
+    slots.fill(-1);
+    reason = "perf events are only available on Linux";
+}
+
+CounterGroup::~CounterGroup() {}
+#endif
+
+CounterGroup &thread_group() {
+    thread_local CounterGroup group;
+    return group;
+}
+} // namespace
+
+std::optional<PerfSample> ThreadPerfCounters::sample() {
+    CounterGroup &group = thread_group();
+    if (group.fds.empty()) {
+        return std::nullopt;
+    }
+
+#ifdef __linux__
+    // nr, time enabled, time running, then one value per counter of the group
+    std::array<uint64_t, 3 + NUM_PERF_COUNTERS> values{};
+    ssize_t bytes = read(group.fds.front(), values.data(), sizeof(values));
+    if (bytes < static_cast<ssize_t>((3 + group.fds.size()) * sizeof(uint64_t))) {
+        return std::nullopt;
+    }
+
+    double scale = values[2] > 0 ? static_cast<double>(values[1]) / values[2] : 0.0;
+    PerfSample perf_sample{};
+    for (int counter = 0; counter < NUM_PERF_COUNTERS; ++counter) {
+        if (group.slots[counter] >= 0) {
+            perf_sample[counter] = static_cast<uint64_t>(values[3 + group.slots[counter]] * scale);
+        }
+    }
+
+    return perf_sample;
+#else
+    return std::nullopt;
+#endif
+}
+
+std::array<bool, NUM_PERF_COUNTERS> ThreadPerfCounters::available() {
+    std::array<bool, NUM_PERF_COUNTERS> counters{};
+    for (int counter = 0; counter < NUM_PERF_COUNTERS; ++counter) {
+        counters[counter] = thread_group().slots[counter] >= 0;
+    }
+
+    return counters;
+}
+
+std::string ThreadPerfCounters::unavailable_reason() { return thread_group().reason; }
+
+const char *ThreadPerfCounters::counter_name(PerfCounter counter) {
+    switch (counter) {
+    case Cycles:
+        return "cycles";
+    case Instructions:
+        return "instructions";
+    case LLCMisses:
+        return "llc_misses";
+    case BranchMisses:
+        return "branch_misses";
+    default:
+        return "unknown";
+    }
+}
+
+double TaskPerfStats::ipc() const {
+    return totals[Cycles] > 0 ? static_cast<double>(totals[Instructions]) / totals[Cycles] : 0.0;
+}
+
+double TaskPerfStats::per_point(PerfCounter counter) const {
+    return points > 0 ? static_cast<double>(totals[counter]) / points : 0.0;
+}
+
+// Runs on the worker that ran the task, so the availability is that of the sampling thread
+void TaskPerfCounters::record(const std::string &task_name, const std::optional<PerfSample> &before,
+                              const std::optional<PerfSample> &after, size_t points) {
+    std::array<bool, NUM_PERF_COUNTERS> thread_available = ThreadPerfCounters::available();
+
+    std::lock_guard<std::mutex> lock(stats_mut_);
+    for (int counter = 0; counter < NUM_PERF_COUNTERS; ++counter) {
+        available_[counter] = (sampled_ ? available_[counter] : true) && thread_available[counter];
+    }
+    if (unavailable_reason_.empty()) {
+        unavailable_reason_ = ThreadPerfCounters::unavailable_reason();
+    }
+    sampled_ = true;
+
+    auto task_iter = task_ids_.find(task_name);
+    if (task_iter == task_ids_.end()) {
+        task_iter = task_ids_.emplace(task_name, tasks_.size()).first;
+        tasks_.push_back({task_name});
+    }
+
+    TaskPerfStats &stats = tasks_[task_iter->second];
+    stats.runs++;
+    stats.points += points;
+    if (before && after) {
+        for (int counter = 0; counter < NUM_PERF_COUNTERS; ++counter) {
+            stats.totals[counter] += (*after)[counter] - std::min((*after)[counter], (*before)[counter]);
+        }
+    }
+}
+
+PerfReport TaskPerfCounters::report() const {
+    std::lock_guard<std::mutex> lock(stats_mut_);
+    return {available_, unavailable_reason_, tasks_};
+}
+
+void TaskPerfCounters::reset() {
+    std::lock_guard<std::mutex> lock(stats_mut_);
+    task_ids_.clear();
+    tasks_.clear();
+    sampled_ = false;
+    available_ = {};
+    unavailable_reason_.clear();
+}
+
+void write_perf_report(std::ostream &out, const PerfReport &report) {
+    if (!report.unavailable_reason.empty()) {
+        out << "perf counters unavailable: " << report.unavailable_reason << "\n";
+    }
+
+    auto write_value = [&](bool available, double value) {
+        if (available) {
+            out << std::setw(16) << std::fixed << std::setprecision(3) << value;
+        } else {
+            out << std::setw(16) << "n/a";
+        }
+    };
+
+    out << std::left << std::setw(24) << "task" << std::right << std::setw(8) << "runs" << std::setw(14) << "points"
+        << std::setw(16) << "IPC" << std::setw(16) << "cycles/pt" << std::setw(16) << "llc_miss/pt" << std::setw(16)
+        << "branch_miss/pt" << "\n";
+    for (const TaskPerfStats &stats : report.tasks) {
+        out << std::left << std::setw(24) << stats.task_name << std::right << std::setw(8) << stats.runs
+            << std::setw(14) << stats.points;
+        write_value(report.available[Cycles] && report.available[Instructions], stats.ipc());
+        write_value(report.available[Cycles], stats.per_point(Cycles));
+        write_value(report.available[LLCMisses], stats.per_point(LLCMisses));
+        write_value(report.available[BranchMisses], stats.per_point(BranchMisses));
+        out << "\n";
+    }
+}
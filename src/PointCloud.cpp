@@ -0,0 +1,122 @@
+#include "PointCloud.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+// The narrowest column (ring) is 2 bytes per point, so rounding capacity to this many points keeps every column a
+// whole number of aligned blocks
+const size_t CAPACITY_GRANULE = POINT_CLOUD_ALIGNMENT / sizeof(uint16_t);
+
+void PointCloud::AlignedDelete::operator()(std::byte *ptr) const { std::free(ptr); }
+
+PointCloud::PointCloud(size_t num_points) { resize(num_points); }
+
+PointCloud::PointCloud(const PointCloud &other) : PointCloud(other.size_) {
+    // Capacities match unless the other cloud was shrunk, then the columns sit at other offsets
+    if (capacity_ == other.capacity_) {
+        std::memcpy(storage_.get(), other.storage_.get(), storage_bytes());
+        return;
+    }
+
+    for (size_t column = 0; column < POINT_FIELD_COUNT && size_ > 0; ++column) {
+        std::span<const std::byte> other_column = other.column_bytes(column);
+        std::memcpy(column_bytes(column).data(), other_column.data(), other_column.size());
+    }
+}
+
+PointCloud &PointCloud::operator=(const PointCloud &other) {
+    if (this != &other) {
+        PointCloud copy(other);
+        *this = std::move(copy);
+    }
+
+    return *this;
+}
+
+PointCloud::PointCloud(PointCloud &&other) noexcept
+    : size_(std::exchange(other.size_, 0)), capacity_(std::exchange(other.capacity_, 0)),
+      storage_(std::move(other.storage_)) {}
+
+PointCloud &PointCloud::operator=(PointCloud &&other) noexcept {
+    if (this != &other) {
+        size_ = std::exchange(other.size_, 0);
+        capacity_ = std::exchange(other.capacity_, 0);
+        storage_ = std::move(other.storage_);
+    }
+
+    return *this;
+}
+
+PointCloud PointCloud::from_xyzi(std::span<const float> interleaved) {
+    if (interleaved.size() % 4 != 0) {
+        throw std::runtime_error("Interleaved point data must contain (x, y, z, intensity) tuples");
+    }
+
+    PointCloud cloud(interleaved.size() / 4);
+    std::span<float> x = cloud.x(), y = cloud.y(), z = cloud.z(), intensity = cloud.intensity();
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        x[i] = interleaved[4 * i];
+        y[i] = interleaved[4 * i + 1];
+        z[i] = interleaved[4 * i + 2];
+        intensity[i] = interleaved[4 * i + 3];
+    }
+    std::fill(cloud.ring().begin(), cloud.ring().end(), 0);
+
+    return cloud;
+}
+
+void PointCloud::resize(size_t num_points) {
+    if (num_points <= capacity_) {
+        size_ = num_points;
+        return;
+    }
+
+    size_t new_capacity = (num_points + CAPACITY_GRANULE - 1) / CAPACITY_GRANULE * CAPACITY_GRANULE;
+    size_t new_bytes = new_capacity * (4 * sizeof(float) + sizeof(uint16_t));
+
+    std::byte *new_storage = static_cast<std::byte *>(std::aligned_alloc(POINT_CLOUD_ALIGNMENT, new_bytes));
+    if (new_storage == nullptr) {
+        throw std::bad_alloc();
+    }
+    std::memset(new_storage, 0, new_bytes);
+
+    // Each column moves to a new offset since the columns are laid out by capacity
+    PointCloud resized;
+    resized.storage_.reset(new_storage);
+    resized.capacity_ = new_capacity;
+    resized.size_ = num_points;
+    for (size_t column = 0; column < POINT_FIELD_COUNT && size_ > 0; ++column) {
+        std::span<const std::byte> old_column = std::as_const(*this).column_bytes(column);
+        std::memcpy(resized.column_bytes(column).data(), old_column.data(), old_column.size());
+    }
+
+    *this = std::move(resized);
+}
+
+std::span<std::byte> PointCloud::column_bytes(size_t column) {
+    if (column >= POINT_FIELD_COUNT) {
+        throw std::out_of_range("Point cloud column index out of range");
+    }
+
+    PointField field = static_cast<PointField>(column);
+    return {storage_.get() + column_offset(field), size_ * field_size(field)};
+}
+
+std::span<const std::byte> PointCloud::column_bytes(size_t column) const {
+    if (column >= POINT_FIELD_COUNT) {
+        throw std::out_of_range("Point cloud column index out of range");
+    }
+
+    PointField field = static_cast<PointField>(column);
+    return {storage_.get() + column_offset(field), size_ * field_size(field)};
+}
+
+size_t PointCloud::column_offset(PointField field) const {
+    // Float columns come first, so every column before ring is capacity * sizeof(float) bytes long
+    return static_cast<size_t>(field) * capacity_ * sizeof(float);
+}
+
+size_t PointCloud::storage_bytes() const { return capacity_ * (4 * sizeof(float) + sizeof(uint16_t)); }
@@ -0,0 +1,96 @@
+#include "ResidencyManager.h"
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+Residency ResidencyManager::get_residency(int data_id, int column) const {
+    std::lock_guard<std::mutex> lock(residency_mut_);
+
+    auto data_iter = residency_map_.find(data_id);
+    if (data_iter == residency_map_.end()) {
+        return Residency::Host;
+    }
+
+    auto column_iter = data_iter->second.find(column);
+    return column_iter == data_iter->second.end() ? Residency::Host : column_iter->second;
+}
+
+void ResidencyManager::mark_host_written(int data_id) {
+    std::lock_guard<std::mutex> lock(residency_mut_);
+
+    auto data_iter = residency_map_.find(data_id);
+    if (data_iter == residency_map_.end()) {
+        return;
+    }
+
+    for (auto &[column, residency] : data_iter->second) {
+        residency = Residency::Host;
+    }
+}
+
+void ResidencyManager::mark_device_written(int data_id, int column) {
+    std::lock_guard<std::mutex> lock(residency_mut_);
+    residency_map_[data_id][column] = Residency::Device;
+}
+
+void ResidencyManager::mark_uploaded(int data_id, int column, size_t num_bytes) {
+    std::lock_guard<std::mutex> lock(residency_mut_);
+    residency_map_[data_id][column] = Residency::Both;
+    stats_.bytes_to_device += num_bytes;
+    stats_.uploads++;
+}
+
+void ResidencyManager::mark_downloaded(int data_id, int column, size_t num_bytes) {
+    std::lock_guard<std::mutex> lock(residency_mut_);
+    residency_map_[data_id][column] = Residency::Both;
+    stats_.bytes_to_host += num_bytes;
+    stats_.downloads++;
+}
+
+// Entries are reset to Host rather than erased, so data that goes back and forth every frame keeps its map nodes
+void ResidencyManager::drop_device(int data_id) {
+    std::lock_guard<std::mutex> lock(residency_mut_);
+
+    auto data_iter = residency_map_.find(data_id);
+    if (data_iter == residency_map_.end()) {
+        return;
+    }
+
+    for (auto &[column, residency] : data_iter->second) {
+        residency = Residency::Host;
+    }
+}
+
+std::vector<int> ResidencyManager::device_only_columns(int data_id) const {
+    std::lock_guard<std::mutex> lock(residency_mut_);
+
+    std::vector<int> columns;
+    auto data_iter = residency_map_.find(data_id);
+    if (data_iter == residency_map_.end()) {
+        return columns;
+    }
+
+    for (const auto &[column, residency] : data_iter->second) {
+        if (residency == Residency::Device) {
+            columns.push_back(column);
+        }
+    }
+
+    return columns;
+}
+
+TransferStats ResidencyManager::get_stats() const {
+    std::lock_guard<std::mutex> lock(residency_mut_);
+    return stats_;
+}
+
+void ResidencyManager::reset() {
+    std::lock_guard<std::mutex> lock(residency_mut_);
+    for (auto &[data_id, columns] : residency_map_) {
+        for (auto &[column, residency] : columns) {
+            residency = Residency::Host;
+        }
+    }
+    stats_ = TransferStats();
+}
@@ -1,45 +1,243 @@
 #include "Runtime.h"
+#include "AllocationTracker.h"
 #include "DataManager.h"
-#include "MetalExecutor.h"
+#include "HostExecutor.h"
+#include "LaunchConfig.h"
 #include "Scheduler.h"
+#include "SimulatedExecutor.h"
 #include "Tasks.h"
 #include <algorithm>
+#include <chrono>
 #include <future>
-#include <iostream>
 #include <memory>
+#include <ostream>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __APPLE__
+#include "MetalExecutor.h"
+#endif
 
 // Allows for GPU setup before execution of tasks
 void Runtime::create_executor_(GPUDevice &device_info, const TaskGraph &task_graph) {
-    if (device_info.backend == GPUBackend::Metal) {
-        // Finds plausible default size for proxy buffer
-        std::vector<DataEntry> device_local_tasks = data_manager_.get_device_local_tasks();
+    if (device_info.backend == GPUBackend::Host) {
+        gpu_exec_ = std::make_unique<HostExecutor>(device_info.devloc_range, device_info.hostvis_range,
+                                                   device_info.unified_range, std::thread::hardware_concurrency(),
+                                                   device_info.num_queues);
+    } else if (device_info.backend == GPUBackend::Simulated) {
+        gpu_exec_ = std::make_unique<SimulatedExecutor>(device_info.simulated_model, device_info.devloc_range,
+                                                        device_info.hostvis_range, device_info.unified_range,
+                                                        std::thread::hardware_concurrency(), device_info.num_queues);
+    } else if (device_info.backend == GPUBackend::Metal) {
+#ifdef __APPLE__
+        // Staging slots fit the largest device local data, so no transfer has to grow one, and there is no point in
+        // more slots than device local data to stage
+        const std::vector<DataEntry> &device_local_tasks = data_manager_.get_device_local_tasks();
 
         size_t max_local_task_size = 0;
-        for (DataEntry &local_task : device_local_tasks) {
-            size_t local_task_size = local_task.byte_size;
-            max_local_task_size = std::max(max_local_task_size, local_task_size);
+        for (const DataEntry &local_task : device_local_tasks) {
+            max_local_task_size = std::max(max_local_task_size, local_task.byte_size);
         }
-
-        // testing proxy buffer allocation
-        max_local_task_size = 16;
-        std::cout << "Attempting proxy size " << max_local_task_size << std::endl;
+        size_t num_staging_slots = std::min(device_local_tasks.size(), device_info.staging_slots);
 
         gpu_exec_ = std::make_unique<MetalExecutor>(device_info.devloc_range, device_info.hostvis_range,
-                                                    device_info.unified_range, max_local_task_size);
+                                                    device_info.unified_range, max_local_task_size, num_staging_slots,
+                                                    device_info.num_queues);
+#else
+        throw std::runtime_error("The Metal backend is only available on Apple platforms");
+#endif
     } else if (device_info.backend == GPUBackend::Cuda) {
         // TODO: Impl once cuda is implemented
     } else {
         std::runtime_error("Attempted to select a backend not current supported");
     }
+
+    if (gpu_exec_ && device_info.trace_allocations) {
+        gpu_exec_->get_allocator().set_tracing(true);
+    }
 }
 
-// TODO: Figure out return type here - Maybe a future?
-void Runtime::commit_graph(TaskGraph &task_graph, GPUDevice &device_info) {
+// In-place writes are only legal on data registered as ReadWrite, catch violations before anything is dispatched
+void Runtime::validate_access_(const TaskGraph &task_graph) const {
+    for (int task_id : task_graph.get_task_ids()) {
+        std::shared_ptr<ITask> task = task_graph.get_task(task_id);
+        for (int input_id : task->input_ids) {
+            if (task->get_input_usage(input_id) == DataUsage::ReadWrite &&
+                data_manager_.get_data_usage(input_id) != DataUsage::ReadWrite) {
+                throw std::runtime_error("Task " + task->task_name + " attempted to modify read-only data in place");
+            }
+        }
+    }
+}
+
+// Every kernel of the graph is built before the first task runs, so the first frame is not slowed down by pipeline
+// creation and a missing kernel is reported before any work is done
+void Runtime::prepare_kernels_(const TaskGraph &task_graph) {
+    // Split tasks also work without a GPU executor, they then run entirely on the CPU
+    std::vector<std::string> kernel_names;
+    bool has_gpu_tasks = false;
+    for (int task_id : task_graph.get_task_ids()) {
+        std::shared_ptr<ITask> task = task_graph.get_task(task_id);
+        if (std::dynamic_pointer_cast<GPUTask>(task)) {
+            has_gpu_tasks = true;
+            kernel_names.push_back(task->task_name);
+        } else if (std::dynamic_pointer_cast<SplitTask>(task)) {
+            kernel_names.push_back(task->task_name);
+        }
+    }
+
+    if (!gpu_exec_) {
+        if (has_gpu_tasks) {
+            throw std::runtime_error("The graph has GPU tasks but the selected backend created no GPU executor");
+        }
+        return;
+    }
+
+    std::vector<std::string> missing_kernels = gpu_exec_->prepare_kernels(kernel_names);
+    if (!missing_kernels.empty()) {
+        std::string error_message = "No kernel function was found for the GPU tasks:";
+        for (const std::string &kernel_name : missing_kernels) {
+            error_message += " " + kernel_name;
+        }
+        throw std::runtime_error(error_message);
+    }
+}
+
+IGPUExecutor::GPUMemoryAllocator::AllocatorStats Runtime::get_allocator_stats(MemoryHint mem_hint) const {
+    if (!gpu_exec_) {
+        return {};
+    }
+
+    return gpu_exec_->get_allocator().get_stats(mem_hint);
+}
+
+void Runtime::write_allocation_trace(std::ostream &out) const {
+    if (!gpu_exec_) {
+        throw std::runtime_error("No GPU executor was created, so no allocations were traced");
+    }
+
+    gpu_exec_->get_allocator().write_trace(out);
+}
+
+SimulatedDeviceStats Runtime::get_simulated_stats() const {
+    const SimulatedExecutor *simulated_exec = dynamic_cast<const SimulatedExecutor *>(gpu_exec_.get());
+    if (!simulated_exec) {
+        throw std::runtime_error("The last committed graph did not run on a simulated device");
+    }
+
+    return simulated_exec->get_simulated_stats();
+}
+
+// The launch cache is only used while autotuning
+static std::string launch_cache_path(const GPUDevice &device_info) {
+    return device_info.autotune_launches ? device_info.launch_cache_path : std::string();
+}
+
+void Runtime::set_up_graph_(TaskGraph &task_graph, GPUDevice &device_info) {
+    // A prepared graph runs on the executor and pool that are about to be replaced
+    prepared_scheduler_.reset();
+
     task_graph.validate_graph();
+    validate_access_(task_graph);
     create_executor_(device_info, task_graph);
+    prepare_kernels_(task_graph);
     create_thread_pool_();
 
-    Scheduler graph_scheduler = Scheduler(data_manager_, thread_pool_, gpu_exec_);
-    graph_scheduler.execute_graph(task_graph);
+    std::string cache_path = launch_cache_path(device_info);
+    if (!cache_path.empty() && loaded_launch_cache_ != cache_path) {
+        launch_tuner_.load(cache_path);
+        loaded_launch_cache_ = cache_path;
+    }
+}
+
+std::unique_ptr<Scheduler> Runtime::make_scheduler_(bool autotune_launches) {
+    auto scheduler = std::make_unique<Scheduler>(data_manager_, thread_pool_, gpu_exec_);
+    scheduler->set_launch_tuner(autotune_launches ? &launch_tuner_ : nullptr);
+    scheduler->set_metrics(&metrics_);
+    return scheduler;
+}
+
+void Runtime::run_scheduler_(Scheduler &scheduler, const std::string &launch_cache_path) {
+    scheduler.set_perf_counters(perf_counters_enabled_ ? &perf_counters_ : nullptr);
+    size_t num_tuned = launch_tuner_.size();
+
+    auto graph_start = std::chrono::steady_clock::now();
+    scheduler.run_graph();
+    scheduler_stats_ = scheduler.get_stats();
+    metrics_.record_graph(std::chrono::steady_clock::now() - graph_start, scheduler_stats_.transfers.bytes_to_device,
+                          scheduler_stats_.transfers.bytes_to_host, scheduler_stats_.gpu_batches,
+                          scheduler_stats_.gpu_kernels);
+
+    if (!launch_cache_path.empty() && launch_tuner_.size() != num_tuned) {
+        launch_tuner_.save(launch_cache_path);
+    }
+}
+
+// TODO: Figure out return type here - Maybe a future?
+void Runtime::commit_graph(TaskGraph &task_graph, GPUDevice &device_info) {
+    set_up_graph_(task_graph, device_info);
+
+    std::unique_ptr<Scheduler> graph_scheduler = make_scheduler_(device_info.autotune_launches);
+    graph_scheduler->prepare_graph(task_graph, false);
+    run_scheduler_(*graph_scheduler, launch_cache_path(device_info));
 };
+
+void Runtime::prepare_graph(TaskGraph &task_graph, GPUDevice &device_info) {
+    set_up_graph_(task_graph, device_info);
+
+    prepared_scheduler_ = make_scheduler_(device_info.autotune_launches);
+    prepared_scheduler_->prepare_graph(task_graph, true);
+    prepared_launch_cache_ = launch_cache_path(device_info);
+    runs_since_check_ = 0;
+}
+
+void Runtime::run() {
+    if (!prepared_scheduler_) {
+        throw std::runtime_error("No graph was prepared, prepare_graph must be called before run");
+    }
+
+    if (!allocation_check_ || runs_since_check_++ < allocation_warmup_runs_) {
+        run_scheduler_(*prepared_scheduler_, prepared_launch_cache_);
+        return;
+    }
+
+    // Violations are counted process wide, so only what this run added is the runtime's
+    AllocationCounts scheduler_before = AllocationTracker::violations(AllocationSite::Scheduler);
+    AllocationCounts worker_before = AllocationTracker::violations(AllocationSite::Worker);
+    AllocationCounts task_before = AllocationTracker::violations(AllocationSite::Task);
+
+    AllocationTracker::set_checking(true);
+    try {
+        run_scheduler_(*prepared_scheduler_, prepared_launch_cache_);
+    } catch (...) {
+        AllocationTracker::set_checking(false);
+        throw;
+    }
+    AllocationTracker::set_checking(false);
+
+    auto add_violations = [](AllocationCounts &total, AllocationSite site, const AllocationCounts &before) {
+        AllocationCounts after = AllocationTracker::violations(site);
+        total.allocations += after.allocations - before.allocations;
+        total.bytes += after.bytes - before.bytes;
+    };
+    add_violations(allocation_report_.scheduler, AllocationSite::Scheduler, scheduler_before);
+    add_violations(allocation_report_.worker, AllocationSite::Worker, worker_before);
+    add_violations(allocation_report_.task, AllocationSite::Task, task_before);
+    allocation_report_.checked_runs++;
+}
+
+void Runtime::enable_allocation_check(size_t warmup_runs, bool abort_on_allocation) {
+    allocation_check_ = true;
+    allocation_warmup_runs_ = warmup_runs;
+    runs_since_check_ = 0;
+    allocation_report_ = AllocationReport();
+    allocation_report_.available = AllocationTracker::hooks_installed();
+    AllocationTracker::set_abort_on_violation(abort_on_allocation);
+}
+
+void Runtime::disable_allocation_check() {
+    allocation_check_ = false;
+    AllocationTracker::set_abort_on_violation(false);
+}
@@ -1,125 +1,854 @@
 #include "Scheduler.h"
+#include "AllocationTracker.h"
 #include "DataManager.h"
 #include "IGPUExecutor.h"
+#include "PerfCounters.h"
 #include "Runtime.h"
 #include "Tasks.h"
+#include "Trace.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
-#include <queue>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
-const size_t COUNTER_BUFFER_SIZE = 8;
+// Uploaded into a counter before its kernel runs, only the count itself has to start at zero
+static const std::array<std::byte, INDIRECT_ARGS_OFFSET> ZERO_COUNT{};
 
-size_t count_bytes_to_size(const std::span<std::byte> bytes) {
-    size_t val = 0;
-
-    for (int i = 0; i < bytes.size(); ++i) {
-        val |= (static_cast<size_t>(bytes[i]) << (i * 8));
+// Runs the callback once every event has been signalled, on the thread signalling the last one
+void on_all_signalled(const std::vector<std::shared_ptr<GPUEvent>> &events, std::function<void()> callback) {
+    if (events.empty()) {
+        callback();
+        return;
     }
 
-    return val;
+    auto remaining = std::make_shared<std::atomic<size_t>>(events.size());
+    for (const std::shared_ptr<GPUEvent> &event : events) {
+        event->on_signal([remaining, callback] {
+            if (remaining->fetch_sub(1) == 1) {
+                callback();
+            }
+        });
+    }
 }
 
 // URGENT: Look into actually tracking CPU return future
 // Just ake sure "lambda with completion" idea actually makes sense
 void Scheduler::visit(const BaseCPUTask &cpu_task) {
-    auto lambda_with_completion = [this, &cpu_task] {
-        cpu_task.task_lambda();
-        completed_queue.push_task(cpu_task.id);
-    };
+    CPURun &cpu_run = cpu_runs_[cpu_task.id];
+    cpu_run.dispatch_ns = Tracer::enabled() ? Tracer::now_ns() : 0;
+
+    // Counters are normalised by the elements of the largest input, sized here as the inputs can't change until the
+    // task has run
+    cpu_run.points = 0;
+    if (perf_counters_) {
+        for (int input_id : cpu_task.input_ids) {
+            size_t type_size = std::max<size_t>(data_manager.get_type_size(input_id), 1);
+            cpu_run.points = std::max(cpu_run.points, data_manager.get_span(input_id).size() / type_size);
+        }
+    }
+
+    // GPU results the task reads are only fetched now, the task is queued once they have arrived
+    std::vector<std::shared_ptr<GPUEvent>> downloads;
+    for (int input_id : cpu_task.input_ids) {
+        for (int column : residency_.device_only_columns(input_id)) {
+            downloads.push_back(download_async(input_id, column));
+        }
+    }
 
-    thread_pool->add_task(lambda_with_completion);
+    if (downloads.empty()) {
+        thread_pool->add_job(run_cpu_task, &cpu_run);
+        return;
+    }
+    on_all_signalled(downloads, [this, &cpu_run] { thread_pool->add_job(run_cpu_task, &cpu_run); });
 };
 
+// Runs on a worker, the task's user code is charged to the Task allocation site rather than the worker
+//  - A throwing task is still reported, an exception escaping the worker would terminate the process
+void Scheduler::run_cpu_task(void *context) {
+    CPURun &cpu_run = *static_cast<CPURun *>(context);
+    Scheduler &scheduler = *cpu_run.scheduler;
+    const BaseCPUTask &cpu_task = *cpu_run.task;
+
+    uint64_t start_ns = cpu_run.dispatch_ns != 0 ? Tracer::now_ns() : 0;
+    try {
+        if (scheduler.perf_counters_) {
+            std::optional<PerfSample> before = ThreadPerfCounters::sample();
+            {
+                AllocationSiteScope task_site(AllocationSite::Task);
+                cpu_task.task_lambda();
+            }
+            std::optional<PerfSample> after = ThreadPerfCounters::sample();
+            scheduler.perf_counters_->record(cpu_task.task_name, before, after, cpu_run.points);
+        } else {
+            AllocationSiteScope task_site(AllocationSite::Task);
+            cpu_task.task_lambda();
+        }
+    } catch (...) {
+        cpu_run.error = std::current_exception();
+    }
+    if (start_ns != 0) {
+        Tracer::record_span(cpu_task.task_name, "cpu task", start_ns, Tracer::now_ns(),
+                            {"task_id", cpu_task.id, "dispatch_to_start_ns",
+                             static_cast<int64_t>(start_ns - cpu_run.dispatch_ns)});
+    }
+
+    // Any device copy of what the task wrote is stale now
+    scheduler.residency_.mark_host_written(cpu_task.output_id);
+    for (int input_id : cpu_task.input_ids) {
+        if (cpu_task.get_input_usage(input_id) == DataUsage::ReadWrite) {
+            scheduler.residency_.mark_host_written(input_id);
+        }
+    }
+
+    scheduler.completed_queue.push_task(cpu_task.id);
+}
+
+std::shared_ptr<GPUEvent> Scheduler::download_async(int data_id, int column) {
+    std::span<std::byte> host_span =
+        column < 0 ? data_manager.get_span_mut(data_id) : data_manager.get_column_span_mut(data_id, column);
+    GPUBufferHandle buffer =
+        column < 0 ? gpu_executor->buffer_from_data(data_id) : gpu_executor->buffer_from_column(data_id, column);
+
+    // Counted data only brings back the elements its kernel wrote, the counter is final once the producer completed
+    auto count_iter = data_counts_.find(data_id);
+    if (column < 0 && count_iter != data_counts_.end()) {
+        uint64_t count = 0;
+        gpu_executor->copy_from_device(std::as_writable_bytes(std::span(&count, 1)), count_iter->second);
+        data_manager.set_counted_length(data_id, count);
+        host_span = host_span.first(std::min<size_t>(host_span.size(), count * data_manager.get_type_size(data_id)));
+    }
+
+    residency_.mark_downloaded(data_id, column, host_span.size());
+    return gpu_executor->copy_from_device_async(host_span, buffer);
+}
+
+// Brings back everything only the device holds, the device buffers are about to be dropped
+void Scheduler::download_device_only(int data_id) {
+    for (int column : residency_.device_only_columns(data_id)) {
+        download_async(data_id, column)->wait();
+    }
+}
+
+// A buffer bound to the kernel in binding order, either already resident or allocated for this dispatch
+//  - column is -1 for whole data, count buffers use VOID_RETURN as their data id
+//  - shares is the index of an earlier binding of the same data, which owns the buffer
+struct BufferBinding {
+    int data_id;
+    int column;
+    bool in_place;
+    bool resident;
+    // Resident, but the host copy is newer so it is uploaded again into the same buffer
+    bool stale;
+    size_t size;
+    MemoryHint mem_hint;
+    std::span<const std::byte> host_data;
+    GPUBufferHandle buffer;
+    int shares = -1;
+};
+
+// Allocates every non resident binding, or none of them if the slab can't currently hold them all
+//  - A task with only part of its buffers could hold memory that the in-flight tasks it waits on need
+bool allocate_bindings(IGPUExecutor &gpu_executor, std::vector<BufferBinding> &bindings) {
+    for (size_t i = 0; i < bindings.size(); ++i) {
+        if (bindings[i].resident || bindings[i].shares >= 0) {
+            continue;
+        }
+
+        std::optional<GPUBufferHandle> buffer =
+            gpu_executor.try_allocate_buffer(bindings[i].size, bindings[i].mem_hint);
+        if (!buffer) {
+            // Roll back in reverse so the buddy blocks merge back exactly as they were split
+            for (int j = i - 1; j >= 0; --j) {
+                if (!bindings[j].resident && bindings[j].shares < 0) {
+                    gpu_executor.deallocate_buffer(bindings[j].buffer);
+                }
+            }
+
+            return false;
+        }
+
+        bindings[i].buffer = *buffer;
+    }
+
+    return true;
+}
+
 void Scheduler::visit(const GPUTask &gpu_task) {
     size_t max_input_size = 0;
+    std::vector<BufferBinding> bindings;
+
+    // The same data may be bound more than once, only its first binding allocates
+    auto bind = [&](int data_id, int column, bool in_place, std::span<const std::byte> host_data) {
+        for (size_t i = 0; i < bindings.size(); ++i) {
+            if (bindings[i].data_id == data_id && bindings[i].column == column) {
+                BufferBinding shared_binding = bindings[i];
+                shared_binding.shares = i;
+                bindings.push_back(shared_binding);
+                return;
+            }
+        }
+
+        bool resident = column < 0 ? gpu_executor->data_buffer_exists(data_id)
+                                   : gpu_executor->column_buffer_exists(data_id, column);
+        bool stale = resident && residency_.get_residency(data_id, column) == Residency::Host;
+        GPUBufferHandle buffer;
+        if (resident) {
+            buffer = column < 0 ? gpu_executor->buffer_from_data(data_id)
+                                : gpu_executor->buffer_from_column(data_id, column);
+        } else {
+            // Maintain max input size in case user doesn't specify other method for output size tracking
+            max_input_size = std::max(max_input_size, host_data.size());
+        }
+
+        bindings.push_back({data_id, column, in_place, resident, stale, host_data.size(),
+                            data_manager.get_mem_hint(data_id), host_data, buffer});
+    };
+
+    for (int data_id : gpu_task.input_ids) {
+        bool in_place = gpu_task.get_input_usage(data_id) == DataUsage::ReadWrite;
+
+        // Only upload (and bind) the columns the kernel asked for
+        auto column_iter = gpu_task.input_columns.find(data_id);
+        if (column_iter != gpu_task.input_columns.end()) {
+            for (int column : column_iter->second) {
+                bind(data_id, column, in_place, data_manager.get_column_span(data_id, column));
+            }
+            continue;
+        }
+
+        // Readers share the resident buffer rather than uploading their own copy
+        bind(data_id, -1, in_place, data_manager.get_span(data_id));
+    }
+
+    // Outputs consumed only by other GPU tasks never leave the device, see ResidencyManager
+
+    // Kernels that only modify their inputs in place have no separate output buffer
+    bool has_output = gpu_task.output_id != VOID_RETURN;
+    if (gpu_task.count_buffer_active && !has_output) {
+        throw std::runtime_error("Counting GPU task " + gpu_task.task_name + " has no output to count");
+    }
+    if (has_output) {
+        // Since output size is by default 0, assume user wanted max input size if it is
+        size_t user_output_size = data_manager.get_data_length(gpu_task.output_id);
+        size_t output_size = user_output_size == 0 ? max_input_size : user_output_size;
+
+        // Map the output so downstream GPU tasks reuse the buffer and it can be freed alongside the data
+        bind(gpu_task.output_id, -1, false, {});
+        bindings.back().size = bindings.back().resident ? bindings.back().buffer.size : output_size;
+    }
+
+    // Counting kernels bind their counter after the output, the output's earlier counter or a pooled one is reused
+    // before a new one is allocated
+    bool pooled_count = false;
+    int count_index = -1;
+    if (gpu_task.count_buffer_active) {
+        BufferBinding count_binding{
+            VOID_RETURN, -1, false, false, false, COUNT_BUFFER_SIZE, MemoryHint::Unified, {}, {}};
+
+        auto count_iter = data_counts_.find(gpu_task.output_id);
+        if (count_iter != data_counts_.end()) {
+            count_binding.resident = true;
+            count_binding.buffer = count_iter->second;
+        } else if (!count_buffer_pool_.empty()) {
+            count_binding.resident = true;
+            count_binding.buffer = count_buffer_pool_.back();
+            pooled_count = true;
+        }
+
+        bindings.push_back(count_binding);
+        count_index = bindings.size() - 1;
+    }
+
+    // Kernels sized from a device count read that counter as their last buffer, it stays mapped to the counted input
+    std::optional<GPUBufferHandle> indirect_count;
+    if (gpu_task.count_input != VOID_RETURN) {
+        auto count_iter = data_counts_.find(gpu_task.count_input);
+        if (count_iter == data_counts_.end()) {
+            throw std::runtime_error("GPU task " + gpu_task.task_name +
+                                     " dispatches from the count of data that has no device counter");
+        }
+
+        indirect_count = count_iter->second;
+        bindings.push_back(
+            {VOID_RETURN, -1, false, true, false, COUNT_BUFFER_SIZE, MemoryHint::Unified, {}, count_iter->second});
+    }
+
+    // Wait for in-flight tasks to free device memory rather than failing the whole graph
+    if (!allocate_bindings(*gpu_executor, bindings)) {
+        // A task offered for chaining simply becomes ready the regular way later
+        if (chaining_) {
+            chain_rejected_ = true;
+            return;
+        }
+
+        if (deferred_since_[gpu_task.id] == NOT_DEFERRED) {
+            deferred_since_[gpu_task.id] = std::chrono::steady_clock::now();
+            stats_.deferred_gpu_tasks++;
+        }
+        deferred_gpu_tasks_.push_back(gpu_task.id);
+        return;
+    }
+
+    if (deferred_since_[gpu_task.id] != NOT_DEFERRED) {
+        stats_.alloc_stall_time += std::chrono::steady_clock::now() - deferred_since_[gpu_task.id];
+        deferred_since_[gpu_task.id] = NOT_DEFERRED;
+    }
+
+    // Every buffer fits, so the uploads are queued for the next flush
     std::vector<GPUBufferHandle> buffer_handles;
-    for (int i = 0; i < gpu_task.input_ids.size(); ++i) {
-        int data_id = gpu_task.input_ids[i];
-        if (gpu_executor->data_buffer_exists(data_id)) {
-            buffer_handles.push_back(gpu_executor->buffer_from_data(data_id));
+    std::vector<BufferBinding> in_place_writes;
+    for (BufferBinding &binding : bindings) {
+        if (binding.shares >= 0) {
+            binding.buffer = bindings[binding.shares].buffer;
+            buffer_handles.push_back(binding.buffer);
             continue;
         }
 
-        size_t input_data_size = data_manager.get_data_length(data_id);
-        MemoryHint data_mem_hint = data_manager.get_mem_hint(data_id);
-        auto input_data = data_manager.get_span(data_id);
+        buffer_handles.push_back(binding.buffer);
+        if (binding.in_place) {
+            in_place_writes.push_back(binding);
+        }
+        if (binding.data_id == VOID_RETURN) {
+            continue;
+        }
 
-        // Maintain max input size in case user doesn't specify other method for output size tracking
-        max_input_size = std::max(max_input_size, input_data_size);
+        if (!binding.host_data.empty() && (!binding.resident || binding.stale)) {
+            pending_uploads_.push_back({binding.host_data, binding.buffer});
+            residency_.mark_uploaded(binding.data_id, binding.column, binding.host_data.size());
+        }
+        if (binding.resident) {
+            continue;
+        }
 
-        GPUBufferHandle buffer_in_use = gpu_executor->allocate_buffer(input_data_size, data_mem_hint);
-        buffer_handles.push_back(buffer_in_use);
-        gpu_executor->copy_to_device(input_data, buffer_in_use);
-        gpu_executor->map_data_to_buffer(data_id, buffer_in_use);
+        if (binding.column < 0) {
+            gpu_executor->map_data_to_buffer(binding.data_id, binding.buffer);
+        } else {
+            gpu_executor->map_column_to_buffer(binding.data_id, binding.column, binding.buffer);
+        }
     }
 
-    // TODO: Should handle if output was marked as DeviceLocal and output is only intermediary for other GPU operation
-    //  - Would mean data wouldn't need to copied back to CPU
-    //  - Maybe could even apply an optimization to detect this?
+    // The count stays on the device with the output, it is only read back if the host needs the counted data
+    if (gpu_task.count_buffer_active) {
+        GPUBufferHandle count_buffer = bindings[count_index].buffer;
+        if (pooled_count) {
+            count_buffer_pool_.pop_back();
+        }
 
-    // Since output size is by default 0, assume user wanted max input size if it is
-    size_t user_output_size = data_manager.get_data_length(gpu_task.output_id);
-    size_t output_size = user_output_size == 0 ? max_input_size : user_output_size;
-    MemoryHint output_mem_hint = data_manager.get_mem_hint(gpu_task.output_id);
+        pending_uploads_.push_back({ZERO_COUNT, count_buffer});
+        data_counts_[gpu_task.output_id] = count_buffer;
+    }
+
+    // Results stay on the device, they are only downloaded once a CPU task or the user needs them
+    //  - Marked at dispatch so GPU tasks chained behind this one bind the buffers instead of uploading stale host data
+    for (const BufferBinding &write : in_place_writes) {
+        residency_.mark_device_written(write.data_id, write.column);
+    }
+    if (has_output) {
+        residency_.mark_device_written(gpu_task.output_id);
+    }
+
+    std::function<void()> cpu_callback = [this, task_id = gpu_task.id]() { completed_queue.push_task(task_id); };
+
+    // Assemble the kernel dispatch, it is assigned to the GPU once the uploads of this pass are flushed
+    KernelDispatch kernel(gpu_task.task_name, buffer_handles, {}, {});
+    kernel.indirect_count = indirect_count;
+    LaunchConfig launch = plan_launch(kernel, gpu_task.problem_shape(), gpu_task.block_dim);
+    kernel.grid_dim = launch.grid_dim;
+    kernel.block_dim = launch.block_dim;
+    std::vector<int> pass_dependencies = chaining_ ? chain_dependencies_ : std::vector<int>{};
+    pending_dispatches_.push_back({kernel, cpu_callback, gpu_task.id, assign_queue(gpu_task.id), pass_dependencies});
+};
+
+// Indirect dispatches size their grid on the device, so only their block is taken from the task
+LaunchConfig Scheduler::plan_launch(const KernelDispatch &kernel, const std::vector<int> &shape,
+                                    const std::vector<int> &default_block) {
+    std::vector<int> block_dim = default_block;
+    if (launch_tuner_ && !kernel.indirect_count) {
+        block_dim = launch_tuner_->select_block(*gpu_executor, kernel, shape, default_block);
+    }
+
+    return make_launch(shape, block_dim);
+}
+
+// The CPU part starts straight away, the GPU part joins the batch of the current pass
+void Scheduler::visit(const SplitTask &split_task) {
+    // Both sides read the inputs on their own side, so GPU results among them are brought back first
+    for (int input_id : split_task.input_ids) {
+        download_device_only(input_id);
+    }
+
+    size_t type_size = data_manager.get_type_size(split_task.output_id);
+    if (data_manager.get_span_mut(split_task.output_id).size() < split_task.num_elements * type_size) {
+        throw std::runtime_error("The output of split task " + split_task.task_name +
+                                 " can't hold all of its elements");
+    }
+
+    SplitRun &split_run = *split_runs_[split_task.id];
+    split_run.active = true;
+    split_run.start = std::chrono::steady_clock::now();
+    split_run.gpu_time = std::chrono::nanoseconds(0);
+    split_run.cpu_time = std::chrono::nanoseconds(0);
+    split_run.gpu_count = gpu_executor ? split_task.gpu_count() : 0;
+    split_run.remaining = 2;
+
+    // The whole range runs on the CPU when the GPU part does not fit in device memory right now
+    if (split_run.gpu_count == 0 || !dispatch_split_gpu(split_task, split_run)) {
+        split_run.gpu_count = 0;
+        split_run.remaining = 1;
+    }
+
+    thread_pool->add_job(run_split_cpu_part, &split_run);
+}
+
+// Runs on a worker, the CPU range is user code like a CPU task's lambda
+void Scheduler::run_split_cpu_part(void *context) {
+    SplitRun &split_run = *static_cast<SplitRun *>(context);
+    const SplitTask &split_task = *split_run.task;
+
+    {
+        TraceScope cpu_scope(split_task.task_name, "cpu task",
+                             {"task_id", split_task.id, "elements",
+                              static_cast<int64_t>(split_task.num_elements - split_run.gpu_count)});
+        AllocationSiteScope task_site(AllocationSite::Task);
+        try {
+            split_task.cpu_range(split_run.gpu_count, split_task.num_elements);
+        } catch (...) {
+            split_run.error = std::current_exception();
+        }
+    }
+    split_run.cpu_time = std::chrono::steady_clock::now() - split_run.start;
+
+    if (split_run.remaining.fetch_sub(1) == 1) {
+        split_run.scheduler->completed_queue.push_task(split_task.id);
+    }
+}
+
+// Inputs the device already holds a valid copy of are bound as they are, every other buffer belongs to this run
+//  - Returns false (holding no device memory) when the buffers don't fit
+bool Scheduler::dispatch_split_gpu(const SplitTask &split_task, SplitRun &split_run) {
+    std::vector<GPUBufferHandle> buffer_handles;
+    std::vector<BufferCopy> uploads;
+
+    auto own_buffer = [&](size_t num_bytes, MemoryHint mem_hint) {
+        std::optional<GPUBufferHandle> buffer = gpu_executor->try_allocate_buffer(num_bytes, mem_hint);
+        if (buffer) {
+            split_run.owned_buffers.push_back(*buffer);
+            buffer_handles.push_back(*buffer);
+        }
+
+        return buffer.has_value();
+    };
+
+    bool allocated = true;
+    for (int input_id : split_task.input_ids) {
+        if (gpu_executor->data_buffer_exists(input_id) && residency_.get_residency(input_id) == Residency::Both) {
+            buffer_handles.push_back(gpu_executor->buffer_from_data(input_id));
+            continue;
+        }
+
+        std::span<const std::byte> host_data = data_manager.get_span(input_id);
+        if (!own_buffer(host_data.size(), data_manager.get_mem_hint(input_id))) {
+            allocated = false;
+            break;
+        }
+        uploads.push_back({host_data, buffer_handles.back()});
+    }
+
+    size_t output_bytes = split_run.gpu_count * data_manager.get_type_size(split_task.output_id);
+    if (!allocated || !own_buffer(output_bytes, data_manager.get_mem_hint(split_task.output_id))) {
+        // Roll back in reverse so the buddy blocks merge back exactly as they were split
+        for (auto buffer_iter = split_run.owned_buffers.rbegin(); buffer_iter != split_run.owned_buffers.rend();
+             ++buffer_iter) {
+            gpu_executor->deallocate_buffer(*buffer_iter);
+        }
+        split_run.owned_buffers.clear();
+        return false;
+    }
+
+    pending_uploads_.insert(pending_uploads_.end(), uploads.begin(), uploads.end());
+
+    // The GPU part is gathered into the front of the output, the half finishing last completes the task
+    std::span<std::byte> gpu_output = data_manager.get_span_mut(split_task.output_id).first(output_bytes);
+    GPUBufferHandle output_buffer = buffer_handles.back();
+    int task_id = split_task.id;
+    std::function<void()> cpu_callback = [this, &split_run, gpu_output, output_buffer, task_id]() {
+        gpu_executor->copy_from_device_async(gpu_output, output_buffer)->on_signal([this, &split_run, task_id] {
+            split_run.gpu_time = std::chrono::steady_clock::now() - split_run.start;
+
+            if (split_run.remaining.fetch_sub(1) == 1) {
+                completed_queue.push_task(task_id);
+            }
+        });
+    };
+
+    // The GPU count changes from run to run, so it is not tuned (its bucket would rarely repeat)
+    LaunchConfig launch = make_launch({static_cast<int>(split_run.gpu_count)}, split_task.block_dim);
+    KernelDispatch kernel(split_task.task_name, buffer_handles, launch.grid_dim, launch.block_dim);
+    pending_dispatches_.push_back({kernel, cpu_callback, split_task.id, assign_queue(split_task.id), {}});
+
+    return true;
+}
+
+// Runs on the scheduler thread once both halves are done, before anything reads the output
+void Scheduler::finish_split(const SplitTask &split_task) {
+    SplitRun &split_run = *split_runs_[split_task.id];
+    if (!split_run.active) {
+        return;
+    }
+
+    for (auto buffer_iter = split_run.owned_buffers.rbegin(); buffer_iter != split_run.owned_buffers.rend();
+         ++buffer_iter) {
+        gpu_executor->deallocate_buffer(*buffer_iter);
+        gpu_memory_freed_ = true;
+    }
+    split_run.owned_buffers.clear();
 
-    GPUBufferHandle output_buffer;
-    if (gpu_executor->data_buffer_exists(gpu_task.output_id)) {
-        output_buffer = gpu_executor->buffer_from_data(gpu_task.output_id);
-        buffer_handles.push_back(output_buffer);
+    // A failed CPU part has no meaningful time to balance the share with
+    if (split_run.gpu_count > 0 && !split_run.error) {
+        split_task.record_split(split_run.gpu_count, split_run.gpu_time, split_run.cpu_time);
+    }
+
+    // Both halves were gathered on the host, any device copy of the output is stale
+    residency_.mark_host_written(split_task.output_id);
+    split_run.active = false;
+}
+
+size_t Scheduler::assign_queue(int task_id) {
+    size_t queue;
+    if (chaining_ && !chain_dependencies_.empty()) {
+        queue = pass_queues_[chain_dependencies_.front()];
     } else {
-        output_buffer = gpu_executor->allocate_buffer(output_size, output_mem_hint);
+        queue = next_queue_++ % gpu_executor->num_queues();
     }
 
-    // Manage count buffer if requested, last buffer since it may or may not be included
-    GPUBufferHandle count_buffer;
-    if (gpu_task.count_buffer_active) {
-        // This allows for 8 bytes of counting (64 bit size_t)
-        count_buffer = gpu_executor->allocate_buffer(COUNTER_BUFFER_SIZE, MemoryHint::Unified);
-        buffer_handles.push_back(count_buffer);
-    }
-
-    // TODO: Implement CPU callbacks for output retrieval to CPU
-    // Needs to notify the event based scheduling loop once data has been fully received
-    // What if the data can stay on the GPU between tasks, this would reduce overhead -> handling multiple
-    // types of callbacks?
-
-    // In general *always* returning the computed back to the CPU is ineffecient
-    // Should instead return an event that signals when the computation is done and data can be fetched if desired
-    std::function<void()> cpu_callback = [&, count_buffer, gpu_task, output_buffer]() {
-        if (gpu_task.count_buffer_active) {
-            // Find the number of bytes used for GPU output
-            std::byte byte_span[COUNTER_BUFFER_SIZE];
-            std::span<std::byte> counted_span(byte_span);
-            gpu_executor->copy_from_device(counted_span, count_buffer);
-            size_t counted_bytes = count_bytes_to_size(counted_span) * data_manager.get_type_size(gpu_task.output_id);
-
-            // Allocate (potentially) smaller memory/span on CPU for GPU output
-            std::vector<std::byte> byte_vec(counted_bytes);
-            std::span<std::byte> output_span(byte_vec);
-            gpu_executor->copy_from_device(output_span, output_buffer);
-
-            data_manager.store_data(gpu_task.output_id, output_span);
-        } else {
-            std::span<std::byte> output_span = data_manager.get_span_mut(gpu_task.output_id);
-            gpu_executor->copy_from_device(output_span, output_buffer);
+    pass_queues_[task_id] = queue;
+    return queue;
+}
+
+// Every upload of the GPU tasks dispatched since the last flush goes out as one asynchronous batch, then the kernels of
+// each queue are submitted as one execute_batch waiting on it, so the scheduler thread moves on while the transfer runs
+//  - Tasks of one ready set have no edges between them and run concurrently, a queue holding chained tasks depends on
+//    earlier kernels of its batch so it is submitted serially instead
+//  - Kernels waited on from another queue get their events before any batch is submitted, in submission order on
+//    their queue as make_queue_event requires
+void Scheduler::flush_gpu_dispatches() {
+    if (pending_dispatches_.empty()) {
+        return;
+    }
+
+    std::shared_ptr<GPUEvent> upload_event;
+    size_t num_uploads = pending_uploads_.size();
+    if (!pending_uploads_.empty()) {
+        upload_event = gpu_executor->copy_to_device_async(pending_uploads_);
+        pending_uploads_.clear();
+    }
+
+    std::unordered_set<int> awaited_tasks;
+    for (const PendingDispatch &pending_dispatch : pending_dispatches_) {
+        for (int dependency_id : pending_dispatch.pass_dependencies) {
+            if (pass_queues_[dependency_id] != pending_dispatch.queue) {
+                awaited_tasks.insert(dependency_id);
+            }
+        }
+    }
+
+    size_t num_queues = gpu_executor->num_queues();
+    std::unordered_map<int, std::shared_ptr<GPUEvent>> task_events;
+    for (size_t queue = 0; queue < num_queues && !awaited_tasks.empty(); ++queue) {
+        for (PendingDispatch &pending_dispatch : pending_dispatches_) {
+            if (pending_dispatch.queue == queue && awaited_tasks.count(pending_dispatch.task_id)) {
+                pending_dispatch.kernel.signal_event = gpu_executor->make_queue_event(queue);
+                task_events[pending_dispatch.task_id] = pending_dispatch.kernel.signal_event;
+            }
+        }
+    }
+
+    if (upload_event) {
+        Tracer::record_instant("upload batch", "scheduler", {"buffers", static_cast<int64_t>(num_uploads)});
+    }
+
+    std::vector<std::vector<KernelDispatch>> queue_kernels(num_queues);
+    std::vector<std::vector<std::function<void()>>> queue_callbacks(num_queues);
+    std::vector<bool> queue_chains(num_queues, false);
+    for (PendingDispatch &pending_dispatch : pending_dispatches_) {
+        if (upload_event) {
+            pending_dispatch.kernel.wait_events.push_back(upload_event);
+        }
+        for (int dependency_id : pending_dispatch.pass_dependencies) {
+            auto event_iter = task_events.find(dependency_id);
+            if (event_iter != task_events.end() && pass_queues_[dependency_id] != pending_dispatch.queue) {
+                pending_dispatch.kernel.wait_events.push_back(event_iter->second);
+                stats_.cross_queue_waits++;
+            }
+        }
+
+        size_t queue = pending_dispatch.queue;
+        queue_chains[queue] = queue_chains[queue] || !pending_dispatch.pass_dependencies.empty();
+        queue_kernels[queue].push_back(std::move(pending_dispatch.kernel));
+        queue_callbacks[queue].push_back(std::move(pending_dispatch.cpu_callback));
+    }
+    pending_dispatches_.clear();
+
+    for (size_t queue = 0; queue < num_queues; ++queue) {
+        if (queue_kernels[queue].empty()) {
+            continue;
+        }
+
+        stats_.gpu_batches++;
+        stats_.gpu_kernels += queue_kernels[queue].size();
+        Tracer::record_instant("gpu batch", "scheduler",
+                               {"queue", static_cast<int64_t>(queue), "kernels",
+                                static_cast<int64_t>(queue_kernels[queue].size())});
+        gpu_executor->execute_batch(queue_kernels[queue],
+                                    queue_chains[queue] ? DispatchType::Serial : DispatchType::Concurrent,
+                                    queue_callbacks[queue], queue);
+    }
+}
+
+// Drops data (and any device buffer backing it) once the last task reading it has completed
+//  - Device buffers are also dropped for root inputs and graph outputs once no pending task reads them, the host copy
+//    stays valid so only device memory is given back
+//  - Retained intermediates keep their entry for the next run, their device buffers go like any other
+void Scheduler::release_consumed_data(const ITask &task) {
+    // Data the host still holds (graph outputs, user inputs modified in place) is fetched before its buffer goes,
+    // consumed intermediates are never read again on either side
+    auto release_buffer = [this](int data_id, size_t slot) {
+        if (!gpu_executor) {
+            return;
+        }
+
+        if (release_counts_[slot] < 0 && data_manager.contains(data_id)) {
+            download_device_only(data_id);
+        }
+        if (gpu_executor->release_data_buffer(data_id)) {
+            gpu_memory_freed_ = true;
         }
+        residency_.drop_device(data_id);
 
-        completed_queue.push_task(gpu_task.id);
+        auto count_iter = data_counts_.find(data_id);
+        if (count_iter != data_counts_.end()) {
+            count_buffer_pool_.push_back(count_iter->second);
+            data_counts_.erase(count_iter);
+        }
     };
 
-    // Assemble the kernel dispatch and assign it to the GPU
-    int num_block_threads = gpu_task.block_dim[0] * gpu_task.block_dim[1] * gpu_task.block_dim[2];
-    // Should probably try and distribute these evenly
-    std::vector<int> grid_dim = {(num_block_threads + gpu_task.threads - 1) / num_block_threads, 1, 1};
-    KernelDispatch kernel(gpu_task.task_name, buffer_handles, grid_dim, gpu_task.block_dim);
-    gpu_executor->execute_kernel(kernel, cpu_callback);
-};
+    auto release_intermediate = [this](int data_id, size_t slot) {
+        remaining_consumers_[slot] = -1;
+        if (!retain_intermediates_) {
+            data_manager.release_data(data_id);
+        }
+    };
+
+    for (int input_id : task.input_ids) {
+        size_t slot = data_slots_.at(input_id);
+        if (remaining_consumers_[slot] > 0 && --remaining_consumers_[slot] == 0) {
+            release_intermediate(input_id, slot);
+        }
+
+        if (device_readers_[slot] > 0 && --device_readers_[slot] == 0) {
+            release_buffer(input_id, slot);
+        }
+    }
+
+    if (task.output_id == VOID_RETURN) {
+        return;
+    }
+
+    // Outputs that no task reads (and aren't graph outputs) are dead as soon as they're produced
+    size_t output_slot = data_slots_.at(task.output_id);
+    if (remaining_consumers_[output_slot] == 0) {
+        release_intermediate(task.output_id, output_slot);
+    }
+    if (device_readers_[output_slot] == 0) {
+        release_buffer(task.output_id, output_slot);
+    }
+}
+
+void Scheduler::execute_graph(const TaskGraph &task_graph) {
+    prepare_graph(task_graph, false);
+    run_graph();
+}
+
+void Scheduler::prepare_graph(const TaskGraph &task_graph, bool retain_intermediates) {
+    task_graph_ = &task_graph;
+    retain_intermediates_ = retain_intermediates;
+
+    std::vector<int> task_ids = task_graph.get_task_ids();
+    size_t num_tasks = task_ids.empty() ? 0 : *std::max_element(task_ids.begin(), task_ids.end()) + 1;
+    tasks_.assign(num_tasks, nullptr);
+    is_gpu_task_.assign(num_tasks, false);
+    task_histograms_.assign(num_tasks, nullptr);
+    dependents_.assign(num_tasks, {});
+    dependencies_.assign(num_tasks, {});
+    graph_tasks_.assign(num_tasks, TaskRuntimeState{TaskState::Pending, 0});
+    cpu_runs_.assign(num_tasks, CPURun{this, nullptr, 0, 0});
+    split_runs_.clear();
+    split_runs_.resize(num_tasks);
+
+    data_slots_.clear();
+    total_readers_.clear();
+    auto slot_of = [this](int data_id) {
+        auto [slot_iter, inserted] = data_slots_.try_emplace(data_id, total_readers_.size());
+        if (inserted) {
+            total_readers_.push_back(0);
+        }
+        return slot_iter->second;
+    };
+
+    for (int task_id : task_ids) {
+        std::shared_ptr<ITask> task = task_graph.get_task(task_id);
+        tasks_[task_id] = task.get();
+        is_gpu_task_[task_id] = std::dynamic_pointer_cast<GPUTask>(task) != nullptr;
+        cpu_runs_[task_id].task = dynamic_cast<const BaseCPUTask *>(task.get());
+        if (auto split_task = dynamic_cast<const SplitTask *>(task.get())) {
+            // The GPU share is gathered into the front of the output by element size, which columnar data lacks
+            if (is_columnar(split_task->output_id)) {
+                throw std::runtime_error("The output of split task " + split_task->task_name +
+                                         " can't be columnar data");
+            }
+            split_runs_[task_id] = std::make_unique<SplitRun>();
+            split_runs_[task_id]->scheduler = this;
+            split_runs_[task_id]->task = split_task;
+        }
+        dependents_[task_id] = task_graph.get_dependents(task_id);
+        dependencies_[task_id] = task_graph.get_dependencies(task_id);
+
+        // Counts are in elements, likewise turned into bytes by the element size
+        auto gpu_task = dynamic_cast<const GPUTask *>(task.get());
+        if (gpu_task && gpu_task->count_buffer_active && is_columnar(task->output_id)) {
+            throw std::runtime_error("The counted output of GPU task " + task->task_name + " can't be columnar data");
+        }
+
+        // Every read of a data id, device buffers are dropped when these reach zero
+        for (int input_id : task->input_ids) {
+            total_readers_[slot_of(input_id)]++;
+        }
+        if (task->output_id != VOID_RETURN) {
+            slot_of(task->output_id);
+        }
+    }
+
+    // Registered in task id order, so the metrics list task names in the order they were added to the graph
+    for (size_t task_id = 0; metrics_ && task_id < num_tasks; ++task_id) {
+        if (tasks_[task_id]) {
+            task_histograms_[task_id] = &metrics_->task_histogram(tasks_[task_id]->task_name);
+        }
+    }
+
+    // Reference counts derived from the graph, intermediates are released as soon as their last consumer completes
+    release_counts_.assign(total_readers_.size(), -1);
+    for (const auto &[data_id, release_count] : task_graph.get_release_counts()) {
+        release_counts_[slot_of(data_id)] = release_count;
+    }
+    remaining_consumers_.assign(release_counts_.size(), 0);
+    device_readers_.assign(total_readers_.size(), 0);
+
+    // Sized for the worst case up front, run_graph only ever clears them
+    ready_queue_.reserve(num_tasks);
+    pass_gpu_tasks_.reserve(num_tasks);
+    in_pass_.assign(num_tasks, false);
+    pass_queues_.assign(num_tasks, 0);
+    deferred_since_.assign(num_tasks, NOT_DEFERRED);
+    completed_queue.reserve(num_tasks);
+    drained_completions_.reserve(num_tasks);
+    if (thread_pool) {
+        thread_pool->reserve_jobs(num_tasks);
+    }
+}
+
+bool Scheduler::is_columnar(int data_id) const {
+    return data_id != VOID_RETURN && data_manager.contains(data_id) && data_manager.get_column_count(data_id) > 0;
+}
+
+// Deferred GPU tasks and rejected chain offers never reached the device, so they are not running
+void Scheduler::dispatch(int task_id) {
+    ITask *task = tasks_[task_id];
+    // Taken before the visit queues the task, a worker may finish it before the visit returns
+    auto dispatched_at = metrics_ ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+    task->accept(*this);
+    if (chain_rejected_ || deferred_since_[task_id] != NOT_DEFERRED) {
+        return;
+    }
+
+    num_running_++;
+    graph_tasks_[task_id].state = TaskState::Running;
+    if (metrics_) {
+        graph_tasks_[task_id].dispatched_at = dispatched_at;
+    }
+    // Chained tasks never sat in the ready queue, they wait 0
+    if (Tracer::enabled()) {
+        uint64_t ready_ns = graph_tasks_[task_id].ready_ns;
+        Tracer::record_instant(task->task_name, "dispatch",
+                               {"task_id", task_id, "ready_wait_ns",
+                                ready_ns != 0 ? static_cast<int64_t>(Tracer::now_ns() - ready_ns) : 0});
+    }
+    if (is_gpu_task_[task_id]) {
+        pass_gpu_tasks_.push_back(task_id);
+        in_pass_[task_id] = true;
+    }
+}
+
+// A pending GPU task whose unfinished dependencies are all GPU tasks of this pass is appended to the batch, saving a
+// completion round trip per link of a GPU chain
+//  - Counts of counting producers stay on the device, so their consumers chain like any other (indirect dispatch)
+bool Scheduler::chainable(int task_id) const {
+    if (!is_gpu_task_[task_id] || graph_tasks_[task_id].state != TaskState::Pending) {
+        return false;
+    }
+
+    for (int dependency_id : dependencies_[task_id]) {
+        if (graph_tasks_[dependency_id].state == TaskState::Complete) {
+            continue;
+        }
+
+        if (!in_pass_[dependency_id]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Scheduler::chain_dependents() {
+    for (size_t i = 0; i < pass_gpu_tasks_.size(); ++i) {
+        for (int dependent_id : dependents_[pass_gpu_tasks_[i]]) {
+            if (!chainable(dependent_id)) {
+                continue;
+            }
+
+            for (int dependency_id : dependencies_[dependent_id]) {
+                if (in_pass_[dependency_id]) {
+                    chain_dependencies_.push_back(dependency_id);
+                }
+            }
+
+            chaining_ = true;
+            dispatch(dependent_id);
+            chaining_ = false;
+            chain_dependencies_.clear();
+            chain_rejected_ = false;
+        }
+    }
+
+    for (int task_id : pass_gpu_tasks_) {
+        in_pass_[task_id] = false;
+    }
+    pass_gpu_tasks_.clear();
+}
 
 /*
  * Maintains state of currently running tasks, tasks that are ready to be ran, and tasks that need dependencies met
@@ -130,8 +859,12 @@ void Scheduler::visit(const GPUTask &gpu_task) {
  *
  *  Moving to implement an event-driven reaction system to avoid inefficient polling
  *
- * TODO: Figure out how to incorporate Memory usages into scheduler
- *  - E.g. if memory is read/write only how can we apply optimizations?
+ * Memory usages are applied when the graph is built (see TaskGraph::add_access_hazards)
+ *  - Tasks only reading the same data have no edges between them, so they are dispatched together and share the
+ *    same host object/device buffer without copies
+ *  - In-place writers carry WAR/RAW edges, so by the time a writer is ready every earlier reader has completed
+ *
+ * All per-task state lives in the vectors built by prepare_graph, which are reset in place rather than rebuilt
  *
  *  TODO: How should we implement priority among tasks?
  *
@@ -141,62 +874,171 @@ void Scheduler::visit(const GPUTask &gpu_task) {
     //      - Employ a thread safe queue that has a condition variable such that when something is added to a completion
     //      queue it wakes up and updates everything
  */
-void Scheduler::execute_graph(const TaskGraph &task_graph) {
-    // Map that indicates each tasks current state, and ensure the root tasks (no dependencies) are ready for exec
-    std::unordered_map<int, TaskRuntimeState> graph_tasks;
-    int num_complete = 0;
-
-    std::queue<int> ready_queue;
-
-    // Goal is to use this for some sort of real-time monitoring of the system
-    // (Vector might not be best, but we should keep track of in-flight tasks for this)
-    std::unordered_set<int> running_tasks;
-
-    for (int task_id : task_graph.get_task_ids()) {
-        TaskState task_state;
-        int num_dependencies = task_graph.get_dependencies(task_id).size();
-        if (num_dependencies == 0) {
-            task_state = TaskState::Ready;
-            ready_queue.push(task_id);
-        } else {
-            task_state = TaskState::Pending;
+void Scheduler::run_graph() {
+    if (!task_graph_) {
+        throw std::runtime_error("No task graph was prepared to run");
+    }
+
+    AllocationSiteScope scheduler_site(AllocationSite::Scheduler);
+    Tracer::set_thread_name("scheduler");
+    TraceScope graph_scope("execute_graph", "scheduler");
+
+    stats_ = SchedulerStats();
+    task_error_ = nullptr;
+    residency_.reset();
+    next_queue_ = 0;
+    // Same size, so the reset reuses the existing storage
+    deferred_since_.assign(deferred_since_.size(), NOT_DEFERRED);
+    data_counts_.clear();
+    count_buffer_pool_.clear();
+    // Same sizes, so the copies reuse the existing storage
+    remaining_consumers_ = release_counts_;
+    device_readers_ = total_readers_;
+    drained_completions_.clear();
+
+    // Root tasks (no dependencies) are ready for exec straight away
+    ready_queue_.clear();
+    ready_head_ = 0;
+    num_running_ = 0;
+    size_t num_tasks = 0;
+    for (size_t task_id = 0; task_id < tasks_.size(); ++task_id) {
+        if (!tasks_[task_id]) {
+            continue;
         }
 
-        graph_tasks[task_id] = TaskRuntimeState(task_state, num_dependencies);
+        num_tasks++;
+        int num_dependencies = dependencies_[task_id].size();
+        TaskState task_state = num_dependencies == 0 ? TaskState::Ready : TaskState::Pending;
+        if (task_state == TaskState::Ready) {
+            ready_queue_.push_back(task_id);
+        }
+
+        uint64_t ready_ns = task_state == TaskState::Ready && Tracer::enabled() ? Tracer::now_ns() : 0;
+        graph_tasks_[task_id] = TaskRuntimeState(task_state, num_dependencies, ready_ns);
     }
 
-    while (num_complete < graph_tasks.size()) {
+    size_t num_complete = 0;
+    while (num_complete < num_tasks) {
+        // Tasks waiting on device memory were ready first, so they get the freed memory before newly ready tasks
+        if (gpu_memory_freed_ && !deferred_gpu_tasks_.empty()) {
+            std::deque<int> retry_tasks;
+            retry_tasks.swap(deferred_gpu_tasks_);
+            for (int deferred_task_id : retry_tasks) {
+                dispatch(deferred_task_id);
+            }
+        }
+        gpu_memory_freed_ = false;
+
         // Dispatch loop - handle ready tasks
         // Shouldn't be while (!ready_queue.empty()) for a regular queue since may need to wait for CPU/GPU load to
         // decrease and don't want scheduler to hang waiting
-        while (!ready_queue.empty()) {
+        if (metrics_) {
+            metrics_->record_ready_depth(ready_queue_.size() - ready_head_);
+        }
+        while (ready_head_ < ready_queue_.size()) {
             // TODO: 2. How can we effectively check for resources on CPU/GPU for scheduling?
             // Currently naive immediate scheduling approach
-            int ready_task_id = ready_queue.front();
-            ready_queue.pop();
+            dispatch(ready_queue_[ready_head_++]);
+        }
+        chain_dependents();
+        flush_gpu_dispatches();
+
+        // After a task failed only the tasks in flight are waited for, nothing else will complete
+        if (task_error_ && num_running_ == 0) {
+            break;
+        }
 
-            task_graph.get_task(ready_task_id)->accept(*this);
-            running_tasks.insert(ready_task_id);
+        // Nothing in flight can free memory anymore, so the deferred tasks would wait forever
+        if (num_running_ == 0 && !deferred_gpu_tasks_.empty()) {
+            throw std::runtime_error("GPU task " + tasks_[deferred_gpu_tasks_.front()]->task_name +
+                                     " does not fit in device memory with no tasks in flight");
         }
 
         // Prevents inefficient use of cycles on constant polling
         // Allows us to choose the most recent task that finished
-        std::unique_lock<std::mutex> queue_lock = completed_queue.wait();
-        while (!completed_queue.data_queue.empty()) {
-            int completed_task = completed_queue.data_queue.front();
-            completed_queue.data_queue.pop();
+        // The queue is drained before handling completions, releasing data may wait on the executor whose callbacks
+        // need the queue to report other tasks
+        uint64_t wait_start_ns = Tracer::enabled() ? Tracer::now_ns() : 0;
+        completed_queue.wait_and_drain(drained_completions_);
+        auto drained_at = std::chrono::steady_clock::now();
+        if (metrics_) {
+            for (const CompletionQueue::Completion &completion : drained_completions_) {
+                metrics_->completion_histogram().record(drained_at - completion.completed_at);
+            }
+            metrics_->record_completion_batch(drained_completions_.size());
+        }
+        if (wait_start_ns != 0) {
+            Tracer::record_span("completion wait", "scheduler", wait_start_ns, Tracer::now_ns(),
+                                {"completed", static_cast<int64_t>(drained_completions_.size())});
+        }
+
+        for (const CompletionQueue::Completion &completion : drained_completions_) {
+            int completed_task = completion.task_id;
+            const ITask &task = *tasks_[completed_task];
             num_complete++;
+            num_running_--;
+            if (Tracer::enabled()) {
+                Tracer::record_instant(task.task_name, "complete", {"task_id", completed_task});
+            }
+            if (metrics_) {
+                task_histograms_[completed_task]->record(drained_at - graph_tasks_[completed_task].dispatched_at);
+            }
 
-            graph_tasks[completed_task].state = TaskState::Complete;
-            running_tasks.erase(completed_task);
-            for (int dependent_id : task_graph.get_dependents(completed_task)) {
-                graph_tasks[dependent_id].num_dependencies--;
+            graph_tasks_[completed_task].state = TaskState::Complete;
+            if (auto split_task = dynamic_cast<const SplitTask *>(&task)) {
+                finish_split(*split_task);
+            }
+            release_consumed_data(task);
 
-                if (graph_tasks[dependent_id].num_dependencies == 0) {
-                    ready_queue.push(dependent_id);
+            // Its dependents never become ready, and neither do tasks that were still waiting to be dispatched
+            if (std::exception_ptr error = take_task_error(completed_task)) {
+                if (!task_error_) {
+                    task_error_ = error;
+                }
+                ready_head_ = ready_queue_.size();
+                deferred_gpu_tasks_.clear();
+            }
+            if (task_error_) {
+                continue;
+            }
+
+            for (int dependent_id : dependents_[completed_task]) {
+                graph_tasks_[dependent_id].num_dependencies--;
+
+                // Chained tasks are already running
+                if (graph_tasks_[dependent_id].num_dependencies == 0 &&
+                    graph_tasks_[dependent_id].state == TaskState::Pending) {
+                    graph_tasks_[dependent_id].ready_ns = Tracer::enabled() ? Tracer::now_ns() : 0;
+                    ready_queue_.push_back(dependent_id);
                 }
             }
         }
-        queue_lock.unlock();
+        drained_completions_.clear();
+    }
+
+    // Counters are only pooled for the graph, the executor gets them back once it has run
+    for (const auto &[data_id, count_buffer] : data_counts_) {
+        count_buffer_pool_.push_back(count_buffer);
+    }
+    for (const GPUBufferHandle &count_buffer : count_buffer_pool_) {
+        gpu_executor->deallocate_buffer(count_buffer);
     }
+    data_counts_.clear();
+    count_buffer_pool_.clear();
+
+    stats_.transfers = residency_.get_stats();
+    if (task_error_) {
+        std::rethrow_exception(task_error_);
+    }
+}
+
+std::exception_ptr Scheduler::take_task_error(int task_id) {
+    if (split_runs_[task_id]) {
+        return std::exchange(split_runs_[task_id]->error, nullptr);
+    }
+    if (cpu_runs_[task_id].task) {
+        return std::exchange(cpu_runs_[task_id].error, nullptr);
+    }
+
+    return nullptr;
 }
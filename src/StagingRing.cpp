@@ -0,0 +1,98 @@
+#include "StagingRing.h"
+#include "DataManager.h"
+#include "IGPUExecutor.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+StagingRing::StagingRing(IGPUExecutor::GPUMemoryAllocator &mem_allocator, size_t num_slots, size_t slot_size)
+    : mem_allocator_(&mem_allocator), claimed_(num_slots, false) {
+    for (size_t i = 0; i < num_slots; ++i) {
+        slots_.push_back({mem_allocator.allocate_memory(slot_size, MemoryHint::Unified), slot_size, nullptr});
+    }
+}
+
+bool StagingRing::slot_free(size_t slot_index) const {
+    return !claimed_[slot_index] && (!slots_[slot_index].fence || slots_[slot_index].fence->is_signalled());
+}
+
+size_t StagingRing::acquire(size_t num_bytes) {
+    std::unique_lock<std::mutex> lock(ring_mut_);
+    if (!mem_allocator_) {
+        throw std::runtime_error("Staging ring was never given any memory");
+    }
+
+    // A ring sized from an empty profile still needs one slot to work with
+    if (slots_.empty()) {
+        slots_.push_back({mem_allocator_->allocate_memory(num_bytes, MemoryHint::Unified), num_bytes, nullptr});
+        claimed_.push_back(false);
+    }
+
+    while (true) {
+        // First free slot in ring order, one that already fits is preferred over growing another
+        size_t free_slot = slots_.size();
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            size_t slot_index = (next_slot_ + i) % slots_.size();
+            if (!slot_free(slot_index)) {
+                continue;
+            }
+
+            if (slots_[slot_index].size >= num_bytes) {
+                free_slot = slot_index;
+                break;
+            }
+            if (free_slot == slots_.size()) {
+                free_slot = slot_index;
+            }
+        }
+
+        if (free_slot != slots_.size()) {
+            Slot &slot = slots_[free_slot];
+            // The larger buffer is allocated before the old one is freed, so a failed grow leaves the slot intact
+            if (slot.size < num_bytes) {
+                size_t grown_size = IGPUExecutor::GPUMemoryAllocator::next_pow2(num_bytes);
+                size_t grown_offset = mem_allocator_->allocate_memory(grown_size, MemoryHint::Unified);
+                mem_allocator_->check_free_mem(slot.size, slot.mem_offset, MemoryHint::Unified);
+                slot.size = grown_size;
+                slot.mem_offset = grown_offset;
+                grow_count_++;
+            }
+
+            claimed_[free_slot] = true;
+            slot.fence.reset();
+            return free_slot;
+        }
+
+        // Every slot is in flight, wait on the oldest transfer rather than allocating more staging memory
+        std::shared_ptr<GPUEvent> oldest_fence;
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            size_t slot_index = (next_slot_ + i) % slots_.size();
+            if (!claimed_[slot_index]) {
+                oldest_fence = slots_[slot_index].fence;
+                break;
+            }
+        }
+
+        if (oldest_fence) {
+            lock.unlock();
+            oldest_fence->wait();
+            lock.lock();
+        } else {
+            // Other threads hold every slot and have not submitted their transfers yet
+            release_cv_.wait(lock);
+        }
+    }
+}
+
+void StagingRing::release(size_t slot_index, std::shared_ptr<GPUEvent> fence) {
+    {
+        std::lock_guard<std::mutex> lock(ring_mut_);
+        slots_[slot_index].fence = std::move(fence);
+        claimed_[slot_index] = false;
+        next_slot_ = (slot_index + 1) % slots_.size();
+    }
+
+    release_cv_.notify_all();
+}
@@ -1,8 +1,11 @@
 #include "Tasks.h"
 #include "Scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <deque>
 #include <iostream>
-#include <mach/task_info.h>
 #include <memory>
 #include <stdexcept>
 #include <unordered_map>
@@ -11,18 +14,43 @@ void BaseCPUTask::accept(Scheduler &scheduler) { scheduler.visit(*this); }
 
 void GPUTask::accept(Scheduler &scheduler) { scheduler.visit(*this); }
 
+void SplitTask::accept(Scheduler &scheduler) { scheduler.visit(*this); }
+
+size_t SplitTask::gpu_count() const {
+    double gpu_share = std::clamp(gpu_share_.load(), MIN_SHARE, 1.0 - MIN_SHARE);
+    return static_cast<size_t>(std::llround(gpu_share * num_elements));
+}
+
+void SplitTask::record_split(size_t gpu_count, std::chrono::nanoseconds gpu_time,
+                             std::chrono::nanoseconds cpu_time) const {
+    size_t cpu_count = num_elements - gpu_count;
+    if (gpu_count == 0 || cpu_count == 0 || gpu_time.count() <= 0 || cpu_time.count() <= 0) {
+        return;
+    }
+
+    // Both sides finish together when each gets a share proportional to its throughput
+    double gpu_rate = static_cast<double>(gpu_count) / gpu_time.count();
+    double cpu_rate = static_cast<double>(cpu_count) / cpu_time.count();
+    double balanced_share = gpu_rate / (gpu_rate + cpu_rate);
+
+    double gpu_share = (1.0 - TUNING_RATE) * gpu_share_ + TUNING_RATE * balanced_share;
+    gpu_share_ = std::clamp(gpu_share, MIN_SHARE, 1.0 - MIN_SHARE);
+}
+
 void TaskGraph::add_task(std::shared_ptr<ITask> task, bool root_task) {
     task->id = task_id_inc++;
     all_tasks_[task->id] = task;
 
-    // Prevent assigning multiple tasks to one output
-    if (data_producer_map_.find(task->output_id) != data_producer_map_.end()) {
-        throw std::runtime_error(
-            "Error during TaskGraph construction: Attempted to assign multiple tasks to one data output");
-    }
+    // Prevent assigning multiple tasks to one output (tasks that only modify their inputs in place have no output)
+    if (task->output_id != VOID_RETURN) {
+        if (data_producer_map_.find(task->output_id) != data_producer_map_.end()) {
+            throw std::runtime_error(
+                "Error during TaskGraph construction: Attempted to assign multiple tasks to one data output");
+        }
 
-    // Mapping the output of the task to the task itself
-    data_producer_map_[task->output_id] = task->id;
+        // Mapping the output of the task to the task itself
+        data_producer_map_[task->output_id] = task->id;
+    }
 
     for (int input_id : task->input_ids) {
         if (root_task) {
@@ -51,6 +79,43 @@ void TaskGraph::add_task(std::shared_ptr<ITask> task, bool root_task) {
 
         unfulfilled_data_.erase(task->output_id);
     }
+
+    add_access_hazards(*task);
+}
+
+// Hazard edges may duplicate a data dependency that already exists, only add them once
+void TaskGraph::add_edge(int producer_id, int consumer_id) {
+    std::vector<int> &consumer_dependencies = dependencies_[consumer_id];
+    if (producer_id == consumer_id ||
+        std::find(consumer_dependencies.begin(), consumer_dependencies.end(), producer_id) !=
+            consumer_dependencies.end()) {
+        return;
+    }
+
+    consumer_dependencies.push_back(producer_id);
+    dependents_[producer_id].push_back(consumer_id);
+}
+
+// Orders in-place writers against other accesses to the same data, in the order tasks were added
+void TaskGraph::add_access_hazards(const ITask &task) {
+    for (int input_id : task.input_ids) {
+        auto writer_iter = last_writer_.find(input_id);
+        if (writer_iter != last_writer_.end()) {
+            add_edge(writer_iter->second, task.id);
+        }
+
+        if (task.get_input_usage(input_id) == DataUsage::ReadOnly) {
+            readers_since_write_[input_id].push_back(task.id);
+            continue;
+        }
+
+        // Write-after-read: every reader added since the last write must finish before the data is modified
+        for (int reader_id : readers_since_write_[input_id]) {
+            add_edge(reader_id, task.id);
+        }
+        readers_since_write_[input_id].clear();
+        last_writer_[input_id] = task.id;
+    }
 }
 
 std::vector<int> TaskGraph::find_ready() const {
@@ -65,6 +130,31 @@ std::vector<int> TaskGraph::find_ready() const {
     return ready_nodes;
 }
 
+std::unordered_map<int, int> TaskGraph::get_release_counts() const {
+    std::unordered_map<int, int> release_counts;
+
+    // Root inputs belong to the user and outputs must outlive the graph, everything else is an intermediate
+    for (auto producer_iter = data_producer_map_.begin(); producer_iter != data_producer_map_.end(); ++producer_iter) {
+        if (producer_iter->second == ROOT_NODE_ID || producer_iter->first == VOID_RETURN ||
+            is_output(producer_iter->first)) {
+            continue;
+        }
+
+        release_counts[producer_iter->first] = 0;
+    }
+
+    for (auto task_iter = all_tasks_.begin(); task_iter != all_tasks_.end(); ++task_iter) {
+        for (int input_id : task_iter->second->input_ids) {
+            auto count_iter = release_counts.find(input_id);
+            if (count_iter != release_counts.end()) {
+                count_iter->second++;
+            }
+        }
+    }
+
+    return release_counts;
+}
+
 std::vector<int> TaskGraph::get_task_ids() const {
     std::vector<int> task_ids;
     for (auto task_iter = all_tasks_.begin(); task_iter != all_tasks_.end(); ++task_iter) {
@@ -79,33 +169,39 @@ void TaskGraph::validate_graph() {
         // TODO: Refactor to pass back more information about what data was unfulfilled
         throw std::runtime_error("Failed to validate task graph: Data Unfulfillment error");
     }
-    std::vector<int> root_nodes = dependents_[ROOT_NODE_ID];
 
-    // Check for cycles utilizing topological sort
-    std::deque<int> task_queue(root_nodes.begin(), root_nodes.end());
-    std::vector<int> ordering;
+    // Check for cycles utilizing topological sort, every task must be reachable once its dependencies are ordered
+    std::deque<int> task_queue;
     std::unordered_map<int, int> indegree_map;
-    for (auto dependent_iter = dependents_.begin(); dependent_iter != dependents_.end(); ++dependent_iter) {
-        indegree_map[dependent_iter->first] = dependent_iter->second.size();
+    for (auto task_iter = all_tasks_.begin(); task_iter != all_tasks_.end(); ++task_iter) {
+        auto dependency_iter = dependencies_.find(task_iter->first);
+        int num_dependencies = dependency_iter == dependencies_.end() ? 0 : dependency_iter->second.size();
+
+        indegree_map[task_iter->first] = num_dependencies;
+        if (num_dependencies == 0) {
+            task_queue.push_back(task_iter->first);
+        }
     }
 
+    size_t num_ordered = 0;
     while (!task_queue.empty()) {
         int cur_task = task_queue.front();
         task_queue.pop_front();
-        ordering.push_back(cur_task);
+        num_ordered++;
 
-        for (int dependent : dependents_[cur_task]) {
-            indegree_map[dependent] -= 1;
+        auto dependent_iter = dependents_.find(cur_task);
+        if (dependent_iter == dependents_.end()) {
+            continue;
         }
 
-        for (auto indegree_iter = indegree_map.begin(); indegree_iter != indegree_map.end(); ++indegree_iter) {
-            if (indegree_iter->second == 0) {
-                task_queue.push_back(indegree_iter->first);
+        for (int dependent : dependent_iter->second) {
+            if (--indegree_map[dependent] == 0) {
+                task_queue.push_back(dependent);
             }
         }
     }
 
-    if (task_queue.size() != all_tasks_.size()) {
-        std::runtime_error("Failed to validate task graph: Cyclic task dependency detected");
+    if (num_ordered != all_tasks_.size()) {
+        throw std::runtime_error("Failed to validate task graph: Cyclic task dependency detected");
     }
 }
@@ -1,16 +1,27 @@
 #include "ThreadPool.h"
+#include "AllocationTracker.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <mutex>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
-ThreadPool::ThreadPool(size_t num_threads) {
+ThreadPool::ThreadPool(size_t num_threads, const std::string &thread_name, ThreadPoolCounters *counters)
+    : counters_(counters) {
     if (num_threads <= 0) {
         throw std::out_of_range("The number of threads in the thread pool must be greater than 0");
     }
 
     for (int i = 0; i < num_threads; ++i) {
-        workers_.emplace_back([this] { this->worker_loop(); });
+        workers_.emplace_back([this, name = thread_name + " " + std::to_string(i)] {
+            Tracer::set_thread_name(name);
+            this->worker_loop();
+        });
     }
 };
 
@@ -27,26 +38,90 @@ ThreadPool::~ThreadPool() {
     }
 }
 
+void ThreadPool::add_job(void (*job)(void *), void *context) {
+    uint64_t enqueue_ns = Tracer::enabled() ? Tracer::now_ns() : 0;
+
+    {
+        // Lock the mutex, put the job into the ring, then unlock the mutex
+        // This prevents threads from accessing the queue as jobs are being added
+        std::unique_lock<std::mutex> lock(queue_mtx_);
+        if (num_queued_ == job_ring_.size()) {
+            grow_ring(std::max<size_t>(2 * job_ring_.size(), 64));
+        }
+
+        job_ring_[(queue_head_ + num_queued_) % job_ring_.size()] = {job, context, enqueue_ns};
+        num_queued_++;
+        // Counted under the lock, so a worker popping the job never counts it out first
+        if (counters_) {
+            update_max(counters_->max_queue_depth, counters_->queue_depth.fetch_add(1, std::memory_order_relaxed) + 1);
+        }
+    }
+
+    // Notify just one thread (undeterministic) that the job queue is ready to be read from
+    cv_.notify_one();
+}
+
+void ThreadPool::reserve_jobs(size_t num_jobs) {
+    std::unique_lock<std::mutex> lock(queue_mtx_);
+    if (num_jobs > job_ring_.size()) {
+        grow_ring(num_jobs);
+    }
+}
+
+void ThreadPool::grow_ring(size_t capacity) {
+    // Unrolled into the front of the new ring, so the queued jobs keep their order
+    std::vector<PoolJob> grown_ring(capacity);
+    for (size_t i = 0; i < num_queued_; ++i) {
+        grown_ring[i] = job_ring_[(queue_head_ + i) % job_ring_.size()];
+    }
+    job_ring_.swap(grown_ring);
+    queue_head_ = 0;
+}
+
 void ThreadPool::worker_loop() {
     while (true) {
-        std::function<void()> task;
+        PoolJob job;
 
         {
             std::unique_lock<std::mutex> queue_lock(this->queue_mtx_);
 
-            // Wait until task is ready or pool is being ended
-            this->cv_.wait(queue_lock, [this] { return this->stop_ || !this->task_queue_.empty(); });
+            // Wait until a job is ready or pool is being ended
+            this->cv_.wait(queue_lock, [this] { return this->stop_ || this->num_queued_ > 0; });
 
             // If stopping and queue is empty -> return
-            // Else, empty the task queue
-            if (this->stop_ && this->task_queue_.empty()) {
+            // Else, empty the job queue
+            if (this->stop_ && this->num_queued_ == 0) {
+                return;
+            }
+
+            job = job_ring_[queue_head_];
+            queue_head_ = (queue_head_ + 1) % job_ring_.size();
+            num_queued_--;
+        }
+
+        AllocationSiteScope worker_site(AllocationSite::Worker);
+        auto run_job = [&job] {
+            if (job.enqueue_ns == 0) {
+                job.job(job.context);
                 return;
             }
 
-            task = std::move(task_queue_.front());
-            this->task_queue_.pop();
+            uint64_t start_ns = Tracer::now_ns();
+            job.job(job.context);
+            Tracer::record_span("pool task", "pool", start_ns, Tracer::now_ns(),
+                                {"queue_wait_ns", static_cast<int64_t>(start_ns - job.enqueue_ns)});
+        };
+
+        if (!counters_) {
+            run_job();
+            continue;
         }
 
-        task();
+        counters_->queue_depth.fetch_sub(1, std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        run_job();
+        std::chrono::nanoseconds busy = std::chrono::steady_clock::now() - start;
+        counters_->busy_ns.fetch_add(busy.count(), std::memory_order_relaxed);
+        counters_->tasks.fetch_add(1, std::memory_order_relaxed);
     }
 }
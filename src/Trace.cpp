@@ -0,0 +1,247 @@
+#include "Trace.h"
+#include "Json.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Written only by its own thread, the count is published after the event so a reader never sees an unwritten slot
+struct Tracer::ThreadBuffer {
+    uint32_t tid;
+    std::string thread_name;
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> num_recorded = 0;
+};
+
+namespace {
+struct TraceRegistry {
+    std::mutex registry_mut;
+    std::vector<std::shared_ptr<void>> buffers;
+    std::vector<std::pair<uint32_t, std::string>> tracks;
+    std::unordered_map<std::string, uint32_t> track_ids;
+    uint32_t next_id = 1;
+    size_t buffer_events = Tracer::DEFAULT_BUFFER_EVENTS;
+};
+
+TraceRegistry &trace_registry() {
+    static TraceRegistry registry;
+    return registry;
+}
+
+// Chrome traces are in microseconds, printed with nanosecond digits so short spans keep their length
+void write_micros(std::ostream &out, uint64_t nanos) {
+    char micros[32];
+    std::snprintf(micros, sizeof(micros), "%llu.%03llu", static_cast<unsigned long long>(nanos / 1000),
+                  static_cast<unsigned long long>(nanos % 1000));
+    out << micros;
+}
+} // namespace
+
+void Tracer::set_buffer_events(size_t num_events) {
+    if (num_events == 0) {
+        throw std::runtime_error("Trace buffers need room for at least one event");
+    }
+
+    TraceRegistry &registry = trace_registry();
+    std::lock_guard<std::mutex> lock(registry.registry_mut);
+    registry.buffer_events = num_events;
+}
+
+// Buffers are owned by the registry too, so events of threads that have exited are still exported
+//  - Created on the first event rather than when the thread is named, so idle threads cost no buffer
+static thread_local std::shared_ptr<void> current_buffer;
+static thread_local std::string current_thread_name;
+
+Tracer::ThreadBuffer &Tracer::thread_buffer() {
+    if (!current_buffer) {
+        TraceRegistry &registry = trace_registry();
+        std::lock_guard<std::mutex> lock(registry.registry_mut);
+
+        std::shared_ptr<ThreadBuffer> buffer = std::make_shared<ThreadBuffer>();
+        buffer->tid = registry.next_id++;
+        buffer->thread_name =
+            current_thread_name.empty() ? "thread " + std::to_string(buffer->tid) : current_thread_name;
+        buffer->events.resize(registry.buffer_events);
+        registry.buffers.push_back(buffer);
+        current_buffer = buffer;
+    }
+
+    return *static_cast<ThreadBuffer *>(current_buffer.get());
+}
+
+void Tracer::set_thread_name(const std::string &thread_name) {
+    current_thread_name = thread_name;
+    if (current_buffer) {
+        std::lock_guard<std::mutex> lock(trace_registry().registry_mut);
+        static_cast<ThreadBuffer *>(current_buffer.get())->thread_name = thread_name;
+    }
+}
+
+uint32_t Tracer::register_track(const std::string &track_name) {
+    TraceRegistry &registry = trace_registry();
+    std::lock_guard<std::mutex> lock(registry.registry_mut);
+
+    auto track_iter = registry.track_ids.find(track_name);
+    if (track_iter != registry.track_ids.end()) {
+        return track_iter->second;
+    }
+
+    uint32_t track = registry.next_id++;
+    registry.track_ids[track_name] = track;
+    registry.tracks.push_back({track, track_name});
+    return track;
+}
+
+void Tracer::record(const TraceEvent &event) {
+    ThreadBuffer &buffer = thread_buffer();
+
+    uint64_t index = buffer.num_recorded.load(std::memory_order_relaxed);
+    buffer.events[index % buffer.events.size()] = event;
+    buffer.num_recorded.store(index + 1, std::memory_order_release);
+}
+
+static TraceEvent make_event(std::string_view name, const char *category, char phase, uint64_t start_ns,
+                             uint64_t duration_ns, const TraceArgs &args, uint32_t track) {
+    TraceEvent event;
+    size_t name_length = std::min(name.size(), TraceEvent::MAX_NAME);
+    std::copy_n(name.data(), name_length, event.name.data());
+    event.name[name_length] = '\0';
+
+    event.category = category;
+    event.phase = phase;
+    event.track = track;
+    event.start_ns = start_ns;
+    event.duration_ns = duration_ns;
+    event.arg_names = args.names;
+    event.arg_values = args.values;
+    return event;
+}
+
+void Tracer::record_span(std::string_view name, const char *category, uint64_t start_ns, uint64_t end_ns,
+                         const TraceArgs &args, uint32_t track) {
+    if (!enabled()) {
+        return;
+    }
+
+    record(make_event(name, category, 'X', start_ns, end_ns > start_ns ? end_ns - start_ns : 0, args, track));
+}
+
+void Tracer::record_instant(std::string_view name, const char *category, const TraceArgs &args, uint32_t track) {
+    if (!enabled()) {
+        return;
+    }
+
+    record(make_event(name, category, 'i', now_ns(), 0, args, track));
+}
+
+size_t Tracer::event_count() {
+    TraceRegistry &registry = trace_registry();
+    std::lock_guard<std::mutex> lock(registry.registry_mut);
+
+    size_t num_events = 0;
+    for (const std::shared_ptr<void> &buffer_ptr : registry.buffers) {
+        const ThreadBuffer &buffer = *static_cast<const ThreadBuffer *>(buffer_ptr.get());
+        num_events += std::min<uint64_t>(buffer.num_recorded.load(std::memory_order_acquire), buffer.events.size());
+    }
+
+    return num_events;
+}
+
+void Tracer::clear() {
+    TraceRegistry &registry = trace_registry();
+    std::lock_guard<std::mutex> lock(registry.registry_mut);
+
+    for (const std::shared_ptr<void> &buffer_ptr : registry.buffers) {
+        static_cast<ThreadBuffer *>(buffer_ptr.get())->num_recorded.store(0, std::memory_order_release);
+    }
+}
+
+// Timestamps start at the oldest exported event, which keeps them short and readable
+void Tracer::write_chrome_trace(std::ostream &out) {
+    TraceRegistry &registry = trace_registry();
+    std::lock_guard<std::mutex> lock(registry.registry_mut);
+
+    std::vector<std::pair<uint32_t, const TraceEvent *>> events;
+    uint64_t origin_ns = UINT64_MAX;
+    for (const std::shared_ptr<void> &buffer_ptr : registry.buffers) {
+        const ThreadBuffer &buffer = *static_cast<const ThreadBuffer *>(buffer_ptr.get());
+        uint64_t num_recorded = buffer.num_recorded.load(std::memory_order_acquire);
+        uint64_t first = num_recorded - std::min<uint64_t>(num_recorded, buffer.events.size());
+
+        for (uint64_t index = first; index < num_recorded; ++index) {
+            const TraceEvent &event = buffer.events[index % buffer.events.size()];
+            events.push_back({event.track != 0 ? event.track : buffer.tid, &event});
+            origin_ns = std::min(origin_ns, event.start_ns);
+        }
+    }
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first_entry = true;
+    auto write_name_metadata = [&](uint32_t tid, const std::string &name) {
+        out << (first_entry ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+            << ",\"args\":{\"name\":";
+        write_json_string(out, name);
+        out << "}}";
+        first_entry = false;
+    };
+
+    for (const std::shared_ptr<void> &buffer_ptr : registry.buffers) {
+        const ThreadBuffer &buffer = *static_cast<const ThreadBuffer *>(buffer_ptr.get());
+        write_name_metadata(buffer.tid, buffer.thread_name);
+    }
+    for (const auto &[track, track_name] : registry.tracks) {
+        write_name_metadata(track, track_name);
+    }
+
+    for (const auto &[tid, event] : events) {
+        out << (first_entry ? "\n" : ",\n") << "{\"name\":";
+        write_json_string(out, event->name.data());
+        out << ",\"cat\":";
+        write_json_string(out, event->category);
+        out << ",\"ph\":\"" << event->phase << "\",\"ts\":";
+        write_micros(out, event->start_ns - origin_ns);
+        if (event->phase == 'X') {
+            out << ",\"dur\":";
+            write_micros(out, event->duration_ns);
+        } else {
+            out << ",\"s\":\"t\"";
+        }
+        out << ",\"pid\":1,\"tid\":" << tid << ",\"args\":{";
+
+        bool first_arg = true;
+        for (size_t arg = 0; arg < TraceEvent::MAX_ARGS; ++arg) {
+            if (event->arg_names[arg] == nullptr) {
+                continue;
+            }
+
+            out << (first_arg ? "" : ",");
+            write_json_string(out, event->arg_names[arg]);
+            out << ':' << event->arg_values[arg];
+            first_arg = false;
+        }
+        out << "}}";
+        first_entry = false;
+    }
+
+    out << "\n]}\n";
+}
+
+void Tracer::save_chrome_trace(const std::string &path) {
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Failed to open the trace file: " + path);
+    }
+
+    write_chrome_trace(out);
+}
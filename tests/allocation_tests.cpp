@@ -0,0 +1,197 @@
+#include "AllocationTracker.h"
+#include "DataManager.h"
+#include "HostExecutor.h"
+#include "Runtime.h"
+#include "Tasks.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+// Direct operator calls, unlike new expressions, can't be elided by the compiler
+void *volatile allocation_sink = nullptr;
+
+void allocate_once(size_t num_bytes) {
+    allocation_sink = ::operator new(num_bytes);
+    ::operator delete(allocation_sink);
+}
+
+class AllocationTest : public testing::Test {
+  protected:
+    DataManager data_manager;
+    GPUDevice device{GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16)};
+
+    std::vector<float> values = std::vector<float>(1024, 1.0f);
+    int sum = 0, doubled = 0, squared = 0, total = 0;
+
+    void TearDown() override { AllocationTracker::set_checking(false); }
+
+    // sum -> (doubled, squared) -> total, where only total is a graph output so the middle results are intermediates
+    TaskGraph make_diamond() {
+        auto values_handle = data_manager.create_ref_handle(&values, DataUsage::ReadOnly);
+        int sum_id = data_manager.create_ref_handle(&sum, DataUsage::ReadWrite).id;
+        int doubled_id = data_manager.create_ref_handle(&doubled, DataUsage::ReadWrite).id;
+        int squared_id = data_manager.create_ref_handle(&squared, DataUsage::ReadWrite).id;
+        int total_id = data_manager.create_ref_handle(&total, DataUsage::ReadWrite).id;
+
+        TaskGraph task_graph;
+        auto sum_task = std::make_shared<BaseCPUTask>("sum", std::vector<int>{values_handle.id}, sum_id);
+        sum_task->task_lambda = [this] { sum = std::accumulate(values.begin(), values.end(), 0.0f); };
+        auto double_task = std::make_shared<BaseCPUTask>("double", std::vector<int>{sum_id}, doubled_id);
+        double_task->task_lambda = [this] { doubled = 2 * sum; };
+        auto square_task = std::make_shared<BaseCPUTask>("square", std::vector<int>{sum_id}, squared_id);
+        square_task->task_lambda = [this] { squared = sum * sum; };
+        auto total_task = std::make_shared<BaseCPUTask>("total", std::vector<int>{doubled_id, squared_id}, total_id);
+        total_task->task_lambda = [this] { total = doubled + squared; };
+
+        task_graph.add_task(sum_task, true);
+        task_graph.add_task(double_task, false);
+        task_graph.add_task(square_task, false);
+        task_graph.add_task(total_task, false);
+        task_graph.mark_output(total_id);
+
+        return task_graph;
+    }
+};
+
+TEST_F(AllocationTest, CountsThreadAllocations) {
+    ASSERT_TRUE(AllocationTracker::hooks_installed());
+
+    AllocationCounts before = AllocationTracker::thread_counts();
+    allocate_once(100);
+    allocate_once(28);
+    AllocationCounts after = AllocationTracker::thread_counts();
+
+    EXPECT_EQ(2, after.allocations - before.allocations);
+    EXPECT_EQ(128, after.bytes - before.bytes);
+}
+
+// Only allocations on a tracked site while checking count as violations, scopes restore the previous site
+TEST_F(AllocationTest, FlagsTrackedSitesWhileChecking) {
+    AllocationTracker::reset_violations();
+
+    {
+        AllocationSiteScope task_site(AllocationSite::Task);
+        allocate_once(16);
+    }
+
+    AllocationTracker::set_checking(true);
+    allocate_once(16);
+    {
+        AllocationSiteScope worker_site(AllocationSite::Worker);
+        {
+            AllocationSiteScope task_site(AllocationSite::Task);
+            allocate_once(32);
+        }
+        EXPECT_EQ(AllocationSite::Worker, AllocationTracker::current_site());
+        allocate_once(8);
+    }
+    AllocationTracker::set_checking(false);
+
+    EXPECT_EQ(AllocationSite::Untracked, AllocationTracker::current_site());
+    EXPECT_EQ(1, AllocationTracker::violations(AllocationSite::Task).allocations);
+    EXPECT_EQ(32, AllocationTracker::violations(AllocationSite::Task).bytes);
+    EXPECT_EQ(1, AllocationTracker::violations(AllocationSite::Worker).allocations);
+    EXPECT_EQ(0, AllocationTracker::violations(AllocationSite::Scheduler).allocations);
+}
+
+// After warm-up a prepared CPU graph runs without a single allocation on the scheduler or the workers, and keeps its
+// intermediates so every run gives the same result
+TEST_F(AllocationTest, PreparedGraphSteadyStateDoesNotAllocate) {
+    TaskGraph task_graph = make_diamond();
+
+    Runtime runtime(data_manager, 4);
+    runtime.prepare_graph(task_graph, device);
+    runtime.enable_allocation_check(3);
+
+    for (int run = 0; run < 50; ++run) {
+        total = 0;
+        runtime.run();
+        ASSERT_EQ(2 * 1024 + 1024 * 1024, total);
+    }
+
+    AllocationReport report = runtime.get_allocation_report();
+    EXPECT_TRUE(report.available);
+    EXPECT_EQ(47, report.checked_runs);
+    EXPECT_EQ(0, report.scheduler.allocations);
+    EXPECT_EQ(0, report.worker.allocations);
+    EXPECT_EQ(0, report.task.allocations);
+    EXPECT_EQ(50, runtime.get_metrics().graphs_run);
+}
+
+// What a task allocates itself is charged to the task, not to the runtime
+TEST_F(AllocationTest, TaskAllocationsAreChargedToTasks) {
+    auto values_handle = data_manager.create_ref_handle(&values, DataUsage::ReadOnly);
+
+    TaskGraph task_graph;
+    auto copy_task = std::make_shared<BaseCPUTask>("copy", std::vector<int>{values_handle.id}, VOID_RETURN);
+    copy_task->task_lambda = [this] {
+        std::vector<float> copy = values;
+        allocation_sink = copy.data();
+    };
+    task_graph.add_task(copy_task, true);
+
+    Runtime runtime(data_manager, 2);
+    runtime.prepare_graph(task_graph, device);
+    runtime.enable_allocation_check(1);
+    for (int run = 0; run < 5; ++run) {
+        runtime.run();
+    }
+
+    AllocationReport report = runtime.get_allocation_report();
+    EXPECT_EQ(4, report.checked_runs);
+    EXPECT_EQ(4, report.task.allocations);
+    EXPECT_EQ(4 * 1024 * sizeof(float), report.task.bytes);
+    EXPECT_EQ(0, report.scheduler.allocations);
+    EXPECT_EQ(0, report.worker.allocations);
+}
+
+// The CPU half of a split task is queued like a CPU task, here it gets the whole range as the GPU share rounds to 0
+TEST_F(AllocationTest, SplitTaskCPUHalfDoesNotAllocate) {
+    HostExecutor::register_kernel("alloc_split", [](const HostKernelContext &) {});
+    std::vector<float> out(8, 0.0f);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite);
+
+    TaskGraph task_graph;
+    auto split_task = std::make_shared<SplitTask>("alloc_split", std::vector<int>{}, out_handle.id, out.size(),
+                                                  [&out](size_t begin, size_t end) {
+                                                      for (size_t i = begin; i < end; ++i) {
+                                                          out[i] += 1.0f;
+                                                      }
+                                                  });
+    split_task->set_gpu_share(SplitTask::MIN_SHARE);
+    ASSERT_EQ(0, split_task->gpu_count());
+    task_graph.add_task(split_task, true);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    runtime.prepare_graph(task_graph, device);
+    runtime.enable_allocation_check(2);
+    for (int run = 0; run < 10; ++run) {
+        runtime.run();
+    }
+
+    EXPECT_EQ(std::vector<float>(out.size(), 10.0f), out);
+    AllocationReport report = runtime.get_allocation_report();
+    EXPECT_EQ(8, report.checked_runs);
+    EXPECT_EQ(0, report.scheduler.allocations);
+    EXPECT_EQ(0, report.worker.allocations);
+    EXPECT_EQ(0, report.task.allocations);
+}
+
+TEST_F(AllocationTest, RunNeedsPreparedGraph) {
+    Runtime runtime(data_manager, 1);
+    EXPECT_THROW(runtime.run(), std::runtime_error);
+
+    // Committing runs the graph once and replaces any prepared one
+    TaskGraph task_graph = make_diamond();
+    runtime.prepare_graph(task_graph, device);
+    runtime.commit_graph(task_graph, device);
+    EXPECT_EQ(2 * 1024 + 1024 * 1024, total);
+    EXPECT_THROW(runtime.run(), std::runtime_error);
+}
@@ -0,0 +1,242 @@
+#include "DataManager.h"
+#include "MappedFile.h"
+#include "PointCloud.h"
+
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+class MappedHandleTest : public testing::Test {
+  protected:
+    DataManager data_manager;
+    std::string file_path;
+    std::vector<float> points;
+
+    void SetUp() override {
+        // Matches the KITTI velodyne layout of (x, y, z, reflectance) float tuples
+        for (int i = 0; i < 4 * 64; ++i) {
+            points.push_back(i * 0.5f);
+        }
+
+        file_path = (std::filesystem::temp_directory_path() /
+                     ("helios_mapped_" + std::string(testing::UnitTest::GetInstance()->current_test_info()->name()) +
+                      ".bin"))
+                        .string();
+        std::ofstream out(file_path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(points.data()), points.size() * sizeof(float));
+    }
+
+    void TearDown() override { std::remove(file_path.c_str()); }
+};
+
+// The mapped handle should expose exactly the file contents through the generic accessors
+TEST_F(MappedHandleTest, SpanMatchesFile) {
+    auto handle = data_manager.create_mapped_handle<float>(file_path);
+
+    auto span = data_manager.get_span(handle.id);
+    ASSERT_EQ(points.size() * sizeof(float), span.size());
+    EXPECT_EQ(0, std::memcmp(points.data(), span.data(), span.size()));
+
+    EXPECT_EQ(points.size() * sizeof(float), data_manager.get_data_length(handle.id));
+    EXPECT_EQ(sizeof(float), data_manager.get_type_size(handle.id));
+}
+
+// Tasks receive the MappedBuffer itself, which must point straight into the mapping rather than a copy
+TEST_F(MappedHandleTest, TypedAccessIsZeroCopy) {
+    auto handle = data_manager.create_mapped_handle<float>(file_path);
+
+    MappedBuffer<float> &buffer = data_manager.get_data(handle);
+    ASSERT_EQ(points.size(), buffer.size());
+    EXPECT_EQ(points[7], buffer[7]);
+    EXPECT_EQ(reinterpret_cast<const std::byte *>(buffer.data()), data_manager.get_span(handle.id).data());
+}
+
+// Read-only mappings must not hand out mutable spans
+TEST_F(MappedHandleTest, ReadOnlyRejectsMutation) {
+    auto handle = data_manager.create_mapped_handle<float>(file_path);
+
+    EXPECT_THROW(data_manager.get_span_mut(handle.id), std::runtime_error);
+}
+
+// Writable mappings are private, so in-place edits never reach the file on disk
+TEST_F(MappedHandleTest, WritableMappingIsPrivate) {
+    MappedFileOptions options;
+    options.sequential = true;
+    options.will_need = true;
+    auto handle = data_manager.create_mapped_handle<float>(file_path, options, DataUsage::ReadWrite);
+
+    data_manager.get_data(handle)[0] = -1.0f;
+    EXPECT_EQ(-1.0f, data_manager.get_data(handle)[0]);
+
+    std::ifstream in(file_path, std::ios::binary);
+    float first_point;
+    in.read(reinterpret_cast<char *>(&first_point), sizeof(float));
+    EXPECT_EQ(points[0], first_point);
+}
+
+// Huge page alignment only changes where the mapping lives, not what it contains
+TEST_F(MappedHandleTest, HugePageAligned) {
+    MappedFileOptions options;
+    options.huge_pages = true;
+    MappedFile mapped(file_path, options);
+
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(mapped.data()) % (2 * 1024 * 1024));
+    EXPECT_EQ(0, std::memcmp(points.data(), mapped.data(), mapped.size()));
+}
+
+// Missing files should surface as a runtime error rather than an empty handle
+TEST_F(MappedHandleTest, MissingFileThrows) {
+    EXPECT_THROW(data_manager.create_mapped_handle<float>(file_path + ".missing"), std::runtime_error);
+}
+
+// A directory opens and has a size but can't be mapped, the error carries mmap's errno rather than close's
+TEST_F(MappedHandleTest, MapFailureReportsErrno) {
+    std::filesystem::path dir_path = file_path + ".dir";
+    std::filesystem::create_directory(dir_path);
+
+    std::string message;
+    try {
+        MappedFile mapped(dir_path.string(), MappedFileOptions());
+    } catch (std::runtime_error &e) {
+        message = e.what();
+    }
+    std::filesystem::remove(dir_path);
+
+    if (message.empty()) {
+        GTEST_SKIP() << "Directories have no size on this file system, so nothing was mapped";
+    }
+    EXPECT_NE(std::string::npos, message.find(std::strerror(ENODEV))) << message;
+}
+
+// Released entries are removed from the manager, aliased data must be left untouched for the user
+TEST(DataManagerTest, ReleaseData) {
+    DataManager data_manager;
+    std::vector<float> user_vec = {1.0f, 2.0f, 3.0f};
+
+    auto owned_handle = data_manager.create_data_handle(std::vector<float>(16, 1.0f));
+    auto alias_handle = data_manager.create_ref_handle(&user_vec);
+    ASSERT_TRUE(data_manager.contains(owned_handle.id));
+    ASSERT_TRUE(data_manager.contains(alias_handle.id));
+
+    data_manager.release_data(owned_handle.id);
+    data_manager.release_data(alias_handle.id);
+
+    EXPECT_FALSE(data_manager.contains(owned_handle.id));
+    EXPECT_FALSE(data_manager.contains(alias_handle.id));
+    EXPECT_THROW(data_manager.get_span(owned_handle.id), std::out_of_range);
+    EXPECT_EQ(3, user_vec.size());
+}
+
+// Storing a container result must replace the object itself, resizing it if needed
+TEST(DataManagerTest, StoreDataResizesContainer) {
+    DataManager data_manager;
+    std::vector<float> user_vec;
+    auto handle = data_manager.create_ref_handle(&user_vec);
+
+    data_manager.store_data(handle.id, std::vector<float>{1.0f, 2.0f, 3.0f});
+
+    ASSERT_EQ(3, user_vec.size());
+    EXPECT_EQ(2.0f, user_vec[1]);
+    EXPECT_EQ(3 * sizeof(float), data_manager.get_data_length(handle.id));
+}
+
+// ****************************
+// Point Cloud Tests
+// ****************************
+
+// Every column must start on a 64-byte boundary so stages can use aligned SIMD loads
+TEST(PointCloudTest, ColumnsAligned) {
+    PointCloud cloud(1000);
+
+    for (size_t column = 0; column < cloud.column_count(); ++column) {
+        EXPECT_EQ(0, reinterpret_cast<uintptr_t>(cloud.column_bytes(column).data()) % POINT_CLOUD_ALIGNMENT);
+    }
+    EXPECT_EQ(1000, cloud.z().size());
+    EXPECT_EQ(1000 * sizeof(uint16_t), cloud.column_bytes(static_cast<size_t>(PointField::Ring)).size());
+}
+
+// Converting from interleaved scans splits each field into its column and resizing keeps existing points
+TEST(PointCloudTest, FromInterleavedAndResize) {
+    std::vector<float> interleaved = {1, 2, 3, 4, 5, 6, 7, 8};
+    PointCloud cloud = PointCloud::from_xyzi(interleaved);
+
+    ASSERT_EQ(2, cloud.size());
+    EXPECT_EQ(5.0f, cloud.x()[1]);
+    EXPECT_EQ(7.0f, cloud.z()[1]);
+    EXPECT_EQ(4.0f, cloud.intensity()[0]);
+
+    cloud.resize(500);
+    EXPECT_EQ(500, cloud.size());
+    EXPECT_EQ(5.0f, cloud.x()[1]);
+    EXPECT_EQ(8.0f, cloud.intensity()[1]);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(cloud.ring().data()) % POINT_CLOUD_ALIGNMENT);
+}
+
+// A shrunk cloud keeps its capacity, so its copy has the columns at other offsets
+TEST(PointCloudTest, CopyOfShrunkCloud) {
+    PointCloud cloud(1000);
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        cloud.x()[i] = i;
+        cloud.intensity()[i] = 2.0f * i;
+        cloud.ring()[i] = i % 64;
+    }
+    cloud.resize(10);
+
+    PointCloud copy = cloud;
+    ASSERT_EQ(10, copy.size());
+    EXPECT_LT(copy.capacity(), cloud.capacity());
+    EXPECT_EQ(9.0f, copy.x()[9]);
+    EXPECT_EQ(18.0f, copy.intensity()[9]);
+    EXPECT_EQ(9, copy.ring()[9]);
+}
+
+// A moved-from cloud gives up its capacity with its storage, so it can be resized and written again
+TEST(PointCloudTest, ReuseMovedFromCloud) {
+    PointCloud cloud(100);
+    cloud.x()[99] = 1.0f;
+
+    PointCloud moved = std::move(cloud);
+    EXPECT_EQ(0, cloud.size());
+    EXPECT_EQ(0, cloud.capacity());
+    EXPECT_EQ(1.0f, moved.x()[99]);
+
+    cloud.resize(50);
+    cloud.x()[49] = 2.0f;
+    cloud.ring()[49] = 3;
+    EXPECT_EQ(2.0f, cloud.x()[49]);
+    EXPECT_EQ(3, cloud.ring()[49]);
+
+    moved = std::move(cloud);
+    cloud.resize(10);
+    cloud.z()[9] = 4.0f;
+    EXPECT_EQ(4.0f, cloud.z()[9]);
+    EXPECT_EQ(2.0f, moved.x()[49]);
+}
+
+// A cloud registers as one handle while still exposing each column as its own span
+TEST(PointCloudTest, RegisteredAsSingleHandle) {
+    DataManager data_manager;
+    PointCloud cloud(64);
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        cloud.z()[i] = static_cast<float>(i);
+    }
+
+    auto handle = data_manager.create_data_handle(std::move(cloud), DataUsage::ReadOnly);
+    PointCloud &stored = data_manager.get_data(handle);
+
+    ASSERT_EQ(POINT_FIELD_COUNT, data_manager.get_column_count(handle.id));
+    auto z_column = data_manager.get_column_span(handle.id, static_cast<size_t>(PointField::Z));
+    EXPECT_EQ(64 * sizeof(float), z_column.size());
+    EXPECT_EQ(reinterpret_cast<const std::byte *>(stored.z().data()), z_column.data());
+    EXPECT_EQ(stored.bytes().size(), data_manager.get_data_length(handle.id));
+    EXPECT_THROW(data_manager.get_column_span(handle.id, POINT_FIELD_COUNT), std::runtime_error);
+}
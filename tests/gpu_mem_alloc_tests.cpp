@@ -1,10 +1,18 @@
 #include "DataManager.h"
 #include "IGPUExecutor.h"
+#include "StagingRing.h"
 
 #include "gmock/gmock.h"
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
 #include <stdexcept>
+#include <thread>
 
 using namespace testing;
 
@@ -33,10 +41,14 @@ class GPUMemoryAllocatorTest : public testing::Test {
     IGPUExecutor::GPUMemoryAllocator mem_alloc = IGPUExecutor::GPUMemoryAllocator(
         min_devloc_size, max_devloc_size, min_unified_size, max_unified_size, min_hostivs_size, max_hostvis_size);
 
+    int unified_min_order() { return mem_alloc.min_order(MemoryHint::Unified); }
+    int unified_max_order() { return mem_alloc.max_order(MemoryHint::Unified); }
+    uint64_t unified_free_mask() { return mem_alloc.free_mask(MemoryHint::Unified); }
+    size_t unified_free_count(size_t order) { return mem_alloc.free_block_count(MemoryHint::Unified, order); }
+
     void check_none_free() {
-        EXPECT_EQ(1 << mem_alloc.unified_max_order, mem_alloc.unified_free_mask);
-        EXPECT_EQ(1, mem_alloc.unified_size_address[mem_alloc.unified_max_order].size());
-        EXPECT_EQ(1, mem_alloc.unified_free_map[mem_alloc.unified_max_order].size());
+        EXPECT_EQ(1 << unified_max_order(), unified_free_mask());
+        EXPECT_EQ(1, unified_free_count(unified_max_order()));
     }
 };
 
@@ -46,11 +58,11 @@ class GPUMemoryAllocatorTest : public testing::Test {
 
 // Tests allocating blocks below minimum size
 TEST_F(GPUMemoryAllocatorTest, AllocBelowMin) {
-    size_t below_min_offset = mem_alloc.allocate_memory(pow(2, mem_alloc.unified_min_order - 1), MemoryHint::Unified);
-    EXPECT_EQ(1, mem_alloc.unified_size_address[mem_alloc.unified_min_order].size());
+    size_t below_min_offset = mem_alloc.allocate_memory(pow(2, unified_min_order() - 1), MemoryHint::Unified);
+    EXPECT_EQ(1, unified_free_count(unified_min_order()));
 
     uint64_t expected_mask = max_unified_size - min_unified_size;
-    EXPECT_EQ(expected_mask, mem_alloc.unified_free_mask);
+    EXPECT_EQ(expected_mask, unified_free_mask());
 }
 
 // Tests allocating blocks above maximum size
@@ -58,9 +70,8 @@ TEST_F(GPUMemoryAllocatorTest, AllocAboveMax) {
     EXPECT_THROW(
         {
             try {
-                mem_alloc.allocate_memory(
-                    std::pow(pow(2, mem_alloc.unified_max_order) + 1, mem_alloc.unified_min_order - 1),
-                    MemoryHint::Unified);
+                mem_alloc.allocate_memory(std::pow(pow(2, unified_max_order()) + 1, unified_min_order() - 1),
+                                          MemoryHint::Unified);
             } catch (const std::runtime_error &e) {
                 EXPECT_STREQ("No space available on GPU for block size!", e.what());
                 throw;
@@ -141,12 +152,11 @@ TEST_F(GPUMemoryAllocatorTest, AllocInvalid) {
 TEST_F(GPUMemoryAllocatorTest, FullAllocFreeMin) {
     size_t min_offset = mem_alloc.allocate_memory(min_unified_size, MemoryHint::Unified);
     uint64_t expected_mask = max_unified_size - min_unified_size;
-    EXPECT_EQ(expected_mask, mem_alloc.unified_free_mask);
+    EXPECT_EQ(expected_mask, unified_free_mask());
 
     // Test each block size has exactly one option free
-    for (int cur_order = mem_alloc.unified_max_order - 1; cur_order >= mem_alloc.unified_min_order; --cur_order) {
-        EXPECT_EQ(1, mem_alloc.unified_size_address[cur_order].size());
-        EXPECT_EQ(1, mem_alloc.unified_free_map[cur_order].size());
+    for (int cur_order = unified_max_order() - 1; cur_order >= unified_min_order(); --cur_order) {
+        EXPECT_EQ(1, unified_free_count(cur_order));
     }
 
     // Test that all memory gets merged after free of only block
@@ -157,13 +167,11 @@ TEST_F(GPUMemoryAllocatorTest, FullAllocFreeMin) {
 // Tests that memory is correctly taken up in a subsection after allocating the full spectrum
 TEST_F(GPUMemoryAllocatorTest, AllocMiddleAfterMin) {
     size_t min_offset = mem_alloc.allocate_memory(min_unified_size, MemoryHint::Unified);
-    int middle_order =
-        mem_alloc.unified_min_order + (int)(mem_alloc.unified_max_order - mem_alloc.unified_min_order) / 2;
+    int middle_order = unified_min_order() + (int)(unified_max_order() - unified_min_order()) / 2;
     int middle_size = 1 << middle_order;
     size_t middle_offset = mem_alloc.allocate_memory(middle_size, MemoryHint::Unified);
 
-    EXPECT_EQ(0, mem_alloc.unified_size_address[middle_order].size());
-    EXPECT_EQ(0, mem_alloc.unified_free_map[middle_order].size());
+    EXPECT_EQ(0, unified_free_count(middle_order));
 }
 
 // ****************************
@@ -172,21 +180,18 @@ TEST_F(GPUMemoryAllocatorTest, AllocMiddleAfterMin) {
 
 // Check that correct free space is reflected when only middle buddies are allocated
 TEST_F(GPUMemoryAllocatorTest, MiddleBuddyFreeSpace) {
-    int middle_order =
-        mem_alloc.unified_min_order + (int)(mem_alloc.unified_max_order - mem_alloc.unified_min_order) / 2;
+    int middle_order = unified_min_order() + (int)(unified_max_order() - unified_min_order()) / 2;
     int middle_size = 1 << middle_order;
     size_t block_offset = mem_alloc.allocate_memory(middle_size, MemoryHint::Unified);
 
-    for (int cur_order = middle_order + 1; cur_order < mem_alloc.unified_max_order; ++cur_order) {
-        EXPECT_EQ(1, mem_alloc.unified_size_address[cur_order].size());
-        EXPECT_EQ(1, mem_alloc.unified_free_map[cur_order].size());
+    for (int cur_order = middle_order + 1; cur_order < unified_max_order(); ++cur_order) {
+        EXPECT_EQ(1, unified_free_count(cur_order));
     }
 
     size_t buddy_offset = mem_alloc.allocate_memory(middle_size, MemoryHint::Unified);
 
-    for (int cur_order = middle_order; cur_order > mem_alloc.unified_min_order; --cur_order) {
-        EXPECT_EQ(0, mem_alloc.unified_size_address[cur_order].size());
-        EXPECT_EQ(0, mem_alloc.unified_free_map[cur_order].size());
+    for (int cur_order = middle_order; cur_order > unified_min_order(); --cur_order) {
+        EXPECT_EQ(0, unified_free_count(cur_order));
     }
 
     mem_alloc.check_free_mem(middle_size, block_offset, MemoryHint::Unified);
@@ -197,8 +202,7 @@ TEST_F(GPUMemoryAllocatorTest, MiddleBuddyFreeSpace) {
 
 // Check that buddies (and memory generally when uniform) allocate contiguously
 TEST_F(GPUMemoryAllocatorTest, BuddyAllocationContiguous) {
-    int middle_order =
-        mem_alloc.unified_min_order + (int)(mem_alloc.unified_max_order - mem_alloc.unified_min_order) / 2;
+    int middle_order = unified_min_order() + (int)(unified_max_order() - unified_min_order()) / 2;
     int middle_size = 1 << middle_order;
     size_t block_offset = mem_alloc.allocate_memory(middle_size, MemoryHint::Unified);
 
@@ -207,8 +211,7 @@ TEST_F(GPUMemoryAllocatorTest, BuddyAllocationContiguous) {
 
     size_t outlier_offset = mem_alloc.allocate_memory(middle_size, MemoryHint::Unified);
     EXPECT_EQ(outlier_offset, buddy_offset + middle_size);
-    EXPECT_EQ(0, mem_alloc.unified_size_address[middle_order + 1].size());
-    EXPECT_EQ(0, mem_alloc.unified_free_map[middle_order + 1].size());
+    EXPECT_EQ(0, unified_free_count(middle_order + 1));
 
     mem_alloc.check_free_mem(middle_size, block_offset, MemoryHint::Unified);
     mem_alloc.check_free_mem(middle_size, outlier_offset, MemoryHint::Unified);
@@ -228,38 +231,31 @@ TEST_F(GPUMemoryAllocatorTest, OutOfOrder) {
     size_t c_offset = mem_alloc.allocate_memory(min_unified_size, MemoryHint::Unified);
     size_t d_offset = mem_alloc.allocate_memory(min_unified_size, MemoryHint::Unified);
 
-    EXPECT_EQ(0, mem_alloc.unified_free_map[mem_alloc.unified_min_order].size());
-    EXPECT_EQ(0, mem_alloc.unified_size_address[mem_alloc.unified_min_order].size());
+    EXPECT_EQ(0, unified_free_count(unified_min_order()));
 
     mem_alloc.check_free_mem(min_unified_size, c_offset, MemoryHint::Unified);
-    EXPECT_EQ(1, mem_alloc.unified_free_map[mem_alloc.unified_min_order].size());
-    EXPECT_EQ(1, mem_alloc.unified_size_address[mem_alloc.unified_min_order].size());
+    EXPECT_EQ(1, unified_free_count(unified_min_order()));
     c_offset = mem_alloc.allocate_memory(min_unified_size, MemoryHint::Unified);
     EXPECT_EQ(c_offset, min_unified_size * 2);
 
     mem_alloc.check_free_mem(min_unified_size, b_offset, MemoryHint::Unified);
-    EXPECT_EQ(1, mem_alloc.unified_free_map[mem_alloc.unified_min_order].size());
-    EXPECT_EQ(1, mem_alloc.unified_size_address[mem_alloc.unified_min_order].size());
+    EXPECT_EQ(1, unified_free_count(unified_min_order()));
 
     mem_alloc.check_free_mem(min_unified_size, d_offset, MemoryHint::Unified);
-    EXPECT_EQ(2, mem_alloc.unified_free_map[mem_alloc.unified_min_order].size());
-    EXPECT_EQ(2, mem_alloc.unified_size_address[mem_alloc.unified_min_order].size());
+    EXPECT_EQ(2, unified_free_count(unified_min_order()));
 
     mem_alloc.check_free_mem(min_unified_size, a_offset, MemoryHint::Unified);
-    EXPECT_EQ(1, mem_alloc.unified_free_map[mem_alloc.unified_min_order].size());
-    EXPECT_EQ(1, mem_alloc.unified_size_address[mem_alloc.unified_min_order].size());
+    EXPECT_EQ(1, unified_free_count(unified_min_order()));
 
     mem_alloc.check_free_mem(min_unified_size, c_offset, MemoryHint::Unified);
-    EXPECT_EQ(0, mem_alloc.unified_free_map[mem_alloc.unified_min_order].size());
-    EXPECT_EQ(0, mem_alloc.unified_size_address[mem_alloc.unified_min_order].size());
+    EXPECT_EQ(0, unified_free_count(unified_min_order()));
 
     check_none_free();
 }
 
 // Tests double free reactivity
 TEST_F(GPUMemoryAllocatorTest, DoubleFreeReaction) {
-    int middle_order =
-        mem_alloc.unified_min_order + (int)(mem_alloc.unified_max_order - mem_alloc.unified_min_order) / 2;
+    int middle_order = unified_min_order() + (int)(unified_max_order() - unified_min_order()) / 2;
     int middle_size = 1 << middle_order;
 
     size_t block_offset = mem_alloc.allocate_memory(middle_size, MemoryHint::Unified);
@@ -277,3 +273,240 @@ TEST_F(GPUMemoryAllocatorTest, DoubleFreeReaction) {
         },
         std::runtime_error);
 }
+
+// Freeing a block that was already merged into a larger free block is still a double free
+TEST_F(GPUMemoryAllocatorTest, DoubleFreeAfterMerge) {
+    size_t block_offset = mem_alloc.allocate_memory(min_unified_size, MemoryHint::Unified);
+    mem_alloc.check_free_mem(min_unified_size, block_offset, MemoryHint::Unified);
+    check_none_free();
+
+    EXPECT_THROW(mem_alloc.check_free_mem(min_unified_size, block_offset, MemoryHint::Unified), std::runtime_error);
+    check_none_free();
+}
+
+// Offsets that could never have been handed out are rejected rather than corrupting the free bitmaps
+TEST_F(GPUMemoryAllocatorTest, FreeInvalidOffset) {
+    mem_alloc.allocate_memory(min_unified_size * 2, MemoryHint::Unified);
+
+    EXPECT_THROW(mem_alloc.check_free_mem(min_unified_size * 2, min_unified_size, MemoryHint::Unified),
+                 std::runtime_error);
+    EXPECT_THROW(mem_alloc.check_free_mem(min_unified_size, max_unified_size, MemoryHint::Unified), std::runtime_error);
+}
+
+// A free must name the size a block was allocated with, a sub-block or a larger block around it is not live
+TEST_F(GPUMemoryAllocatorTest, FreeWrongSize) {
+    size_t block_size = min_unified_size * 4;
+    size_t block_offset = mem_alloc.allocate_memory(block_size, MemoryHint::Unified);
+    auto stats = mem_alloc.get_stats(MemoryHint::Unified);
+
+    // Sub-blocks of the live block, at its start and inside it
+    EXPECT_THROW(mem_alloc.check_free_mem(block_size / 2, block_offset, MemoryHint::Unified), std::runtime_error);
+    EXPECT_THROW(mem_alloc.check_free_mem(min_unified_size, block_offset + min_unified_size, MemoryHint::Unified),
+                 std::runtime_error);
+    // The larger block it was split from
+    EXPECT_THROW(mem_alloc.check_free_mem(block_size * 2, block_offset, MemoryHint::Unified), std::runtime_error);
+
+    auto after = mem_alloc.get_stats(MemoryHint::Unified);
+    EXPECT_EQ(stats.live_bytes, after.live_bytes);
+    EXPECT_EQ(stats.requested_bytes, after.requested_bytes);
+    EXPECT_EQ(stats.live_allocations, after.live_allocations);
+
+    // Nothing was handed back, so the next allocation can't land inside the live block
+    size_t next_offset = mem_alloc.allocate_memory(block_size / 2, MemoryHint::Unified);
+    EXPECT_TRUE(next_offset >= block_offset + block_size || next_offset + block_size / 2 <= block_offset);
+
+    mem_alloc.check_free_mem(block_size / 2, next_offset, MemoryHint::Unified);
+    mem_alloc.check_free_mem(block_size, block_offset, MemoryHint::Unified);
+    check_none_free();
+}
+
+// Sizes past 32 bits must round to the right power of two
+TEST_F(GPUMemoryAllocatorTest, NextPow2Wide) {
+    EXPECT_EQ(1ULL << 33, IGPUExecutor::GPUMemoryAllocator::next_pow2((1ULL << 32) + 1));
+    EXPECT_EQ(1ULL << 40, IGPUExecutor::GPUMemoryAllocator::next_pow2(1ULL << 40));
+    EXPECT_EQ(1, IGPUExecutor::GPUMemoryAllocator::next_pow2(0));
+}
+
+// Random churn must never hand out overlapping blocks and must merge back into a single free slab
+TEST_F(GPUMemoryAllocatorTest, ChurnNoOverlap) {
+    set_sizes(64, 1 << 20, 64, 1 << 20, 64, 1 << 20);
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<size_t> size_dist(1, 1 << 14);
+    std::map<size_t, size_t> live_blocks;
+    auto block_bytes = [](size_t size) {
+        return std::max<size_t>(64, IGPUExecutor::GPUMemoryAllocator::next_pow2(size));
+    };
+
+    for (int i = 0; i < 20000; ++i) {
+        if (!live_blocks.empty() && (rng() % 2 == 0)) {
+            auto block_iter = std::next(live_blocks.begin(), rng() % live_blocks.size());
+            mem_alloc.check_free_mem(block_iter->second, block_iter->first, MemoryHint::Unified);
+            live_blocks.erase(block_iter);
+            continue;
+        }
+
+        size_t block_size = size_dist(rng);
+        size_t block_offset;
+        try {
+            block_offset = mem_alloc.allocate_memory(block_size, MemoryHint::Unified);
+        } catch (const std::runtime_error &) {
+            continue;
+        }
+
+        // The rounded block must not overlap its neighbours on either side
+        auto next_iter = live_blocks.lower_bound(block_offset);
+        if (next_iter != live_blocks.end()) {
+            ASSERT_LE(block_offset + block_bytes(block_size), next_iter->first);
+        }
+        if (next_iter != live_blocks.begin()) {
+            auto prev_iter = std::prev(next_iter);
+            ASSERT_LE(prev_iter->first + block_bytes(prev_iter->second), block_offset);
+        }
+        live_blocks[block_offset] = block_size;
+    }
+
+    for (auto &[block_offset, block_size] : live_blocks) {
+        mem_alloc.check_free_mem(block_size, block_offset, MemoryHint::Unified);
+    }
+    check_none_free();
+}
+
+// ****************************
+// Telemetry Tests
+// ****************************
+
+// Live/peak bytes follow the rounded blocks, while fragmentation compares them with the requested sizes
+TEST_F(GPUMemoryAllocatorTest, OccupancyStats) {
+    size_t small_offset = mem_alloc.allocate_memory(3, MemoryHint::Unified);
+    size_t large_offset = mem_alloc.allocate_memory(48, MemoryHint::Unified);
+
+    auto stats = mem_alloc.get_stats(MemoryHint::Unified);
+    EXPECT_EQ(max_unified_size, stats.capacity_bytes);
+    EXPECT_EQ(4 + 64, stats.live_bytes);
+    EXPECT_EQ(3 + 48, stats.requested_bytes);
+    EXPECT_EQ(2, stats.live_allocations);
+    EXPECT_DOUBLE_EQ(1.0 - 51.0 / 68.0, stats.internal_fragmentation);
+    EXPECT_EQ(128, stats.largest_free_block);
+
+    // Splitting for the 4 byte block left one free block at each order below 64 bytes
+    size_t free_bytes = 0;
+    for (size_t order = 0; order < stats.free_bytes_per_order.size(); ++order) {
+        free_bytes += stats.free_bytes_per_order[order];
+    }
+    EXPECT_EQ(max_unified_size - stats.live_bytes, free_bytes);
+    EXPECT_EQ(32, stats.free_bytes_per_order[5]);
+
+    mem_alloc.check_free_mem(48, large_offset, MemoryHint::Unified);
+    mem_alloc.check_free_mem(3, small_offset, MemoryHint::Unified);
+
+    stats = mem_alloc.get_stats(MemoryHint::Unified);
+    EXPECT_EQ(0, stats.live_bytes);
+    EXPECT_EQ(68, stats.peak_bytes);
+    EXPECT_EQ(max_unified_size, stats.largest_free_block);
+
+    mem_alloc.reset_peak(MemoryHint::Unified);
+    EXPECT_EQ(0, mem_alloc.get_stats(MemoryHint::Unified).peak_bytes);
+}
+
+// Allocations that don't fit are counted per memory class
+TEST_F(GPUMemoryAllocatorTest, FailedAllocationCount) {
+    mem_alloc.allocate_memory(max_unified_size, MemoryHint::Unified);
+
+    EXPECT_FALSE(mem_alloc.try_allocate_memory(min_unified_size, MemoryHint::Unified).has_value());
+    EXPECT_THROW(mem_alloc.allocate_memory(max_unified_size * 2, MemoryHint::Unified), std::runtime_error);
+
+    EXPECT_EQ(2, mem_alloc.get_stats(MemoryHint::Unified).failed_allocations);
+    EXPECT_EQ(0, mem_alloc.get_stats(MemoryHint::DeviceLocal).failed_allocations);
+}
+
+// A written trace reads back with frees paired to their allocation ids
+TEST_F(GPUMemoryAllocatorTest, TraceRoundTrip) {
+    using TraceOp = IGPUExecutor::GPUMemoryAllocator::TraceOp;
+
+    mem_alloc.set_tracing(true);
+    size_t block_offset = mem_alloc.allocate_memory(16, MemoryHint::Unified);
+    size_t other_offset = mem_alloc.allocate_memory(100, MemoryHint::DeviceLocal);
+    mem_alloc.check_free_mem(16, block_offset, MemoryHint::Unified);
+    mem_alloc.try_allocate_memory(max_devloc_size, MemoryHint::DeviceLocal);
+    mem_alloc.check_free_mem(100, other_offset, MemoryHint::DeviceLocal);
+
+    std::stringstream trace_stream;
+    mem_alloc.write_trace(trace_stream);
+    auto trace = IGPUExecutor::GPUMemoryAllocator::read_trace(trace_stream);
+
+    ASSERT_EQ(5, trace.size());
+    EXPECT_EQ(TraceOp::Alloc, trace[0].op);
+    EXPECT_EQ(MemoryHint::Unified, trace[0].mem_hint);
+    EXPECT_EQ(16, trace[0].size);
+    EXPECT_EQ(TraceOp::Free, trace[2].op);
+    EXPECT_EQ(trace[0].id, trace[2].id);
+    EXPECT_EQ(TraceOp::Failed, trace[3].op);
+    EXPECT_EQ(MemoryHint::DeviceLocal, trace[4].mem_hint);
+    EXPECT_EQ(trace[1].id, trace[4].id);
+    EXPECT_NE(trace[0].id, trace[1].id);
+}
+
+// Slots in flight are skipped, a slot is recycled in place once its fence is signalled
+TEST_F(GPUMemoryAllocatorTest, StagingRingRecyclesSlots) {
+    StagingRing staging_ring(mem_alloc, 3, 32);
+    size_t live_allocations = mem_alloc.get_stats(MemoryHint::Unified).live_allocations;
+    EXPECT_EQ(3, live_allocations);
+
+    std::vector<std::shared_ptr<GPUEvent>> fences;
+    std::vector<size_t> slot_indices;
+    for (int i = 0; i < 3; ++i) {
+        slot_indices.push_back(staging_ring.acquire(32));
+        fences.push_back(std::make_shared<GPUEvent>());
+        staging_ring.release(slot_indices.back(), fences.back());
+    }
+    std::sort(slot_indices.begin(), slot_indices.end());
+    EXPECT_EQ((std::vector<size_t>{0, 1, 2}), slot_indices);
+
+    fences[1]->signal();
+    EXPECT_EQ(1, staging_ring.acquire(16));
+    EXPECT_EQ(live_allocations, mem_alloc.get_stats(MemoryHint::Unified).live_allocations);
+    EXPECT_EQ(0, staging_ring.get_grow_count());
+}
+
+// With every slot in flight acquire waits for the oldest transfer instead of allocating more memory
+TEST_F(GPUMemoryAllocatorTest, StagingRingWaitsForOldest) {
+    StagingRing staging_ring(mem_alloc, 2, 32);
+    std::shared_ptr<GPUEvent> first_fence = std::make_shared<GPUEvent>();
+    std::shared_ptr<GPUEvent> second_fence = std::make_shared<GPUEvent>();
+    size_t first_slot = staging_ring.acquire(32);
+    staging_ring.release(first_slot, first_fence);
+    staging_ring.release(staging_ring.acquire(32), second_fence);
+
+    std::thread signaller([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        first_fence->signal();
+    });
+    EXPECT_EQ(first_slot, staging_ring.acquire(32));
+    signaller.join();
+    EXPECT_FALSE(second_fence->is_signalled());
+}
+
+// A transfer larger than every free slot grows one of them rather than failing
+TEST_F(GPUMemoryAllocatorTest, StagingRingGrowsOversizedSlot) {
+    StagingRing staging_ring(mem_alloc, 2, 16);
+
+    size_t slot_index = staging_ring.acquire(100);
+    EXPECT_GE(staging_ring.get_slot(slot_index).size, 100);
+    EXPECT_EQ(1, staging_ring.get_grow_count());
+    EXPECT_EQ(2, mem_alloc.get_stats(MemoryHint::Unified).live_allocations);
+}
+
+// A slot that can't grow keeps its old buffer and stays usable
+TEST_F(GPUMemoryAllocatorTest, StagingRingKeepsSlotWhenGrowFails) {
+    StagingRing staging_ring(mem_alloc, 2, 16);
+    StagingRing::Slot slot = staging_ring.get_slot(0);
+
+    EXPECT_THROW(staging_ring.acquire(max_unified_size + 1), std::runtime_error);
+    EXPECT_EQ(2, mem_alloc.get_stats(MemoryHint::Unified).live_allocations);
+    EXPECT_EQ(0, staging_ring.get_grow_count());
+
+    size_t slot_index = staging_ring.acquire(16);
+    EXPECT_EQ(slot.mem_offset, staging_ring.get_slot(slot_index).mem_offset);
+    EXPECT_EQ(slot.size, staging_ring.get_slot(slot_index).size);
+}
@@ -0,0 +1,955 @@
+#include "DataManager.h"
+#include "HostExecutor.h"
+#include "IGPUExecutor.h"
+#include "PointCloud.h"
+#include "Runtime.h"
+#include "Scheduler.h"
+#include "Tasks.h"
+#include "ThreadPool.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Counts how uploads reach the executor, to check the scheduler coalesces them
+class CountingHostExecutor : public HostExecutor {
+  public:
+    using HostExecutor::HostExecutor;
+
+    int single_copies = 0;
+    int batches = 0;
+    size_t batched_copies = 0;
+
+    GPUState copy_to_device(std::span<const std::byte> data_mem, const GPUBufferHandle &buffer_handle) override {
+        single_copies++;
+        return HostExecutor::copy_to_device(data_mem, buffer_handle);
+    }
+
+    GPUState copy_to_device_batch(const std::vector<BufferCopy> &copies) override {
+        batches++;
+        batched_copies += copies.size();
+        return HostExecutor::copy_to_device_batch(copies);
+    }
+};
+
+class HostExecutorTest : public testing::Test {
+  protected:
+    HostExecutor executor{std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16), 4};
+
+    static void SetUpTestSuite() {
+        HostExecutor::register_kernel("host_vec_add", [](const HostKernelContext &context) {
+            auto lhs = context.buffer<const float>(0);
+            auto rhs = context.buffer<const float>(1);
+            auto out = context.buffer<float>(2);
+
+            size_t i = context.linear_id();
+            if (i < out.size()) {
+                out[i] = lhs[i] + rhs[i];
+            }
+        });
+
+        HostExecutor::register_kernel("host_copy", [](const HostKernelContext &context) {
+            auto in = context.buffer<const float>(0);
+            auto out = context.buffer<float>(context.buffers.size() - 1);
+
+            size_t i = context.linear_id();
+            if (i < out.size()) {
+                out[i] = in[i] + 1.0f;
+            }
+        });
+
+        // Stream compaction, positive inputs are appended to the output through the counter
+        HostExecutor::register_kernel("host_compact_positive", [](const HostKernelContext &context) {
+            auto in = context.buffer<const float>(0);
+            auto out = context.buffer<float>(1);
+            auto count = context.buffer<uint64_t>(2);
+
+            size_t i = context.linear_id();
+            if (i < in.size() && in[i] > 0.0f) {
+                out[std::atomic_ref<uint64_t>(count[0]).fetch_add(1)] = in[i];
+            }
+        });
+
+        // Sized from the device counter of its input, which is bound last
+        HostExecutor::register_kernel("host_double_counted", [](const HostKernelContext &context) {
+            auto in = context.buffer<const float>(0);
+            auto out = context.buffer<float>(1);
+            auto count = context.buffer<const uint64_t>(context.buffers.size() - 1);
+
+            size_t i = context.linear_id();
+            if (i < count[0]) {
+                out[i] = 2.0f * in[i];
+            }
+        });
+
+        HostExecutor::register_kernel("host_count_threads", [](const HostKernelContext &context) {
+            std::atomic_ref<uint64_t>(context.buffer<uint64_t>(0)[0]).fetch_add(1);
+        });
+
+        HostExecutor::register_kernel("host_range_filter", [](const HostKernelContext &context) {
+            auto in = context.buffer<const float>(0);
+            auto out = context.buffer<float>(1);
+
+            size_t i = context.linear_id();
+            if (i < out.size()) {
+                out[i] = in[i] > 1.0f ? in[i] : 0.0f;
+            }
+        });
+
+        HostExecutor::register_kernel("host_scale", [](const HostKernelContext &context) {
+            auto data = context.buffer<float>(0);
+
+            size_t i = context.linear_id();
+            if (i < data.size()) {
+                data[i] *= 2.0f;
+            }
+        });
+    }
+
+    GPUBufferHandle upload(const std::vector<float> &values, MemoryHint mem_hint = MemoryHint::DeviceLocal) {
+        std::span<const std::byte> bytes = std::as_bytes(std::span(values));
+        GPUBufferHandle buffer = executor.allocate_buffer(bytes.size(), mem_hint);
+        EXPECT_EQ(GPUState::GPUSuccess, executor.copy_to_device(bytes, buffer));
+        return buffer;
+    }
+
+    std::vector<float> download(const GPUBufferHandle &buffer, size_t num_values) {
+        std::vector<float> values(num_values);
+        EXPECT_EQ(GPUState::GPUSuccess, executor.copy_from_device(std::as_writable_bytes(std::span(values)), buffer));
+        return values;
+    }
+};
+
+// Every memory class is plain host memory, so data must survive a round trip untouched
+TEST_F(HostExecutorTest, CopyRoundTrip) {
+    std::vector<float> values = {1.0f, 2.0f, 3.0f, 4.0f};
+
+    for (MemoryHint mem_hint : {MemoryHint::DeviceLocal, MemoryHint::HostVisible, MemoryHint::Unified}) {
+        GPUBufferHandle buffer = upload(values, mem_hint);
+        EXPECT_EQ(values, download(buffer, values.size()));
+        EXPECT_EQ(GPUState::GPUSuccess, executor.deallocate_buffer(buffer));
+    }
+}
+
+// Kernels run once per grid thread and the callback fires after the whole grid has completed
+TEST_F(HostExecutorTest, ExecuteKernel) {
+    const size_t num_values = 1000;
+    std::vector<float> lhs(num_values), rhs(num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        lhs[i] = i;
+        rhs[i] = 2.0f * i;
+    }
+
+    GPUBufferHandle lhs_buffer = upload(lhs);
+    GPUBufferHandle rhs_buffer = upload(rhs);
+    GPUBufferHandle out_buffer = executor.allocate_buffer(num_values * sizeof(float), MemoryHint::DeviceLocal);
+
+    std::atomic<int> num_callbacks = 0;
+    std::function<void()> callback = [&] { num_callbacks++; };
+    KernelDispatch kernel{"host_vec_add", {lhs_buffer, rhs_buffer, out_buffer}, {16, 1, 1}, {8, 8, 1}};
+    ASSERT_EQ(GPUState::GPUSuccess, executor.execute_kernel(kernel, callback));
+    executor.synchronize();
+
+    EXPECT_EQ(1, num_callbacks);
+    std::vector<float> out = download(out_buffer, num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        EXPECT_EQ(3.0f * i, out[i]);
+    }
+}
+
+// Serial batches behave like a serial encoder, so each kernel sees the previous kernel's writes
+TEST_F(HostExecutorTest, SerialBatchIsOrdered) {
+    std::vector<float> values(64, 1.0f);
+    GPUBufferHandle buffer = upload(values);
+
+    std::atomic<int> num_callbacks = 0;
+    std::function<void()> callback = [&] { num_callbacks++; };
+    KernelDispatch scale{"host_scale", {buffer}, {1, 1, 1}, {64, 1, 1}};
+    ASSERT_EQ(GPUState::GPUSuccess, executor.execute_batch({scale, scale, scale}, DispatchType::Serial, callback));
+    executor.synchronize();
+
+    EXPECT_EQ(3, num_callbacks);
+    EXPECT_EQ(std::vector<float>(64, 8.0f), download(buffer, values.size()));
+}
+
+// Unknown kernels are reported at submission rather than failing on the command thread
+TEST_F(HostExecutorTest, MissingKernelThrows) {
+    std::function<void()> callback = [] {};
+    KernelDispatch kernel{"host_missing_kernel", {}, {1, 1, 1}, {1, 1, 1}};
+
+    EXPECT_THROW(executor.execute_kernel(kernel, callback), std::runtime_error);
+}
+
+// Warm-up resolves every known kernel once and reports each missing name a single time
+TEST_F(HostExecutorTest, PrepareKernelsReportsMissing) {
+    std::vector<std::string> missing_kernels =
+        executor.prepare_kernels({"host_vec_add", "host_missing_kernel", "host_scale", "host_missing_kernel"});
+
+    EXPECT_EQ(std::vector<std::string>{"host_missing_kernel"}, missing_kernels);
+    EXPECT_TRUE(executor.get_kernel_status("host_vec_add"));
+    EXPECT_TRUE(executor.get_kernel_status("host_scale"));
+    EXPECT_FALSE(executor.get_kernel_status("host_missing_kernel"));
+}
+
+// A graph with an unknown kernel is rejected at commit, before any of its tasks run
+TEST_F(HostExecutorTest, RuntimeRejectsMissingKernel) {
+    const size_t num_values = 16;
+    DataManager data_manager;
+    std::vector<float> in(num_values, 1.0f), mid(num_values), out(num_values);
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto mid_handle = data_manager.create_ref_handle(&mid, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    auto copy_task =
+        std::make_shared<GPUTask>("host_copy", std::vector<int>{in_handle.id}, mid_handle.id, false, num_values);
+    task_graph.add_task(copy_task, true);
+    task_graph.add_task(std::make_shared<GPUTask>("host_missing_kernel", std::vector<int>{mid_handle.id},
+                                                  out_handle.id, false, num_values),
+                        false);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    EXPECT_THROW(runtime.commit_graph(task_graph, device), std::runtime_error);
+    EXPECT_EQ(std::vector<float>(num_values, 0.0f), mid);
+}
+
+// The full GPU scheduling path (upload, dispatch, callback, download) runs on the host backend
+TEST_F(HostExecutorTest, RuntimeGPUTask) {
+    const size_t num_values = 300;
+    DataManager data_manager;
+    std::vector<float> lhs(num_values, 1.5f), rhs(num_values, 2.5f), out(num_values);
+
+    auto lhs_handle = data_manager.create_ref_handle(&lhs, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto rhs_handle = data_manager.create_ref_handle(&rhs, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    task_graph.add_task(
+        std::make_shared<GPUTask>("host_vec_add", std::vector<int>{lhs_handle.id, rhs_handle.id}, out_handle.id,
+                                  false, num_values),
+        true);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.commit_graph(task_graph, device);
+
+    EXPECT_EQ(std::vector<float>(num_values, 4.0f), out);
+}
+
+// A prepared graph keeps its intermediates, so every run uploads, computes and downloads the current frame again
+TEST_F(HostExecutorTest, PreparedGraphReruns) {
+    const size_t num_values = 256;
+    DataManager data_manager;
+    std::vector<float> in(num_values), scaled(num_values), copied(num_values);
+    float total = 0.0f;
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly);
+    auto scaled_handle = data_manager.create_ref_handle(&scaled, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    auto copied_handle = data_manager.create_ref_handle(&copied, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    auto total_handle = data_manager.create_ref_handle(&total, DataUsage::ReadWrite);
+
+    TaskGraph task_graph;
+    auto scale_task = std::make_shared<BaseCPUTask>("scale", std::vector<int>{in_handle.id}, scaled_handle.id);
+    scale_task->task_lambda = [&] {
+        std::transform(in.begin(), in.end(), scaled.begin(), [](float value) { return 2.0f * value; });
+    };
+    auto sum_task = std::make_shared<BaseCPUTask>("sum", std::vector<int>{copied_handle.id}, total_handle.id);
+    sum_task->task_lambda = [&] { total = std::accumulate(copied.begin(), copied.end(), 0.0f); };
+
+    task_graph.add_task(scale_task, true);
+    task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{scaled_handle.id}, copied_handle.id,
+                                                  false, num_values),
+                        false);
+    task_graph.add_task(sum_task, false);
+    task_graph.mark_output(total_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.prepare_graph(task_graph, device);
+    for (int run = 0; run < 5; ++run) {
+        std::fill(in.begin(), in.end(), static_cast<float>(run));
+        runtime.run();
+        EXPECT_EQ(num_values * (2.0f * run + 1.0f), total);
+    }
+
+    EXPECT_TRUE(data_manager.contains(scaled_handle.id));
+    EXPECT_EQ(0, runtime.get_allocator_stats(MemoryHint::DeviceLocal).live_allocations);
+}
+
+// Tasks whose buffers don't fit wait for in-flight tasks to free device memory instead of failing the graph
+TEST_F(HostExecutorTest, DeferredUntilMemoryFreed) {
+    // Each task needs half of the 4 KiB device local slab for its input and half for its output
+    const size_t num_values = 512;
+    DataManager data_manager;
+    std::vector<std::vector<float>> inputs(3, std::vector<float>(num_values));
+    std::vector<std::vector<float>> outputs(3, std::vector<float>(num_values));
+
+    TaskGraph task_graph;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::fill(inputs[i].begin(), inputs[i].end(), static_cast<float>(i));
+        auto in_handle = data_manager.create_ref_handle(&inputs[i], DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+        auto out_handle = data_manager.create_ref_handle(&outputs[i], DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+        task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{in_handle.id}, out_handle.id,
+                                                      false, num_values),
+                            true);
+        task_graph.mark_output(out_handle.id);
+    }
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 4096), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.commit_graph(task_graph, device);
+
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        EXPECT_EQ(std::vector<float>(num_values, i + 1.0f), outputs[i]);
+    }
+    EXPECT_EQ(2, runtime.get_scheduler_stats().deferred_gpu_tasks);
+    EXPECT_GT(runtime.get_scheduler_stats().alloc_stall_time.count(), 0);
+}
+
+// A task that can't fit even with nothing else in flight is reported instead of waiting forever
+TEST_F(HostExecutorTest, DeferredWithNothingInFlightThrows) {
+    const size_t num_values = 512;
+    DataManager data_manager;
+    std::vector<float> lhs(num_values), rhs(num_values), out(num_values);
+
+    auto lhs_handle = data_manager.create_ref_handle(&lhs, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto rhs_handle = data_manager.create_ref_handle(&rhs, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    task_graph.add_task(
+        std::make_shared<GPUTask>("host_vec_add", std::vector<int>{lhs_handle.id, rhs_handle.id}, out_handle.id,
+                                  false, num_values),
+        true);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 4096), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    EXPECT_THROW(runtime.commit_graph(task_graph, device), std::runtime_error);
+}
+
+// Allocator telemetry and the allocation trace of a committed graph stay readable through the Runtime
+TEST_F(HostExecutorTest, RuntimeAllocationTelemetry) {
+    const size_t num_values = 256;
+    DataManager data_manager;
+    std::vector<float> in(num_values, 1.0f), out(num_values);
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    task_graph.add_task(
+        std::make_shared<GPUTask>("host_copy", std::vector<int>{in_handle.id}, out_handle.id, false, num_values),
+        true);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    device.trace_allocations = true;
+    runtime.commit_graph(task_graph, device);
+
+    auto stats = runtime.get_allocator_stats(MemoryHint::DeviceLocal);
+    EXPECT_EQ(2 * num_values * sizeof(float), stats.peak_bytes);
+    EXPECT_EQ(0, stats.live_bytes);
+    EXPECT_EQ(0, stats.failed_allocations);
+
+    std::stringstream trace_stream;
+    runtime.write_allocation_trace(trace_stream);
+    auto trace = IGPUExecutor::GPUMemoryAllocator::read_trace(trace_stream);
+    EXPECT_EQ(4, trace.size());
+}
+
+// A batch uploads every entry, whatever memory class each buffer lives in
+TEST_F(HostExecutorTest, BatchedUpload) {
+    std::vector<float> lhs = {1.0f, 2.0f, 3.0f}, rhs = {4.0f, 5.0f};
+    GPUBufferHandle lhs_buffer = executor.allocate_buffer(lhs.size() * sizeof(float), MemoryHint::DeviceLocal);
+    GPUBufferHandle rhs_buffer = executor.allocate_buffer(rhs.size() * sizeof(float), MemoryHint::Unified);
+
+    std::vector<BufferCopy> copies = {{std::as_bytes(std::span(lhs)), lhs_buffer},
+                                      {std::as_bytes(std::span(rhs)), rhs_buffer}};
+    EXPECT_EQ(GPUState::GPUSuccess, executor.copy_to_device_batch(copies));
+
+    EXPECT_EQ(lhs, download(lhs_buffer, lhs.size()));
+    EXPECT_EQ(rhs, download(rhs_buffer, rhs.size()));
+}
+
+// Each kernel of a batch reports its own completion
+TEST_F(HostExecutorTest, BatchCallbackPerKernel) {
+    const size_t num_values = 32;
+    GPUBufferHandle first = upload(std::vector<float>(num_values, 1.0f));
+    GPUBufferHandle second = upload(std::vector<float>(num_values, 3.0f));
+
+    std::vector<int> completed;
+    std::vector<std::function<void()>> callbacks = {[&] { completed.push_back(0); }, [&] { completed.push_back(1); }};
+    KernelDispatch scale_first{"host_scale", {first}, {1, 1, 1}, {num_values, 1, 1}};
+    KernelDispatch scale_second{"host_scale", {second}, {1, 1, 1}, {num_values, 1, 1}};
+    ASSERT_EQ(GPUState::GPUSuccess,
+              executor.execute_batch({scale_first, scale_second}, DispatchType::Concurrent, callbacks));
+    executor.synchronize();
+
+    EXPECT_EQ((std::vector<int>{0, 1}), completed);
+    EXPECT_EQ(std::vector<float>(num_values, 2.0f), download(first, num_values));
+    EXPECT_EQ(std::vector<float>(num_values, 6.0f), download(second, num_values));
+}
+
+// Independent GPU tasks become ready together, so all of their inputs go out in one batch
+TEST_F(HostExecutorTest, ReadySetUploadsInOneBatch) {
+    const size_t num_values = 64;
+    DataManager data_manager;
+    std::vector<std::vector<float>> inputs(3, std::vector<float>(num_values, 1.0f));
+    std::vector<std::vector<float>> outputs(3, std::vector<float>(num_values));
+
+    TaskGraph task_graph;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        auto in_handle = data_manager.create_ref_handle(&inputs[i], DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+        auto out_handle = data_manager.create_ref_handle(&outputs[i], DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+        task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{in_handle.id}, out_handle.id,
+                                                      false, num_values),
+                            true);
+        task_graph.mark_output(out_handle.id);
+    }
+
+    auto counting_executor =
+        std::make_unique<CountingHostExecutor>(std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    CountingHostExecutor &counts = *counting_executor;
+    std::unique_ptr<IGPUExecutor> gpu_executor = std::move(counting_executor);
+    std::unique_ptr<ThreadPool> thread_pool = std::make_unique<ThreadPool>(2);
+
+    Scheduler scheduler(data_manager, thread_pool, gpu_executor);
+    scheduler.execute_graph(task_graph);
+
+    for (const std::vector<float> &output : outputs) {
+        EXPECT_EQ(std::vector<float>(num_values, 2.0f), output);
+    }
+    EXPECT_EQ(0, counts.single_copies);
+    EXPECT_EQ(1, counts.batches);
+    EXPECT_EQ(inputs.size(), counts.batched_copies);
+    EXPECT_EQ(1, scheduler.get_stats().gpu_batches);
+    EXPECT_EQ(inputs.size(), scheduler.get_stats().gpu_kernels);
+}
+
+// Asynchronous transfers are queued behind earlier work and report completion through their events
+TEST_F(HostExecutorTest, AsyncCopiesSignalEvents) {
+    std::vector<float> values = {1.0f, 2.0f, 3.0f, 4.0f};
+    GPUBufferHandle buffer = executor.allocate_buffer(values.size() * sizeof(float), MemoryHint::DeviceLocal);
+
+    std::shared_ptr<GPUEvent> upload_event =
+        executor.copy_to_device_async({{std::as_bytes(std::span(values)), buffer}});
+    std::vector<float> result(values.size());
+    std::shared_ptr<GPUEvent> download_event =
+        executor.copy_from_device_async(std::as_writable_bytes(std::span(result)), buffer);
+
+    std::atomic<bool> chained = false;
+    download_event->on_signal([&] { chained = true; });
+    download_event->wait();
+
+    EXPECT_TRUE(upload_event->is_signalled());
+    EXPECT_TRUE(chained);
+    EXPECT_EQ(values, result);
+}
+
+// Invalid transfers are rejected on the calling thread, before anything is queued
+TEST_F(HostExecutorTest, AsyncCopyOutsideDeviceMemoryThrows) {
+    std::vector<float> values(4);
+    GPUBufferHandle buffer(0, MemoryHint::DeviceLocal, 1 << 16, values.size() * sizeof(float));
+
+    EXPECT_THROW(executor.copy_to_device_async({{std::as_bytes(std::span(values)), buffer}}), std::runtime_error);
+    EXPECT_THROW(executor.copy_from_device_async(std::as_writable_bytes(std::span(values)), buffer),
+                 std::runtime_error);
+    EXPECT_EQ(GPUState::GPUSuccess, executor.synchronize());
+}
+
+// A kernel waiting on an event is held back on the executor's queue, the submitting thread is never blocked
+TEST_F(HostExecutorTest, KernelWaitsOnEvent) {
+    const size_t num_values = 64;
+    GPUBufferHandle data_buffer = upload(std::vector<float>(num_values, 1.0f));
+
+    std::atomic<int> num_callbacks = 0;
+    std::function<void()> callback = [&] { num_callbacks++; };
+    std::shared_ptr<GPUEvent> gate = std::make_shared<GPUEvent>();
+    KernelDispatch kernel{"host_scale", {data_buffer}, {1, 1, 1}, {num_values, 1, 1}, {gate}};
+    ASSERT_EQ(GPUState::GPUSuccess, executor.execute_kernel(kernel, callback));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(0, num_callbacks);
+
+    gate->signal();
+    executor.synchronize();
+    EXPECT_EQ(1, num_callbacks);
+    EXPECT_EQ(std::vector<float>(num_values, 2.0f), download(data_buffer, num_values));
+}
+
+// An intermediate passed between GPU tasks never comes back to the host, only the graph output is downloaded
+TEST_F(HostExecutorTest, GPUChainStaysOnDevice) {
+    const size_t num_values = 256;
+    DataManager data_manager;
+    std::vector<float> in(num_values, 1.0f), mid(num_values, 0.0f), out(num_values, 0.0f);
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto mid_handle = data_manager.create_ref_handle(&mid, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{in_handle.id}, mid_handle.id, false,
+                                                  num_values),
+                        true);
+    task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{mid_handle.id}, out_handle.id, false,
+                                                  num_values),
+                        false);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.commit_graph(task_graph, device);
+
+    EXPECT_EQ(std::vector<float>(num_values, 3.0f), out);
+    EXPECT_EQ(std::vector<float>(num_values, 0.0f), mid);
+
+    TransferStats transfers = runtime.get_scheduler_stats().transfers;
+    EXPECT_EQ(num_values * sizeof(float), transfers.bytes_to_device);
+    EXPECT_EQ(num_values * sizeof(float), transfers.bytes_to_host);
+    EXPECT_EQ(1, transfers.uploads);
+    EXPECT_EQ(1, transfers.downloads);
+
+    // The consumer was chained behind its producer instead of waiting for its completion
+    EXPECT_EQ(1, runtime.get_scheduler_stats().gpu_batches);
+    EXPECT_EQ(2, runtime.get_scheduler_stats().gpu_kernels);
+}
+
+// A chained consumer that doesn't fit next to its producer's buffers falls back to waiting for the producer, whose
+// completion releases the input it no longer needs
+TEST_F(HostExecutorTest, ChainRejectedWithoutMemory) {
+    // The producer's buffers fill the 4 KiB device local slab, so the consumer's output only fits once the producer's
+    // first input is released
+    const size_t num_values = 256;
+    DataManager data_manager;
+    std::vector<float> in(num_values, 1.0f), mid(num_values, 0.0f), out(num_values, 0.0f);
+    std::vector<float> offsets(2 * num_values, 1.0f);
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto mid_handle = data_manager.create_ref_handle(&mid, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    auto offsets_handle = data_manager.create_ref_handle(&offsets, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{in_handle.id, offsets_handle.id},
+                                                  mid_handle.id, false, num_values),
+                        true);
+    task_graph.add_task(std::make_shared<GPUTask>("host_vec_add", std::vector<int>{mid_handle.id, offsets_handle.id},
+                                                  out_handle.id, false, num_values),
+                        false);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 4096), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.commit_graph(task_graph, device);
+
+    EXPECT_EQ(std::vector<float>(num_values, 3.0f), out);
+    EXPECT_EQ(2, runtime.get_scheduler_stats().gpu_batches);
+    EXPECT_EQ(2, runtime.get_scheduler_stats().gpu_kernels);
+}
+
+// A CPU task reading a GPU result fetches it lazily, and a later GPU reader re-uploads what the CPU rewrote
+TEST_F(HostExecutorTest, CPUReaderDownloadsLazily) {
+    const size_t num_values = 128;
+    DataManager data_manager;
+    std::vector<float> in(num_values, 1.0f), mid(num_values, 0.0f), out(num_values, 0.0f);
+    float checksum = 0.0f;
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto mid_handle = data_manager.create_ref_handle(&mid, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    auto checksum_handle = data_manager.create_ref_handle(&checksum, DataUsage::ReadWrite);
+
+    TaskGraph task_graph;
+    task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{in_handle.id}, mid_handle.id, false,
+                                                  num_values),
+                        true);
+    auto sum_task = std::make_shared<BaseCPUTask>("sum", std::vector<int>{mid_handle.id}, checksum_handle.id);
+    sum_task->task_lambda = [&] {
+        for (float &value : mid) {
+            checksum += value;
+            value = 5.0f;
+        }
+    };
+    sum_task->set_input_usage(mid_handle.id, DataUsage::ReadWrite);
+    task_graph.add_task(sum_task, false);
+    task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{mid_handle.id}, out_handle.id, false,
+                                                  num_values),
+                        false);
+    task_graph.mark_output(checksum_handle.id);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.commit_graph(task_graph, device);
+
+    EXPECT_EQ(2.0f * num_values, checksum);
+    EXPECT_EQ(std::vector<float>(num_values, 6.0f), out);
+
+    TransferStats transfers = runtime.get_scheduler_stats().transfers;
+    EXPECT_EQ(2, transfers.uploads);
+    EXPECT_EQ(2, transfers.downloads);
+}
+
+// An indirect dispatch covers the blocks needed for the count in the counter, not the grid it was submitted with
+TEST_F(HostExecutorTest, IndirectDispatchUsesDeviceCount) {
+    std::vector<uint64_t> counter = {5, 0, 0, 0};
+    GPUBufferHandle count_buffer = executor.allocate_buffer(COUNT_BUFFER_SIZE, MemoryHint::Unified);
+    ASSERT_EQ(GPUState::GPUSuccess, executor.copy_to_device(std::as_bytes(std::span(counter)), count_buffer));
+
+    std::vector<uint64_t> num_threads = {0};
+    GPUBufferHandle threads_buffer = executor.allocate_buffer(sizeof(uint64_t), MemoryHint::Unified);
+    ASSERT_EQ(GPUState::GPUSuccess, executor.copy_to_device(std::as_bytes(std::span(num_threads)), threads_buffer));
+
+    std::function<void()> callback = [] {};
+    KernelDispatch kernel{"host_count_threads", {threads_buffer, count_buffer}, {100, 1, 1}, {4, 1, 1}};
+    kernel.indirect_count = count_buffer;
+    ASSERT_EQ(GPUState::GPUSuccess, executor.execute_kernel(kernel, callback));
+    executor.synchronize();
+
+    // Two blocks of four threads cover the five counted elements
+    ASSERT_EQ(GPUState::GPUSuccess,
+              executor.copy_from_device(std::as_writable_bytes(std::span(num_threads)), threads_buffer));
+    EXPECT_EQ(8, num_threads[0]);
+}
+
+// A compaction feeding another kernel chains into one batch, the count never leaves the device
+TEST_F(HostExecutorTest, CompactionChainStaysOnDevice) {
+    const size_t num_values = 64;
+    DataManager data_manager;
+    std::vector<float> in(num_values), mid(num_values, 0.0f), out(num_values, 0.0f);
+    for (size_t i = 0; i < num_values; ++i) {
+        in[i] = i % 2 ? static_cast<float>(i) : -static_cast<float>(i);
+    }
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto mid_handle = data_manager.create_ref_handle(&mid, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    task_graph.add_task(std::make_shared<GPUTask>("host_compact_positive", std::vector<int>{in_handle.id},
+                                                  mid_handle.id, true, num_values),
+                        true);
+    auto double_task = std::make_shared<GPUTask>("host_double_counted", std::vector<int>{mid_handle.id},
+                                                 out_handle.id, false, num_values);
+    double_task->dispatch_from_count(mid_handle.id);
+    task_graph.add_task(double_task, false);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.commit_graph(task_graph, device);
+
+    // Compaction order depends on the worker threads, the set of values does not
+    std::vector<float> expected;
+    for (size_t i = 1; i < num_values; i += 2) {
+        expected.push_back(2.0f * i);
+    }
+    std::vector<float> counted(out.begin(), out.begin() + expected.size());
+    std::sort(counted.begin(), counted.end());
+    EXPECT_EQ(expected, counted);
+    EXPECT_TRUE(std::all_of(out.begin() + expected.size(), out.end(), [](float value) { return value == 0.0f; }));
+
+    EXPECT_EQ(1, runtime.get_scheduler_stats().gpu_batches);
+    EXPECT_EQ(1, runtime.get_scheduler_stats().transfers.downloads);
+
+    // Pooled counters are handed back to the executor with the graph
+    EXPECT_EQ(0, runtime.get_allocator_stats(MemoryHint::Unified).live_allocations);
+}
+
+// A throwing CPU task fails the run once the work in flight has finished, and the prepared graph still runs again
+TEST_F(HostExecutorTest, CPUTaskErrorIsRethrown) {
+    const size_t num_values = 64;
+    DataManager data_manager;
+    std::vector<float> in(num_values, 1.0f), out(num_values, 0.0f);
+    int failed = 0, after = 0;
+    bool fail = true;
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    auto failed_handle = data_manager.create_ref_handle(&failed, DataUsage::ReadWrite);
+    auto after_handle = data_manager.create_ref_handle(&after, DataUsage::ReadWrite);
+
+    TaskGraph task_graph;
+    task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{in_handle.id}, out_handle.id, false,
+                                                  num_values),
+                        true);
+    auto fail_task = std::make_shared<BaseCPUTask>("fail", std::vector<int>{}, failed_handle.id);
+    fail_task->task_lambda = [&] {
+        if (fail) {
+            throw std::runtime_error("fail task threw");
+        }
+        failed = 1;
+    };
+    task_graph.add_task(fail_task, true);
+    auto after_task = std::make_shared<BaseCPUTask>("after", std::vector<int>{failed_handle.id}, after_handle.id);
+    after_task->task_lambda = [&] { after++; };
+    task_graph.add_task(after_task, false);
+    task_graph.mark_output(out_handle.id);
+    task_graph.mark_output(after_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.prepare_graph(task_graph, device);
+    EXPECT_THROW(
+        {
+            try {
+                runtime.run();
+            } catch (std::runtime_error &e) {
+                EXPECT_STREQ("fail task threw", e.what());
+                throw;
+            }
+        },
+        std::runtime_error);
+    EXPECT_EQ(0, after);
+
+    fail = false;
+    runtime.run();
+    EXPECT_EQ(1, failed);
+    EXPECT_EQ(1, after);
+    EXPECT_EQ(std::vector<float>(num_values, 2.0f), out);
+}
+
+// The CPU part of a split task reports its error the same way
+TEST_F(HostExecutorTest, SplitTaskErrorIsRethrown) {
+    DataManager data_manager;
+    std::vector<float> out(8, 0.0f);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite);
+
+    TaskGraph task_graph;
+    auto split_task = std::make_shared<SplitTask>("host_range_filter", std::vector<int>{}, out_handle.id, out.size(),
+                                                  [](size_t, size_t) { throw std::runtime_error("split threw"); });
+    split_task->set_gpu_share(SplitTask::MIN_SHARE);
+    task_graph.add_task(split_task, true);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    EXPECT_THROW(runtime.commit_graph(task_graph, device), std::runtime_error);
+}
+
+// Counted graph outputs only bring back the counted elements and record their length
+TEST_F(HostExecutorTest, CountedOutputDownloadsCountedElements) {
+    const size_t num_values = 64;
+    DataManager data_manager;
+    std::vector<float> in(num_values), out(num_values, 0.0f);
+    for (size_t i = 0; i < num_values; ++i) {
+        in[i] = i < 10 ? 1.0f : -1.0f;
+    }
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    task_graph.add_task(std::make_shared<GPUTask>("host_compact_positive", std::vector<int>{in_handle.id},
+                                                  out_handle.id, true, num_values),
+                        true);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.commit_graph(task_graph, device);
+
+    ASSERT_TRUE(data_manager.get_counted_length(out_handle.id).has_value());
+    EXPECT_EQ(10, *data_manager.get_counted_length(out_handle.id));
+    EXPECT_EQ(10 * sizeof(float), runtime.get_scheduler_stats().transfers.bytes_to_host);
+    EXPECT_EQ(std::vector<float>(10, 1.0f), std::vector<float>(out.begin(), out.begin() + 10));
+}
+
+// A count is in elements, a columnar output has no element size to download it by, so the graph is rejected
+TEST_F(HostExecutorTest, CountedColumnarOutputRejected) {
+    DataManager data_manager;
+    std::vector<float> in(64, 1.0f);
+    PointCloud out(64);
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    task_graph.add_task(std::make_shared<GPUTask>("host_compact_positive", std::vector<int>{in_handle.id},
+                                                  out_handle.id, true, 64),
+                        true);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    EXPECT_THROW(runtime.commit_graph(task_graph, device), std::runtime_error);
+    EXPECT_FALSE(data_manager.get_counted_length(out_handle.id).has_value());
+}
+
+// A split task runs part of its range on each side and gathers both parts into its output
+TEST_F(HostExecutorTest, SplitTaskGathersBothHalves) {
+    const size_t num_values = 4096;
+    std::vector<float> in(num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        in[i] = static_cast<float>(i % 4);
+    }
+    std::vector<float> expected(num_values);
+    std::transform(in.begin(), in.end(), expected.begin(), [](float value) { return value > 1.0f ? value : 0.0f; });
+
+    std::vector<float> out(num_values);
+    auto split_task = std::make_shared<SplitTask>("host_range_filter", std::vector<int>{}, VOID_RETURN, num_values,
+                                                  [&](size_t begin, size_t end) {
+                                                      for (size_t i = begin; i < end; ++i) {
+                                                          out[i] = in[i] > 1.0f ? in[i] : 0.0f;
+                                                      }
+                                                  });
+
+    // The same task is committed every frame, so its share keeps being tuned
+    for (int frame = 0; frame < 3; ++frame) {
+        DataManager data_manager;
+        std::fill(out.begin(), out.end(), -1.0f);
+        auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+        auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+        split_task->input_ids = {in_handle.id};
+        split_task->output_id = out_handle.id;
+
+        TaskGraph task_graph;
+        task_graph.add_task(split_task, true);
+        task_graph.mark_output(out_handle.id);
+
+        Runtime runtime(data_manager, 2);
+        GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+        runtime.commit_graph(task_graph, device);
+
+        EXPECT_EQ(expected, out);
+        EXPECT_EQ(1, runtime.get_scheduler_stats().gpu_kernels);
+        EXPECT_EQ(0, runtime.get_allocator_stats(MemoryHint::DeviceLocal).live_allocations);
+    }
+
+    EXPECT_GE(split_task->get_gpu_share(), SplitTask::MIN_SHARE);
+    EXPECT_LE(split_task->get_gpu_share(), 1.0 - SplitTask::MIN_SHARE);
+}
+
+// Both halves write the output by element index, a columnar output is rejected before either half runs
+TEST_F(HostExecutorTest, SplitTaskColumnarOutputRejected) {
+    DataManager data_manager;
+    std::vector<float> in(64, 1.0f);
+    PointCloud out(64);
+    bool cpu_ran = false;
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    task_graph.add_task(std::make_shared<SplitTask>("host_range_filter", std::vector<int>{in_handle.id},
+                                                    out_handle.id, in.size(),
+                                                    [&cpu_ran](size_t, size_t) { cpu_ran = true; }),
+                        true);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    EXPECT_THROW(runtime.commit_graph(task_graph, device), std::runtime_error);
+    EXPECT_FALSE(cpu_ran);
+}
+
+// Each queue has its own command thread, so a kernel stalled on one queue does not hold back another queue
+TEST_F(HostExecutorTest, QueuesRunIndependently) {
+    const size_t num_values = 64;
+    HostExecutor multi_executor(std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16), 2, 2);
+    ASSERT_EQ(2, multi_executor.num_queues());
+    GPUBufferHandle first = multi_executor.allocate_buffer(num_values * sizeof(float), MemoryHint::DeviceLocal);
+    GPUBufferHandle second = multi_executor.allocate_buffer(num_values * sizeof(float), MemoryHint::DeviceLocal);
+
+    std::shared_ptr<GPUEvent> gate = std::make_shared<GPUEvent>();
+    std::shared_ptr<GPUEvent> second_done = std::make_shared<GPUEvent>();
+    std::function<void()> first_callback = [] {};
+    std::function<void()> second_callback = [&] { second_done->signal(); };
+
+    KernelDispatch stalled{"host_scale", {first}, {1, 1, 1}, {num_values, 1, 1}, {gate}};
+    KernelDispatch free{"host_scale", {second}, {1, 1, 1}, {num_values, 1, 1}};
+    multi_executor.execute_batch({stalled}, DispatchType::Serial, first_callback, 0);
+    multi_executor.execute_batch({free}, DispatchType::Serial, second_callback, 1);
+
+    second_done->wait();
+    gate->signal();
+    multi_executor.synchronize();
+}
+
+// A kernel waiting on another queue's kernel event runs after it, even when its batch was submitted first
+TEST_F(HostExecutorTest, CrossQueueEventOrdersKernels) {
+    const size_t num_values = 64;
+    HostExecutor multi_executor(std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16), 2, 2);
+    std::vector<float> values(num_values, 1.0f);
+    GPUBufferHandle in = multi_executor.allocate_buffer(num_values * sizeof(float), MemoryHint::DeviceLocal);
+    GPUBufferHandle out = multi_executor.allocate_buffer(num_values * sizeof(float), MemoryHint::DeviceLocal);
+    multi_executor.copy_to_device(std::as_bytes(std::span(values)), in);
+
+    std::function<void()> callback = [] {};
+    KernelDispatch producer{"host_scale", {in}, {1, 1, 1}, {num_values, 1, 1}};
+    producer.signal_event = multi_executor.make_queue_event(0);
+    KernelDispatch consumer{"host_copy", {in, out}, {1, 1, 1}, {num_values, 1, 1}, {producer.signal_event}};
+
+    multi_executor.execute_batch({consumer}, DispatchType::Serial, callback, 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    multi_executor.execute_batch({producer}, DispatchType::Serial, callback, 0);
+
+    std::vector<float> result(num_values);
+    multi_executor.copy_from_device_async(std::as_writable_bytes(std::span(result)), out)->wait();
+    EXPECT_EQ(std::vector<float>(num_values, 3.0f), result);
+    EXPECT_THROW(multi_executor.execute_batch({producer}, DispatchType::Serial, callback, 2), std::runtime_error);
+}
+
+// Independent branches of a pass go to different queues, a join waits on the other branch through an event
+TEST_F(HostExecutorTest, RuntimeSpreadsBranchesOverQueues) {
+    const size_t num_values = 256;
+    DataManager data_manager;
+    std::vector<float> in(num_values, 1.0f), out(num_values, 0.0f);
+    std::vector<std::vector<float>> branches(4, std::vector<float>(num_values, 0.0f));
+
+    auto in_handle = data_manager.create_ref_handle(&in, DataUsage::ReadOnly, MemoryHint::DeviceLocal);
+    auto out_handle = data_manager.create_ref_handle(&out, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    std::vector<int> branch_ids;
+    for (std::vector<float> &branch : branches) {
+        branch_ids.push_back(
+            data_manager.create_ref_handle(&branch, DataUsage::ReadWrite, MemoryHint::DeviceLocal).id);
+    }
+
+    // in -> (a -> c) and (b -> d), then c + d -> out
+    TaskGraph task_graph;
+    for (int branch = 0; branch < 2; ++branch) {
+        task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{in_handle.id},
+                                                      branch_ids[branch], false, num_values),
+                            true);
+        task_graph.add_task(std::make_shared<GPUTask>("host_copy", std::vector<int>{branch_ids[branch]},
+                                                      branch_ids[branch + 2], false, num_values),
+                            false);
+    }
+    task_graph.add_task(std::make_shared<GPUTask>("host_vec_add", std::vector<int>{branch_ids[2], branch_ids[3]},
+                                                  out_handle.id, false, num_values),
+                        false);
+    task_graph.mark_output(out_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    device.num_queues = 2;
+    runtime.commit_graph(task_graph, device);
+
+    EXPECT_EQ(std::vector<float>(num_values, 6.0f), out);
+
+    // One batch per queue, only the join crosses queues
+    SchedulerStats stats = runtime.get_scheduler_stats();
+    EXPECT_EQ(2, stats.gpu_batches);
+    EXPECT_EQ(5, stats.gpu_kernels);
+    EXPECT_EQ(1, stats.cross_queue_waits);
+}
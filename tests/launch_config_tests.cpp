@@ -0,0 +1,164 @@
+#include "DataManager.h"
+#include "HostExecutor.h"
+#include "IGPUExecutor.h"
+#include "LaunchConfig.h"
+#include "Runtime.h"
+#include "Tasks.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static std::atomic<int> probed_grid_width = 0;
+
+class LaunchConfigTest : public testing::Test {
+  protected:
+    static constexpr int WIDTH = 37;
+    static constexpr int HEIGHT = 23;
+
+    static void SetUpTestSuite() {
+        HostExecutor::register_kernel("launch_fill_2d", [](const HostKernelContext &context) {
+            auto out = context.buffer<float>(0);
+
+            int x = context.thread_position[0];
+            int y = context.thread_position[1];
+            if (x < WIDTH && y < HEIGHT) {
+                out[y * WIDTH + x] = static_cast<float>(x + 1000 * y);
+            }
+        });
+        HostExecutor::register_kernel("launch_grid_probe", [](const HostKernelContext &context) {
+            auto data = context.buffer<float>(0);
+            probed_grid_width = context.grid_size[0];
+
+            size_t i = context.linear_id();
+            if (i < data.size()) {
+                data[i] += 1.0f;
+            }
+        });
+    }
+
+    std::filesystem::path cache_path(const std::string &name) {
+        std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+        std::filesystem::remove(path);
+        return path;
+    }
+
+    // One in place increment over num_values, run through a fresh runtime
+    void run_probe(size_t num_values, GPUDevice &device) {
+        DataManager data_manager;
+        std::vector<float> data(num_values, 0.0f);
+        auto data_handle = data_manager.create_ref_handle(&data, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+        TaskGraph task_graph;
+        auto probe_task = std::make_shared<GPUTask>("launch_grid_probe", std::vector<int>{data_handle.id}, VOID_RETURN,
+                                                    false, num_values);
+        probe_task->set_input_usage(data_handle.id, DataUsage::ReadWrite);
+        task_graph.add_task(probe_task, true);
+        task_graph.mark_output(data_handle.id);
+
+        Runtime runtime(data_manager, 2);
+        runtime.commit_graph(task_graph, device);
+        EXPECT_EQ(std::vector<float>(num_values, 1.0f), data);
+    }
+};
+
+// Grids are whole blocks covering each dimension, block dimensions past the shape's fold into its last dimension
+TEST_F(LaunchConfigTest, GridCoversShape) {
+    LaunchConfig linear = make_launch({1000}, {8, 8, 8});
+    EXPECT_EQ(std::vector<int>({2, 1, 1}), linear.grid_dim);
+    EXPECT_EQ(std::vector<int>({512, 1, 1}), linear.block_dim);
+
+    LaunchConfig image = make_launch({640, 481}, {16, 16, 1});
+    EXPECT_EQ(std::vector<int>({40, 31, 1}), image.grid_dim);
+    EXPECT_EQ(std::vector<int>({16, 16, 1}), image.block_dim);
+
+    LaunchConfig volume = make_launch({10, 10, 10}, {4, 4, 4});
+    EXPECT_EQ(std::vector<int>({3, 3, 3}), volume.grid_dim);
+
+    LaunchConfig short_block = make_launch({100, 100}, {32});
+    EXPECT_EQ(std::vector<int>({4, 100, 1}), short_block.grid_dim);
+    EXPECT_EQ(std::vector<int>({32, 1, 1}), short_block.block_dim);
+}
+
+// A 2-D task launches a 2-D grid, every pixel is written exactly at its own position
+TEST_F(LaunchConfigTest, TwoDimensionalTask) {
+    DataManager data_manager;
+    std::vector<float> image(WIDTH * HEIGHT, -1.0f);
+    auto image_handle = data_manager.create_ref_handle(&image, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    auto fill_task = std::make_shared<GPUTask>("launch_fill_2d", std::vector<int>{image_handle.id}, VOID_RETURN,
+                                               false, 0, std::vector<int>{16, 16, 1});
+    fill_task->set_input_usage(image_handle.id, DataUsage::ReadWrite);
+    fill_task->set_shape({WIDTH, HEIGHT});
+    task_graph.add_task(fill_task, true);
+    task_graph.mark_output(image_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.commit_graph(task_graph, device);
+
+    EXPECT_EQ(WIDTH * HEIGHT, fill_task->threads);
+    for (int y = 0; y < HEIGHT; ++y) {
+        for (int x = 0; x < WIDTH; ++x) {
+            EXPECT_EQ(static_cast<float>(x + 1000 * y), image[y * WIDTH + x]);
+        }
+    }
+}
+
+// The first selection of a bucket tunes it, the winner survives a round trip through the cache format
+TEST_F(LaunchConfigTest, TunerCachesWinners) {
+    HostExecutor executor(std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16), 2);
+    GPUBufferHandle buffer = executor.allocate_buffer(4096 * sizeof(float), MemoryHint::DeviceLocal);
+    KernelDispatch kernel{"launch_grid_probe", {buffer}, {}, {}};
+
+    LaunchTuner tuner;
+    std::vector<int> block = tuner.select_block(executor, kernel, {4000}, {64});
+    EXPECT_TRUE(tuner.contains("launch_grid_probe", {4000}));
+    EXPECT_TRUE(tuner.contains("launch_grid_probe", {3000}));
+    EXPECT_FALSE(tuner.contains("launch_grid_probe", {64, 64}));
+    EXPECT_EQ(1, tuner.size());
+
+    // Tuning works on scratch buffers, all of which are given back
+    EXPECT_EQ(1, executor.get_allocator().get_stats(MemoryHint::DeviceLocal).live_allocations);
+
+    std::stringstream cache;
+    tuner.write_cache(cache);
+    LaunchTuner cached_tuner;
+    cached_tuner.read_cache(cache);
+    EXPECT_EQ(block, cached_tuner.select_block(executor, kernel, {4000}, {64}));
+    EXPECT_EQ(1, cached_tuner.size());
+}
+
+// Tuned launches are written to the cache file, and launches found in it are used as is
+TEST_F(LaunchConfigTest, RuntimeUsesLaunchCache) {
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    device.autotune_launches = true;
+    device.launch_cache_path = cache_path("helios_launch_cache_tuned.csv").string();
+
+    run_probe(2000, device);
+    LaunchTuner saved_tuner;
+    saved_tuner.load(device.launch_cache_path);
+    EXPECT_TRUE(saved_tuner.contains("launch_grid_probe", {2000}));
+
+    // 96 threads is not a candidate, so a grid 11 blocks of 96 wide can only come from the cache
+    device.launch_cache_path = cache_path("helios_launch_cache_given.csv").string();
+    {
+        std::ofstream cache_file(device.launch_cache_path);
+        cache_file << "kernel,dims,bucket,block_x,block_y,block_z\n";
+        cache_file << "launch_grid_probe,1," << LaunchTuner::size_bucket({1000}) << ",96,1,1\n";
+    }
+
+    run_probe(1000, device);
+    EXPECT_EQ(11 * 96, probed_grid_width);
+
+    std::filesystem::remove(device.launch_cache_path);
+    std::filesystem::remove(cache_path("helios_launch_cache_tuned.csv"));
+}
@@ -0,0 +1,192 @@
+#include "LidarPipeline.h"
+#include "PointCloud.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+namespace {
+using Point = std::array<float, 3>;
+
+PointCloud make_cloud(const std::vector<Point> &points) {
+    std::vector<float> interleaved;
+    for (size_t i = 0; i < points.size(); ++i) {
+        interleaved.insert(interleaved.end(), {points[i][0], points[i][1], points[i][2], static_cast<float>(i)});
+    }
+
+    return PointCloud::from_xyzi(interleaved);
+}
+
+std::vector<Point> cloud_points(const PointCloud &cloud) {
+    std::vector<Point> points;
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        points.push_back({cloud.x()[i], cloud.y()[i], cloud.z()[i]});
+    }
+
+    return points;
+}
+
+// Flood fill over every pair of points, with the same distance test and numbering as cluster_cloud
+std::vector<int> brute_force_clusters(const PointCloud &cloud, const PipelineParams &params) {
+    float tolerance_sq = params.cluster_tolerance * params.cluster_tolerance;
+    std::vector<int> components(cloud.size(), -1);
+    std::vector<size_t> component_sizes;
+
+    for (size_t seed = 0; seed < cloud.size(); ++seed) {
+        if (components[seed] != -1) {
+            continue;
+        }
+
+        int component = component_sizes.size();
+        std::vector<size_t> stack{seed};
+        components[seed] = component;
+        size_t component_size = 0;
+        while (!stack.empty()) {
+            size_t point = stack.back();
+            stack.pop_back();
+            component_size++;
+
+            for (size_t other = 0; other < cloud.size(); ++other) {
+                float diff_x = cloud.x()[point] - cloud.x()[other], diff_y = cloud.y()[point] - cloud.y()[other],
+                      diff_z = cloud.z()[point] - cloud.z()[other];
+                if (components[other] == -1 && diff_x * diff_x + diff_y * diff_y + diff_z * diff_z <= tolerance_sq) {
+                    components[other] = component;
+                    stack.push_back(other);
+                }
+            }
+        }
+        component_sizes.push_back(component_size);
+    }
+
+    std::vector<int> labels(cloud.size(), NOISE_LABEL);
+    std::vector<int> component_labels(component_sizes.size(), NOISE_LABEL);
+    int num_clusters = 0;
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        int component = components[i];
+        if (component_sizes[component] < params.min_cluster_points) {
+            continue;
+        }
+
+        if (component_labels[component] == NOISE_LABEL) {
+            component_labels[component] = num_clusters++;
+        }
+        labels[i] = component_labels[component];
+    }
+
+    return labels;
+}
+} // namespace
+
+// Every bound of the box and the vehicle radius drop points, the kept ones stay in order with all their fields
+TEST(LidarPipelineTest, CropKeepsRegionOfInterest) {
+    PipelineParams params;
+    PointCloud cloud = make_cloud({{10.0f, 0.0f, 0.0f},
+                                   {41.0f, 0.0f, 0.0f},
+                                   {-10.0f, 5.0f, -1.0f},
+                                   {10.0f, -21.0f, 0.0f},
+                                   {10.0f, 0.0f, -3.5f},
+                                   {10.0f, 0.0f, 1.5f},
+                                   {1.0f, 1.0f, 0.0f},
+                                   {40.0f, 20.0f, 1.0f}});
+    cloud.ring()[2] = 7;
+
+    PointCloud cropped = crop_cloud(cloud, params);
+    ASSERT_EQ(3, cropped.size());
+    EXPECT_EQ((std::vector<Point>{{10.0f, 0.0f, 0.0f}, {-10.0f, 5.0f, -1.0f}, {40.0f, 20.0f, 1.0f}}),
+              cloud_points(cropped));
+    EXPECT_EQ(2.0f, cropped.intensity()[1]);
+    EXPECT_EQ(7, cropped.ring()[1]);
+}
+
+// Points of one voxel merge into their centroid, voxels come out ordered by key so the result is deterministic
+TEST(LidarPipelineTest, VoxelDownsampleMergesCentroids) {
+    PipelineParams params;
+    params.voxel_size = 1.0f;
+    PointCloud cloud =
+        make_cloud({{2.5f, 0.5f, 0.5f}, {0.25f, 0.25f, 0.25f}, {0.75f, 0.75f, 0.75f}, {-0.5f, 0.5f, 0.5f}});
+
+    PointCloud downsampled = voxel_downsample(cloud, params);
+    ASSERT_EQ(3, downsampled.size());
+    EXPECT_EQ((std::vector<Point>{{-0.5f, 0.5f, 0.5f}, {0.5f, 0.5f, 0.5f}, {2.5f, 0.5f, 0.5f}}),
+              cloud_points(downsampled));
+    EXPECT_EQ(3.0f, downsampled.intensity()[0]);
+    EXPECT_EQ(1.5f, downsampled.intensity()[1]);
+
+    // Downsampling twice changes nothing, every voxel already holds a single point
+    EXPECT_EQ(cloud_points(downsampled), cloud_points(voxel_downsample(downsampled, params)));
+}
+
+// The lowest point of every column and anything within ground_height above it is ground
+TEST(LidarPipelineTest, RemoveGroundPerColumn) {
+    PipelineParams params;
+    PointCloud cloud = make_cloud({{0.5f, 0.5f, -1.7f},
+                                   {0.6f, 0.4f, -1.6f},
+                                   {0.5f, 0.5f, -0.5f},
+                                   {5.5f, 5.5f, 0.0f},
+                                   {5.4f, 5.6f, 0.2f},
+                                   {5.5f, 5.5f, 1.0f}});
+
+    PointCloud objects = remove_ground(cloud, params);
+    EXPECT_EQ((std::vector<Point>{{0.5f, 0.5f, -0.5f}, {5.5f, 5.5f, 1.0f}}), cloud_points(objects));
+}
+
+TEST(LidarPipelineTest, ClusterSeparatesObjectsAndNoise) {
+    PipelineParams params;
+    params.min_cluster_points = 3;
+    std::vector<Point> points;
+    for (int i = 0; i < 4; ++i) {
+        points.push_back({0.3f * i, 0.0f, 0.0f});
+        points.push_back({10.0f, 0.3f * i, 0.0f});
+    }
+    points.push_back({5.0f, 5.0f, 5.0f});
+    points.push_back({5.0f, 5.0f, 5.4f});
+
+    std::vector<int> labels = cluster_cloud(make_cloud(points), params);
+    EXPECT_EQ((std::vector<int>{0, 1, 0, 1, 0, 1, 0, 1, NOISE_LABEL, NOISE_LABEL}), labels);
+}
+
+// Random clouds dense enough to chain across cells in every direction, around the origin so cells of both signs meet
+TEST(LidarPipelineTest, ClusterMatchesBruteForce) {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> coord_dist(-3.0f, 3.0f);
+    std::uniform_int_distribution<size_t> size_dist(0, 250);
+    std::uniform_real_distribution<float> tolerance_dist(0.2f, 0.8f);
+    std::uniform_int_distribution<size_t> min_points_dist(1, 6);
+
+    for (int trial = 0; trial < 200; ++trial) {
+        PipelineParams params;
+        params.cluster_tolerance = tolerance_dist(rng);
+        params.min_cluster_points = min_points_dist(rng);
+
+        std::vector<Point> points(size_dist(rng));
+        for (Point &point : points) {
+            point = {coord_dist(rng), coord_dist(rng), coord_dist(rng)};
+        }
+        PointCloud cloud = make_cloud(points);
+
+        ASSERT_EQ(brute_force_clusters(cloud, params), cluster_cloud(cloud, params)) << "trial " << trial;
+    }
+}
+
+// Every stage passes an empty cloud through, a single point is noise unless one point is enough for a cluster
+TEST(LidarPipelineTest, EmptyAndSinglePointClouds) {
+    PipelineParams params;
+    PointCloud empty;
+    EXPECT_EQ(0, crop_cloud(empty, params).size());
+    EXPECT_EQ(0, voxel_downsample(empty, params).size());
+    EXPECT_EQ(0, remove_ground(empty, params).size());
+    EXPECT_TRUE(cluster_cloud(empty, params).empty());
+
+    PointCloud single = make_cloud({{10.0f, 0.0f, 0.0f}});
+    EXPECT_EQ(1, crop_cloud(single, params).size());
+    EXPECT_EQ(cloud_points(single), cloud_points(voxel_downsample(single, params)));
+    // The point is the lowest of its column, so it is ground
+    EXPECT_EQ(0, remove_ground(single, params).size());
+    EXPECT_EQ(std::vector<int>{NOISE_LABEL}, cluster_cloud(single, params));
+
+    params.min_cluster_points = 1;
+    EXPECT_EQ(std::vector<int>{0}, cluster_cloud(single, params));
+}
@@ -0,0 +1,205 @@
+#include "DataManager.h"
+#include "HostExecutor.h"
+#include "Metrics.h"
+#include "Runtime.h"
+#include "Tasks.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+class MetricsTest : public testing::Test {
+  protected:
+    static void SetUpTestSuite() {
+        HostExecutor::register_kernel("metrics_increment", [](const HostKernelContext &context) {
+            auto data = context.buffer<float>(0);
+
+            size_t i = context.linear_id();
+            if (i < data.size()) {
+                data[i] += 1.0f;
+            }
+        });
+    }
+
+    // stage_a (sleeping for a millisecond) -> stage_b
+    static void add_stages(TaskGraph &task_graph, DataManager &data_manager, std::vector<float> &values) {
+        auto values_handle = data_manager.create_ref_handle(&values, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+        auto stage_a = std::make_shared<BaseCPUTask>("stage_a", std::vector<int>{}, values_handle.id);
+        stage_a->task_lambda = [&values] {
+            std::this_thread::sleep_for(1ms);
+            values[0] += 1.0f;
+        };
+        auto stage_b = std::make_shared<BaseCPUTask>("stage_b", std::vector<int>{values_handle.id}, VOID_RETURN);
+        stage_b->task_lambda = [&values] { values[0] *= 2.0f; };
+
+        task_graph.add_task(stage_a, true);
+        task_graph.add_task(stage_b, false);
+    }
+
+    static GPUDevice host_device() {
+        return GPUDevice(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    }
+};
+
+// Every value lands in a bucket whose upper bound is within 1 / SUB_BUCKETS of it
+TEST_F(MetricsTest, BucketsBoundRelativeError) {
+    for (uint64_t value : std::vector<uint64_t>{0, 1, 15, 16, 17, 1000, 123456789, 1ULL << 40, UINT64_MAX}) {
+        uint64_t upper = LatencyHistogram::bucket_upper(LatencyHistogram::bucket_index(value));
+        EXPECT_GE(upper, value);
+        EXPECT_LE(upper - value, value / LatencyHistogram::SUB_BUCKETS) << value;
+    }
+
+    EXPECT_EQ(LatencyHistogram::NUM_BUCKETS - 1, LatencyHistogram::bucket_index(UINT64_MAX));
+}
+
+TEST_F(MetricsTest, HistogramPercentiles) {
+    LatencyHistogram histogram;
+    for (uint64_t micros = 1; micros <= 100; ++micros) {
+        histogram.record(std::chrono::microseconds(micros));
+    }
+
+    LatencySummary summary = histogram.summary();
+    EXPECT_EQ(100, summary.count);
+    EXPECT_NEAR(50'000, summary.p50, 50'000 / LatencyHistogram::SUB_BUCKETS);
+    EXPECT_NEAR(99'000, summary.p99, 99'000 / LatencyHistogram::SUB_BUCKETS);
+    EXPECT_EQ(100'000, summary.max);
+    EXPECT_DOUBLE_EQ(50'500.0, summary.mean);
+    EXPECT_EQ(summary.max, histogram.percentile(1.0));
+
+    histogram.reset();
+    EXPECT_EQ(0, histogram.summary().count);
+    EXPECT_EQ(0, histogram.percentile(0.5));
+}
+
+// Task names past the capacity share the last histogram
+TEST_F(MetricsTest, ExtraTaskNamesShareOneHistogram) {
+    RuntimeMetrics metrics;
+    for (size_t i = 0; i < RuntimeMetrics::MAX_TASK_NAMES + 10; ++i) {
+        metrics.task_histogram("task " + std::to_string(i)).record(i);
+    }
+    metrics.task_histogram("task 0").record(1);
+
+    MetricsSnapshot snapshot = metrics.snapshot();
+    ASSERT_EQ(RuntimeMetrics::MAX_TASK_NAMES, snapshot.task_latencies.size());
+    EXPECT_EQ("task 0", snapshot.task_latencies.front().task_name);
+    EXPECT_EQ(2, snapshot.task_latencies.front().latency.count);
+    EXPECT_EQ("other tasks", snapshot.task_latencies.back().task_name);
+    EXPECT_EQ(11, snapshot.task_latencies.back().latency.count);
+}
+
+// Latencies accumulate per task name across committed graphs, next to the pool and queue counters
+TEST_F(MetricsTest, RuntimeRecordsTaskLatencies) {
+    DataManager data_manager;
+    std::vector<float> values(1, 0.0f);
+    TaskGraph task_graph;
+    add_stages(task_graph, data_manager, values);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device = host_device();
+    runtime.commit_graph(task_graph, device);
+    runtime.commit_graph(task_graph, device);
+
+    // Workers count a task after it has reported its completion, so the last one may land after the graph returns
+    MetricsSnapshot snapshot = runtime.get_metrics();
+    for (int attempt = 0; attempt < 1000 && snapshot.pool_tasks < 4; ++attempt) {
+        std::this_thread::sleep_for(1ms);
+        snapshot = runtime.get_metrics();
+    }
+    EXPECT_EQ(2, snapshot.graphs_run);
+    EXPECT_GE(snapshot.graph_latency.p50, 1'000'000);
+
+    ASSERT_EQ(2, snapshot.task_latencies.size());
+    EXPECT_EQ("stage_a", snapshot.task_latencies[0].task_name);
+    EXPECT_EQ(2, snapshot.task_latencies[0].latency.count);
+    EXPECT_GE(snapshot.task_latencies[0].latency.p50, 1'000'000);
+    EXPECT_EQ("stage_b", snapshot.task_latencies[1].task_name);
+    EXPECT_EQ(2, snapshot.task_latencies[1].latency.count);
+    EXPECT_EQ(4, snapshot.completion_latency.count);
+
+    EXPECT_EQ(2, snapshot.pool_threads);
+    EXPECT_EQ(4, snapshot.pool_tasks);
+    EXPECT_GE(snapshot.pool_busy, 2ms);
+    EXPECT_GT(snapshot.pool_utilization, 0.0);
+    EXPECT_LE(snapshot.pool_utilization, 1.0);
+    EXPECT_EQ(0, snapshot.pool_queue_depth);
+    EXPECT_GE(snapshot.max_pool_queue_depth, 1);
+    EXPECT_EQ(1, snapshot.max_ready_queue_depth);
+    EXPECT_GE(snapshot.max_completion_batch, 1);
+}
+
+TEST_F(MetricsTest, RuntimeCountsGPUTraffic) {
+    const size_t num_values = 256;
+    DataManager data_manager;
+    std::vector<float> data(num_values, 1.0f);
+    auto data_handle = data_manager.create_ref_handle(&data, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    auto increment_task = std::make_shared<GPUTask>("metrics_increment", std::vector<int>{data_handle.id},
+                                                    VOID_RETURN, false, num_values);
+    increment_task->set_input_usage(data_handle.id, DataUsage::ReadWrite);
+    task_graph.add_task(increment_task, true);
+    task_graph.mark_output(data_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device = host_device();
+    runtime.commit_graph(task_graph, device);
+
+    MetricsSnapshot snapshot = runtime.get_metrics();
+    EXPECT_EQ(num_values * sizeof(float), snapshot.bytes_to_device);
+    EXPECT_EQ(num_values * sizeof(float), snapshot.bytes_to_host);
+    EXPECT_EQ(1, snapshot.gpu_batches);
+    EXPECT_EQ(1, snapshot.gpu_kernels);
+    ASSERT_EQ(1, snapshot.task_latencies.size());
+    EXPECT_EQ("metrics_increment", snapshot.task_latencies[0].task_name);
+}
+
+// The file holds the latest snapshot, stopping the writer flushes one last time
+TEST_F(MetricsTest, FileWriterKeepsLatestSnapshot) {
+    std::string file_name =
+        "helios_metrics_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".json";
+    std::string path = (std::filesystem::temp_directory_path() / file_name).string();
+
+    DataManager data_manager;
+    std::vector<float> values(1, 0.0f);
+    TaskGraph task_graph;
+    add_stages(task_graph, data_manager, values);
+
+    Runtime runtime(data_manager, 2);
+    runtime.start_metrics_file(path, 5ms);
+    GPUDevice device = host_device();
+    runtime.commit_graph(task_graph, device);
+    runtime.stop_metrics_file();
+
+    std::ifstream in(path);
+    ASSERT_TRUE(in.good());
+    std::stringstream contents;
+    contents << in.rdbuf();
+
+    EXPECT_NE(std::string::npos, contents.str().find("\"graphs_run\": 1"));
+    EXPECT_NE(std::string::npos, contents.str().find("\"stage_a\": {\"count\":1,"));
+    EXPECT_FALSE(std::filesystem::exists(path + ".tmp"));
+    std::remove(path.c_str());
+}
+
+// Task names are escaped the same way trace event names are
+TEST_F(MetricsTest, JsonEscapesTaskNames) {
+    MetricsSnapshot snapshot;
+    snapshot.task_latencies.push_back({"say \"hi\"\\\n\t", {}});
+
+    std::stringstream out;
+    write_metrics_json(out, snapshot);
+    EXPECT_NE(std::string::npos, out.str().find("\"say \\\"hi\\\"\\\\\\n\\u0009\": {\"count\":0,"));
+}
@@ -0,0 +1,102 @@
+#include "DataManager.h"
+#include "PerfCounters.h"
+#include "Runtime.h"
+#include "Tasks.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class PerfCountersTest : public testing::Test {
+  protected:
+    static PerfSample make_sample(uint64_t cycles, uint64_t instructions, uint64_t llc_misses, uint64_t branch_misses) {
+        return {cycles, instructions, llc_misses, branch_misses};
+    }
+};
+
+// Deltas accumulate per task name, runs without both samples are counted but add nothing
+TEST_F(PerfCountersTest, AggregatesDeltasPerTaskName) {
+    TaskPerfCounters perf_counters;
+    perf_counters.record("sum", make_sample(100, 50, 10, 4), make_sample(300, 450, 30, 8), 100);
+    perf_counters.record("sum", make_sample(1000, 1000, 0, 0), make_sample(1200, 1400, 20, 4), 100);
+    perf_counters.record("sum", std::nullopt, make_sample(5000, 5000, 5000, 5000), 100);
+    perf_counters.record("scale", make_sample(0, 0, 0, 0), make_sample(10, 5, 1, 1), 0);
+
+    PerfReport report = perf_counters.report();
+    ASSERT_EQ(2, report.tasks.size());
+
+    const TaskPerfStats &sum_stats = report.tasks[0];
+    EXPECT_EQ("sum", sum_stats.task_name);
+    EXPECT_EQ(3, sum_stats.runs);
+    EXPECT_EQ(300, sum_stats.points);
+    EXPECT_EQ(make_sample(400, 800, 40, 8), sum_stats.totals);
+    EXPECT_DOUBLE_EQ(2.0, sum_stats.ipc());
+    EXPECT_DOUBLE_EQ(40.0 / 300, sum_stats.per_point(LLCMisses));
+
+    EXPECT_EQ("scale", report.tasks[1].task_name);
+    EXPECT_DOUBLE_EQ(0.0, report.tasks[1].per_point(Cycles));
+
+    perf_counters.reset();
+    EXPECT_TRUE(perf_counters.report().tasks.empty());
+}
+
+TEST_F(PerfCountersTest, UnavailableCountersPrintAsNA) {
+    PerfReport report;
+    report.available[Cycles] = true;
+    report.unavailable_reason = "no PMU";
+    report.tasks.push_back({"sum", 1, 10, make_sample(20, 0, 0, 0)});
+
+    std::stringstream out;
+    write_perf_report(out, report);
+
+    EXPECT_NE(std::string::npos, out.str().find("perf counters unavailable: no PMU"));
+    EXPECT_NE(std::string::npos, out.str().find("2.000"));
+    EXPECT_NE(std::string::npos, out.str().find("n/a"));
+}
+
+// Either the workers count (and a busy loop takes cycles) or every counter reports why it is missing, the runs are
+// counted both ways
+TEST_F(PerfCountersTest, RuntimeSamplesCPUTasks) {
+    const size_t num_values = 1 << 16;
+    DataManager data_manager;
+    std::vector<float> values(num_values, 1.0f);
+    float total = 0.0f;
+    auto values_handle = data_manager.create_ref_handle(&values, DataUsage::ReadOnly, MemoryHint::HostVisible);
+
+    TaskGraph task_graph;
+    auto sum_task = std::make_shared<BaseCPUTask>("sum", std::vector<int>{values_handle.id}, VOID_RETURN);
+    sum_task->task_lambda = [&values, &total] { total = std::accumulate(values.begin(), values.end(), 0.0f); };
+    task_graph.add_task(sum_task, true);
+
+    Runtime runtime(data_manager, 2);
+    runtime.enable_perf_counters(true);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.commit_graph(task_graph, device);
+    runtime.commit_graph(task_graph, device);
+    EXPECT_EQ(static_cast<float>(num_values), total);
+
+    PerfReport report = runtime.get_perf_report();
+    ASSERT_EQ(1, report.tasks.size());
+    EXPECT_EQ("sum", report.tasks[0].task_name);
+    EXPECT_EQ(2, report.tasks[0].runs);
+    EXPECT_EQ(2 * num_values, report.tasks[0].points);
+
+    if (report.available[Cycles]) {
+        EXPECT_GT(report.tasks[0].totals[Cycles], 0);
+    } else {
+        EXPECT_FALSE(report.unavailable_reason.empty());
+        EXPECT_EQ(0, report.tasks[0].totals[Cycles]);
+    }
+
+    // Disabled again, nothing more is recorded
+    runtime.enable_perf_counters(false);
+    runtime.commit_graph(task_graph, device);
+    EXPECT_EQ(2, runtime.get_perf_report().tasks[0].runs);
+}
@@ -0,0 +1,201 @@
+#include "DataManager.h"
+#include "IGPUExecutor.h"
+#include "Runtime.h"
+#include "SimulatedExecutor.h"
+#include "Tasks.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+class SimulatedExecutorTest : public testing::Test {
+  protected:
+    // 1 byte per ns transfers and 1 thread per ns kernels keep the expected times readable
+    SimulatedDeviceModel model = [] {
+        SimulatedDeviceModel model;
+        model.host_to_device_bandwidth = 1e9;
+        model.device_to_host_bandwidth = 1e9;
+        model.transfer_latency = 100ns;
+        model.launch_latency = 50ns;
+        model.default_throughput = 1e9;
+        return model;
+    }();
+
+    static void SetUpTestSuite() {
+        HostExecutor::register_kernel("sim_increment", [](const HostKernelContext &context) {
+            auto data = context.buffer<float>(0);
+
+            size_t i = context.linear_id();
+            if (i < data.size()) {
+                data[i] += 1.0f;
+            }
+        });
+    }
+
+    std::unique_ptr<SimulatedExecutor> make_executor(size_t num_queues = 1) {
+        return std::make_unique<SimulatedExecutor>(model, std::pair(64, 1 << 16), std::pair(64, 1 << 16),
+                                                   std::pair(64, 1 << 16), 2, num_queues);
+    }
+};
+
+// Transfers take their latency plus their size over the bandwidth, and their events carry that completion time
+TEST_F(SimulatedExecutorTest, TransfersFollowBandwidthModel) {
+    std::unique_ptr<SimulatedExecutor> executor = make_executor();
+    std::vector<float> values(1000, 1.0f);
+    GPUBufferHandle buffer = executor->allocate_buffer(values.size() * sizeof(float), MemoryHint::DeviceLocal);
+
+    std::shared_ptr<GPUEvent> upload_event =
+        executor->copy_to_device_async({{std::as_bytes(std::span(values)), buffer}});
+    std::vector<float> result(values.size());
+    std::shared_ptr<GPUEvent> download_event =
+        executor->copy_from_device_async(std::as_writable_bytes(std::span(result)), buffer);
+    download_event->wait();
+
+    EXPECT_EQ(100 + 4000, upload_event->device_value);
+    EXPECT_EQ(2 * (100 + 4000), download_event->device_value);
+    EXPECT_EQ(values, result);
+
+    SimulatedDeviceStats stats = executor->get_simulated_stats();
+    EXPECT_EQ(8200ns, stats.device_time);
+    EXPECT_EQ(2, stats.transfers);
+    EXPECT_EQ(4000, stats.bytes_to_device);
+    EXPECT_EQ(4000, stats.bytes_to_host);
+}
+
+// Kernels not waiting on a transfer overlap it on the compute engine, a kernel waiting on it starts after it
+TEST_F(SimulatedExecutorTest, CopiesOverlapIndependentKernels) {
+    std::unique_ptr<SimulatedExecutor> executor = make_executor();
+    std::vector<float> values(1000, 0.0f);
+    GPUBufferHandle resident = executor->allocate_buffer(values.size() * sizeof(float), MemoryHint::DeviceLocal);
+    GPUBufferHandle uploaded = executor->allocate_buffer(values.size() * sizeof(float), MemoryHint::DeviceLocal);
+
+    std::shared_ptr<GPUEvent> upload_event =
+        executor->copy_to_device_async({{std::as_bytes(std::span(values)), uploaded}});
+
+    std::function<void()> callback = [] {};
+    KernelDispatch independent{"sim_increment", {resident}, {1, 1, 1}, {1000, 1, 1}};
+    KernelDispatch dependent{"sim_increment", {uploaded}, {1, 1, 1}, {1000, 1, 1}, {upload_event}};
+    executor->execute_kernel(independent, callback);
+    executor->execute_kernel(dependent, callback);
+    executor->synchronize();
+
+    // Upload ends at 4100, the independent kernel at 1050, the dependent one starts once the upload has landed
+    SimulatedDeviceStats stats = executor->get_simulated_stats();
+    EXPECT_EQ(4100ns + 1050ns, stats.device_time);
+    EXPECT_EQ(2100ns, stats.compute_busy);
+    EXPECT_EQ(4100ns, stats.copy_busy);
+}
+
+// Serial batches pay the launch latency per kernel, concurrent batches once
+TEST_F(SimulatedExecutorTest, ConcurrentBatchLaunchesOnce) {
+    std::vector<float> values(500, 0.0f);
+    std::function<void()> callback = [] {};
+
+    for (DispatchType dispatch_type : {DispatchType::Serial, DispatchType::Concurrent}) {
+        std::unique_ptr<SimulatedExecutor> executor = make_executor();
+        GPUBufferHandle buffer = executor->allocate_buffer(values.size() * sizeof(float), MemoryHint::DeviceLocal);
+        executor->reset_clock();
+
+        KernelDispatch kernel{"sim_increment", {buffer}, {1, 1, 1}, {500, 1, 1}};
+        executor->execute_batch({kernel, kernel, kernel}, dispatch_type, callback);
+        executor->synchronize();
+
+        std::chrono::nanoseconds expected = dispatch_type == DispatchType::Serial ? 3 * (50ns + 500ns) : 50ns + 1500ns;
+        EXPECT_EQ(expected, executor->get_simulated_stats().device_time);
+        EXPECT_EQ(3, executor->get_simulated_stats().kernels);
+    }
+}
+
+// Kernels with their own throughput entry use it instead of the default
+TEST_F(SimulatedExecutorTest, PerKernelThroughput) {
+    model.kernel_throughput["sim_increment"] = 0.5e9;
+    std::unique_ptr<SimulatedExecutor> executor = make_executor();
+    GPUBufferHandle buffer = executor->allocate_buffer(1000 * sizeof(float), MemoryHint::DeviceLocal);
+
+    std::function<void()> callback = [] {};
+    executor->execute_kernel({"sim_increment", {buffer}, {1, 1, 1}, {1000, 1, 1}}, callback);
+    executor->synchronize();
+
+    EXPECT_EQ(50ns + 2000ns, executor->get_simulated_stats().device_time);
+}
+
+// Kernels of different queues overlap, a kernel waiting on another queue's kernel starts once that one completes
+TEST_F(SimulatedExecutorTest, QueuesOverlapKernels) {
+    std::unique_ptr<SimulatedExecutor> executor = make_executor(2);
+    GPUBufferHandle first = executor->allocate_buffer(64 * sizeof(float), MemoryHint::DeviceLocal);
+    GPUBufferHandle second = executor->allocate_buffer(64 * sizeof(float), MemoryHint::DeviceLocal);
+
+    std::function<void()> callback = [] {};
+    KernelDispatch long_kernel{"sim_increment", {first}, {1, 1, 1}, {2000, 1, 1}};
+    long_kernel.signal_event = executor->make_queue_event(0);
+    KernelDispatch short_kernel{"sim_increment", {second}, {1, 1, 1}, {1000, 1, 1}};
+    KernelDispatch waiting_kernel{"sim_increment", {second}, {1, 1, 1}, {1000, 1, 1}, {long_kernel.signal_event}};
+
+    executor->execute_batch({long_kernel}, DispatchType::Serial, callback, 0);
+    executor->execute_batch({short_kernel, waiting_kernel}, DispatchType::Serial, callback, 1);
+    executor->synchronize();
+
+    // The short kernel ends at 1050 alongside the long one, the waiting one starts when the long one ends at 2050
+    SimulatedDeviceStats stats = executor->get_simulated_stats();
+    EXPECT_EQ(2050ns + 1050ns, stats.device_time);
+    EXPECT_EQ(2050ns + 2 * 1050ns, stats.compute_busy);
+    EXPECT_EQ(2050, long_kernel.signal_event->device_value);
+}
+
+// On a scaled clock the callback fires no earlier than the modelled time in real time
+TEST_F(SimulatedExecutorTest, ScaledClockPacesCallbacks) {
+    model.default_throughput = 1e6;
+    model.real_time_scale = 1.0;
+    std::unique_ptr<SimulatedExecutor> executor = make_executor();
+    GPUBufferHandle buffer = executor->allocate_buffer(64 * sizeof(float), MemoryHint::DeviceLocal);
+
+    // 20000 threads at 1e6 per second take 20ms
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point fired;
+    std::function<void()> callback = [&] { fired = std::chrono::steady_clock::now(); };
+    executor->execute_kernel({"sim_increment", {buffer}, {1, 1, 1}, {20000, 1, 1}}, callback);
+    executor->synchronize();
+
+    EXPECT_GE(fired - start, 20ms);
+}
+
+// Graphs run end to end on the simulated backend and the virtual timeline does not depend on host timing
+TEST_F(SimulatedExecutorTest, RuntimeTimelineIsDeterministic) {
+    const size_t num_values = 256;
+    std::vector<std::chrono::nanoseconds> device_times;
+
+    for (int run = 0; run < 2; ++run) {
+        DataManager data_manager;
+        std::vector<float> data(num_values, 1.0f);
+        auto data_handle = data_manager.create_ref_handle(&data, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+        TaskGraph task_graph;
+        auto increment_task = std::make_shared<GPUTask>("sim_increment", std::vector<int>{data_handle.id},
+                                                        VOID_RETURN, false, num_values);
+        increment_task->set_input_usage(data_handle.id, DataUsage::ReadWrite);
+        task_graph.add_task(increment_task, true);
+        task_graph.mark_output(data_handle.id);
+
+        Runtime runtime(data_manager, 2);
+        GPUDevice device(GPUBackend::Simulated, std::pair(64, 1 << 16), std::pair(64, 1 << 16),
+                         std::pair(64, 1 << 16));
+        device.simulated_model = model;
+        runtime.commit_graph(task_graph, device);
+
+        EXPECT_EQ(std::vector<float>(num_values, 2.0f), data);
+        SimulatedDeviceStats stats = runtime.get_simulated_stats();
+        EXPECT_EQ(1, stats.kernels);
+        EXPECT_EQ(2, stats.transfers);
+        device_times.push_back(stats.device_time);
+    }
+
+    EXPECT_GT(device_times[0].count(), 0);
+    EXPECT_EQ(device_times[0], device_times[1]);
+}
@@ -0,0 +1,121 @@
+#include "DataManager.h"
+#include "Tasks.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+class TaskGraphTest : public testing::Test {
+  protected:
+    DataManager data_manager;
+    TaskGraph task_graph;
+
+    std::shared_ptr<BaseCPUTask> make_task(const std::string &name, const std::vector<int> &input_ids, int output_id) {
+        auto task = std::make_shared<BaseCPUTask>(name, input_ids, output_id);
+        task->task_lambda = [] {};
+        return task;
+    }
+};
+
+// Intermediates are counted per reading task, while root inputs and graph outputs are never released
+TEST_F(TaskGraphTest, ReleaseCounts) {
+    auto input = data_manager.create_data_handle(1.0f);
+    auto intermediate = data_manager.create_data_handle(0.0f);
+    auto sink = data_manager.create_data_handle(0.0f);
+    auto output = data_manager.create_data_handle(0.0f);
+
+    task_graph.add_task(make_task("produce", {input.id}, intermediate.id), true);
+    task_graph.add_task(make_task("consume_a", {intermediate.id}, sink.id), false);
+    task_graph.add_task(make_task("consume_b", {intermediate.id}, output.id), false);
+    task_graph.mark_output(output.id);
+
+    auto release_counts = task_graph.get_release_counts();
+    EXPECT_EQ(2, release_counts.at(intermediate.id));
+    EXPECT_EQ(0, release_counts.at(sink.id));
+    EXPECT_EQ(release_counts.end(), release_counts.find(input.id));
+    EXPECT_EQ(release_counts.end(), release_counts.find(output.id));
+}
+
+// Readers of the same data share it concurrently, while an in-place writer waits for them and later readers wait
+// for the writer
+TEST_F(TaskGraphTest, ReaderWriterHazards) {
+    auto cloud = data_manager.create_data_handle(std::vector<float>(16, 0.0f));
+    auto stats_a = data_manager.create_data_handle(0.0f);
+    auto stats_b = data_manager.create_data_handle(0.0f);
+    auto stats_c = data_manager.create_data_handle(0.0f);
+
+    auto reader_a = make_task("reader_a", {cloud.id}, stats_a.id);
+    auto reader_b = make_task("reader_b", {cloud.id}, stats_b.id);
+    auto writer = make_task("writer", {cloud.id}, VOID_RETURN);
+    writer->set_input_usage(cloud.id, DataUsage::ReadWrite);
+    auto reader_c = make_task("reader_c", {cloud.id}, stats_c.id);
+
+    task_graph.add_task(reader_a, true);
+    task_graph.add_task(reader_b, true);
+    task_graph.add_task(writer, true);
+    task_graph.add_task(reader_c, true);
+
+    EXPECT_TRUE(task_graph.get_dependencies(reader_a->id).empty());
+    EXPECT_TRUE(task_graph.get_dependencies(reader_b->id).empty());
+    EXPECT_THAT(task_graph.get_dependencies(writer->id), testing::UnorderedElementsAre(reader_a->id, reader_b->id));
+    EXPECT_THAT(task_graph.get_dependencies(reader_c->id), testing::ElementsAre(writer->id));
+}
+
+// Several in-place writers without outputs may coexist and are serialized in the order they were added
+TEST_F(TaskGraphTest, ChainedInPlaceWriters) {
+    auto cloud = data_manager.create_data_handle(std::vector<float>(16, 0.0f));
+
+    auto first = make_task("first", {cloud.id}, VOID_RETURN);
+    auto second = make_task("second", {cloud.id}, VOID_RETURN);
+    first->set_input_usage(cloud.id, DataUsage::ReadWrite);
+    second->set_input_usage(cloud.id, DataUsage::ReadWrite);
+
+    task_graph.add_task(first, true);
+    EXPECT_NO_THROW(task_graph.add_task(second, true));
+
+    EXPECT_TRUE(task_graph.get_dependencies(first->id).empty());
+    EXPECT_THAT(task_graph.get_dependencies(second->id), testing::ElementsAre(first->id));
+}
+
+// A diamond with an in-place writer in one branch is acyclic, two tasks feeding each other are not
+TEST_F(TaskGraphTest, ValidateDetectsCycles) {
+    auto input = data_manager.create_data_handle(1.0f);
+    auto left = data_manager.create_data_handle(0.0f);
+    auto right = data_manager.create_data_handle(0.0f);
+    auto output = data_manager.create_data_handle(0.0f);
+
+    task_graph.add_task(make_task("split", {input.id}, left.id), true);
+    auto writer = make_task("modify", {left.id}, right.id);
+    writer->set_input_usage(left.id, DataUsage::ReadWrite);
+    task_graph.add_task(writer, false);
+    task_graph.add_task(make_task("join", {left.id, right.id}, output.id), false);
+    EXPECT_NO_THROW(task_graph.validate_graph());
+
+    TaskGraph cyclic_graph;
+    auto first = data_manager.create_data_handle(0.0f);
+    auto second = data_manager.create_data_handle(0.0f);
+    cyclic_graph.add_task(make_task("ping", {first.id}, second.id), false);
+    cyclic_graph.add_task(make_task("pong", {second.id}, first.id), false);
+    EXPECT_THROW(cyclic_graph.validate_graph(), std::runtime_error);
+}
+
+// The GPU share moves towards the split at which both sides would have finished together, and stays clamped
+TEST_F(TaskGraphTest, SplitShareMovesTowardsBalance) {
+    using namespace std::chrono_literals;
+    SplitTask split_task("split", {}, VOID_RETURN, 1000, [](size_t, size_t) {});
+    EXPECT_EQ(500, split_task.gpu_count());
+
+    // The GPU did its half four times faster, so it should get 80% of the range, half of that step is taken
+    split_task.record_split(500, 1ms, 4ms);
+    EXPECT_DOUBLE_EQ(0.65, split_task.get_gpu_share());
+    EXPECT_EQ(650, split_task.gpu_count());
+
+    for (int run = 0; run < 20; ++run) {
+        split_task.record_split(split_task.gpu_count(), 1us, 1s);
+    }
+    EXPECT_DOUBLE_EQ(1.0 - SplitTask::MIN_SHARE, split_task.get_gpu_share());
+}
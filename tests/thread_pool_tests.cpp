@@ -4,9 +4,13 @@
 
 #include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <future>
 #include <memory>
 #include <stdexcept>
 #include <thread>
+#include <vector>
 
 const size_t SMALL_POOL_SIZE = 5;
 
@@ -28,7 +32,8 @@ void test_NTasksMThreads_sleep(int sleep_time, int num_tasks, int num_threads) {
 
     std::vector<std::future<void>> slp_futures;
     for (int i = 0; i < num_tasks; ++i) {
-        slp_futures.push_back(thread_pool.add_task(slp_test, sleep_time));
+        auto sleep_task = [sleep_time] { slp_test(sleep_time); };
+        slp_futures.push_back(thread_pool.add_task(sleep_task));
     }
 
     auto parallel_start_time = std::chrono::high_resolution_clock::now();
@@ -77,7 +82,8 @@ TEST_F(ThreadPoolTest, ZeroThreads) { EXPECT_THROW(ThreadPool(0), std::out_of_ra
 // Ensures a single thread pool correctly executes a task
 TEST_F(ThreadPoolTest, SingleThreadSingleTask) {
     bool prev_bool = atomic_bool.load();
-    single_thread_pool_->add_task(flip_test, std::ref(atomic_bool)).get();
+    auto flip_task = [this] { flip_test(atomic_bool); };
+    single_thread_pool_->add_task(flip_task).get();
 
     ASSERT_NE(prev_bool, atomic_bool.load());
 }
@@ -88,8 +94,8 @@ TEST_F(ThreadPoolTest, MultipleThreadSingleTask) {
     int expected_add = atomic_int_1.load() + atomic_int_2.load();
     std::atomic<int> atomic_int_result = 0;
 
-    small_thread_pool_->add_task(add_test, std::ref(atomic_int_1), std::ref(atomic_int_2), std::ref(atomic_int_result))
-        .get();
+    auto add_task = [&] { add_test(atomic_int_1, atomic_int_2, atomic_int_result); };
+    small_thread_pool_->add_task(add_task).get();
 
     ASSERT_EQ(expected_add, atomic_int_result.load());
 }
@@ -127,7 +133,8 @@ TEST_F(ThreadPoolTest, ExceptContinue) {
     int expected_time_max = sleep_time_mult * sleep_time + (sleep_time_mult * SMALL_POOL_SIZE);
 
     for (int i = 0; i < (SMALL_POOL_SIZE * (sleep_time_mult - 1)) + 1; ++i) {
-        sleep_futures.push_back(small_thread_pool_->add_task(slp_test, sleep_time));
+        auto sleep_task = [sleep_time] { slp_test(sleep_time); };
+        sleep_futures.push_back(small_thread_pool_->add_task(sleep_task));
         sleep_futures.push_back(small_thread_pool_->add_task(throw_exception_test));
     }
 
@@ -148,6 +155,109 @@ TEST_F(ThreadPoolTest, ExceptContinue) {
     ASSERT_LE(milliseconds, expected_time_max);
 }
 
+// Jobs of a single worker run in queue order, so the order they ran in shows whether the ring kept it
+struct OrderedJob {
+    std::vector<int> *order;
+    int index;
+};
+
+void record_order(void *context) {
+    auto *ordered_job = static_cast<OrderedJob *>(context);
+    ordered_job->order->push_back(ordered_job->index);
+}
+
+// Holds the single worker until opened, so the jobs queued meanwhile pile up in the ring
+void wait_for_gate(void *context) {
+    auto *gate = static_cast<std::atomic<bool> *>(context);
+    while (!gate->load()) {
+        std::this_thread::yield();
+    }
+}
+
+void count_job(void *context) { static_cast<std::atomic<int> *>(context)->fetch_add(1); }
+
+// Rounds smaller than the ring move its head all the way around, the jobs must still run in order
+TEST_F(ThreadPoolTest, RingWrapsAround) {
+    const int rounds = 10, round_jobs = 40;
+    std::vector<int> order;
+    std::vector<OrderedJob> jobs;
+    for (int i = 0; i < rounds * round_jobs; ++i) {
+        jobs.push_back({&order, i});
+    }
+
+    single_thread_pool_->reserve_jobs(round_jobs + 1);
+    for (int round = 0; round < rounds; ++round) {
+        std::atomic<bool> gate = false;
+        single_thread_pool_->add_job(wait_for_gate, &gate);
+        for (int i = 0; i < round_jobs; ++i) {
+            single_thread_pool_->add_job(record_order, &jobs[round * round_jobs + i]);
+        }
+        gate = true;
+
+        // Queued behind the round, so once it ran the whole round did
+        auto flush = [] {};
+        single_thread_pool_->add_task(flush).get();
+    }
+
+    ASSERT_EQ(rounds * round_jobs, order.size());
+    for (int i = 0; i < rounds * round_jobs; ++i) {
+        EXPECT_EQ(i, order[i]);
+    }
+}
+
+// Growing a ring whose queued jobs wrap past its end unrolls them into the new ring in queue order
+TEST_F(ThreadPoolTest, RingGrowsWhileWrapped) {
+    const int first_jobs = 40, queued_jobs = 500;
+    std::vector<int> order;
+    std::vector<OrderedJob> jobs;
+    for (int i = 0; i < first_jobs + queued_jobs; ++i) {
+        jobs.push_back({&order, i});
+    }
+
+    // Moves the head to the middle of the (smallest) ring
+    for (int i = 0; i < first_jobs; ++i) {
+        single_thread_pool_->add_job(record_order, &jobs[i]);
+    }
+    auto flush = [] {};
+    single_thread_pool_->add_task(flush).get();
+
+    // The worker is held, so the ring wraps and then has to grow several times with its head past the start
+    std::atomic<bool> gate = false;
+    single_thread_pool_->add_job(wait_for_gate, &gate);
+    for (int i = first_jobs; i < first_jobs + queued_jobs; ++i) {
+        single_thread_pool_->add_job(record_order, &jobs[i]);
+    }
+    gate = true;
+    single_thread_pool_->add_task(flush).get();
+
+    ASSERT_EQ(first_jobs + queued_jobs, order.size());
+    for (int i = 0; i < first_jobs + queued_jobs; ++i) {
+        EXPECT_EQ(i, order[i]);
+    }
+}
+
+// Producers outpace the workers, so the ring grows and wraps while it is being drained, no job may be lost or doubled
+TEST_F(ThreadPoolTest, RingGrowsWhileDraining) {
+    const int num_producers = 4, producer_jobs = 20000;
+    std::atomic<int> count = 0;
+
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < num_producers; ++producer) {
+        producers.emplace_back([this, &count] {
+            for (int i = 0; i < producer_jobs; ++i) {
+                small_thread_pool_->add_job(count_job, &count);
+            }
+        });
+    }
+    for (std::thread &producer : producers) {
+        producer.join();
+    }
+
+    // The pool finishes its queue before its workers stop
+    small_thread_pool_.reset();
+    EXPECT_EQ(num_producers * producer_jobs, count.load());
+}
+
 // TODO: Move-Only Types Test: Test with tasks that take ownership of, or
 // return, move only types like std::unique_ptr
 // Cases to consider:
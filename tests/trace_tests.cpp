@@ -0,0 +1,157 @@
+#include "DataManager.h"
+#include "HostExecutor.h"
+#include "Runtime.h"
+#include "Tasks.h"
+#include "Trace.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TraceTest : public testing::Test {
+  protected:
+    static void SetUpTestSuite() {
+        HostExecutor::register_kernel("trace_double", [](const HostKernelContext &context) {
+            auto data = context.buffer<float>(0);
+
+            size_t i = context.linear_id();
+            if (i < data.size()) {
+                data[i] *= 2.0f;
+            }
+        });
+    }
+
+    void SetUp() override {
+        Tracer::clear();
+        Tracer::set_enabled(true);
+    }
+
+    void TearDown() override {
+        Tracer::set_enabled(false);
+        Tracer::clear();
+    }
+
+    static std::string chrome_trace() {
+        std::ostringstream out;
+        Tracer::write_chrome_trace(out);
+        return out.str();
+    }
+};
+
+// Nothing is recorded while tracing is off, scopes opened while it was off stay silent
+TEST_F(TraceTest, DisabledRecordsNothing) {
+    Tracer::set_enabled(false);
+
+    {
+        TraceScope scope("scope", "test");
+        Tracer::set_enabled(true);
+    }
+    Tracer::set_enabled(false);
+    Tracer::record_span("span", "test", 0, 10);
+    Tracer::record_instant("instant", "test");
+
+    EXPECT_EQ(0, Tracer::event_count());
+}
+
+TEST_F(TraceTest, RecordsSpansAndInstants) {
+    Tracer::set_thread_name("test thread");
+    uint64_t start_ns = Tracer::now_ns();
+    Tracer::record_span("upload", "gpu transfer", start_ns, start_ns + 2500, {"bytes", 42});
+    Tracer::record_instant("ready", "dispatch", {"task_id", 3, "ready_wait_ns", 7});
+    {
+        TraceScope scope("scope", "test");
+    }
+
+    EXPECT_EQ(3, Tracer::event_count());
+
+    std::string trace = chrome_trace();
+    EXPECT_NE(std::string::npos, trace.find("\"args\":{\"name\":\"test thread\"}"));
+    EXPECT_NE(std::string::npos, trace.find("{\"name\":\"upload\",\"cat\":\"gpu transfer\",\"ph\":\"X\",\"ts\":0.000,"
+                                            "\"dur\":2.500,"));
+    EXPECT_NE(std::string::npos, trace.find("\"args\":{\"bytes\":42}"));
+    EXPECT_NE(std::string::npos, trace.find("\"ph\":\"i\""));
+    EXPECT_NE(std::string::npos, trace.find("\"args\":{\"task_id\":3,\"ready_wait_ns\":7}"));
+}
+
+// Tracks are named timelines of their own, events recorded on them are exported under the track
+TEST_F(TraceTest, TracksHaveTheirOwnTimeline) {
+    uint32_t track = Tracer::register_track("test engine");
+    EXPECT_EQ(track, Tracer::register_track("test engine"));
+
+    Tracer::record_span("kernel", "gpu kernel", 100, 200, {}, track);
+
+    std::string tid = "\"tid\":" + std::to_string(track);
+    std::string trace = chrome_trace();
+    EXPECT_NE(std::string::npos, trace.find(tid + ",\"args\":{\"name\":\"test engine\"}"));
+    EXPECT_NE(std::string::npos, trace.find("\"pid\":1," + tid + ",\"args\":{}"));
+}
+
+// A full ring overwrites its oldest events
+TEST_F(TraceTest, FullBufferKeepsNewestEvents) {
+    Tracer::set_buffer_events(4);
+    std::thread recorder([] {
+        for (int i = 0; i < 10; ++i) {
+            Tracer::record_instant("event " + std::to_string(i), "test");
+        }
+    });
+    recorder.join();
+    Tracer::set_buffer_events(Tracer::DEFAULT_BUFFER_EVENTS);
+
+    EXPECT_EQ(4, Tracer::event_count());
+
+    std::string trace = chrome_trace();
+    EXPECT_EQ(std::string::npos, trace.find("\"event 5\""));
+    for (int i = 6; i < 10; ++i) {
+        EXPECT_NE(std::string::npos, trace.find("\"event " + std::to_string(i) + "\""));
+    }
+}
+
+// A graph run shows the scheduler, its workers and the device queue with the task, kernel and transfer spans
+TEST_F(TraceTest, RuntimeGraphTimeline) {
+    const size_t num_values = 256;
+    DataManager data_manager;
+    std::vector<float> data(num_values, 1.0f);
+    std::vector<float> sum(1, 0.0f);
+    auto data_handle = data_manager.create_ref_handle(&data, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+    auto sum_handle = data_manager.create_ref_handle(&sum, DataUsage::ReadWrite, MemoryHint::DeviceLocal);
+
+    TaskGraph task_graph;
+    auto double_task = std::make_shared<GPUTask>("trace_double", std::vector<int>{data_handle.id}, VOID_RETURN,
+                                                 false, num_values);
+    double_task->set_input_usage(data_handle.id, DataUsage::ReadWrite);
+    task_graph.add_task(double_task, true);
+
+    auto sum_task = std::make_shared<BaseCPUTask>("sum_on_host", std::vector<int>{data_handle.id}, sum_handle.id);
+    sum_task->task_lambda = [&] {
+        for (float value : data) {
+            sum[0] += value;
+        }
+    };
+    task_graph.add_task(sum_task, false);
+    task_graph.mark_output(sum_handle.id);
+
+    Runtime runtime(data_manager, 2);
+    GPUDevice device(GPUBackend::Host, std::pair(64, 1 << 16), std::pair(64, 1 << 16), std::pair(64, 1 << 16));
+    runtime.commit_graph(task_graph, device);
+
+    EXPECT_EQ(2.0f * num_values, sum[0]);
+
+    std::string trace = chrome_trace();
+    for (const char *thread_name : {"scheduler", "worker 0", "gpu queue 0"}) {
+        EXPECT_NE(std::string::npos, trace.find("\"args\":{\"name\":\"" + std::string(thread_name) + "\"}"))
+            << thread_name;
+    }
+    EXPECT_NE(std::string::npos, trace.find("\"name\":\"execute_graph\",\"cat\":\"scheduler\""));
+    EXPECT_NE(std::string::npos, trace.find("\"name\":\"trace_double\",\"cat\":\"dispatch\""));
+    EXPECT_NE(std::string::npos, trace.find("\"name\":\"trace_double\",\"cat\":\"gpu kernel\""));
+    EXPECT_NE(std::string::npos, trace.find("\"name\":\"upload\",\"cat\":\"gpu transfer\""));
+    EXPECT_NE(std::string::npos, trace.find("\"name\":\"download\",\"cat\":\"gpu transfer\""));
+    EXPECT_NE(std::string::npos, trace.find("\"name\":\"sum_on_host\",\"cat\":\"cpu task\""));
+    EXPECT_NE(std::string::npos, trace.find("\"name\":\"pool task\",\"cat\":\"pool\""));
+    EXPECT_NE(std::string::npos, trace.find("\"name\":\"sum_on_host\",\"cat\":\"complete\""));
+}